@@ -50,9 +50,15 @@ struct render_params {
   bool               transparent_background = false;
   int                samples                = 9;
   bool               highqualitybvh         = false;
+  bool               embreebvh              = false;
   bool               noparallel             = false;
+  bool               nooptimize             = false;
   dgram_sampler_type sampler                = dgram_sampler_type::color;
   antialiasing_type  antialiasing           = antialiasing_type::super_sampling;
+  string             checkpoint             = "";
+  int                checkpointtime         = 60;
+  bool               indexed                = false;
+  int                indexederror           = 4;
 };
 
 // Cli
@@ -64,11 +70,19 @@ void add_options(cli_command& cli, render_params& params) {
       "hide background");
   add_option(cli, "samples", params.samples, "number of samples");
   add_option(cli, "highqualitybvh", params.highqualitybvh, "high quality bvh");
+  add_option(cli, "embreebvh", params.embreebvh, "use embree bvh");
   add_option(cli, "noparallel", params.noparallel, "disable threading");
+  add_option(cli, "nooptimize", params.nooptimize, "disable optimization");
   add_option(cli, "antialiasing", params.antialiasing, "antialiasing type",
       antialiasing_labels);
   add_option(
       cli, "sampler", params.sampler, "sampler type", dgram_sampler_labels);
+  add_option(cli, "checkpoint", params.checkpoint, "checkpoint filename");
+  add_option(cli, "checkpointtime", params.checkpointtime,
+      "seconds between checkpoints");
+  add_option(cli, "indexed", params.indexed, "save a palette-indexed png");
+  add_option(cli, "indexederror", params.indexederror,
+      "max error of indexed colors, in 8-bit units");
 }
 
 // render diagram
@@ -96,8 +110,7 @@ void run_render(const render_params& params_) {
     image.pixels = vector<vec4f>(width * height, vec4f{1, 1, 1, 1});
 
   for (auto idx = 0; idx < dgram.scenes.size(); idx++) {
-    auto& scene = dgram.scenes[idx];
-    timer       = simple_timer{};
+    timer = simple_timer{};
 
     auto params_         = dgram_trace_params{};
     params_.width        = width;
@@ -109,25 +122,55 @@ void run_render(const render_params& params_) {
     params_.sampler      = params.sampler;
     params_.antialiasing = params.antialiasing;
 
+    // optimize scene
+    auto scene = params.nooptimize
+                     ? dgram.scenes[idx]
+                     : optimize_scene(dgram.scenes[idx], params_.camera,
+                           params_.size, params_.scale);
+
     // build bvh
-    auto shapes = make_shapes(
-        scene, params_.camera, params_.size, params_.scale, params_.noparallel);
-    auto bvh = make_bvh(shapes, params.highqualitybvh, params_.noparallel);
+    auto shapes = make_shapes(scene, params_.camera, params_.size,
+        params_.scale, params_.noparallel, get_pixel_size(params_));
+    auto bvh_timer = simple_timer{};
+    auto bvh       = make_bvh(
+        shapes, params.highqualitybvh, params.embreebvh, params_.noparallel);
+    print_info("build bvh: {}", elapsed_formatted(bvh_timer));
 
     // make texts
     auto texts = make_texts(scene, params_.camera, params_.size, params_.scale,
         params_.width, params_.height, params_.noparallel);
 
-    // make state
-    auto state = make_state(params_);
+    // make state, resuming from a checkpoint if present
+    auto state      = make_state(params_);
+    auto checkpoint = params.checkpoint.empty()
+                          ? string{}
+                          : params.checkpoint + "." + std::to_string(idx);
+    if (!checkpoint.empty() && fs::exists(fs::u8path(checkpoint))) {
+      auto error = string{};
+      if (load_checkpoint(checkpoint, state, scene, params_, error)) {
+        print_info("resume scene {}/{}: {} samples", idx + 1,
+            dgram.scenes.size(), state.samples);
+      } else {
+        print_info("skip checkpoint: {}", error);
+      }
+    }
 
     // render
-    timer = simple_timer{};
-    for (auto sample = 0; sample < params.samples; sample++) {
+    timer                 = simple_timer{};
+    auto checkpoint_timer = simple_timer{};
+    for (auto sample = state.samples; sample < params.samples; sample++) {
       auto sample_timer = simple_timer{};
       trace_samples(state, scene, shapes, texts, bvh, params_);
       print_info("render sample {}/{}: {}", sample + 1, params.samples,
           elapsed_formatted(sample_timer));
+      if (!checkpoint.empty() &&
+          (sample + 1 == params.samples ||
+              elapsed_seconds(checkpoint_timer) >= params.checkpointtime)) {
+        auto error = string{};
+        if (!save_checkpoint(checkpoint, state, scene, params_, error))
+          print_info("skip checkpoint: {}", error);
+        checkpoint_timer = simple_timer{};
+      }
     }
     print_info("render scene: {}/{}: {}", idx + 1, dgram.scenes.size(),
         elapsed_formatted(timer));
@@ -138,8 +181,21 @@ void run_render(const render_params& params_) {
   // save image
   timer = simple_timer{};
   if (is_hdr_filename(params.output)) convert_image(image, true);
-  save_image(params.output, image);
+  if (params.indexed) {
+    save_indexed_png(
+        params.output, image, params.indexederror, params.noparallel);
+  } else {
+    save_image(params.output, image);
+  }
   print_info("save image: {}", elapsed_formatted(timer));
+
+  // remove checkpoints
+  if (!params.checkpoint.empty()) {
+    for (auto idx = 0; idx < dgram.scenes.size(); idx++) {
+      auto ec = std::error_code{};
+      fs::remove(fs::u8path(params.checkpoint + "." + std::to_string(idx)), ec);
+    }
+  }
 }
 
 // view params
@@ -150,6 +206,7 @@ struct view_params {
   int                samples                = 9;
   bool               highqualitybvh         = false;
   bool               noparallel             = false;
+  bool               nooptimize             = false;
   dgram_sampler_type sampler                = dgram_sampler_type::color;
   antialiasing_type  antialiasing           = antialiasing_type::super_sampling;
 };
@@ -163,6 +220,7 @@ void add_options(cli_command& cli, view_params& params) {
   add_option(cli, "samples", params.samples, "number of samples");
   add_option(cli, "highqualitybvh", params.highqualitybvh, "high quality bvh");
   add_option(cli, "noparallel", params.noparallel, "disable threading");
+  add_option(cli, "nooptimize", params.nooptimize, "disable optimization");
   add_option(cli, "antialiasing", params.antialiasing, "antialiasing type",
       antialiasing_labels);
   add_option(
@@ -196,7 +254,8 @@ void run_view(const view_params& params_) {
   params.width  = width;
   params.height = height;
 
-  show_dgram_gui(dgram, params, params_.transparent_background);
+  show_dgram_gui(
+      dgram, params, params_.transparent_background, !params_.nooptimize);
 }
 
 // text params
@@ -225,14 +284,80 @@ void run_text(const text_params& params_) {
   auto resolution = params_.resolution;
   if (resolution == 0) resolution = 2 * (int)round(dgram.size.x);
 
+  auto num_labels = 0;
+  for (auto& scene : dgram.scenes) {
+    for (auto& object : scene.objects) {
+      if (object.labels != -1)
+        num_labels += (int)scene.labels[object.labels].texts.size();
+    }
+  }
+
+  timer = simple_timer{};
   save_texts(params_.scene, dgram, resolution);
+  print_info("render text: {} labels in {} ({} labels/s)", num_labels,
+      elapsed_formatted(timer), num_labels / elapsed_seconds(timer));
+}
+
+// optimize params
+struct optimize_params {
+  string scene  = "scene.json";
+  string output = "out.json";
+  int    camera = 0;
+};
+
+// Cli
+void add_options(cli_command& cli, optimize_params& params) {
+  add_option(cli, "scene", params.scene, "scene filename");
+  add_option(cli, "output", params.output, "output filename");
+  add_option(cli, "camera", params.camera, "camera used to cull primitives");
+}
+
+void run_optimize(const optimize_params& params) {
+  print_info("optimizing {}", params.scene);
+  auto timer = simple_timer{};
+
+  // scene loading
+  timer      = simple_timer{};
+  auto dgram = load_dgram(params.scene);
+  print_info("load diagram: {}", elapsed_formatted(timer));
+
+  auto count = [](const dgram_scenes& dgram) {
+    auto objects = 0, materials = 0, primitives = 0;
+    for (auto& scene : dgram.scenes) {
+      objects += (int)scene.objects.size();
+      materials += (int)scene.materials.size();
+      for (auto& object : scene.objects) {
+        if (object.shape == -1) continue;
+        auto& shape = scene.shapes[object.shape];
+        primitives += (int)(shape.points.size() + shape.lines.size() +
+                            shape.beziers.size() + shape.arcs.size() +
+                            shape.triangles.size() + shape.quads.size());
+      }
+    }
+    return array<int, 3>{objects, materials, primitives};
+  };
+
+  timer          = simple_timer{};
+  auto optimized = optimize_scenes(dgram, params.camera);
+  print_info("optimize diagram: {}", elapsed_formatted(timer));
+
+  auto before = count(dgram), after = count(optimized);
+  print_info("objects: {} -> {}", before[0], after[0]);
+  print_info("materials: {} -> {}", before[1], after[1]);
+  print_info("primitives: {} -> {}", before[2], after[2]);
+
+  // save scene
+  timer = simple_timer{};
+  save_dgram(params.output, optimized);
+  print_info("save diagram: {}", elapsed_formatted(timer));
 }
 
 struct app_params {
-  string        command = "render";
-  render_params render  = {};
-  view_params   view    = {};
-  text_params   text    = {};
+  string          command  = "render";
+  render_params   render   = {};
+  view_params     view     = {};
+  text_params     text     = {};
+  optimize_params optimize = {};
 };
 
 // Run
@@ -245,6 +370,7 @@ int main(int argc, const char* argv[]) {
     add_command(cli, "render", params.render, "render diagrams");
     add_command(cli, "view", params.view, "view diagrams");
     add_command(cli, "render_text", params.text, "render text for diagrams");
+    add_command(cli, "optimize", params.optimize, "optimize diagrams");
     parse_cli(cli, argc, argv);
 
     // dispatch commands
@@ -254,6 +380,8 @@ int main(int argc, const char* argv[]) {
       run_view(params.view);
     } else if (params.command == "render_text") {
       run_text(params.text);
+    } else if (params.command == "optimize") {
+      run_optimize(params.optimize);
     } else {
       throw io_error{"unknown command"};
     }
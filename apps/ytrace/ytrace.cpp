@@ -0,0 +1,207 @@
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2022 Fabio Pellacini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <yocto/yocto_bvh.h>
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_image.h>
+#include <yocto/yocto_scene.h>
+#include <yocto/yocto_sceneio.h>
+#include <yocto/yocto_trace.h>
+
+#include <filesystem>
+
+using namespace yocto;
+
+// bench params
+struct bench_params {
+  string             scene          = "";
+  string             output         = "";
+  string             reference      = "";
+  int                camera         = 0;
+  int                resolution     = 512;
+  trace_sampler_type sampler        = trace_sampler_type::path;
+  int                samples        = 16;
+  int                bounces        = 8;
+  int                guidingsamples = 64;
+  bool               highqualitybvh = false;
+  bool               embreebvh      = false;
+  bool               trianglesbvh   = false;
+  bool               noparallel     = false;
+  int                cachebudget    = 0;
+};
+
+// Cli
+void add_options(cli_command& cli, bench_params& params) {
+  add_option(
+      cli, "scene", params.scene, "scene filename, or the cornell box if empty");
+  add_option(cli, "output", params.output, "output filename, if any");
+  add_option(
+      cli, "reference", params.reference, "reference image to compare, if any");
+  add_option(cli, "camera", params.camera, "camera index");
+  add_option(cli, "resolution", params.resolution, "image resolution");
+  add_option(
+      cli, "sampler", params.sampler, "sampler type", trace_sampler_labels);
+  add_option(cli, "samples", params.samples, "number of samples");
+  add_option(cli, "bounces", params.bounces, "number of bounces");
+  add_option(cli, "guidingsamples", params.guidingsamples,
+      "path guiding training samples");
+  add_option(cli, "highqualitybvh", params.highqualitybvh, "high quality bvh");
+  add_option(cli, "embreebvh", params.embreebvh, "use embree bvh");
+  add_option(cli, "trianglesbvh", params.trianglesbvh, "bvh triangle records");
+  add_option(cli, "noparallel", params.noparallel, "disable threading");
+  add_option(cli, "cachebudget", params.cachebudget,
+      "out-of-core shape cache budget in MB, or in-core if 0");
+}
+
+// bench path tracing
+void run_bench(const bench_params& params) {
+  print_info("benchmarking {}",
+      params.scene.empty() ? string{"cornell box"} : params.scene);
+
+  // trace params
+  auto tparams           = trace_params{};
+  tparams.camera         = params.camera;
+  tparams.resolution     = params.resolution;
+  tparams.sampler        = params.sampler;
+  tparams.samples        = params.samples;
+  tparams.bounces        = params.bounces;
+  tparams.guidingsamples = params.guidingsamples;
+  tparams.highqualitybvh = params.highqualitybvh;
+  tparams.embreebvh      = params.embreebvh;
+  tparams.trianglesbvh   = params.trianglesbvh;
+  tparams.noparallel     = params.noparallel;
+
+  // scene loading
+  auto timer = simple_timer{};
+  auto scene = params.scene.empty() ? make_cornellbox()
+                                    : load_scene(params.scene);
+  print_info("load scene: {}", elapsed_formatted(timer));
+  if (params.camera < 0 || params.camera >= (int)scene.cameras.size())
+    throw io_error{"missing camera " + std::to_string(params.camera)};
+
+  // bvh
+  timer    = simple_timer{};
+  auto bvh = make_bvh(scene, tparams);
+  print_info("build bvh: {}", elapsed_formatted(timer));
+
+  // out-of-core shapes
+  auto cachename = (std::filesystem::temp_directory_path() / "ytrace.shapes")
+                       .string();
+  if (params.cachebudget > 0) {
+    timer      = simple_timer{};
+    auto error = string{};
+    if (!make_shape_cache(bvh, scene, cachename,
+            (size_t)params.cachebudget * 1024 * 1024, error))
+      throw io_error{error};
+    print_info("make shape cache: {}", elapsed_formatted(timer));
+  }
+
+  // lights
+  timer       = simple_timer{};
+  auto lights = make_lights(scene, tparams);
+  print_info("init lights: {}", elapsed_formatted(timer));
+
+  // fix renderer type if no lights
+  if (lights.lights.empty() && is_sampler_lit(tparams)) {
+    print_info("no lights presents --- switching to eyelight");
+    tparams.sampler = trace_sampler_type::eyelight;
+  }
+
+  // render
+  auto state = make_state(scene, tparams);
+  reset_bvh_stats();
+  enable_bvh_stats();
+  timer = simple_timer{};
+  while (state.samples < tparams.samples) {
+    trace_samples(state, scene, bvh, lights, tparams);
+  }
+  stop_timer(timer);
+  enable_bvh_stats(false);
+  print_info("render image: {}", elapsed_formatted(timer));
+
+  // statistics
+  auto stats   = get_bvh_stats();
+  auto seconds = elapsed_seconds(timer);
+  auto paths   = (double)state.width * state.height *
+               (state.samples + state.training);
+  auto bounces = 0.0;
+  for (auto count : state.bounces) bounces += count;
+  auto rays = std::max((double)stats.rays, 1.0);
+  print_info("image size:      {}x{}", state.width, state.height);
+  print_info("paths:           {}", (uint64_t)paths);
+  print_info("rays:            {}", stats.rays);
+  print_info("rays/s:          {}M", stats.rays / seconds / 1e6);
+  print_info("bounces/path:    {}", bounces / paths);
+  print_info("hits/ray:        {}", stats.hits / rays);
+  print_info("nodes/ray:       {}", stats.nodes / rays);
+  print_info("primitives/ray:  {}", stats.primitives / rays);
+  for (auto& stat : shape_cache_stats(bvh)) print_info("{}", stat);
+
+  // compare to reference
+  if (!params.reference.empty()) {
+    auto reference = load_image(params.reference);
+    auto render    = get_render(state);
+    if (reference.width != render.width || reference.height != render.height)
+      throw io_error{"mismatched reference " + params.reference};
+    auto diff = image_difference(render, reference, false);
+    auto sum  = 0.0;
+    for (auto& pixel : diff.pixels)
+      sum += pixel.x * pixel.x + pixel.y * pixel.y + pixel.z * pixel.z;
+    auto rmse = std::sqrt(sum / (3.0 * diff.pixels.size()));
+    print_info("rmse:            {}", rmse);
+  }
+
+  // save image
+  if (!params.output.empty()) {
+    timer = simple_timer{};
+    save_image(params.output, get_render(state));
+    print_info("save image: {}", elapsed_formatted(timer));
+  }
+
+  // remove out-of-core shapes
+  if (params.cachebudget > 0) {
+    bvh = {};
+    std::filesystem::remove(cachename);
+  }
+}
+
+// Run
+int main(int argc, const char* argv[]) {
+  try {
+    // command line parameters
+    auto params = bench_params{};
+    auto cli    = make_cli("ytrace", "benchmark path tracing");
+    add_options(cli, params);
+    parse_cli(cli, argc, argv);
+
+    // run
+    run_bench(params);
+  } catch (const std::exception& error) {
+    print_error(error.what());
+    return 1;
+  }
+
+  // done
+  return 0;
+}
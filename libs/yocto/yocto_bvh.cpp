@@ -36,6 +36,7 @@
 #include <array>
 #include <cstring>
 #include <future>
+#include <list>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -556,7 +557,20 @@ static void refit_bvh(vector<bvh_node>& nodes, const vector<int>& primitives,
   }
 }
 
-shape_bvh make_bvh(const shape_data& shape, bool highquality, bool embree) {
+// Precompute the triangles of the bvh leaves
+static void make_triangle_records(shape_bvh& bvh, const shape_data& shape) {
+  bvh.triangles.resize(bvh.primitives.size());
+  for (auto idx = 0; idx < bvh.primitives.size(); idx++) {
+    auto  element      = bvh.primitives[idx];
+    auto& triangle     = shape.triangles[element];
+    auto& p0           = shape.positions[triangle.x];
+    bvh.triangles[idx] = {p0, shape.positions[triangle.y] - p0,
+        shape.positions[triangle.z] - p0, element};
+  }
+}
+
+shape_bvh make_bvh(const shape_data& shape, bool highquality, bool embree,
+    bool triangle_records) {
   // embree
 #ifdef YOCTO_EMBREE
   if (embree) return make_embree_bvh(shape, highquality);
@@ -600,12 +614,16 @@ shape_bvh make_bvh(const shape_data& shape, bool highquality, bool embree) {
   // build nodes
   build_bvh(bvh.nodes, bvh.primitives, bboxes, highquality);
 
+  // precompute triangles
+  if (triangle_records && !shape.triangles.empty())
+    make_triangle_records(bvh, shape);
+
   // done
   return bvh;
 }
 
-scene_bvh make_bvh(
-    const scene_data& scene, bool highquality, bool embree, bool noparallel) {
+scene_bvh make_bvh(const scene_data& scene, bool highquality, bool embree,
+    bool noparallel, bool triangle_records) {
   // embree
 #ifdef YOCTO_EMBREE
   if (embree) return make_embree_bvh(scene, highquality, noparallel);
@@ -618,11 +636,13 @@ scene_bvh make_bvh(
   bvh.shapes.resize(scene.shapes.size());
   if (noparallel) {
     for (auto idx = (size_t)0; idx < scene.shapes.size(); idx++) {
-      bvh.shapes[idx] = make_bvh(scene.shapes[idx], highquality, embree);
+      bvh.shapes[idx] = make_bvh(
+          scene.shapes[idx], highquality, embree, triangle_records);
     }
   } else {
     parallel_for(scene.shapes.size(), [&](size_t idx) {
-      bvh.shapes[idx] = make_bvh(scene.shapes[idx], highquality, embree);
+      bvh.shapes[idx] = make_bvh(
+          scene.shapes[idx], highquality, embree, triangle_records);
     });
   }
 
@@ -683,6 +703,9 @@ static void refit_bvh(shape_bvh& bvh, const shape_data& shape) {
 
   // update nodes
   refit_bvh(bvh.nodes, bvh.primitives, bboxes);
+
+  // update triangles
+  if (!bvh.triangles.empty()) make_triangle_records(bvh, shape);
 }
 
 void refit_bvh(scene_bvh& bvh, const scene_data& scene,
@@ -723,11 +746,353 @@ void update_bvh(scene_bvh& bvh, const scene_data& scene,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF OUT-OF-CORE SHAPES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Alignment of the store records
+static const auto shape_store_page = (size_t)4096;
+
+// Shapes pinned by the calling thread
+static thread_local vector<pair<shape_cache*, int>> pinned_shapes = {};
+
+// Memory used by a shape and its BVH
+static size_t shape_memory(const shape_data& shape, const shape_bvh& bvh) {
+  auto vector_memory = [](auto& values) -> size_t {
+    return values.size() * sizeof(values[0]);
+  };
+  return vector_memory(shape.points) + vector_memory(shape.lines) +
+         vector_memory(shape.triangles) + vector_memory(shape.quads) +
+         vector_memory(shape.positions) + vector_memory(shape.normals) +
+         vector_memory(shape.texcoords) + vector_memory(shape.colors) +
+         vector_memory(shape.radius) + vector_memory(shape.tangents) +
+         vector_memory(shape.normalso) + vector_memory(shape.texcoordsu) +
+         vector_memory(shape.colorsb) + vector_memory(bvh.nodes) +
+         vector_memory(bvh.primitives) + vector_memory(bvh.triangles);
+}
+
+// Serialize a shape and its BVH, padded to a page
+static vector<byte> write_shape_record(
+    const shape_data& shape, const shape_bvh& bvh) {
+  auto data        = vector<byte>{};
+  auto write_array = [&](const auto& values) {
+    auto size  = (uint64_t)values.size();
+    auto start = (const byte*)&size;
+    data.insert(data.end(), start, start + sizeof(size));
+    start = (const byte*)values.data();
+    data.insert(data.end(), start, start + values.size() * sizeof(values[0]));
+  };
+  write_array(shape.points);
+  write_array(shape.lines);
+  write_array(shape.triangles);
+  write_array(shape.quads);
+  write_array(shape.positions);
+  write_array(shape.normals);
+  write_array(shape.texcoords);
+  write_array(shape.colors);
+  write_array(shape.radius);
+  write_array(shape.tangents);
+  write_array(shape.normalso);
+  write_array(shape.texcoordsu);
+  write_array(shape.colorsb);
+  write_array(vector<bbox2f>{shape.texcoords_range});
+  write_array(bvh.nodes);
+  write_array(bvh.primitives);
+  write_array(bvh.triangles);
+  auto pages = (data.size() + shape_store_page - 1) / shape_store_page;
+  data.resize(pages * shape_store_page);
+  return data;
+}
+
+// Deserialize a shape and its BVH
+static bool read_shape_record(shape_cache& cache, int shape_id) {
+  auto  data  = vector<byte>(cache.sizes[shape_id]);
+  auto& shape = cache.scene->shapes[shape_id];
+  auto& bvh   = cache.bvhs[shape_id];
+  if (fseek(cache.file.get(), (long)cache.offsets[shape_id], SEEK_SET) != 0)
+    return false;
+  if (fread(data.data(), 1, data.size(), cache.file.get()) != data.size())
+    return false;
+  auto offset     = (size_t)0;
+  auto read_array = [&](auto& values) {
+    auto size = (uint64_t)0;
+    memcpy(&size, data.data() + offset, sizeof(size));
+    offset += sizeof(size);
+    values.resize(size);
+    memcpy(values.data(), data.data() + offset, size * sizeof(values[0]));
+    offset += size * sizeof(values[0]);
+  };
+  read_array(shape.points);
+  read_array(shape.lines);
+  read_array(shape.triangles);
+  read_array(shape.quads);
+  read_array(shape.positions);
+  read_array(shape.normals);
+  read_array(shape.texcoords);
+  read_array(shape.colors);
+  read_array(shape.radius);
+  read_array(shape.tangents);
+  read_array(shape.normalso);
+  read_array(shape.texcoordsu);
+  read_array(shape.colorsb);
+  auto texcoords_range = vector<bbox2f>{};
+  read_array(texcoords_range);
+  shape.texcoords_range = texcoords_range.front();
+  read_array(bvh.nodes);
+  read_array(bvh.primitives);
+  read_array(bvh.triangles);
+  return true;
+}
+
+// Evict least recently used shapes that are not pinned, until the cache
+// fits its budget. Assumes the cache is locked.
+static void evict_shapes(shape_cache& cache) {
+  auto it = cache.lru.end();
+  while (cache.memory > cache.budget && it != cache.lru.begin()) {
+    --it;
+    auto shape_id = *it;
+    if (cache.pins[shape_id] > 0) continue;
+    cache.memory -= shape_memory(
+        cache.scene->shapes[shape_id], cache.bvhs[shape_id]);
+    cache.scene->shapes[shape_id] = {};
+    cache.bvhs[shape_id]          = {};
+    cache.resident[shape_id]      = false;
+    it                            = cache.lru.erase(it);
+    cache.evictions += 1;
+  }
+}
+
+// Fault in a shape and pin it for the calling thread
+static const shape_bvh& fault_shape(shape_cache& cache, int shape_id) {
+  for (auto& [pinned_cache, pinned_id] : pinned_shapes) {
+    if (pinned_cache == &cache && pinned_id == shape_id)
+      return cache.bvhs[shape_id];
+  }
+  auto lock = std::lock_guard{cache.mutex};
+  if (cache.resident[shape_id]) {
+    cache.hits += 1;
+    cache.lru.splice(
+        cache.lru.begin(), cache.lru, cache.lru_nodes[shape_id]);
+  } else {
+    cache.misses += 1;
+    if (!read_shape_record(cache, shape_id))
+      throw std::runtime_error{"cannot read out-of-core shape"};
+    cache.resident[shape_id] = true;
+    cache.memory += shape_memory(
+        cache.scene->shapes[shape_id], cache.bvhs[shape_id]);
+    cache.lru.push_front(shape_id);
+    cache.lru_nodes[shape_id] = cache.lru.begin();
+  }
+  cache.pins[shape_id] += 1;
+  pinned_shapes.push_back({&cache, shape_id});
+  evict_shapes(cache);
+  cache.peak = max(cache.peak, cache.memory);
+  return cache.bvhs[shape_id];
+}
+
+// Move shapes to an out-of-core store
+bool make_shape_cache(scene_bvh& bvh, scene_data& scene,
+    const string& filename, size_t budget, string& error) {
+  if (bvh.embree_bvh) {
+    error = "out-of-core shapes do not support embree";
+    return false;
+  }
+  auto cache    = std::make_unique<shape_cache>();
+  cache->scene  = &scene;
+  cache->budget = budget;
+  cache->offsets.assign(scene.shapes.size(), 0);
+  cache->sizes.assign(scene.shapes.size(), 0);
+  cache->bounds.assign(scene.shapes.size(), invalidb3f);
+  cache->bvhs.resize(scene.shapes.size());
+  cache->pins.assign(scene.shapes.size(), 0);
+  cache->resident.assign(scene.shapes.size(), false);
+  cache->lru_nodes.assign(scene.shapes.size(), cache->lru.end());
+
+  // shapes sampled by lights stay resident
+  auto emissive = vector<bool>(scene.shapes.size(), false);
+  for (auto& instance : scene.instances) {
+    if (scene.materials[instance.material].emission != vec3f{0, 0, 0})
+      emissive[instance.shape] = true;
+  }
+
+  // write records
+  cache->file = {fopen(filename.c_str(), "w+b"), &fclose};
+  if (!cache->file) {
+    error = "cannot create " + filename;
+    return false;
+  }
+  auto offset = (size_t)0;
+  for (auto shape_id : range((int)scene.shapes.size())) {
+    auto& shape = scene.shapes[shape_id];
+    auto& sbvh  = bvh.shapes[shape_id];
+    if (!sbvh.nodes.empty()) cache->bounds[shape_id] = sbvh.nodes[0].bbox;
+    if (emissive[shape_id]) {
+      cache->bvhs[shape_id]     = std::move(sbvh);
+      cache->pins[shape_id]     = 1;
+      cache->resident[shape_id] = true;
+      cache->memory += shape_memory(shape, cache->bvhs[shape_id]);
+      cache->lru.push_front(shape_id);
+      cache->lru_nodes[shape_id] = cache->lru.begin();
+      continue;
+    }
+    auto data = write_shape_record(shape, sbvh);
+    if (fwrite(data.data(), 1, data.size(), cache->file.get()) !=
+        data.size()) {
+      error = "cannot write " + filename;
+      return false;
+    }
+    cache->offsets[shape_id] = offset;
+    cache->sizes[shape_id]   = data.size();
+    offset += data.size();
+    shape = {};
+    sbvh  = {};
+  }
+  if (fflush(cache->file.get()) != 0) {
+    error = "cannot write " + filename;
+    return false;
+  }
+  cache->peak = cache->memory;
+  bvh.cache   = std::move(cache);
+  return true;
+}
+
+// Unpin the shapes faulted in by the calling thread
+void release_shapes(const scene_bvh& bvh) {
+  if (!bvh.cache || pinned_shapes.empty()) return;
+  auto& cache = *bvh.cache;
+  auto  lock  = std::lock_guard{cache.mutex};
+  for (auto& [pinned_cache, pinned_id] : pinned_shapes) {
+    if (pinned_cache == &cache) cache.pins[pinned_id] -= 1;
+  }
+  pinned_shapes.erase(std::remove_if(pinned_shapes.begin(),
+                          pinned_shapes.end(),
+                          [&cache](auto& pinned) {
+                            return pinned.first == &cache;
+                          }),
+      pinned_shapes.end());
+  evict_shapes(cache);
+}
+
+// Out-of-core cache statistics
+vector<string> shape_cache_stats(const scene_bvh& bvh) {
+  if (!bvh.cache) return {};
+  auto& cache    = *bvh.cache;
+  auto  lock     = std::lock_guard{cache.mutex};
+  auto  lookups  = cache.hits + cache.misses;
+  auto  hit_rate = lookups != 0 ? 100.0 * cache.hits / lookups : 100.0;
+  auto  stats    = vector<string>{};
+  stats.push_back("budget:       " + std::to_string(cache.budget));
+  stats.push_back("memory:       " + std::to_string(cache.memory));
+  stats.push_back("peak:         " + std::to_string(cache.peak));
+  stats.push_back("hits:         " + std::to_string(cache.hits));
+  stats.push_back("misses:       " + std::to_string(cache.misses));
+  stats.push_back("evictions:    " + std::to_string(cache.evictions));
+  stats.push_back("hitrate:      " + std::to_string(hit_rate) + "%");
+  return stats;
+}
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR BVH STATISTICS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Visits counted by the traversals of the calling thread. They are always
+// counted, since that is cheaper than checking, but only summed when enabled.
+struct bvh_visits {
+  uint64_t nodes      = 0;
+  uint64_t primitives = 0;
+};
+static thread_local auto bvh_thread_visits = bvh_visits{};
+
+// Statistics are summed into cache-line sized slots, picked per thread, to
+// keep threads from contending for the same counters.
+struct alignas(64) bvh_stats_slot {
+  atomic<uint64_t> rays       = 0;
+  atomic<uint64_t> hits       = 0;
+  atomic<uint64_t> nodes      = 0;
+  atomic<uint64_t> primitives = 0;
+};
+static auto           bvh_stats_enabled = atomic<bool>{false};
+static auto           bvh_stats_threads = atomic<int>{0};
+static bvh_stats_slot bvh_stats_slots[16];
+
+// Sum the visits of the calling thread for one ray.
+static void count_bvh_ray(bool hit) {
+  auto& visits = bvh_thread_visits;
+  if (bvh_stats_enabled.load(std::memory_order_relaxed)) {
+    static thread_local auto slot = bvh_stats_threads++ % 16;
+    auto& stats = bvh_stats_slots[slot];
+    stats.rays.fetch_add(1, std::memory_order_relaxed);
+    stats.hits.fetch_add(hit ? 1 : 0, std::memory_order_relaxed);
+    stats.nodes.fetch_add(visits.nodes, std::memory_order_relaxed);
+    stats.primitives.fetch_add(visits.primitives, std::memory_order_relaxed);
+  }
+  visits = {};
+}
+
+void enable_bvh_stats(bool enabled) { bvh_stats_enabled = enabled; }
+
+bvh_stats get_bvh_stats() {
+  auto stats = bvh_stats{};
+  for (auto& slot : bvh_stats_slots) {
+    stats.rays += slot.rays;
+    stats.hits += slot.hits;
+    stats.nodes += slot.nodes;
+    stats.primitives += slot.primitives;
+  }
+  return stats;
+}
+
+void reset_bvh_stats() {
+  for (auto& slot : bvh_stats_slots) {
+    slot.rays       = 0;
+    slot.hits       = 0;
+    slot.nodes      = 0;
+    slot.primitives = 0;
+  }
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION FOR BVH INTERSECTION
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Intersect a ray with a precomputed triangle, as intersect_triangle does.
+static inline bool intersect_triangle(
+    const ray3f& ray, const bvh_triangle& triangle, vec2f& uv, float& dist) {
+  // compute determinant to solve a linear system
+  auto pvec = cross(ray.d, triangle.e2);
+  auto det  = dot(triangle.e1, pvec);
+
+  // check determinant and exit if triangle and ray are parallel
+  if (det == 0) return false;
+  auto inv_det = 1.0f / det;
+
+  // compute and check first bricentric coordinated
+  auto tvec = ray.o - triangle.p0;
+  auto u    = dot(tvec, pvec) * inv_det;
+  if (u < 0 || u > 1) return false;
+
+  // compute and check second bricentric coordinated
+  auto qvec = cross(tvec, triangle.e1);
+  auto v    = dot(ray.d, qvec) * inv_det;
+  if (v < 0 || u + v > 1) return false;
+
+  // compute and check ray parameter
+  auto t = dot(triangle.e2, qvec) * inv_det;
+  if (t < ray.tmin || t > ray.tmax) return false;
+
+  // intersection occurred: set params and exit
+  uv   = {u, v};
+  dist = t;
+  return true;
+}
+
 // Intersect ray with a bvh.
 static bool intersect_bvh(const shape_bvh& bvh, const shape_data& shape,
     const ray3f& ray_, int& element, vec2f& uv, float& distance,
@@ -759,14 +1124,19 @@ static bool intersect_bvh(const shape_bvh& bvh, const shape_data& shape,
   auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
       (ray_dinv.z < 0) ? 1 : 0};
 
+  // visit counters
+  auto& visits = bvh_thread_visits;
+
   // walking stack
   while (node_cur != 0) {
     // grab node
     auto& node = bvh.nodes[node_stack[--node_cur]];
+    visits.nodes += 1;
 
     // intersect bbox
     // if (!intersect_bbox(ray, ray_dinv, ray_dsign, node.bbox)) continue;
     if (!intersect_bbox(ray, ray_dinv, node.bbox)) continue;
+    if (!node.internal) visits.primitives += node.num;
 
     // intersect node, switching based on node type
     // for each type, iterate over the the primitive list
@@ -800,6 +1170,15 @@ static bool intersect_bvh(const shape_bvh& bvh, const shape_data& shape,
           ray.tmax = distance;
         }
       }
+    } else if (!bvh.triangles.empty()) {
+      for (auto idx = node.start; idx < node.start + node.num; idx++) {
+        auto& t = bvh.triangles[idx];
+        if (intersect_triangle(ray, t, uv, distance)) {
+          hit      = true;
+          element  = t.element;
+          ray.tmax = distance;
+        }
+      }
     } else if (!shape.triangles.empty()) {
       for (auto idx = node.start; idx < node.start + node.num; idx++) {
         auto& t = shape.triangles[bvh.primitives[idx]];
@@ -860,10 +1239,14 @@ static bool intersect_bvh(const scene_bvh& bvh, const scene_data& scene,
   auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
       (ray_dinv.z < 0) ? 1 : 0};
 
+  // visit counters
+  auto& visits = bvh_thread_visits;
+
   // walking stack
   while (node_cur != 0) {
     // grab node
     auto& node = bvh.nodes[node_stack[--node_cur]];
+    visits.nodes += 1;
 
     // intersect bbox
     // if (!intersect_bbox(ray, ray_dinv, ray_dsign, node.bbox)) continue;
@@ -885,9 +1268,18 @@ static bool intersect_bvh(const scene_bvh& bvh, const scene_data& scene,
       for (auto idx = node.start; idx < node.start + node.num; idx++) {
         auto& instance_ = scene.instances[bvh.primitives[idx]];
         auto  inv_ray   = transform_ray(inverse(instance_.frame, true), ray);
-        if (intersect_bvh(bvh.shapes[instance_.shape],
-                scene.shapes[instance_.shape], inv_ray, element, uv, distance,
-                find_any)) {
+        // skip out-of-core shapes missed by the ray before faulting them in
+        if (bvh.cache) {
+          auto inv_dinv = vec3f{
+              1 / inv_ray.d.x, 1 / inv_ray.d.y, 1 / inv_ray.d.z};
+          if (!intersect_bbox(
+                  inv_ray, inv_dinv, bvh.cache->bounds[instance_.shape]))
+            continue;
+        }
+        auto& sbvh = bvh.cache ? fault_shape(*bvh.cache, instance_.shape)
+                               : bvh.shapes[instance_.shape];
+        if (intersect_bvh(sbvh, scene.shapes[instance_.shape], inv_ray,
+                element, uv, distance, find_any)) {
           hit      = true;
           instance = bvh.primitives[idx];
           ray.tmax = distance;
@@ -907,9 +1299,11 @@ static bool intersect_bvh(const scene_bvh& bvh, const scene_data& scene,
     int instance_, const ray3f& ray, int& element, vec2f& uv, float& distance,
     bool find_any) {
   auto& instance = scene.instances[instance_];
+  auto& sbvh     = bvh.cache ? fault_shape(*bvh.cache, instance.shape)
+                             : bvh.shapes[instance.shape];
   auto  inv_ray  = transform_ray(inverse(instance.frame, true), ray);
-  return intersect_bvh(bvh.shapes[instance.shape], scene.shapes[instance.shape],
-      inv_ray, element, uv, distance, find_any);
+  return intersect_bvh(sbvh, scene.shapes[instance.shape], inv_ray, element,
+      uv, distance, find_any);
 }
 
 shape_intersection intersect_shape(const shape_bvh& bvh,
@@ -917,6 +1311,7 @@ shape_intersection intersect_shape(const shape_bvh& bvh,
   auto intersection = shape_intersection{};
   intersection.hit  = intersect_bvh(bvh, shape, ray, intersection.element,
       intersection.uv, intersection.distance, find_any);
+  count_bvh_ray(intersection.hit);
   return intersection;
 }
 scene_intersection intersect_scene(const scene_bvh& bvh,
@@ -924,6 +1319,7 @@ scene_intersection intersect_scene(const scene_bvh& bvh,
   auto intersection = scene_intersection{};
   intersection.hit  = intersect_bvh(bvh, scene, ray, intersection.instance,
       intersection.element, intersection.uv, intersection.distance, find_any);
+  count_bvh_ray(intersection.hit);
   return intersection;
 }
 scene_intersection intersect_instance(const scene_bvh& bvh,
@@ -932,6 +1328,7 @@ scene_intersection intersect_instance(const scene_bvh& bvh,
   intersection.hit      = intersect_bvh(bvh, scene, instance, ray,
       intersection.element, intersection.uv, intersection.distance, find_any);
   intersection.instance = instance;
+  count_bvh_ray(intersection.hit);
   return intersection;
 }
 
@@ -1061,8 +1458,9 @@ static bool overlap_bvh(const scene_bvh& bvh, const scene_data& scene,
       for (auto idx = 0; idx < node.num; idx++) {
         auto  primitive = bvh.primitives[node.start + idx];
         auto& instance_ = scene.instances[primitive];
+        auto& sbvh      = bvh.cache ? fault_shape(*bvh.cache, instance_.shape)
+                                    : bvh.shapes[instance_.shape];
         auto& shape     = scene.shapes[instance_.shape];
-        auto& sbvh      = bvh.shapes[instance_.shape];
         auto  inv_pos   = transform_point(inverse(instance_.frame, true), pos);
         if (overlap_bvh(sbvh, shape, inv_pos, max_distance, element, uv,
                 distance, find_any)) {
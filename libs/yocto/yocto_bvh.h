@@ -40,7 +40,10 @@
 
 #include <array>
 #include <cstdint>
+#include <cstdio>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -78,17 +81,60 @@ struct bvh_node {
   bool    internal = false;
 };
 
+// Triangle precomputed for intersection, as its first vertex, its edges
+// from the first vertex, and its shape element.
+struct bvh_triangle {
+  vec3f p0      = {0, 0, 0};
+  vec3f e1      = {0, 0, 0};
+  vec3f e2      = {0, 0, 0};
+  int   element = 0;
+};
+
 // BVH tree stored as a node array with the tree structure is encoded using
 // array indices. BVH nodes indices refer to either the node array,
 // for internal nodes, or the primitive arrays, for leaf nodes.
-// Application data is not stored explicitly.
+// Application data is not stored explicitly, except for the optional
+// triangle records, stored in the order of the primitives, that let leaves
+// be intersected without gathering vertices.
 // Additionally, we support the use of Intel Embree.
 struct shape_bvh {
   vector<bvh_node>                  nodes      = {};
   vector<int>                       primitives = {};
+  vector<bvh_triangle>              triangles  = {};  // triangle records
   unique_ptr<void, void (*)(void*)> embree_bvh = {nullptr, nullptr};  // embree
 };
 
+// Cache of out-of-core shapes. Shapes and their BVHs are written ahead of
+// time to a store on disk, in page-aligned records, and faulted back into
+// the scene by the threads that traverse them. Faulted shapes stay pinned
+// by a thread until it calls release_shapes(), and the least recently used
+// unpinned shapes are evicted when the cache memory exceeds its budget.
+// Shapes of emissive instances are never evicted, since lights sample them.
+struct shape_cache {
+  // store
+  unique_ptr<FILE, int (*)(FILE*)> file    = {nullptr, nullptr};
+  vector<size_t>                   offsets = {};
+  vector<size_t>                   sizes   = {};
+  vector<bbox3f>                   bounds  = {};
+
+  // residency, guarded by the mutex
+  scene_data*                      scene     = nullptr;
+  vector<shape_bvh>                bvhs      = {};
+  vector<int>                      pins      = {};
+  vector<bool>                     resident  = {};
+  std::list<int>                   lru       = {};
+  vector<std::list<int>::iterator> lru_nodes = {};
+  size_t                           budget    = 0;
+  size_t                           memory    = 0;
+  std::mutex                       mutex     = {};
+
+  // statistics
+  size_t hits      = 0;
+  size_t misses    = 0;
+  size_t evictions = 0;
+  size_t peak      = 0;
+};
+
 // BVH tree stored as a node array with the tree structure is encoded using
 // array indices. BVH nodes indices refer to either the node array,
 // for internal nodes, or the primitive arrays, for leaf nodes.
@@ -100,13 +146,28 @@ struct scene_bvh {
   vector<int>                       primitives = {};
   vector<shape_bvh>                 shapes     = {};                  // shapes
   unique_ptr<void, void (*)(void*)> embree_bvh = {nullptr, nullptr};  // embree
+  unique_ptr<shape_cache>           cache      = {};  // out-of-core shapes
 };
 
-// Build the bvh acceleration structure.
-shape_bvh make_bvh(
-    const shape_data& shape, bool highquality = false, bool embree = false);
+// Build the bvh acceleration structure. Triangle records trade 40 bytes per
+// triangle for faster intersection, and are ignored by Embree.
+shape_bvh make_bvh(const shape_data& shape, bool highquality = false,
+    bool embree = false, bool triangle_records = false);
 scene_bvh make_bvh(const scene_data& scene, bool highquality = false,
-    bool embree = false, bool noparallel = false);
+    bool embree = false, bool noparallel = false,
+    bool triangle_records = false);
+
+// Move the shapes of a scene, and their BVHs, to an out-of-core store, and
+// fault them back in through a cache bounded by budget bytes. The scene must
+// outlive the BVH, and Embree BVHs are not supported.
+bool make_shape_cache(scene_bvh& bvh, scene_data& scene,
+    const string& filename, size_t budget, string& error);
+
+// Unpin the out-of-core shapes faulted in by the calling thread.
+void release_shapes(const scene_bvh& bvh);
+
+// Return out-of-core cache statistics as list of strings.
+vector<string> shape_cache_stats(const scene_bvh& bvh);
 
 // Refit bvh data
 void update_bvh(shape_bvh& bvh, const shape_data& shape);
@@ -137,6 +198,21 @@ scene_intersection intersect_instance(const scene_bvh& bvh,
     const scene_data& scene, int instance, const ray3f& ray,
     bool find_any = false);
 
+// Ray traversal statistics, counted by the intersection functions once
+// enabled and summed over all threads. Node visits include both the instance
+// and the shape levels. Visits are not counted by Embree.
+struct bvh_stats {
+  uint64_t rays       = 0;
+  uint64_t hits       = 0;
+  uint64_t nodes      = 0;
+  uint64_t primitives = 0;
+};
+
+// Enable, get and reset ray traversal statistics.
+void      enable_bvh_stats(bool enabled = true);
+bvh_stats get_bvh_stats();
+void      reset_bvh_stats();
+
 // Find a shape element that overlaps a point within a given distance
 // max distance, returning either the closest or any overlap depending on
 // `find_any`. Returns the point distance, the instance id, the shape element
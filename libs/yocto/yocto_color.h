@@ -51,6 +51,7 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <cstring>
 #include <stdexcept>
 #include <utility>
 
@@ -67,6 +68,17 @@ inline vec4f byte_to_float(const vec4b& a);
 inline byte  float_to_byte(float a);
 inline float byte_to_float(byte a);
 
+// Conversion between floats and half floats, rounding to nearest even.
+inline vec4h  float_to_half(const vec4f& a);
+inline vec4f  half_to_float(const vec4h& a);
+inline ushort float_to_half(float a);
+inline float  half_to_float(ushort a);
+
+// Conversion between floats and shared exponent RGB9E5. Negative values are
+// clamped to zero and alpha is not stored, so it is returned as one.
+inline uint  float_to_rgb9e5(const vec4f& a);
+inline vec4f rgb9e5_to_float(uint a);
+
 // Luminance
 inline float luminance(const vec3f& a);
 
@@ -215,6 +227,86 @@ inline vec4f byte_to_float(const vec4b& a) {
 inline byte float_to_byte(float a) { return (byte)clamp(int(a * 256), 0, 255); }
 inline float byte_to_float(byte a) { return a / 255.0f; }
 
+// Bit casts used in half and shared exponent conversions
+inline uint float_as_uint(float a) {
+  auto b = (uint)0;
+  std::memcpy(&b, &a, sizeof(b));
+  return b;
+}
+inline float uint_as_float(uint a) {
+  auto b = 0.0f;
+  std::memcpy(&b, &a, sizeof(b));
+  return b;
+}
+
+// Conversion between floats and half floats
+inline vec4h float_to_half(const vec4f& a) {
+  return {float_to_half(a.x), float_to_half(a.y), float_to_half(a.z),
+      float_to_half(a.w)};
+}
+inline vec4f half_to_float(const vec4h& a) {
+  return {half_to_float(a.x), half_to_float(a.y), half_to_float(a.z),
+      half_to_float(a.w)};
+}
+inline ushort float_to_half(float a) {
+  auto bits = float_as_uint(a);
+  auto sign = (bits >> 16) & 0x8000u;
+  bits &= 0x7fffffffu;
+  auto half = (uint)0;
+  if (bits >= 0x47800000u) {
+    // overflow to infinity, keep nans
+    half = bits > 0x7f800000u ? 0x7e00u : 0x7c00u;
+  } else if (bits < 0x38800000u) {
+    // denormals, rounded by adding 0.5 as a float
+    half = float_as_uint(uint_as_float(bits) + 0.5f) - 0x3f000000u;
+  } else {
+    // normals, rebias the exponent and round to nearest even
+    auto odd = (bits >> 13) & 1u;
+    bits += ((uint)(15 - 127) << 23) + 0xfffu + odd;
+    half = bits >> 13;
+  }
+  return (ushort)(half | sign);
+}
+inline float half_to_float(ushort a) {
+  auto bits     = ((uint)a & 0x7fffu) << 13;
+  auto exponent = bits & 0x0f800000u;
+  bits += (uint)(127 - 15) << 23;
+  if (exponent == 0x0f800000u) {
+    // infinity and nans
+    bits += (uint)(128 - 16) << 23;
+  } else if (exponent == 0) {
+    // denormals, renormalized by a float subtraction
+    bits = float_as_uint(uint_as_float(bits + (1u << 23)) -
+                         uint_as_float(113u << 23));
+  }
+  return uint_as_float(bits | (((uint)a & 0x8000u) << 16));
+}
+
+// Conversion between floats and shared exponent RGB9E5
+inline uint float_to_rgb9e5(const vec4f& a) {
+  // largest value is (511 / 512) * 2^16
+  const auto max_value = 65408.0f;
+  auto r = (a.x > 0) ? min(a.x, max_value) : 0.0f;
+  auto g = (a.y > 0) ? min(a.y, max_value) : 0.0f;
+  auto b = (a.z > 0) ? min(a.z, max_value) : 0.0f;
+  auto m = max(r, max(g, b));
+  // shared exponent from the float exponent of the largest channel
+  auto exponent = max(-16, (int)((float_as_uint(m) >> 23) & 0xff) - 127) + 16;
+  auto scale    = uint_as_float((uint)(127 + 24 - exponent) << 23);
+  if ((uint)(m * scale + 0.5f) == 512) {
+    exponent += 1;
+    scale *= 0.5f;
+  }
+  auto rm = (uint)(r * scale + 0.5f), gm = (uint)(g * scale + 0.5f),
+       bm = (uint)(b * scale + 0.5f);
+  return rm | (gm << 9) | (bm << 18) | ((uint)exponent << 27);
+}
+inline vec4f rgb9e5_to_float(uint a) {
+  auto scale = uint_as_float(((a >> 27) + 127 - 24) << 23);
+  return {(a & 0x1ff) * scale, ((a >> 9) & 0x1ff) * scale,
+      ((a >> 18) & 0x1ff) * scale, 1};
+}
+
 // Luminance
 inline float luminance(const vec3f& a) {
   return (0.2126f * a.x + 0.7152f * a.y + 0.0722f * a.z);
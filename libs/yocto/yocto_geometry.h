@@ -251,6 +251,10 @@ inline vec3f quad_point(const vec3f& p0, const vec3f& p1, const vec3f& p2,
 inline vec3f quad_normal(const vec3f& n0, const vec3f& n1, const vec3f& n2,
     const vec3f& n3, const vec2f& uv);
 
+// Octahedral encoding of unit vectors as two 16-bit values packed in a uint.
+inline uint  direction_to_octahedral(const vec3f& direction);
+inline vec3f octahedral_to_direction(uint encoded);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -639,6 +643,29 @@ inline pair<vec3f, vec3f> quad_tangents_fromuv(const vec3f& p0, const vec3f& p1,
   }
 }
 
+// Octahedral encoding of unit vectors. Follows "A Survey of Efficient
+// Representations for Independent Unit Vectors", Cigolle et al., 2014.
+inline uint direction_to_octahedral(const vec3f& direction) {
+  auto norm = abs(direction.x) + abs(direction.y) + abs(direction.z);
+  if (norm == 0) return direction_to_octahedral({0, 0, 1});
+  auto uv = vec2f{direction.x, direction.y} / norm;
+  if (direction.z < 0)
+    uv = {(1 - abs(uv.y)) * sign(uv.x), (1 - abs(uv.x)) * sign(uv.y)};
+  auto x = (uint)(clamp(uv.x * 0.5f + 0.5f, 0.0f, 1.0f) * 65535 + 0.5f);
+  auto y = (uint)(clamp(uv.y * 0.5f + 0.5f, 0.0f, 1.0f) * 65535 + 0.5f);
+  return x | (y << 16);
+}
+inline vec3f octahedral_to_direction(uint encoded) {
+  auto uv = vec2f{(encoded & 0xffff) / 65535.0f * 2 - 1,
+      (encoded >> 16) / 65535.0f * 2 - 1};
+  auto direction = vec3f{uv.x, uv.y, 1 - abs(uv.x) - abs(uv.y)};
+  if (direction.z < 0) {
+    direction.x = (1 - abs(uv.y)) * sign(uv.x);
+    direction.y = (1 - abs(uv.x)) * sign(uv.y);
+  }
+  return normalize(direction);
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -33,12 +33,15 @@
 
 #include <glad/glad.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <future>
 #include <stdexcept>
 
 #include "yocto_geometry.h"
+#include "yocto_sceneio.h"
 
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
@@ -93,16 +96,6 @@ inline void parallel_for(T num1, T num2, Func&& func) {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Opengl texture
-struct glscene_texture {
-  // texture properties
-  int width  = 0;
-  int height = 0;
-
-  // opengl state
-  uint texture = 0;
-};
-
 // Create texture
 static void set_texture(
     glscene_texture& gltexture, const texture_data& texture);
@@ -110,65 +103,12 @@ static void set_texture(
 // Clean texture
 static void clear_texture(glscene_texture& gltexture);
 
-// Opengl shape
-struct glscene_shape {
-  // Shape properties
-  int num_positions = 0;
-  int num_normals   = 0;
-  int num_texcoords = 0;
-  int num_colors    = 0;
-  int num_tangents  = 0;
-  int num_points    = 0;
-  int num_lines     = 0;
-  int num_triangles = 0;
-  int num_quads     = 0;
-
-  // OpenGl state
-  uint  vertexarray = 0;
-  uint  positions   = 0;
-  uint  normals     = 0;
-  uint  texcoords   = 0;
-  uint  colors      = 0;
-  uint  tangents    = 0;
-  uint  points      = 0;
-  uint  lines       = 0;
-  uint  triangles   = 0;
-  uint  quads       = 0;
-  float point_size  = 1;
-};
-
 // Create shape
 static void set_shape(glscene_shape& glshape, const shape_data& shape);
 
 // Clean shape
 static void clear_shape(glscene_shape& glshape);
 
-// Opengl scene
-struct glscene_state {
-  // scene objects
-  vector<glscene_shape>   shapes   = {};
-  vector<glscene_texture> textures = {};
-
-  // programs
-  uint program  = 0;
-  uint vertex   = 0;
-  uint fragment = 0;
-};
-
-// init scene
-static void init_glscene(glscene_state& glscene, const scene_data& scene);
-
-// update scene
-static void update_glscene(glscene_state& glscene, const scene_data& scene,
-    const vector<int>& updated_shapes, const vector<int>& updated_textures);
-
-// Clear an OpenGL scene
-static void clear_scene(glscene_state& scene);
-
-// draw scene
-static void draw_scene(glscene_state& glscene, const scene_data& scene,
-    const vec4i& viewport, const shade_params& params);
-
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -236,6 +176,16 @@ static bool draw_tonemap_params(
   return (bool)edited;
 }
 
+// Color grading equivalent to tonemap_image(), so that images can be
+// tonemapped in the shader.
+static colorgrade_params make_tonemap_grading(
+    const image_data& image, float exposure, bool filmic) {
+  auto grading     = colorgrade_params{};
+  grading.exposure = exposure;
+  grading.filmic   = filmic && image.linear;
+  return grading;
+}
+
 static bool draw_image_inspector(const gui_input& input,
     const image_data& image, const image_data& display,
     glimage_params& glparams) {
@@ -251,7 +201,10 @@ static bool draw_image_inspector(const gui_input& input,
     auto display_pixel = zero4f;
     if (i >= 0 && i < image.width && j >= 0 && j < image.height) {
       image_pixel   = image.pixels[j * image.width + i];
-      display_pixel = image.pixels[j * image.width + i];
+      display_pixel = glparams.graded
+                          ? colorgrade(image_pixel, image.linear,
+                                glparams.grading)
+                          : display.pixels[j * image.width + i];
     }
     draw_gui_coloredit("image", image_pixel);
     draw_gui_coloredit("display", display_pixel);
@@ -344,9 +297,12 @@ static bool draw_scene_editor(scene_data& scene, scene_selection& selection,
     draw_gui_label("triangles", (int)shape.triangles.size());
     draw_gui_label("quads", (int)shape.quads.size());
     draw_gui_label("positions", (int)shape.positions.size());
-    draw_gui_label("normals", (int)shape.normals.size());
-    draw_gui_label("texcoords", (int)shape.texcoords.size());
-    draw_gui_label("colors", (int)shape.colors.size());
+    draw_gui_label(
+        "normals", (int)max(shape.normals.size(), shape.normalso.size()));
+    draw_gui_label("texcoords",
+        (int)max(shape.texcoords.size(), shape.texcoordsu.size()));
+    draw_gui_label(
+        "colors", (int)max(shape.colors.size(), shape.colorsb.size()));
     draw_gui_label("radius", (int)shape.radius.size());
     draw_gui_label("tangents", (int)shape.tangents.size());
     end_gui_header();
@@ -358,6 +314,8 @@ static bool draw_scene_editor(scene_data& scene, scene_selection& selection,
     draw_gui_label("height", texture.height);
     draw_gui_label("linear", texture.linear);
     draw_gui_label("byte", !texture.pixelsb.empty());
+    draw_gui_label("half", !texture.pixelsh.empty());
+    draw_gui_label("rgb9e5", !texture.pixelse.empty());
     end_gui_header();
   }
   if (draw_gui_header("subdivs")) {
@@ -384,15 +342,14 @@ namespace yocto {
 // Open a window and show an image
 void show_image_gui(
     const string& title, const string& name, const image_data& image) {
-  // display image
-  auto  display  = make_image(image.width, image.height, false);
+  // tonemapping parameters
   float exposure = 0;
   bool  filmic   = false;
-  tonemap_image_mt(display, image, exposure, filmic);
 
-  // opengl image
-  auto glimage  = glimage_state{};
-  auto glparams = glimage_params{};
+  // opengl image, tonemapped in the shader
+  auto glimage    = glimage_state{};
+  auto glparams   = glimage_params{};
+  glparams.graded = true;
 
   // top level combo
   auto names    = vector<string>{name};
@@ -402,7 +359,7 @@ void show_image_gui(
   auto callbacks = gui_callbacks{};
   callbacks.init = [&](const gui_input& input) {
     init_image(glimage);
-    set_image(glimage, display);
+    set_image(glimage, image);
   };
   callbacks.clear = [&](const gui_input& input) { clear_image(glimage); };
   callbacks.draw  = [&](const gui_input& input) {
@@ -412,14 +369,14 @@ void show_image_gui(
   callbacks.widgets = [&](const gui_input& input) {
     draw_gui_combobox("name", selected, names);
     if (draw_tonemap_params(input, exposure, filmic)) {
-      tonemap_image_mt(display, image, exposure, filmic);
-      set_image(glimage, display);
+      glparams.grading = make_tonemap_grading(image, exposure, filmic);
     }
-    draw_image_inspector(input, image, display, glparams);
+    draw_image_inspector(input, image, image, glparams);
   };
   callbacks.uiupdate = [&](const gui_input& input) {
     uiupdate_image_params(input, glparams);
   };
+  callbacks.idle = [](const gui_input& input) { return true; };
 
   // run ui
   show_gui_window({1280 + 320, 720}, title, callbacks);
@@ -428,18 +385,14 @@ void show_image_gui(
 // Open a window and show an image
 void show_image_gui(const string& title, const vector<string>& names,
     const vector<image_data>& images) {
-  // display image
-  auto displays  = vector<image_data>(images.size());
+  // tonemapping parameters
   auto exposures = vector<float>(images.size(), 0);
   auto filmics   = vector<bool>(images.size(), false);
-  for (auto idx = 0; idx < (int)images.size(); idx++) {
-    displays[idx] = make_image(images[idx].width, images[idx].height, false);
-    tonemap_image_mt(displays[idx], images[idx], exposures[idx], filmics[idx]);
-  }
 
-  // opengl image
+  // opengl image, tonemapped in the shader
   auto glimages  = vector<glimage_state>(images.size());
   auto glparamss = vector<glimage_params>(images.size());
+  for (auto& glparams : glparamss) glparams.graded = true;
 
   // selection
   auto selected = 0;
@@ -449,7 +402,7 @@ void show_image_gui(const string& title, const vector<string>& names,
   callbacks.init = [&](const gui_input& input) {
     for (auto idx = 0; idx < (int)images.size(); idx++) {
       init_image(glimages[idx]);
-      set_image(glimages[idx], displays[idx]);
+      set_image(glimages[idx], images[idx]);
     }
   };
   callbacks.clear = [&](const gui_input& input) {
@@ -458,24 +411,24 @@ void show_image_gui(const string& title, const vector<string>& names,
     }
   };
   callbacks.draw = [&](const gui_input& input) {
-    update_image_params(input, displays[selected], glparamss[selected]);
+    update_image_params(input, images[selected], glparamss[selected]);
     draw_image(glimages[selected], glparamss[selected]);
   };
   callbacks.widgets = [&](const gui_input& input) {
     draw_gui_combobox("name", selected, names);
     auto filmic = (bool)filmics[selected];  // vector of bool ...
     if (draw_tonemap_params(input, exposures[selected], filmic)) {
-      filmics[selected] = filmic;
-      tonemap_image_mt(displays[selected], images[selected],
-          exposures[selected], filmics[selected]);
-      set_image(glimages[selected], displays[selected]);
+      filmics[selected]            = filmic;
+      glparamss[selected].grading = make_tonemap_grading(
+          images[selected], exposures[selected], filmics[selected]);
     }
     draw_image_inspector(
-        input, images[selected], displays[selected], glparamss[selected]);
+        input, images[selected], images[selected], glparamss[selected]);
   };
   callbacks.uiupdate = [&](const gui_input& input) {
     uiupdate_image_params(input, glparamss[selected]);
   };
+  callbacks.idle = [](const gui_input& input) { return true; };
 
   // run ui
   show_gui_window({1280 + 320, 720}, title, callbacks);
@@ -487,13 +440,10 @@ void show_colorgrade_gui(
   // color grading parameters
   auto params = colorgrade_params{};
 
-  // display image
-  auto display = make_image(image.width, image.height, false);
-  colorgrade_image_mt(display, image, params);
-
-  // opengl image
-  auto glimage  = glimage_state{};
-  auto glparams = glimage_params{};
+  // opengl image, graded in the shader
+  auto glimage    = glimage_state{};
+  auto glparams   = glimage_params{};
+  glparams.graded = true;
 
   // top level combo
   auto names    = vector<string>{name};
@@ -503,7 +453,7 @@ void show_colorgrade_gui(
   auto callbacks = gui_callbacks{};
   callbacks.init = [&](const gui_input& input) {
     init_image(glimage);
-    set_image(glimage, display);
+    set_image(glimage, image);
   };
   callbacks.clear = [&](const gui_input& input) { clear_image(glimage); };
   callbacks.draw  = [&](const gui_input& input) {
@@ -531,16 +481,14 @@ void show_colorgrade_gui(
       edited += draw_gui_coloredit("midtones color", params.midtones_color);
       edited += draw_gui_coloredit("highlights color", params.highlights_color);
       end_gui_header();
-      if (edited) {
-        colorgrade_image_mt(display, image, params);
-        set_image(glimage, display);
-      }
+      if (edited) glparams.grading = params;
     }
-    draw_image_inspector(input, image, display, glparams);
+    draw_image_inspector(input, image, image, glparams);
   };
   callbacks.uiupdate = [&glparams](const gui_input& input) {
     uiupdate_image_params(input, glparams);
   };
+  callbacks.idle = [](const gui_input& input) { return true; };
 
   // run ui
   show_gui_window({1280 + 320, 720}, title, callbacks);
@@ -548,7 +496,8 @@ void show_colorgrade_gui(
 
 // Open a window and show an scene via path tracing
 void show_trace_gui(const string& title, const string& name, scene_data& scene,
-    const trace_params& params_, bool print, bool edit) {
+    const trace_params& params_, bool print, bool edit,
+    texture_stream* stream) {
   // copy params and camera
   auto params = params_;
 
@@ -628,15 +577,16 @@ void show_trace_gui(const string& title, const string& name, scene_data& scene,
 
     // start renderer
     render_worker = std::async(std::launch::async, [&]() {
-      for (auto sample = 0; sample < params.samples; sample += params.batch) {
+      while (state.samples < params.samples) {
         if (render_stop) return;
         parallel_for(state.width, state.height, [&](int i, int j) {
           for (auto s = 0; s < params.batch; s++) {
             if (render_stop) return;
             trace_sample(state, scene, bvh, lights, i, j, params);
+            release_shapes(bvh);
           }
          });
-        state.samples += params.batch;
+        finish_samples(state, params, params.batch);
         if (!render_stop) {
           auto lock      = std::lock_guard{render_mutex};
           render_current = state.samples;
@@ -649,6 +599,7 @@ void show_trace_gui(const string& title, const string& name, scene_data& scene,
           tonemap_image_mt(display, image, params.exposure, params.filmic);
           render_update = true;
         }
+        wakeup_gui_window();
       }
      });
   };
@@ -665,14 +616,30 @@ void show_trace_gui(const string& title, const string& name, scene_data& scene,
   // prepare selection
   auto selection = scene_selection{};
 
+  // streamed textures, checked once before any lands
+  auto textures_landed = std::atomic<bool>{stream != nullptr};
+
   // callbacks
   auto callbacks = gui_callbacks{};
   callbacks.init = [&](const gui_input& input) {
     auto lock = std::lock_guard{render_mutex};
     init_image(glimage);
     set_image(glimage, display);
+    if (stream) {
+      auto lock      = std::lock_guard{stream->mutex};
+      stream->notify = [&textures_landed]() {
+        textures_landed = true;
+        wakeup_gui_window();
+      };
+    }
+  };
+  callbacks.clear = [&](const gui_input& input) {
+    if (stream) {
+      auto lock      = std::lock_guard{stream->mutex};
+      stream->notify = {};
+    }
+    clear_image(glimage);
   };
-  callbacks.clear = [&](const gui_input& input) { clear_image(glimage); };
   callbacks.draw  = [&](const gui_input& input) {
     // update image
     if (render_update) {
@@ -738,6 +705,16 @@ void show_trace_gui(const string& title, const string& name, scene_data& scene,
       reset_display();
     }
   };
+  callbacks.update = [&](const gui_input& input) {
+    if (!textures_landed.exchange(false)) return;
+    stop_render();
+    auto updated = update_streamed_textures(*stream, scene);
+    if (!updated.empty()) lights = make_lights(scene, params);
+    reset_display();
+  };
+  callbacks.idle = [&](const gui_input& input) {
+    return !render_update && !textures_landed;
+  };
 
   // run ui
   show_gui_window({1280 + 320, 720}, title, callbacks);
@@ -749,7 +726,7 @@ void show_trace_gui(const string& title, const string& name, scene_data& scene,
 void show_shade_gui(const string& title, const string& name, scene_data& scene,
     const shade_params& params_, const glview_callback& widgets_callback,
     const glview_callback& uiupdate_callback,
-    const glview_callback& update_callback) {
+    const glview_callback& update_callback, texture_stream* stream) {
   // glscene
   auto glscene = glscene_state{};
 
@@ -772,12 +749,28 @@ void show_shade_gui(const string& title, const string& name, scene_data& scene,
   auto updated_shapes   = vector<int>{};
   auto updated_textures = vector<int>{};
 
+  // streamed textures, checked once before any lands
+  auto textures_landed = std::atomic<bool>{stream != nullptr};
+
   // callbacks
   auto callbacks = gui_callbacks{};
   callbacks.init = [&](const gui_input& input) {
     init_glscene(glscene, scene);
+    if (stream) {
+      auto lock      = std::lock_guard{stream->mutex};
+      stream->notify = [&textures_landed]() {
+        textures_landed = true;
+        wakeup_gui_window();
+      };
+    }
+  };
+  callbacks.clear = [&](const gui_input& input) {
+    if (stream) {
+      auto lock      = std::lock_guard{stream->mutex};
+      stream->notify = {};
+    }
+    clear_scene(glscene);
   };
-  callbacks.clear = [&](const gui_input& input) { clear_scene(glscene); };
   callbacks.draw  = [&](const gui_input& input) {
     draw_scene(glscene, scene, input.framebuffer, params);
   };
@@ -799,6 +792,14 @@ void show_shade_gui(const string& title, const string& name, scene_data& scene,
       draw_gui_coloredit("background", params.background);
       end_gui_header();
     }
+    if (draw_gui_header("stats")) {
+      draw_gui_label("instances", (int)scene.instances.size());
+      draw_gui_label("drawn", glscene.drawn_instances);
+      draw_gui_label("culled", glscene.culled_instances);
+      draw_gui_label("draw calls", glscene.draw_calls);
+      draw_gui_label("cpu time", std::to_string(glscene.cpu_time) + " ms");
+      end_gui_header();
+    }
     // draw_scene_editor(scene, selection, {});
     if (widgets_callback) {
       widgets_callback(input, updated_shapes, updated_textures);
@@ -810,6 +811,10 @@ void show_shade_gui(const string& title, const string& name, scene_data& scene,
     }
   };
   callbacks.update = [&](const gui_input& input) {
+    if (textures_landed.exchange(false)) {
+      auto updated = update_streamed_textures(*stream, scene);
+      if (!updated.empty()) update_glscene(glscene, scene, {}, updated);
+    }
     if (update_callback) {
       update_callback(input, updated_shapes, updated_textures);
       if (!updated_shapes.empty() || !updated_textures.empty()) {
@@ -834,6 +839,9 @@ void show_shade_gui(const string& title, const string& name, scene_data& scene,
       scene.cameras.at(params.camera) = camera;
     }
   };
+  callbacks.idle = [&](const gui_input& input) {
+    return !(bool)update_callback && !textures_landed;
+  };
 
   // run ui
   show_gui_window({1280 + 320, 720}, "yshade", callbacks);
@@ -981,8 +989,67 @@ in vec2 frag_texcoord;
 out vec4 frag_color;
 uniform sampler2D txt;
 uniform vec4 background;
+uniform bool graded, linear;
+uniform float exposure;
+uniform vec3 tint;
+uniform float lincontrast, logcontrast, linsaturation;
+uniform bool filmic, srgb;
+uniform float contrast, saturation;
+uniform bool lgg;
+uniform vec3 lift, gamma, gain;
+
+float bias_curve(float a, float b) { return a / ((1 / b - 2) * (1 - a) + 1); }
+float gain_curve(float a, float g) {
+  return (a < 0.5) ? bias_curve(a * 2, g) / 2
+                   : bias_curve(a * 2 - 1, 1 - g) / 2 + 0.5;
+}
+vec3 gain_curve(vec3 a, float g) {
+  return vec3(gain_curve(a.x, g), gain_curve(a.y, g), gain_curve(a.z, g));
+}
+vec3 saturate_color(vec3 rgb, float saturation) {
+  float grey = dot(vec3(0.333333), rgb);
+  return max(vec3(0), grey + (rgb - grey) * (saturation * 2));
+}
+vec3 tonemap_filmic(vec3 hdr_) {
+  vec3 hdr = hdr_ * 0.6;
+  vec3 ldr = (hdr * hdr * 2.51 + hdr * 0.03) /
+             (hdr * hdr * 2.43 + hdr * 0.59 + 0.14);
+  return max(vec3(0), ldr);
+}
+vec3 rgb_to_srgb(vec3 rgb) {
+  vec3 curve = 1.055 * pow(max(rgb, vec3(0)), vec3(1 / 2.4)) - 0.055;
+  return mix(curve, 12.92 * rgb, lessThanEqual(rgb, vec3(0.0031308)));
+}
+
+// mirrors colorgrade() in yocto_color.h
+vec3 colorgrade(vec3 rgb) {
+  float grey = linear ? 0.18 : 0.5;
+  if (exposure != 0) rgb *= exp2(exposure);
+  if (tint != vec3(1)) rgb *= tint;
+  if (lincontrast != 0.5)
+    rgb = max(vec3(0), grey + (rgb - grey) * (lincontrast * 2));
+  if (logcontrast != 0.5) {
+    float epsilon  = 0.0001;
+    vec3  adjusted = log2(grey) +
+                    (log2(rgb + epsilon) - log2(grey)) * (logcontrast * 2);
+    rgb = max(vec3(0), exp2(adjusted) - epsilon);
+  }
+  if (linsaturation != 0.5) rgb = saturate_color(rgb, linsaturation);
+  if (filmic) rgb = tonemap_filmic(rgb);
+  if (linear && srgb) rgb = rgb_to_srgb(rgb);
+  if (contrast != 0.5) rgb = gain_curve(rgb, 1 - contrast);
+  if (saturation != 0.5) rgb = saturate_color(rgb, saturation);
+  if (lgg) {
+    vec3 lerp_value = clamp(pow(rgb, 1 / gamma), 0, 1);
+    rgb = gain * lerp_value + lift * (1 - lerp_value);
+  }
+  return rgb;
+}
+
 void main() {
-  frag_color = texture(txt, frag_texcoord);
+  vec4 color = texture(txt, frag_texcoord);
+  if (graded) color.xyz = colorgrade(color.xyz);
+  frag_color = color;
 }
 )";
 #if 0
@@ -1050,11 +1117,11 @@ void clear_image(glimage_state& glimage) {
 
 void set_image(glimage_state& glimage, const image_data& image) {
   if (!glimage.texture || glimage.width != image.width ||
-      glimage.height != image.height) {
+      glimage.height != image.height || glimage.linear != image.linear) {
     if (!glimage.texture) glGenTextures(1, &glimage.texture);
     glBindTexture(GL_TEXTURE_2D, glimage.texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
-        GL_RGBA, GL_FLOAT, image.pixels.data());
+    glTexImage2D(GL_TEXTURE_2D, 0, image.linear ? GL_RGBA16F : GL_RGBA,
+        image.width, image.height, 0, GL_RGBA, GL_FLOAT, image.pixels.data());
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   } else {
@@ -1064,6 +1131,7 @@ void set_image(glimage_state& glimage, const image_data& image) {
   }
   glimage.width  = image.width;
   glimage.height = image.height;
+  glimage.linear = image.linear;
 }
 
 // draw image
@@ -1102,6 +1170,50 @@ void draw_image(glimage_state& glimage, const glimage_params& params) {
       params.background.w);
   assert_glerror();
 
+  // color grading
+  glUniform1i(glGetUniformLocation(glimage.program, "graded"), params.graded);
+  if (params.graded) {
+    auto& grading = params.grading;
+    auto  set_uniform1f = [&](const char* name, float value) {
+      glUniform1f(glGetUniformLocation(glimage.program, name), value);
+    };
+    auto set_uniform3f = [&](const char* name, const vec3f& value) {
+      glUniform3f(glGetUniformLocation(glimage.program, name), value.x,
+          value.y, value.z);
+    };
+    glUniform1i(
+        glGetUniformLocation(glimage.program, "linear"), glimage.linear);
+    set_uniform1f("exposure", grading.exposure);
+    set_uniform3f("tint", grading.tint);
+    set_uniform1f("lincontrast", grading.lincontrast);
+    set_uniform1f("logcontrast", grading.logcontrast);
+    set_uniform1f("linsaturation", grading.linsaturation);
+    glUniform1i(glGetUniformLocation(glimage.program, "filmic"), grading.filmic);
+    glUniform1i(glGetUniformLocation(glimage.program, "srgb"), grading.srgb);
+    set_uniform1f("contrast", grading.contrast);
+    set_uniform1f("saturation", grading.saturation);
+    // lift, gamma and gain are per-frame constants, so solve them here
+    auto lgg = grading.shadows != 0.5f || grading.midtones != 0.5f ||
+               grading.highlights != 0.5f ||
+               grading.shadows_color != vec3f{1, 1, 1} ||
+               grading.midtones_color != vec3f{1, 1, 1} ||
+               grading.highlights_color != vec3f{1, 1, 1};
+    glUniform1i(glGetUniformLocation(glimage.program, "lgg"), lgg);
+    if (lgg) {
+      auto lift  = grading.shadows_color;
+      auto gamma = grading.midtones_color;
+      auto gain  = grading.highlights_color;
+      lift       = lift - mean(lift) + grading.shadows - (float)0.5;
+      gain       = gain - mean(gain) + grading.highlights + (float)0.5;
+      auto grey  = gamma - mean(gamma) + grading.midtones;
+      gamma      = log(((float)0.5 - lift) / (gain - lift)) / log(grey);
+      set_uniform3f("lift", lift);
+      set_uniform3f("gamma", gamma);
+      set_uniform3f("gain", gain);
+    }
+    assert_glerror();
+  }
+
   // draw
   glBindVertexArray(glimage.vertexarray);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glimage.triangles);
@@ -1138,9 +1250,8 @@ layout(location = 1) in vec3 normals;             // vertex normal (in mesh coor
 layout(location = 2) in vec2 texcoords;           // vertex texcoords
 layout(location = 3) in vec4 colors;              // vertex color
 layout(location = 4) in vec4 tangents;            // vertex tangent space
-
-uniform mat4 frame;             // shape transform
-uniform mat4 frameit;           // shape transform
+layout(location = 5) in mat4 instance_frame;      // shape transform (per instance)
+layout(location = 9) in mat4 instance_frameit;    // shape transform (per instance)
 
 uniform mat4 view;              // inverse of the camera frame (as a matrix)
 uniform mat4 projection;        // camera projection
@@ -1150,6 +1261,7 @@ out vec3 normal;                // [to fragment shader] vertex normal (in world
 out vec2 texcoord;              // [to fragment shader] vertex texture coordinates
 out vec4 scolor;                // [to fragment shader] vertex color
 out vec4 tangsp;                // [to fragment shader] vertex tangent space
+flat out mat4 frame;            // [to fragment shader] shape transform
 
 // main function
 void main() {
@@ -1161,8 +1273,9 @@ void main() {
   scolor = colors;
 
   // world projection
+  frame = instance_frame;
   position = (frame * vec4(position,1)).xyz;
-  normal = (frameit * vec4(normal,0)).xyz;
+  normal = (instance_frameit * vec4(normal,0)).xyz;
   tangsp.xyz = (frame * vec4(tangsp.xyz,0)).xyz;
 
   // clip
@@ -1179,6 +1292,7 @@ in vec3 normal;    // [from vertex shader] normal in world space
 in vec2 texcoord;  // [from vertex shader] texcoord
 in vec4 scolor;    // [from vertex shader] color
 in vec4 tangsp;    // [from vertex shader] tangent space
+flat in mat4 frame; // [from vertex shader] shape transform
 
 uniform int element;
 uniform bool unlit;
@@ -1208,9 +1322,6 @@ uniform int  lights_num;          // number of lights
 uniform vec3 lights_direction[16];// light positions
 uniform vec3 lights_emission[16]; // light intensities
 
-uniform mat4 frame;              // shape transform
-uniform mat4 frameit;            // shape transform
-
 uniform vec3 eye;              // camera position
 uniform mat4 view;             // inverse of the camera frame (as a matrix)
 uniform mat4 projection;       // camera projection
@@ -1380,30 +1491,39 @@ void main() {
 // Create texture
 static void set_texture(
     glscene_texture& gltexture, const texture_data& texture) {
+  // compact storage is uploaded as is and kept in half floats on the gpu,
+  // since shared exponent textures cannot be mipmapped
+  auto internal = GL_RGBA, format = GL_RGBA, type = GL_FLOAT;
+  auto data     = (const void*)nullptr;
+  if (!texture.pixelsb.empty()) {
+    type = GL_UNSIGNED_BYTE;
+    data = texture.pixelsb.data();
+  } else if (!texture.pixelsh.empty()) {
+    internal = GL_RGBA16F;
+    type     = GL_HALF_FLOAT;
+    data     = texture.pixelsh.data();
+  } else if (!texture.pixelse.empty()) {
+    internal = GL_RGBA16F;
+    format   = GL_RGB;
+    type     = GL_UNSIGNED_INT_5_9_9_9_REV;
+    data     = texture.pixelse.data();
+  } else {
+    data = texture.pixelsf.data();
+  }
   if (!gltexture.texture || gltexture.width != texture.width ||
       gltexture.height != texture.height) {
     if (!gltexture.texture) glGenTextures(1, &gltexture.texture);
     glBindTexture(GL_TEXTURE_2D, gltexture.texture);
-    if (!texture.pixelsb.empty()) {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0,
-          GL_RGBA, GL_UNSIGNED_BYTE, texture.pixelsb.data());
-    } else {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0,
-          GL_RGBA, GL_FLOAT, texture.pixelsf.data());
-    }
+    glTexImage2D(GL_TEXTURE_2D, 0, internal, texture.width, texture.height, 0,
+        format, type, data);
     glGenerateMipmap(GL_TEXTURE_2D);
     glTexParameteri(
         GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   } else {
     glBindTexture(GL_TEXTURE_2D, gltexture.texture);
-    if (!texture.pixelsb.empty()) {
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture.width, texture.height,
-          GL_RGBA, GL_UNSIGNED_BYTE, texture.pixelsb.data());
-    } else {
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture.width, texture.height,
-          GL_RGBA, GL_FLOAT, texture.pixelsf.data());
-    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture.width, texture.height,
+        format, type, data);
     glGenerateMipmap(GL_TEXTURE_2D);
   }
 }
@@ -1476,24 +1596,70 @@ static void set_shape(glscene_shape& glshape, const shape_data& shape) {
     }
   };
 
+  // quads are split into triangles directly in the mapped index buffer,
+  // avoiding a temporary triangle array on every upload
+  auto set_quads = [](uint& buffer, int& num, const vector<vec4i>& quads) {
+    if (quads.empty()) {
+      if (buffer) glDeleteBuffers(1, &buffer);
+      buffer = 0;
+      num    = 0;
+      return;
+    }
+    auto count = 0;
+    for (auto& q : quads) count += (q.z != q.w) ? 2 : 1;
+    if (!buffer || count != num) {
+      if (buffer) glDeleteBuffers(1, &buffer);
+      glGenBuffers(1, &buffer);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(vec3i), nullptr,
+          GL_STATIC_DRAW);
+      num = count;
+    } else {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    }
+    auto triangles = (vec3i*)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0,
+        count * sizeof(vec3i),
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    for (auto& q : quads) {
+      *triangles++ = {q.x, q.y, q.w};
+      if (q.z != q.w) *triangles++ = {q.z, q.w, q.y};
+    }
+    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+  };
+
+  // compact vertex data is decoded to floats for the shaders
+  auto normals   = vector<vec3f>(shape.normalso.size());
+  auto texcoords = vector<vec2f>(shape.texcoordsu.size());
+  auto colors    = vector<vec4f>(shape.colorsb.size());
+  for (auto vertex = 0; vertex < (int)normals.size(); vertex++)
+    normals[vertex] = get_normal(shape, vertex);
+  for (auto vertex = 0; vertex < (int)texcoords.size(); vertex++)
+    texcoords[vertex] = get_texcoord(shape, vertex);
+  for (auto vertex = 0; vertex < (int)colors.size(); vertex++)
+    colors[vertex] = get_color(shape, vertex);
+
   if (!glshape.vertexarray) glGenVertexArrays(1, &glshape.vertexarray);
   glBindVertexArray(glshape.vertexarray);
   set_indices(glshape.points, glshape.num_points, shape.points);
   set_indices(glshape.lines, glshape.num_lines, shape.lines);
   set_indices(glshape.triangles, glshape.num_triangles, shape.triangles);
-  set_indices(
-      glshape.quads, glshape.num_quads, quads_to_triangles(shape.quads));
+  set_quads(glshape.quads, glshape.num_quads, shape.quads);
   set_vertex(glshape.positions, glshape.num_positions, shape.positions,
       vec3f{0, 0, 0}, 0);
-  set_vertex(
-      glshape.normals, glshape.num_normals, shape.normals, vec3f{0, 0, 1}, 1);
-  set_vertex(glshape.texcoords, glshape.num_texcoords, shape.texcoords,
-      vec2f{0, 0}, 2);
-  set_vertex(
-      glshape.colors, glshape.num_colors, shape.colors, vec4f{1, 1, 1, 1}, 3);
+  set_vertex(glshape.normals, glshape.num_normals,
+      shape.normalso.empty() ? shape.normals : normals, vec3f{0, 0, 1}, 1);
+  set_vertex(glshape.texcoords, glshape.num_texcoords,
+      shape.texcoordsu.empty() ? shape.texcoords : texcoords, vec2f{0, 0}, 2);
+  set_vertex(glshape.colors, glshape.num_colors,
+      shape.colorsb.empty() ? shape.colors : colors, vec4f{1, 1, 1, 1}, 3);
   set_vertex(glshape.tangents, glshape.num_tangents, shape.tangents,
       vec4f{0, 0, 1, 1}, 4);
   glBindVertexArray(0);
+
+  // bounds
+  glshape.bounds = invalidb3f;
+  for (auto& position : shape.positions)
+    glshape.bounds = merge(glshape.bounds, position);
 }
 
 // Clean shape
@@ -1513,11 +1679,53 @@ static void clear_shape(glscene_shape& glshape) {
 }
 
 // init scene
-static void init_glscene(glscene_state& glscene, const scene_data& ioscene) {
+void init_glscene(glscene_state& glscene, const scene_data& ioscene) {
   // program
   set_program(glscene.program, glscene.vertex, glscene.fragment, glscene_vertex,
       glscene_fragment);
 
+  // uniforms
+  auto& program  = glscene.program;
+  auto& uniforms = glscene.uniforms;
+  auto  location = [program](const string& name) {
+    return glGetUniformLocation(program, name.c_str());
+  };
+  uniforms.eye          = location("eye");
+  uniforms.view         = location("view");
+  uniforms.projection   = location("projection");
+  uniforms.exposure     = location("exposure");
+  uniforms.gamma        = location("gamma");
+  uniforms.double_sided = location("double_sided");
+  uniforms.faceted      = location("faceted");
+  uniforms.unlit        = location("unlit");
+  uniforms.highlight    = location("highlight");
+  uniforms.element      = location("element");
+  uniforms.lighting     = location("lighting");
+  uniforms.ambient      = location("ambient");
+  uniforms.lights_num   = location("lights_num");
+  for (auto lid = 0; lid < (int)uniforms.lights_direction.size(); lid++) {
+    auto is                       = std::to_string(lid);
+    uniforms.lights_direction[lid] = location("lights_direction[" + is + "]");
+    uniforms.lights_emission[lid]  = location("lights_emission[" + is + "]");
+  }
+  uniforms.emission         = location("emission");
+  uniforms.color            = location("color");
+  uniforms.specular         = location("specular");
+  uniforms.metallic         = location("metallic");
+  uniforms.roughness        = location("roughness");
+  uniforms.opacity          = location("opacity");
+  uniforms.emission_tex     = location("emission_tex");
+  uniforms.emission_tex_on  = location("emission_tex_on");
+  uniforms.color_tex        = location("color_tex");
+  uniforms.color_tex_on     = location("color_tex_on");
+  uniforms.roughness_tex    = location("roughness_tex");
+  uniforms.roughness_tex_on = location("roughness_tex_on");
+  uniforms.normalmap_tex    = location("normalmap_tex");
+  uniforms.normalmap_tex_on = location("normalmap_tex_on");
+
+  // instance frames
+  glGenBuffers(1, &glscene.instances);
+
   // textures
   for (auto& iotexture : ioscene.textures) {
     auto& gltexture = glscene.textures.emplace_back();
@@ -1532,8 +1740,20 @@ static void init_glscene(glscene_state& glscene, const scene_data& ioscene) {
 }
 
 // update scene
-static void update_glscene(glscene_state& glscene, const scene_data& scene,
+void update_glscene(glscene_state& glscene, const scene_data& scene,
     const vector<int>& updated_shapes, const vector<int>& updated_textures) {
+  // shapes and textures added to the scene after init are created empty and
+  // need to be in the updated ones, while removed ones are cleared
+  while (glscene.shapes.size() > scene.shapes.size()) {
+    clear_shape(glscene.shapes.back());
+    glscene.shapes.pop_back();
+  }
+  glscene.shapes.resize(scene.shapes.size());
+  while (glscene.textures.size() > scene.textures.size()) {
+    clear_texture(glscene.textures.back());
+    glscene.textures.pop_back();
+  }
+  glscene.textures.resize(scene.textures.size());
   for (auto shape_id : updated_shapes) {
     set_shape(glscene.shapes[shape_id], scene.shapes[shape_id]);
   }
@@ -1543,9 +1763,10 @@ static void update_glscene(glscene_state& glscene, const scene_data& scene,
 }
 
 // Clear an OpenGL scene
-static void clear_scene(glscene_state& glscene) {
+void clear_scene(glscene_state& glscene) {
   for (auto& texture : glscene.textures) clear_texture(texture);
   for (auto& shape : glscene.shapes) clear_shape(shape);
+  if (glscene.instances) glDeleteBuffers(1, &glscene.instances);
   if (glscene.program) glDeleteProgram(glscene.program);
   if (glscene.vertex) glDeleteProgram(glscene.vertex);
   if (glscene.fragment) glDeleteProgram(glscene.fragment);
@@ -1582,11 +1803,39 @@ static void clear_scene(glscene_state& glscene) {
   assert_glerror();
 }
 
-static void draw_scene(glscene_state& glscene, const scene_data& scene,
+// Check whether a bounding box lies outside the view frustum, by testing its
+// corners against each clip plane in clip space.
+static bool is_bbox_culled(const mat4f& view_projection, const bbox3f& bbox) {
+  if (bbox.min.x > bbox.max.x) return true;
+  auto outside = std::array<int, 6>{};
+  for (auto corner = 0; corner < 8; corner++) {
+    auto p = view_projection * vec4f{(corner & 1) ? bbox.max.x : bbox.min.x,
+                                   (corner & 2) ? bbox.max.y : bbox.min.y,
+                                   (corner & 4) ? bbox.max.z : bbox.min.z, 1};
+    if (p.x < -p.w) outside[0] += 1;
+    if (p.x > p.w) outside[1] += 1;
+    if (p.y < -p.w) outside[2] += 1;
+    if (p.y > p.w) outside[3] += 1;
+    if (p.z < -p.w) outside[4] += 1;
+    if (p.z > p.w) outside[5] += 1;
+  }
+  for (auto count : outside) {
+    if (count == 8) return true;
+  }
+  return false;
+}
+
+void draw_scene(glscene_state& glscene, const scene_data& scene,
     const vec4i& viewport, const shade_params& params) {
   // check errors
   assert_glerror();
 
+  // frame statistics
+  auto start_time          = std::chrono::high_resolution_clock::now();
+  glscene.draw_calls       = 0;
+  glscene.drawn_instances  = 0;
+  glscene.culled_instances = 0;
+
   // viewport and framebuffer
   glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
   glClearColor(params.background.x, params.background.y, params.background.z,
@@ -1595,7 +1844,8 @@ static void draw_scene(glscene_state& glscene, const scene_data& scene,
   glEnable(GL_DEPTH_TEST);
 
   // set program
-  auto& program = glscene.program;
+  auto& program  = glscene.program;
+  auto& uniforms = glscene.uniforms;
   glUseProgram(program);
 
   // camera
@@ -1608,18 +1858,22 @@ static void draw_scene(glscene_state& glscene, const scene_data& scene,
   auto view_matrix       = frame_to_mat(inverse(camera.frame));
   auto projection_matrix = perspective_mat(
       camera_yfov, camera_aspect, params.near, params.far);
-  glUniform3f(glGetUniformLocation(program, "eye"), camera.frame.o.x,
-      camera.frame.o.y, camera.frame.o.z);
-  glUniformMatrix4fv(
-      glGetUniformLocation(program, "view"), 1, false, &view_matrix.x.x);
-  glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, false,
-      &projection_matrix.x.x);
+  if (camera.orthographic) {
+    // same film extent as eval_camera, that scales the film by 1 / lens
+    auto xmag         = camera.film / (2 * camera.lens);
+    projection_matrix = ortho_mat(
+        xmag, xmag / camera_aspect, params.near, params.far);
+  }
+  glUniform3f(
+      uniforms.eye, camera.frame.o.x, camera.frame.o.y, camera.frame.o.z);
+  glUniformMatrix4fv(uniforms.view, 1, false, &view_matrix.x.x);
+  glUniformMatrix4fv(uniforms.projection, 1, false, &projection_matrix.x.x);
 
   // params
-  glUniform1f(glGetUniformLocation(program, "exposure"), params.exposure);
-  glUniform1f(glGetUniformLocation(program, "gamma"), params.gamma);
-  glUniform1i(glGetUniformLocation(program, "double_sided"),
-      params.double_sided ? 1 : 0);
+  glUniform1f(uniforms.exposure, params.exposure);
+  glUniform1f(uniforms.gamma, params.gamma);
+  glUniform1i(uniforms.double_sided, params.double_sided ? 1 : 0);
+  glUniform1i(uniforms.unlit, 0);
 
   static auto lights_direction = vector<vec3f>{normalize(vec3f{1, 1, 1}),
       normalize(vec3f{-1, 1, 1}), normalize(vec3f{-1, -1, 1}),
@@ -1628,130 +1882,182 @@ static void draw_scene(glscene_state& glscene, const scene_data& scene,
       vec3f{pif / 2, pif / 2, pif / 2}, vec3f{pif / 4, pif / 4, pif / 4},
       vec3f{pif / 4, pif / 4, pif / 4}};
   if (params.lighting == shade_lighting::camlight) {
-    glUniform1i(glGetUniformLocation(program, "lighting"), 1);
-    glUniform3f(glGetUniformLocation(program, "ambient"), 0, 0, 0);
-    glUniform1i(glGetUniformLocation(program, "lights_num"),
-        (int)lights_direction.size());
+    glUniform1i(uniforms.lighting, 1);
+    glUniform3f(uniforms.ambient, 0, 0, 0);
+    glUniform1i(uniforms.lights_num, (int)lights_direction.size());
     for (auto lid = 0; lid < lights_direction.size(); lid++) {
-      auto is        = std::to_string(lid);
       auto direction = transform_direction(camera.frame, lights_direction[lid]);
-      glUniform3f(glGetUniformLocation(
-                      program, ("lights_direction[" + is + "]").c_str()),
-          direction.x, direction.y, direction.z);
-      glUniform3f(glGetUniformLocation(
-                      program, ("lights_emission[" + is + "]").c_str()),
-          lights_emission[lid].x, lights_emission[lid].y,
-          lights_emission[lid].z);
+      glUniform3f(uniforms.lights_direction[lid], direction.x, direction.y,
+          direction.z);
+      glUniform3f(uniforms.lights_emission[lid], lights_emission[lid].x,
+          lights_emission[lid].y, lights_emission[lid].z);
     }
   } else if (params.lighting == shade_lighting::eyelight) {
-    glUniform1i(glGetUniformLocation(program, "lighting"), 0);
-    glUniform1i(glGetUniformLocation(program, "lights_num"), 0);
+    glUniform1i(uniforms.lighting, 0);
+    glUniform1i(uniforms.lights_num, 0);
   } else {
     throw std::invalid_argument{"unknown lighting type"};
   }
 
   // helper
-  auto set_texture = [&glscene](uint program, const char* name,
-                         const char* name_on, int texture_idx, int unit) {
+  auto set_texture = [&glscene](int name, int name_on, int texture_idx,
+                         int unit) {
     if (texture_idx >= 0) {
       auto& gltexture = glscene.textures.at(texture_idx);
       glActiveTexture(GL_TEXTURE0 + unit);
       glBindTexture(GL_TEXTURE_2D, gltexture.texture);
-      glUniform1i(glGetUniformLocation(program, name), unit);
-      glUniform1i(glGetUniformLocation(program, name_on), 1);
+      glUniform1i(name, unit);
+      glUniform1i(name_on, 1);
     } else {
       glActiveTexture(GL_TEXTURE0 + unit);
       glBindTexture(GL_TEXTURE_2D, 0);
-      glUniform1i(glGetUniformLocation(program, name), unit);
-      glUniform1i(glGetUniformLocation(program, name_on), 0);
+      glUniform1i(name, unit);
+      glUniform1i(name_on, 0);
     }
   };
 
-  // draw instances
+  // cull instances against the view frustum
+  auto  view_projection = projection_matrix * view_matrix;
+  auto& visible         = glscene.visible;
+  visible.clear();
+  for (auto idx = 0; idx < (int)scene.instances.size(); idx++) {
+    auto& instance = scene.instances[idx];
+    auto& glshape  = glscene.shapes.at(instance.shape);
+    if (is_bbox_culled(view_projection,
+            transform_bbox(instance.frame, glshape.bounds))) {
+      glscene.culled_instances += 1;
+    } else {
+      visible.push_back(idx);
+    }
+  }
+
+  // group instances that share shape and material into batches
+  std::sort(visible.begin(), visible.end(), [&scene](int a, int b) {
+    auto& instance_a = scene.instances[a];
+    auto& instance_b = scene.instances[b];
+    if (instance_a.shape != instance_b.shape)
+      return instance_a.shape < instance_b.shape;
+    if (instance_a.material != instance_b.material)
+      return instance_a.material < instance_b.material;
+    return a < b;
+  });
+
+  // stream per-instance frames
+  auto& frames = glscene.frames;
+  frames.resize(visible.size() * 2);
+  for (auto vid = 0; vid < (int)visible.size(); vid++) {
+    auto& instance     = scene.instances[visible[vid]];
+    frames[vid * 2 + 0] = frame_to_mat(instance.frame);
+    frames[vid * 2 + 1] = transpose(
+        frame_to_mat(inverse(instance.frame, params.non_rigid_frames)));
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, glscene.instances);
+  glBufferData(GL_ARRAY_BUFFER, frames.size() * sizeof(mat4f), frames.data(),
+      GL_STREAM_DRAW);
+
+  // draw batches
   if (params.wireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-  for (auto& instance : scene.instances) {
+  for (auto batch_start = 0; batch_start < (int)visible.size();) {
+    auto& instance  = scene.instances[visible[batch_start]];
+    auto  batch_end = batch_start + 1;
+    while (batch_end < (int)visible.size() &&
+           scene.instances[visible[batch_end]].shape == instance.shape &&
+           scene.instances[visible[batch_end]].material == instance.material)
+      batch_end += 1;
+    auto num_instances = batch_end - batch_start;
+
     auto& glshape  = glscene.shapes.at(instance.shape);
     auto& material = scene.materials.at(instance.material);
 
-    auto shape_xform     = frame_to_mat(instance.frame);
-    auto shape_inv_xform = transpose(
-        frame_to_mat(inverse(instance.frame, params.non_rigid_frames)));
-    glUniformMatrix4fv(
-        glGetUniformLocation(program, "frame"), 1, false, &shape_xform.x.x);
-    glUniformMatrix4fv(glGetUniformLocation(program, "frameit"), 1, false,
-        &shape_inv_xform.x.x);
-    glUniform1i(glGetUniformLocation(program, "faceted"),
-        (params.faceted || glshape.normals == 0) ? 1 : 0);
-
-    glUniform1i(glGetUniformLocation(program, "unlit"), 0);
-    glUniform3f(glGetUniformLocation(program, "emission"), material.emission.x,
-        material.emission.y, material.emission.z);
-    glUniform3f(glGetUniformLocation(program, "color"), material.color.x,
-        material.color.y, material.color.z);
-    glUniform1f(glGetUniformLocation(program, "specular"), 1);
-    glUniform1f(glGetUniformLocation(program, "metallic"), material.metallic);
-    glUniform1f(glGetUniformLocation(program, "roughness"), material.roughness);
-    glUniform1f(glGetUniformLocation(program, "opacity"), material.opacity);
+    glUniform1i(
+        uniforms.faceted, (params.faceted || glshape.normals == 0) ? 1 : 0);
+    glUniform3f(uniforms.emission, material.emission.x, material.emission.y,
+        material.emission.z);
+    glUniform3f(
+        uniforms.color, material.color.x, material.color.y, material.color.z);
+    glUniform1f(uniforms.specular, 1);
+    glUniform1f(uniforms.metallic, material.metallic);
+    glUniform1f(uniforms.roughness, material.roughness);
+    glUniform1f(uniforms.opacity, material.opacity);
     if (material.type == material_type::matte ||
         material.type == material_type::transparent ||
         material.type == material_type::refractive ||
         material.type == material_type::subsurface ||
         material.type == material_type::volumetric) {
-      glUniform1f(glGetUniformLocation(program, "specular"), 0);
+      glUniform1f(uniforms.specular, 0);
     }
     if (material.type == material_type::reflective) {
-      glUniform1f(glGetUniformLocation(program, "metallic"), 1);
+      glUniform1f(uniforms.metallic, 1);
     }
-    glUniform1f(glGetUniformLocation(program, "double_sided"),
-        params.double_sided ? 1 : 0);
+    set_texture(uniforms.emission_tex, uniforms.emission_tex_on,
+        material.emission_tex, 0);
     set_texture(
-        program, "emission_tex", "emission_tex_on", material.emission_tex, 0);
-    set_texture(program, "color_tex", "color_tex_on", material.color_tex, 1);
-    set_texture(program, "roughness_tex", "roughness_tex_on",
+        uniforms.color_tex, uniforms.color_tex_on, material.color_tex, 1);
+    set_texture(uniforms.roughness_tex, uniforms.roughness_tex_on,
         material.roughness_tex, 3);
-    set_texture(
-        program, "normalmap_tex", "normalmap_tex_on", material.normal_tex, 5);
+    set_texture(uniforms.normalmap_tex, uniforms.normalmap_tex_on,
+        material.normal_tex, 5);
     assert_glerror();
 
-    if (glshape.points)
-      glUniform1i(glGetUniformLocation(program, "element"), 1);
-    if (glshape.lines) glUniform1i(glGetUniformLocation(program, "element"), 2);
-    if (glshape.triangles)
-      glUniform1i(glGetUniformLocation(program, "element"), 3);
-    if (glshape.quads) glUniform1i(glGetUniformLocation(program, "element"), 3);
+    if (glshape.points) glUniform1i(uniforms.element, 1);
+    if (glshape.lines) glUniform1i(uniforms.element, 2);
+    if (glshape.triangles) glUniform1i(uniforms.element, 3);
+    if (glshape.quads) glUniform1i(uniforms.element, 3);
     assert_glerror();
 
+    // per-instance attributes, two matrices for each instance
     glBindVertexArray(glshape.vertexarray);
+    glBindBuffer(GL_ARRAY_BUFFER, glscene.instances);
+    for (auto column = 0; column < 8; column++) {
+      auto offset = (batch_start * 2 * 4 + column) * sizeof(vec4f);
+      glEnableVertexAttribArray(5 + column);
+      glVertexAttribPointer(5 + column, 4, GL_FLOAT, false,
+          2 * sizeof(mat4f), (const void*)offset);
+      glVertexAttribDivisor(5 + column, 1);
+    }
+
     if (glshape.points) {
       glPointSize(glshape.point_size);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glshape.points);
-      glDrawElements(
-          GL_POINTS, (GLsizei)glshape.num_points * 1, GL_UNSIGNED_INT, nullptr);
+      glDrawElementsInstanced(GL_POINTS, (GLsizei)glshape.num_points * 1,
+          GL_UNSIGNED_INT, nullptr, num_instances);
       glPointSize(glshape.point_size);
+      glscene.draw_calls += 1;
     }
     if (glshape.lines) {
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glshape.lines);
-      glDrawElements(
-          GL_LINES, (GLsizei)glshape.num_lines * 2, GL_UNSIGNED_INT, nullptr);
+      glDrawElementsInstanced(GL_LINES, (GLsizei)glshape.num_lines * 2,
+          GL_UNSIGNED_INT, nullptr, num_instances);
+      glscene.draw_calls += 1;
     }
     if (glshape.triangles) {
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glshape.triangles);
-      glDrawElements(GL_TRIANGLES, (GLsizei)glshape.num_triangles * 3,
-          GL_UNSIGNED_INT, nullptr);
+      glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)glshape.num_triangles * 3,
+          GL_UNSIGNED_INT, nullptr, num_instances);
+      glscene.draw_calls += 1;
     }
     if (glshape.quads) {
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glshape.quads);
-      glDrawElements(GL_TRIANGLES, (GLsizei)glshape.num_quads * 3,
-          GL_UNSIGNED_INT, nullptr);
+      glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)glshape.num_quads * 3,
+          GL_UNSIGNED_INT, nullptr, num_instances);
+      glscene.draw_calls += 1;
     }
 
     glBindVertexArray(0);
     assert_glerror();
+
+    glscene.drawn_instances += num_instances;
+    batch_start = batch_end;
   }
   if (params.wireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
   // done
   glUseProgram(0);
+
+  // frame statistics
+  glscene.cpu_time = std::chrono::duration<double, std::milli>(
+      std::chrono::high_resolution_clock::now() - start_time)
+                         .count();
 }
 
 }  // namespace yocto
@@ -1763,20 +2069,27 @@ namespace yocto {
 
 // OpenGL window wrapper
 struct glwindow_state {
-  string       title         = "";
-  gui_callback init          = {};
-  gui_callback clear         = {};
-  gui_callback draw          = {};
-  gui_callback widgets       = {};
-  gui_callback update        = {};
-  gui_callback uiupdate      = {};
-  int          widgets_width = 0;
-  bool         widgets_left  = true;
-  gui_input    input         = {};
-  vec2i        window        = {0, 0};
-  vec4f        background    = {0.15f, 0.15f, 0.15f, 1.0f};
+  string            title         = "";
+  gui_callback      init          = {};
+  gui_callback      clear         = {};
+  gui_callback      draw          = {};
+  gui_callback      widgets       = {};
+  gui_callback      update        = {};
+  gui_callback      uiupdate      = {};
+  gui_idle_callback idle          = {};
+  int               widgets_width = 0;
+  bool              widgets_left  = true;
+  gui_input         input         = {};
+  vec2i             window        = {0, 0};
+  vec4f             background    = {0.15f, 0.15f, 0.15f, 1.0f};
+  int               settle_frames = 0;
 };
 
+// Frames drawn after each event before blocking, so that widgets settle
+static const auto gui_settle_frames = 2;
+// Maximum blocking time while idle, in seconds
+static const auto gui_idle_timeout = 0.5;
+
 static void draw_window(glwindow_state& state) {
   glClearColor(state.background.x, state.background.y, state.background.z,
       state.background.w);
@@ -1830,6 +2143,7 @@ void show_gui_window(const vec2i& size, const string& title,
   state.widgets  = callbacks.widgets;
   state.update   = callbacks.update;
   state.uiupdate = callbacks.uiupdate;
+  state.idle     = callbacks.idle;
 
   // create window
   auto window = glfwCreateWindow(
@@ -1952,8 +2266,20 @@ void show_gui_window(const vec2i& size, const string& title,
     draw_window(state);
     glfwSwapBuffers(window);
 
-    // event hadling
-    glfwPollEvents();
+    // event hadling, blocking while idle until an event or a wakeup
+    if (state.idle && state.input.mouse == zero3i &&
+        state.idle(state.input)) {
+      if (state.settle_frames > 0) {
+        state.settle_frames--;
+        glfwPollEvents();
+      } else {
+        glfwWaitEventsTimeout(gui_idle_timeout);
+        state.settle_frames = gui_settle_frames;
+      }
+    } else {
+      state.settle_frames = gui_settle_frames;
+      glfwPollEvents();
+    }
   }
 
   // clear
@@ -1964,6 +2290,9 @@ void show_gui_window(const vec2i& size, const string& title,
   glfwTerminate();
 }  // namespace yocto
 
+// wake up an idle window
+void wakeup_gui_window() { glfwPostEmptyEvent(); }
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -2742,7 +3071,8 @@ void show_colorgrade_gui(
 
 // Open a window and show an scene via path tracing
 void show_trace_gui(const string& title, const string& name, scene_data& scene,
-    const trace_params& params, bool print, bool edit) {
+    const trace_params& params, bool print, bool edit,
+    texture_stream* stream) {
   exit_nogl();
 }
 
@@ -2751,7 +3081,7 @@ struct shade_params;
 void show_shade_gui(const string& title, const string& name, scene_data& scene,
     const shade_params& params, const glview_callback& widgets_callback,
     const glview_callback& uiupdate_callback,
-    const glview_callback& update_callback) {
+    const glview_callback& update_callback, texture_stream* stream) {
   exit_nogl();
 }
 
@@ -2768,6 +3098,9 @@ void show_gui_window(const vec2i& size, const string& title,
   exit_nogl();
 }
 
+// wake up an idle window
+void wakeup_gui_window() {}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
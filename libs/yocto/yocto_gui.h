@@ -73,9 +73,13 @@ void show_image_gui(const string& title, const vector<string>& names,
 void show_colorgrade_gui(
     const string& title, const string& name, const image_data& image);
 
+// Textures streamed in the background, swapped in by the viewers as they land
+struct texture_stream;
+
 // Open a window and show an scene via path tracing
 void show_trace_gui(const string& title, const string& name, scene_data& scene,
-    const trace_params& params = {}, bool print = true, bool edit = false);
+    const trace_params& params = {}, bool print = true, bool edit = false,
+    texture_stream* stream = nullptr);
 
 // GUI callback
 struct gui_input;
@@ -110,7 +114,8 @@ struct shade_params;
 void show_shade_gui(const string& title, const string& name, scene_data& scene,
     const shade_params& params, const glview_callback& widgets_callback = {},
     const glview_callback& uiupdate_callback = {},
-    const glview_callback& update_callback   = {});
+    const glview_callback& update_callback   = {},
+    texture_stream*        stream            = nullptr);
 
 }  // namespace yocto
 
@@ -122,8 +127,9 @@ namespace yocto {
 // OpenGL image data
 struct glimage_state {
   // image properties
-  int width  = 0;
-  int height = 0;
+  int  width  = 0;
+  int  height = 0;
+  bool linear = false;
 
   // Opengl state
   uint texture     = 0;  // texture
@@ -141,7 +147,7 @@ bool init_image(glimage_state& glimage);
 // clear image
 void clear_image(glimage_state& glimage);
 
-// update image data
+// update image data; linear images are kept in half float for grading
 void set_image(glimage_state& glimage, const image_data& image);
 
 // OpenGL image drawing params
@@ -154,6 +160,9 @@ struct glimage_params {
   bool  checker     = true;
   float border_size = 2;
   vec4f background  = {0.15f, 0.15f, 0.15f, 1.0f};
+  // color grading done in the shader, matching colorgrade() on the cpu
+  bool              graded  = false;
+  colorgrade_params grading = {};
 };
 
 // draw image
@@ -161,6 +170,129 @@ void draw_image(glimage_state& image, const glimage_params& params);
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// SCENE DRAWING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Opengl texture
+struct glscene_texture {
+  // texture properties
+  int width  = 0;
+  int height = 0;
+
+  // opengl state
+  uint texture = 0;
+};
+
+// Opengl shape
+struct glscene_shape {
+  // Shape properties
+  int num_positions = 0;
+  int num_normals   = 0;
+  int num_texcoords = 0;
+  int num_colors    = 0;
+  int num_tangents  = 0;
+  int num_points    = 0;
+  int num_lines     = 0;
+  int num_triangles = 0;
+  int num_quads     = 0;
+
+  // OpenGl state
+  uint  vertexarray = 0;
+  uint  positions   = 0;
+  uint  normals     = 0;
+  uint  texcoords   = 0;
+  uint  colors      = 0;
+  uint  tangents    = 0;
+  uint  points      = 0;
+  uint  lines       = 0;
+  uint  triangles   = 0;
+  uint  quads       = 0;
+  float point_size  = 1;
+
+  // object-space bounds used for culling
+  bbox3f bounds = invalidb3f;
+};
+
+// Opengl uniform locations, looked up once when the program is built
+struct glscene_uniforms {
+  // frame
+  int eye          = -1;
+  int view         = -1;
+  int projection   = -1;
+  int exposure     = -1;
+  int gamma        = -1;
+  int double_sided = -1;
+  int faceted      = -1;
+  int unlit        = -1;
+  int highlight    = -1;
+  int element      = -1;
+
+  // lights
+  int                 lighting         = -1;
+  int                 ambient          = -1;
+  int                 lights_num       = -1;
+  std::array<int, 16> lights_direction = {};
+  std::array<int, 16> lights_emission  = {};
+
+  // material
+  int emission         = -1;
+  int color            = -1;
+  int specular         = -1;
+  int metallic         = -1;
+  int roughness        = -1;
+  int opacity          = -1;
+  int emission_tex     = -1;
+  int emission_tex_on  = -1;
+  int color_tex        = -1;
+  int color_tex_on     = -1;
+  int roughness_tex    = -1;
+  int roughness_tex_on = -1;
+  int normalmap_tex    = -1;
+  int normalmap_tex_on = -1;
+};
+
+// Opengl scene
+struct glscene_state {
+  // scene objects
+  vector<glscene_shape>   shapes   = {};
+  vector<glscene_texture> textures = {};
+
+  // programs
+  uint             program  = 0;
+  uint             vertex   = 0;
+  uint             fragment = 0;
+  glscene_uniforms uniforms = {};
+
+  // per-instance frames, streamed each frame for instanced draws
+  uint          instances = 0;
+  vector<int>   visible   = {};
+  vector<mat4f> frames    = {};
+
+  // statistics of the last frame
+  int    draw_calls       = 0;
+  int    drawn_instances  = 0;
+  int    culled_instances = 0;
+  double cpu_time         = 0;  // milliseconds
+};
+
+// init scene
+void init_glscene(glscene_state& glscene, const scene_data& scene);
+
+// update scene, following shapes and textures added or removed since init
+void update_glscene(glscene_state& glscene, const scene_data& scene,
+    const vector<int>& updated_shapes, const vector<int>& updated_textures);
+
+// Clear an OpenGL scene
+void clear_scene(glscene_state& scene);
+
+// draw scene, clearing the viewport to the background color
+void draw_scene(glscene_state& glscene, const scene_data& scene,
+    const vec4i& viewport, const shade_params& params);
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // WINDOW
 // -----------------------------------------------------------------------------
@@ -180,21 +312,31 @@ struct gui_input {
 // Init callback called after the window has opened
 using gui_callback = function<void(const gui_input& input)>;
 
+// Idle callback, returns true when nothing changes until the next event
+using gui_idle_callback = function<bool(const gui_input& input)>;
+
 // User interface callcaks
 struct gui_callbacks {
-  gui_callback init     = {};
-  gui_callback clear    = {};
-  gui_callback draw     = {};
-  gui_callback widgets  = {};
-  gui_callback update   = {};
-  gui_callback uiupdate = {};
+  gui_callback      init     = {};
+  gui_callback      clear    = {};
+  gui_callback      draw     = {};
+  gui_callback      widgets  = {};
+  gui_callback      update   = {};
+  gui_callback      uiupdate = {};
+  gui_idle_callback idle     = {};
 };
 
-// run the user interface with the give callbacks
+// run the user interface with the give callbacks. If the idle callback is
+// set, the window blocks waiting for events while idle, instead of redrawing
+// at every vsync.
 void show_gui_window(const vec2i& size, const string& title,
     const gui_callbacks& callbaks, int widgets_width = 320,
     bool widgets_left = true);
 
+// wake up an idle window; safe to call from any thread, e.g. from render
+// workers when new samples are ready
+void wakeup_gui_window();
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -451,6 +451,17 @@ struct vec4b {
   const byte& operator[](int i) const;
 };
 
+// Half float storage. See float_to_half() and half_to_float() for conversions.
+struct vec4h {
+  ushort x = 0;
+  ushort y = 0;
+  ushort z = 0;
+  ushort w = 0;
+
+  ushort&       operator[](int i);
+  const ushort& operator[](int i) const;
+};
+
 // Zero vector constants.
 inline const auto zero2i = vec2i{0, 0};
 inline const auto zero3i = vec3i{0, 0, 0};
@@ -1901,6 +1912,10 @@ inline const int& vec4i::operator[](int i) const { return (&x)[i]; }
 inline byte& vec4b::operator[](int i) { return (&x)[i]; }
 inline const byte& vec4b::operator[](int i) const { return (&x)[i]; }
 
+// Vector data types
+inline ushort& vec4h::operator[](int i) { return (&x)[i]; }
+inline const ushort& vec4h::operator[](int i) const { return (&x)[i]; }
+
 // Element access
 inline vec3i xyz(const vec4i& a) { return {a.x, a.y, a.z}; }
 
@@ -113,6 +113,10 @@ vec4f lookup_texture(
   auto color = vec4f{0, 0, 0, 0};
   if (!texture.pixelsf.empty()) {
     color = texture.pixelsf[j * texture.width + i];
+  } else if (!texture.pixelsh.empty()) {
+    color = half_to_float(texture.pixelsh[j * texture.width + i]);
+  } else if (!texture.pixelse.empty()) {
+    color = rgb9e5_to_float(texture.pixelse[j * texture.width + i]);
   } else {
     color = byte_to_float(texture.pixelsb[j * texture.width + i]);
   }
@@ -179,6 +183,35 @@ texture_data image_to_texture(const image_data& image) {
   return texture;
 }
 
+// conversion between storages
+void convert_texture(texture_data& texture, texture_storage storage) {
+  if (!texture.pixelsb.empty()) return;
+  // decode to floats first
+  if (!texture.pixelsh.empty()) {
+    texture.pixelsf.resize(texture.pixelsh.size());
+    for (auto idx : range(texture.pixelsh.size()))
+      texture.pixelsf[idx] = half_to_float(texture.pixelsh[idx]);
+    texture.pixelsh = {};
+  } else if (!texture.pixelse.empty()) {
+    texture.pixelsf.resize(texture.pixelse.size());
+    for (auto idx : range(texture.pixelse.size()))
+      texture.pixelsf[idx] = rgb9e5_to_float(texture.pixelse[idx]);
+    texture.pixelse = {};
+  }
+  // encode to the requested storage
+  if (storage == texture_storage::float16) {
+    texture.pixelsh.resize(texture.pixelsf.size());
+    for (auto idx : range(texture.pixelsf.size()))
+      texture.pixelsh[idx] = float_to_half(texture.pixelsf[idx]);
+    texture.pixelsf = {};
+  } else if (storage == texture_storage::rgb9e5) {
+    texture.pixelse.resize(texture.pixelsf.size());
+    for (auto idx : range(texture.pixelsf.size()))
+      texture.pixelse[idx] = float_to_rgb9e5(texture.pixelsf[idx]);
+    texture.pixelsf = {};
+  }
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -329,6 +362,8 @@ vec3f eval_element_normal(
 vec3f eval_normal(const scene_data& scene, const instance_data& instance,
     int element, const vec2f& uv) {
   auto& shape = scene.shapes[instance.shape];
+  if (!shape.normalso.empty())
+    return transform_normal(instance.frame, eval_normal(shape, element, uv));
   if (shape.normals.empty())
     return eval_element_normal(scene, instance, element);
   if (!shape.triangles.empty()) {
@@ -358,6 +393,7 @@ vec3f eval_normal(const scene_data& scene, const instance_data& instance,
 vec2f eval_texcoord(const scene_data& scene, const instance_data& instance,
     int element, const vec2f& uv) {
   auto& shape = scene.shapes[instance.shape];
+  if (!shape.texcoordsu.empty()) return eval_texcoord(shape, element, uv);
   if (shape.texcoords.empty()) return uv;
   if (!shape.triangles.empty()) {
     auto t = shape.triangles[element];
@@ -412,20 +448,21 @@ static pair<vec3f, vec3f> eval_tangents(
 // Shape element normal.
 pair<vec3f, vec3f> eval_element_tangents(
     const scene_data& scene, const instance_data& instance, int element) {
-  auto& shape = scene.shapes[instance.shape];
-  if (!shape.triangles.empty() && !shape.texcoords.empty()) {
+  auto& shape         = scene.shapes[instance.shape];
+  auto  has_texcoords = !shape.texcoords.empty() || !shape.texcoordsu.empty();
+  if (!shape.triangles.empty() && has_texcoords) {
     auto t        = shape.triangles[element];
     auto [tu, tv] = triangle_tangents_fromuv(shape.positions[t.x],
-        shape.positions[t.y], shape.positions[t.z], shape.texcoords[t.x],
-        shape.texcoords[t.y], shape.texcoords[t.z]);
+        shape.positions[t.y], shape.positions[t.z], get_texcoord(shape, t.x),
+        get_texcoord(shape, t.y), get_texcoord(shape, t.z));
     return {transform_direction(instance.frame, tu),
         transform_direction(instance.frame, tv)};
-  } else if (!shape.quads.empty() && !shape.texcoords.empty()) {
+  } else if (!shape.quads.empty() && has_texcoords) {
     auto q        = shape.quads[element];
     auto [tu, tv] = quad_tangents_fromuv(shape.positions[q.x],
         shape.positions[q.y], shape.positions[q.z], shape.positions[q.w],
-        shape.texcoords[q.x], shape.texcoords[q.y], shape.texcoords[q.z],
-        shape.texcoords[q.w], {0, 0});
+        get_texcoord(shape, q.x), get_texcoord(shape, q.y),
+        get_texcoord(shape, q.z), get_texcoord(shape, q.w), {0, 0});
     return {transform_direction(instance.frame, tu),
         transform_direction(instance.frame, tv)};
   } else {
@@ -498,6 +535,7 @@ vec3f eval_shading_normal(const scene_data& scene,
 vec4f eval_color(const scene_data& scene, const instance_data& instance,
     int element, const vec2f& uv) {
   auto& shape = scene.shapes[instance.shape];
+  if (!shape.colorsb.empty()) return eval_color(shape, element, uv);
   if (shape.colors.empty()) return {1, 1, 1, 1};
   if (!shape.triangles.empty()) {
     auto t = shape.triangles[element];
@@ -738,7 +776,8 @@ void tesselate_subdiv(
       }
     }
     if (subdiv.smooth) {
-      subdiv.normals   = quads_normals(subdiv.quadspos, subdiv.positions);
+      subdiv.normals   = quads_normals_parallel(
+          subdiv.quadspos, subdiv.positions);
       subdiv.quadsnorm = subdiv.quadspos;
     } else {
       subdiv.normals   = {};
@@ -765,13 +804,14 @@ void tesselate_subdiv(
         count[qpos[i]] += 1;
       }
     }
-    auto normals = quads_normals(subdiv.quadspos, subdiv.positions);
+    auto normals = quads_normals_parallel(subdiv.quadspos, subdiv.positions);
     for (auto vid = 0; vid < subdiv.positions.size(); vid++) {
       subdiv.positions[vid] += normals[vid] * offset[vid] / (float)count[vid];
     }
     if (subdiv.smooth || !subdiv.normals.empty()) {
       subdiv.quadsnorm = subdiv.quadspos;
-      subdiv.normals   = quads_normals(subdiv.quadspos, subdiv.positions);
+      subdiv.normals   = quads_normals_parallel(
+          subdiv.quadspos, subdiv.positions);
     }
   }
 
@@ -788,6 +828,47 @@ void tesselate_subdivs(scene_data& scene) {
   }
 }
 
+void simplify_shapes(scene_data& scene, int camera_, int resolution,
+    float max_pixels, bool noparallel) {
+  // size of a pixel at unit distance, or everywhere for orthographic cameras
+  auto& camera     = scene.cameras[camera_];
+  auto  pixel_size = camera.film / camera.lens / resolution;
+
+  // error allowed for each shape by its closest instance
+  auto shape_bbox   = vector<bbox3f>(scene.shapes.size());
+  auto shape_errors = vector<float>(scene.shapes.size(), 0);
+  for (auto shape : range(scene.shapes.size())) {
+    for (auto p : scene.shapes[shape].positions)
+      shape_bbox[shape] = merge(shape_bbox[shape], p);
+  }
+  auto shape_instanced = vector<bool>(scene.shapes.size(), false);
+  for (auto& instance : scene.instances) {
+    auto bbox    = transform_bbox(instance.frame, shape_bbox[instance.shape]);
+    auto closest = min(max(camera.frame.o, bbox.min), bbox.max);
+    auto depth   = camera.orthographic ? 1.0f
+                                       : distance(camera.frame.o, closest);
+    auto scale   = max(length(instance.frame.x),
+        max(length(instance.frame.y), length(instance.frame.z)));
+    auto  error       = max_pixels * pixel_size * depth / scale;
+    auto& shape_error = shape_errors[instance.shape];
+    shape_error       = shape_instanced[instance.shape]
+                            ? min(shape_error, error)
+                            : error;
+    shape_instanced[instance.shape] = true;
+  }
+
+  // simplify shapes, keeping the original when nothing is removed
+  for (auto shape_id : range(scene.shapes.size())) {
+    auto& shape = scene.shapes[shape_id];
+    if (!shape_instanced[shape_id] || shape_errors[shape_id] <= 0) continue;
+    auto num_triangles = shape.triangles.size() + 2 * shape.quads.size();
+    auto simplified    = simplify_shape_clusters(
+        shape, 0, shape_errors[shape_id], false, 65536, noparallel);
+    if (simplified.triangles.size() < num_triangles)
+      shape = std::move(simplified);
+  }
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -823,7 +904,11 @@ size_t compute_memory(const scene_data& scene) {
     memory += vector_memory(shape.normals);
     memory += vector_memory(shape.texcoords);
     memory += vector_memory(shape.colors);
-    memory += vector_memory(shape.triangles);
+    memory += vector_memory(shape.radius);
+    memory += vector_memory(shape.tangents);
+    memory += vector_memory(shape.normalso);
+    memory += vector_memory(shape.texcoordsu);
+    memory += vector_memory(shape.colorsb);
   }
   for (auto& subdiv : scene.subdivs) {
     memory += vector_memory(subdiv.quadspos);
@@ -836,6 +921,8 @@ size_t compute_memory(const scene_data& scene) {
   for (auto& texture : scene.textures) {
     memory += vector_memory(texture.pixelsb);
     memory += vector_memory(texture.pixelsf);
+    memory += vector_memory(texture.pixelsh);
+    memory += vector_memory(texture.pixelse);
   }
   return memory;
 }
@@ -849,7 +936,9 @@ vector<string> scene_stats(const scene_data& scene, bool verbose) {
   auto format = [](size_t num) {
     auto str = string{};
     while (num > 0) {
-      str = std::to_string(num % 1000) + (str.empty() ? "" : ",") + str;
+      auto group = std::to_string(num % 1000);
+      if (num >= 1000) group = string(3 - group.size(), '0') + group;
+      str = group + (str.empty() ? "" : ",") + str;
       num /= 1000;
     }
     if (str.empty()) str = "0";
@@ -874,6 +963,8 @@ vector<string> scene_stats(const scene_data& scene, bool verbose) {
   stats.push_back("environments: " + format(scene.environments.size()));
   stats.push_back("textures:     " + format(scene.textures.size()));
   stats.push_back("memory:       " + format(compute_memory(scene)));
+  stats.push_back("dupmemory:    " + format(scene.deduplicated_memory));
+  stats.push_back("dupelements:  " + format(scene.deduplicated_elements));
   stats.push_back(
       "points:       " + format(accumulate(scene.shapes,
                              [](auto& shape) { return shape.points.size(); })));
@@ -895,6 +986,12 @@ vector<string> scene_stats(const scene_data& scene, bool verbose) {
   stats.push_back("texels4f:     " +
                   format(accumulate(scene.textures,
                       [](auto& texture) { return texture.pixelsf.size(); })));
+  stats.push_back("texels4h:     " +
+                  format(accumulate(scene.textures,
+                      [](auto& texture) { return texture.pixelsh.size(); })));
+  stats.push_back("texels9e5:    " +
+                  format(accumulate(scene.textures,
+                      [](auto& texture) { return texture.pixelse.size(); })));
   stats.push_back("center:       " + format3(center(bbox)));
   stats.push_back("size:         " + format3(size(bbox)));
 
@@ -919,7 +1016,8 @@ vector<string> scene_validation(const scene_data& scene, bool notextures) {
   auto check_empty_textures = [&errs](const scene_data& scene) {
     for (auto idx = 0; idx < (int)scene.textures.size(); idx++) {
       auto& texture = scene.textures[idx];
-      if (texture.pixelsf.empty() && texture.pixelsb.empty()) {
+      if (texture.pixelsf.empty() && texture.pixelsb.empty() &&
+          texture.pixelsh.empty() && texture.pixelse.empty()) {
         errs.push_back("empty texture " + scene.texture_names[idx]);
       }
     }
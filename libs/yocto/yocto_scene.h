@@ -39,6 +39,7 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -55,6 +56,7 @@ namespace yocto {
 // using directives
 using std::pair;
 using std::string;
+using std::unordered_map;
 using std::vector;
 
 }  // namespace yocto
@@ -91,15 +93,27 @@ struct camera_data {
 };
 
 // Texture data as array of float or byte pixels. Textures can be stored in
-// linear or non linear color space.
+// linear or non linear color space. Linear textures may instead be stored
+// compactly as half floats or as shared exponent RGB9E5, in which case only
+// one of pixelsh and pixelse is set.
 struct texture_data {
   int           width   = 0;
   int           height  = 0;
   bool          linear  = false;
   vector<vec4f> pixelsf = {};
   vector<vec4b> pixelsb = {};
+  vector<vec4h> pixelsh = {};
+  vector<uint>  pixelse = {};
 };
 
+// Storage for linear textures: 16 bytes per texel for floats, 8 for half
+// floats and 4 for RGB9E5, which also drops alpha.
+enum struct texture_storage { float32, float16, rgb9e5 };
+
+// Enum labels
+inline const auto texture_storage_names = std::vector<std::string>{
+    "float32", "float16", "rgb9e5"};
+
 // Material type
 enum struct material_type {
   // clang-format off
@@ -180,6 +194,12 @@ struct subdiv_data {
   int shape = invalidid;
 };
 
+// Content hash and modification time of an asset file when last loaded.
+struct asset_state {
+  uint64_t hash = 0;
+  int64_t  time = 0;
+};
+
 // Scene comprised an array of objects whose memory is owened by the scene.
 // All members are optional,Scene objects (camera, instances, environments)
 // have transforms defined internally. A scene can optionally contain a
@@ -208,6 +228,14 @@ struct scene_data {
 
   // copyright info preserve in IO
   string copyright = "";
+
+  // memory and shape elements of the duplicates removed when loading
+  size_t deduplicated_memory   = 0;
+  size_t deduplicated_elements = 0;
+
+  // shape and texture files as loaded, indexed by path, used to skip
+  // rewriting unchanged assets when saving
+  unordered_map<string, asset_state> asset_states = {};
 };
 
 }  // namespace yocto
@@ -243,6 +271,9 @@ vec4f lookup_texture(
 // conversion from image
 texture_data image_to_texture(const image_data& image);
 
+// Converts the storage of linear textures. Byte textures are left unchanged.
+void convert_texture(texture_data& texture, texture_storage storage);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -362,6 +393,12 @@ namespace yocto {
 // Apply subdivision and displacement rules.
 void tesselate_subdivs(scene_data& scene);
 
+// Simplify shapes to the level of detail needed by their closest instance,
+// as seen from a camera at the given resolution, so that their geometric
+// error stays within max_pixels on screen.
+void simplify_shapes(scene_data& scene, int camera, int resolution,
+    float max_pixels = 0.5f, bool noparallel = false);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -53,6 +53,10 @@
 #include "yocto_shading.h"
 #include "yocto_shape.h"
 
+// zlib compression of stb_image_write, defined but not declared by its header
+extern "C" unsigned char* stbi_zlib_compress(
+    unsigned char* data, int data_len, int* out_len, int quality);
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
@@ -314,6 +318,47 @@ bool save_binary(
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// ATOMIC SAVING AND HASHING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Save a file through a temporary that replaces it once fully written
+bool save_atomic(const string& filename, string& error,
+    const std::function<bool(const string& tempname, string& error)>& save) {
+  auto tempname = path_join(path_dirname(filename),
+      "." + path_basename(filename) + ".tmp" + path_extension(filename));
+  auto ec       = std::error_code{};
+  if (!save(tempname, error)) {
+    std::filesystem::remove(make_path(tempname), ec);
+    return false;
+  }
+  std::filesystem::rename(make_path(tempname), make_path(filename), ec);
+  if (ec) {
+    std::filesystem::remove(make_path(tempname), ec);
+    error = "cannot write " + filename;
+    return false;
+  }
+  return true;
+}
+
+// Hash bytes into a running hash, a word at a time
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+  auto mix = [](uint64_t hash, uint64_t word) {
+    return ((hash << 5 | hash >> 59) ^ word) * 0x9e3779b97f4a7c15ull;
+  };
+  auto bytes = (const byte*)data;
+  hash       = mix(hash, size);
+  for (auto offset = (size_t)0; offset < size; offset += 8) {
+    auto word = (uint64_t)0;
+    memcpy(&word, bytes + offset, std::min((size_t)8, size - offset));
+    hash = mix(hash, word);
+  }
+  return hash;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // JSON SUPPORT
 // -----------------------------------------------------------------------------
@@ -628,6 +673,206 @@ bool save_image(
   }
 }
 
+// Build a palette of at most 256 colors, and the palette index of each pixel,
+// so that every pixel is replaced by a color within max_error of it in each
+// channel. Colors are visited from the most to the least frequent, and
+// become palette entries unless an entry is close enough, so that flat areas
+// keep their colors exactly and antialiased edges share nearby entries.
+// Returns false if more than 256 colors are needed.
+static bool make_png_palette(const vector<vec4b>& pixels, int max_error,
+    vector<vec4b>& palette, vector<byte>& indices, bool noparallel) {
+  auto key = [](vec4b c) {
+    return (uint32_t)c.x | ((uint32_t)c.y << 8) | ((uint32_t)c.z << 16) |
+           ((uint32_t)c.w << 24);
+  };
+  auto color = [](uint32_t k) {
+    return vec4b{(byte)k, (byte)(k >> 8), (byte)(k >> 16), (byte)(k >> 24)};
+  };
+
+  // count colors, by chunks of pixels
+  auto chunk_size = (size_t)65536;
+  auto num_chunks = (pixels.size() + chunk_size - 1) / chunk_size;
+  auto counts     = vector<std::unordered_map<uint32_t, int>>(num_chunks);
+  auto count      = [&](size_t chunk, string&) {
+    auto& chunk_counts = counts[chunk];
+    auto  end = std::min(pixels.size(), (chunk + 1) * chunk_size);
+    for (auto idx : range(chunk * chunk_size, end))
+      chunk_counts[key(pixels[idx])] += 1;
+    return true;
+  };
+  auto error = string{};
+  if (noparallel) {
+    for (auto chunk : range(num_chunks)) count(chunk, error);
+  } else {
+    parallel_for(num_chunks, error, count);
+  }
+  auto colors = std::unordered_map<uint32_t, int>{};
+  for (auto& chunk_counts : counts) {
+    for (auto& [k, n] : chunk_counts) colors[k] += n;
+  }
+  counts.clear();
+
+  // pick palette entries greedily
+  auto sorted = vector<pair<int, uint32_t>>{};
+  sorted.reserve(colors.size());
+  for (auto& [k, n] : colors) sorted.push_back({-n, k});
+  std::sort(sorted.begin(), sorted.end());
+  auto distance = [](vec4b a, vec4b b) {
+    auto d = 0;
+    for (auto c : range(4)) d = std::max(d, std::abs((int)a[c] - (int)b[c]));
+    return d;
+  };
+  auto nearest = [&](vec4b c) {
+    auto best = pair<int, int>{INT_MAX, -1};
+    for (auto entry : range((int)palette.size())) {
+      auto d = distance(c, palette[entry]);
+      if (d < best.first) best = {d, entry};
+      if (d == 0) break;
+    }
+    return best;
+  };
+  palette.clear();
+  for (auto& [n, k] : sorted) {
+    if (nearest(color(k)).first <= max_error) continue;
+    if (palette.size() == 256) return false;
+    palette.push_back(color(k));
+  }
+
+  // translucent entries first, to shorten the transparency chunk
+  std::stable_partition(palette.begin(), palette.end(),
+      [](vec4b c) { return c.w != 255; });
+
+  // map colors to their nearest entry, and pixels to their color entry
+  auto entries = std::unordered_map<uint32_t, byte>{};
+  for (auto& [n, k] : sorted) entries[k] = (byte)nearest(color(k)).second;
+  indices.resize(pixels.size());
+  auto index = [&](size_t chunk, string&) {
+    auto end = std::min(pixels.size(), (chunk + 1) * chunk_size);
+    for (auto idx : range(chunk * chunk_size, end))
+      indices[idx] = entries.at(key(pixels[idx]));
+    return true;
+  };
+  if (noparallel) {
+    for (auto chunk : range(num_chunks)) index(chunk, error);
+  } else {
+    parallel_for(num_chunks, error, index);
+  }
+  return true;
+}
+
+// Crc of PNG chunks
+static uint32_t png_crc(const byte* data, size_t size, uint32_t crc) {
+  static const auto table = []() {
+    auto table = std::array<uint32_t, 256>{};
+    for (auto n : range(256u)) {
+      auto c = n;
+      for (auto k = 0; k < 8; k++)
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+    return table;
+  }();
+  crc = ~crc;
+  for (auto idx : range(size))
+    crc = table[(crc ^ data[idx]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+// Pack the rows of an indexed PNG, most significant bits first, each after
+// its filter type. Rows are left unfiltered, as the PNG spec suggests for
+// palette images, since residuals of indices are not smaller than indices,
+// and filtering compresses diagrams worse.
+static vector<byte> pack_png_rows(const vector<byte>& indices, int width,
+    int height, int depth, bool noparallel) {
+  auto row_size = (size_t)(width * depth + 7) / 8 + 1;
+  auto rows     = vector<byte>(row_size * height, 0);
+  auto pack     = [&](size_t j, string&) {
+    auto row = rows.data() + j * row_size + 1;
+    for (auto i : range(width)) {
+      auto value = indices[j * width + i];
+      auto bit   = i * depth;
+      row[bit / 8] |= (byte)(value << (8 - depth - bit % 8));
+    }
+    return true;
+  };
+  auto error = string{};
+  if (noparallel) {
+    for (auto j : range((size_t)height)) pack(j, error);
+  } else {
+    parallel_for((size_t)height, error, pack);
+  }
+  return rows;
+}
+
+// Saves an image as a palette-indexed PNG, or as in save_image if its colors
+// do not fit a palette.
+bool save_indexed_png(const string& filename, const image_data& image,
+    int max_error, string& error, bool noparallel) {
+  auto ext = path_extension(filename);
+  if (ext != ".png" && ext != ".PNG") return save_image(filename, image, error);
+
+  // 8-bit colors, as written by save_image
+  auto pixels = vector<vec4b>(image.pixels.size());
+  if (image.linear) {
+    rgb_to_srgb(pixels, image.pixels);
+  } else {
+    float_to_byte(pixels, image.pixels);
+  }
+
+  // palette
+  auto palette = vector<vec4b>{};
+  auto indices = vector<byte>{};
+  if (!make_png_palette(pixels, max_error, palette, indices, noparallel))
+    return save_image(filename, image, error);
+  auto depth = palette.size() <= 2    ? 1
+               : palette.size() <= 4  ? 2
+               : palette.size() <= 16 ? 4
+                                      : 8;
+
+  // compressed rows
+  auto rows       = pack_png_rows(
+      indices, image.width, image.height, depth, noparallel);
+  auto size       = 0;
+  auto compressed = stbi_zlib_compress(
+      rows.data(), (int)rows.size(), &size, stbi_write_png_compression_level);
+  if (compressed == nullptr) {
+    error = "cannot write " + filename;
+    return false;
+  }
+
+  // chunks
+  auto buffer = vector<byte>{137, 80, 78, 71, 13, 10, 26, 10};
+  auto add_uint = [&buffer](uint32_t value) {
+    for (auto shift : {24, 16, 8, 0}) buffer.push_back((byte)(value >> shift));
+  };
+  auto add_chunk = [&](const char* type, const byte* data, size_t size) {
+    add_uint((uint32_t)size);
+    auto start = buffer.size();
+    buffer.insert(buffer.end(), type, type + 4);
+    buffer.insert(buffer.end(), data, data + size);
+    add_uint(png_crc(buffer.data() + start, buffer.size() - start, 0));
+  };
+  auto header = vector<byte>{};
+  for (auto value : {image.width, image.height}) {
+    for (auto shift : {24, 16, 8, 0}) header.push_back((byte)(value >> shift));
+  }
+  header.insert(header.end(), {(byte)depth, 3, 0, 0, 0});
+  add_chunk("IHDR", header.data(), header.size());
+  auto colors = vector<byte>{};
+  auto alphas = vector<byte>{};
+  for (auto& entry : palette) {
+    colors.insert(colors.end(), {entry.x, entry.y, entry.z});
+    if (entry.w != 255) alphas.push_back(entry.w);
+  }
+  add_chunk("PLTE", colors.data(), colors.size());
+  if (!alphas.empty()) add_chunk("tRNS", alphas.data(), alphas.size());
+  add_chunk("IDAT", compressed, size);
+  add_chunk("IEND", nullptr, 0);
+  free(compressed);
+
+  return save_binary(filename, buffer, error);
+}
+
 image_data make_image_preset(const string& type_) {
   auto type  = path_basename(type_);
   auto width = 1024, height = 1024;
@@ -773,6 +1018,12 @@ void save_image(const string& filename, const image_data& image) {
   auto error = string{};
   if (!save_image(filename, image, error)) throw io_error{error};
 }
+void save_indexed_png(const string& filename, const image_data& image,
+    int max_error, bool noparallel) {
+  auto error = string{};
+  if (!save_indexed_png(filename, image, max_error, error, noparallel))
+    throw io_error{error};
+}
 
 bool make_image_preset(
     const string& filename, image_data& image, string& error) {
@@ -991,6 +1242,14 @@ bool save_shape(const string& filename, const shape_data& shape, string& error,
     return false;
   };
 
+  // compact storage is written as floats
+  if (!shape.normalso.empty() || !shape.texcoordsu.empty() ||
+      !shape.colorsb.empty()) {
+    auto shapef = shape;
+    convert_shape(shapef, shape_storage::float32);
+    return save_shape(filename, shapef, error, flip_texcoord, ascii);
+  }
+
   auto ext = path_extension(filename);
   if (ext == ".ply" || ext == ".PLY") {
     auto ply = ply_model{};
@@ -1707,8 +1966,8 @@ bool make_fvshape_preset(
 namespace yocto {
 
 // Loads/saves an image. Chooses hdr or ldr based on file name.
-bool load_texture(
-    const string& filename, texture_data& texture, string& error) {
+bool load_texture(const string& filename, texture_data& texture, string& error,
+    texture_storage storage) {
   auto read_error = [&]() {
     error = "cannot raed " + filename;
     return false;
@@ -1724,6 +1983,7 @@ bool load_texture(
     texture.pixelsf = vector<vec4f>{
         (vec4f*)pixels, (vec4f*)pixels + texture.width * texture.height};
     free(pixels);
+    convert_texture(texture, storage);
     return true;
   } else if (ext == ".hdr" || ext == ".HDR") {
     auto buffer = vector<byte>{};
@@ -1736,6 +1996,7 @@ bool load_texture(
     texture.pixelsf = vector<vec4f>{
         (vec4f*)pixels, (vec4f*)pixels + texture.width * texture.height};
     free(pixels);
+    convert_texture(texture, storage);
     return true;
   } else if (ext == ".png" || ext == ".PNG") {
     auto buffer = vector<byte>{};
@@ -1788,6 +2049,7 @@ bool load_texture(
     return true;
   } else if (ext == ".ypreset" || ext == ".YPRESET") {
     if (!make_texture_preset(filename, texture, error)) return false;
+    convert_texture(texture, storage);
     return true;
   } else {
     error = "unsupported format " + filename;
@@ -1803,6 +2065,13 @@ bool save_texture(
     return false;
   };
 
+  // compact storage is written as floats
+  if (!texture.pixelsh.empty() || !texture.pixelse.empty()) {
+    auto texturef = texture;
+    convert_texture(texturef, texture_storage::float32);
+    return save_texture(filename, texturef, error);
+  }
+
   // check for correct handling
   if (!texture.pixelsf.empty() && is_ldr_filename(filename))
     throw std::invalid_argument(
@@ -1877,15 +2146,16 @@ texture_data make_texture_preset(const string& type) {
 }
 
 // Loads/saves an image. Chooses hdr or ldr based on file name.
-texture_data load_texture(const string& filename) {
+texture_data load_texture(const string& filename, texture_storage storage) {
   auto error   = string{};
   auto texture = texture_data{};
-  if (!load_texture(filename, texture, error)) throw io_error{error};
+  if (!load_texture(filename, texture, error, storage)) throw io_error{error};
   return texture;
 }
-void load_texture(const string& filename, texture_data& texture) {
+void load_texture(
+    const string& filename, texture_data& texture, texture_storage storage) {
   auto error = string{};
-  if (!load_texture(filename, texture, error)) throw io_error{error};
+  if (!load_texture(filename, texture, error, storage)) throw io_error{error};
 }
 void save_texture(const string& filename, const texture_data& texture) {
   auto error = string{};
@@ -2086,6 +2356,8 @@ static void trim_memory(scene_data& scene) {
   for (auto& texture : scene.textures) {
     texture.pixelsf.shrink_to_fit();
     texture.pixelsb.shrink_to_fit();
+    texture.pixelsh.shrink_to_fit();
+    texture.pixelse.shrink_to_fit();
   }
   scene.cameras.shrink_to_fit();
   scene.shapes.shrink_to_fit();
@@ -2597,71 +2869,590 @@ bool make_scene_preset(
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// SCENE DEDUPLICATION
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Compare the bytes of two arrays
+template <typename T>
+static bool same_values(const vector<T>& values1, const vector<T>& values2) {
+  return values1.size() == values2.size() &&
+         (values1.empty() || memcmp(values1.data(), values2.data(),
+                                 values1.size() * sizeof(T)) == 0);
+}
+
+// Shape and texture payloads
+uint64_t hash_shape(const shape_data& shape) {
+  auto hash = (uint64_t)0;
+  hash      = hash_values(hash, shape.points);
+  hash      = hash_values(hash, shape.lines);
+  hash      = hash_values(hash, shape.triangles);
+  hash      = hash_values(hash, shape.quads);
+  hash      = hash_values(hash, shape.positions);
+  hash      = hash_values(hash, shape.normals);
+  hash      = hash_values(hash, shape.texcoords);
+  hash      = hash_values(hash, shape.colors);
+  hash      = hash_values(hash, shape.radius);
+  hash      = hash_values(hash, shape.tangents);
+  hash      = hash_values(hash, shape.normalso);
+  hash      = hash_values(hash, shape.texcoordsu);
+  hash      = hash_values(hash, shape.colorsb);
+  hash      = hash_value(hash, shape.texcoords_range);
+  return hash;
+}
+static bool same_shape(const shape_data& shape1, const shape_data& shape2) {
+  return same_values(shape1.points, shape2.points) &&
+         same_values(shape1.lines, shape2.lines) &&
+         same_values(shape1.triangles, shape2.triangles) &&
+         same_values(shape1.quads, shape2.quads) &&
+         same_values(shape1.positions, shape2.positions) &&
+         same_values(shape1.normals, shape2.normals) &&
+         same_values(shape1.texcoords, shape2.texcoords) &&
+         same_values(shape1.colors, shape2.colors) &&
+         same_values(shape1.radius, shape2.radius) &&
+         same_values(shape1.tangents, shape2.tangents) &&
+         same_values(shape1.normalso, shape2.normalso) &&
+         same_values(shape1.texcoordsu, shape2.texcoordsu) &&
+         same_values(shape1.colorsb, shape2.colorsb) &&
+         shape1.texcoords_range == shape2.texcoords_range;
+}
+uint64_t hash_texture(const texture_data& texture) {
+  auto hash = (uint64_t)0;
+  hash      = hash_value(hash, texture.width);
+  hash      = hash_value(hash, texture.height);
+  hash      = hash_value(hash, texture.linear);
+  hash = hash_values(hash, texture.pixelsf);
+  hash = hash_values(hash, texture.pixelsb);
+  hash = hash_values(hash, texture.pixelsh);
+  hash = hash_values(hash, texture.pixelse);
+  return hash;
+}
+static bool same_texture(
+    const texture_data& texture1, const texture_data& texture2) {
+  return texture1.width == texture2.width &&
+         texture1.height == texture2.height &&
+         texture1.linear == texture2.linear &&
+         same_values(texture1.pixelsf, texture2.pixelsf) &&
+         same_values(texture1.pixelsb, texture2.pixelsb) &&
+         same_values(texture1.pixelsh, texture2.pixelsh) &&
+         same_values(texture1.pixelse, texture2.pixelse);
+}
+
+// Memory and elements of shapes and textures
+static size_t shape_memory(const shape_data& shape) {
+  return shape.points.size() * sizeof(int) +
+         shape.lines.size() * sizeof(vec2i) +
+         shape.triangles.size() * sizeof(vec3i) +
+         shape.quads.size() * sizeof(vec4i) +
+         shape.positions.size() * sizeof(vec3f) +
+         shape.normals.size() * sizeof(vec3f) +
+         shape.texcoords.size() * sizeof(vec2f) +
+         shape.colors.size() * sizeof(vec4f) +
+         shape.radius.size() * sizeof(float) +
+         shape.tangents.size() * sizeof(vec4f) +
+         shape.normalso.size() * sizeof(uint) +
+         shape.texcoordsu.size() * sizeof(uint) +
+         shape.colorsb.size() * sizeof(vec4b);
+}
+static size_t shape_elements(const shape_data& shape) {
+  return shape.points.size() + shape.lines.size() + shape.triangles.size() +
+         shape.quads.size();
+}
+static size_t texture_memory(const texture_data& texture) {
+  return texture.pixelsf.size() * sizeof(vec4f) +
+         texture.pixelsb.size() * sizeof(vec4b) +
+         texture.pixelsh.size() * sizeof(vec4h) +
+         texture.pixelse.size() * sizeof(uint);
+}
+
+// Find the first copy of each value, comparing values with equal hashes.
+// Values that cannot be shared are mapped to themselves.
+template <typename T, typename Same>
+static vector<int> find_duplicates(const vector<T>& values,
+    const vector<uint64_t>& hashes, const vector<bool>& shareable,
+    Same&& same) {
+  auto firsts = vector<int>(values.size());
+  auto copies = unordered_map<uint64_t, vector<int>>{};
+  for (auto idx : range((int)values.size())) {
+    firsts[idx] = idx;
+    if (!shareable[idx]) continue;
+    auto& candidates = copies[hashes[idx]];
+    for (auto candidate : candidates) {
+      if (same(values[candidate], values[idx])) {
+        firsts[idx] = candidate;
+        break;
+      }
+    }
+    if (firsts[idx] == idx) candidates.push_back(idx);
+  }
+  return firsts;
+}
+
+// Remove duplicates from values and names, and return the map from old to
+// new indices
+template <typename T>
+static vector<int> remove_duplicates(
+    vector<T>& values, vector<string>& names, const vector<int>& firsts) {
+  auto remap = vector<int>(values.size());
+  auto kept  = 0;
+  for (auto idx : range((int)values.size())) {
+    if (firsts[idx] != idx) {
+      remap[idx] = remap[firsts[idx]];
+      continue;
+    }
+    remap[idx] = kept;
+    if (kept != idx) {
+      values[kept] = std::move(values[idx]);
+      if (idx < (int)names.size()) names[kept] = std::move(names[idx]);
+    }
+    kept += 1;
+  }
+  values.resize(kept);
+  if ((int)names.size() > kept) names.resize(kept);
+  return remap;
+}
+
+// Alias byte-identical shapes, and textures if requested
+static void deduplicate_scene(
+    scene_data& scene, bool noparallel, bool textures) {
+  // hash payloads
+  auto shape_hashes   = vector<uint64_t>(scene.shapes.size());
+  auto texture_hashes = vector<uint64_t>(scene.textures.size());
+  if (noparallel) {
+    for (auto idx : range(scene.shapes.size()))
+      shape_hashes[idx] = hash_shape(scene.shapes[idx]);
+    if (textures) {
+      for (auto idx : range(scene.textures.size()))
+        texture_hashes[idx] = hash_texture(scene.textures[idx]);
+    }
+  } else {
+    auto error = string{};
+    parallel_for(scene.shapes.size(), error, [&](size_t idx, string&) {
+      shape_hashes[idx] = hash_shape(scene.shapes[idx]);
+      return true;
+    });
+    if (textures) {
+      parallel_for(scene.textures.size(), error, [&](size_t idx, string&) {
+        texture_hashes[idx] = hash_texture(scene.textures[idx]);
+        return true;
+      });
+    }
+  }
+
+  // shapes overwritten by subdivs are never shared
+  auto shareable_shapes = vector<bool>(scene.shapes.size(), true);
+  for (auto& subdiv : scene.subdivs) {
+    if (subdiv.shape != invalidid) shareable_shapes[subdiv.shape] = false;
+  }
+  auto shareable_textures = vector<bool>(scene.textures.size(), textures);
+
+  // find duplicates
+  auto shape_firsts   = find_duplicates(scene.shapes, shape_hashes,
+      shareable_shapes, same_shape);
+  auto texture_firsts = find_duplicates(scene.textures, texture_hashes,
+      shareable_textures, same_texture);
+  for (auto idx : range((int)scene.shapes.size())) {
+    if (shape_firsts[idx] == idx) continue;
+    scene.deduplicated_memory += shape_memory(scene.shapes[idx]);
+    scene.deduplicated_elements += shape_elements(scene.shapes[idx]);
+  }
+  for (auto idx : range((int)scene.textures.size())) {
+    if (texture_firsts[idx] == idx) continue;
+    scene.deduplicated_memory += texture_memory(scene.textures[idx]);
+  }
+
+  // remove duplicates and rewrite references
+  auto shape_remap = remove_duplicates(
+      scene.shapes, scene.shape_names, shape_firsts);
+  auto texture_remap = remove_duplicates(
+      scene.textures, scene.texture_names, texture_firsts);
+  auto remap_texture = [&texture_remap](int& texture) {
+    if (texture != invalidid) texture = texture_remap[texture];
+  };
+  auto remap_shape = [&shape_remap](int& shape) {
+    if (shape != invalidid) shape = shape_remap[shape];
+  };
+  for (auto& instance : scene.instances) {
+    remap_shape(instance.shape);
+  }
+  for (auto& subdiv : scene.subdivs) {
+    remap_shape(subdiv.shape);
+    remap_texture(subdiv.displacement_tex);
+  }
+  for (auto& material : scene.materials) {
+    remap_texture(material.emission_tex);
+    remap_texture(material.color_tex);
+    remap_texture(material.roughness_tex);
+    remap_texture(material.scattering_tex);
+    remap_texture(material.normal_tex);
+  }
+  for (auto& environment : scene.environments) {
+    remap_texture(environment.emission_tex);
+  }
+}
+
+// Alias byte-identical shapes and textures
+void deduplicate_scene(scene_data& scene, bool noparallel) {
+  deduplicate_scene(scene, noparallel, true);
+}
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// INCREMENTAL SCENE SAVING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Modification time of a file, or 0 if missing
+static int64_t file_time(const string& filename) {
+  auto ec   = std::error_code{};
+  auto time = std::filesystem::last_write_time(make_path(filename), ec);
+  if (ec) return 0;
+  return (int64_t)time.time_since_epoch().count();
+}
+
+// Record hashes and times of the loaded shape and texture files
+static void record_asset_states(scene_data& scene,
+    const vector<string>& shape_filenames,
+    const vector<string>& texture_filenames, bool noparallel) {
+  auto shape_hashes   = vector<uint64_t>(scene.shapes.size());
+  auto texture_hashes = vector<uint64_t>(scene.textures.size());
+  if (noparallel) {
+    for (auto idx : range(scene.shapes.size()))
+      shape_hashes[idx] = hash_shape(scene.shapes[idx]);
+    for (auto idx : range(scene.textures.size()))
+      texture_hashes[idx] = hash_texture(scene.textures[idx]);
+  } else {
+    auto error = string{};
+    parallel_for(scene.shapes.size(), error, [&](size_t idx, string&) {
+      shape_hashes[idx] = hash_shape(scene.shapes[idx]);
+      return true;
+    });
+    parallel_for(scene.textures.size(), error, [&](size_t idx, string&) {
+      texture_hashes[idx] = hash_texture(scene.textures[idx]);
+      return true;
+    });
+  }
+  scene.asset_states.clear();
+  for (auto idx : range(scene.shapes.size())) {
+    auto& filename               = shape_filenames[idx];
+    scene.asset_states[filename] = {shape_hashes[idx], file_time(filename)};
+  }
+  for (auto idx : range(scene.textures.size())) {
+    auto& filename               = texture_filenames[idx];
+    scene.asset_states[filename] = {texture_hashes[idx], file_time(filename)};
+  }
+}
+
+// Check whether an asset file holds the same data as when it was loaded
+static bool is_asset_unchanged(
+    const scene_data& scene, const string& filename, uint64_t hash) {
+  auto it = scene.asset_states.find(filename);
+  if (it == scene.asset_states.end()) return false;
+  return it->second.hash == hash && it->second.time != 0 &&
+         it->second.time == file_time(filename);
+}
+
+// Save a shape unless unchanged since loaded
+static bool save_scene_shape(const string& filename, const scene_data& scene,
+    const shape_data& shape, string& error) {
+  if (is_asset_unchanged(scene, filename, hash_shape(shape))) return true;
+  return save_atomic(
+      filename, error, [&](const string& tempname, string& error) {
+        return save_shape(tempname, shape, error, true);
+      });
+}
+
+// Save a texture unless unchanged since loaded
+static bool save_scene_texture(const string& filename, const scene_data& scene,
+    const texture_data& texture, string& error) {
+  if (is_asset_unchanged(scene, filename, hash_texture(texture))) return true;
+  return save_atomic(
+      filename, error, [&](const string& tempname, string& error) {
+        return save_texture(tempname, texture, error);
+      });
+}
+
+// Save a subdiv, always rewritten since subdivs are not recorded
+static bool save_scene_subdiv(
+    const string& filename, const subdiv_data& subdiv, string& error) {
+  return save_atomic(
+      filename, error, [&](const string& tempname, string& error) {
+        return save_subdiv(tempname, subdiv, error);
+      });
+}
+
+// Save a text file unless its contents are the same
+static bool save_scene_text(
+    const string& filename, const string& text, string& error) {
+  auto current = string{};
+  auto ignored = string{};
+  if (path_exists(filename) && load_text(filename, current, ignored) &&
+      current == text)
+    return true;
+  return save_atomic(
+      filename, error, [&](const string& tempname, string& error) {
+        return save_text(tempname, text, error);
+      });
+}
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// TEXTURE STREAMING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Load a scene texture, or queue it to the stream if any
+static bool load_scene_texture(const string& filename, scene_data& scene,
+    texture_data& texture, string& error, texture_storage storage,
+    texture_stream* stream) {
+  if (stream == nullptr) return load_texture(filename, texture, error, storage);
+  auto lock = std::lock_guard{stream->mutex};
+  stream->filenames.resize(scene.textures.size());
+  stream->filenames[&texture - scene.textures.data()] = filename;
+  return true;
+}
+
+// Size of a file, or 0 if missing
+static uintmax_t file_size(const string& filename) {
+  auto ec   = std::error_code{};
+  auto size = std::filesystem::file_size(make_path(filename), ec);
+  if (ec) return 0;
+  return size;
+}
+
+// Replace the queued textures with proxies and start decoding them
+static void start_streamed_textures(texture_stream& stream, scene_data& scene,
+    texture_storage storage, bool noparallel) {
+  stream.filenames.resize(scene.textures.size());
+  stream.landed.assign(scene.textures.size(), {});
+  stream.hashes.assign(scene.textures.size(), 0);
+  stream.storage = storage;
+
+  // proxies are single texels that are neutral for colors and normals
+  auto normals = vector<bool>(scene.textures.size(), false);
+  for (auto& material : scene.materials) {
+    if (material.normal_tex != invalidid) normals[material.normal_tex] = true;
+  }
+  for (auto idx : range((int)scene.textures.size())) {
+    if (stream.filenames[idx].empty()) continue;
+    auto texel = normals[idx] ? vec4b{128, 128, 255, 255}
+                              : vec4b{255, 255, 255, 255};
+    scene.textures[idx] = texture_data{1, 1, false, {}, {texel}};
+    stream.order.push_back(idx);
+  }
+
+  // decode from the smallest file to the largest
+  auto sizes = vector<uintmax_t>(scene.textures.size(), 0);
+  for (auto idx : stream.order) sizes[idx] = file_size(stream.filenames[idx]);
+  std::stable_sort(stream.order.begin(), stream.order.end(),
+      [&sizes](int a, int b) { return sizes[a] < sizes[b]; });
+  stream.pending = (int)stream.order.size();
+  if (stream.order.empty()) return;
+
+  // decoding threads
+  auto decode = [&stream]() {
+    while (!stream.stop) {
+      auto next = stream.next.fetch_add(1);
+      if (next >= (int)stream.order.size()) break;
+      auto idx     = stream.order[next];
+      auto texture = texture_data{};
+      auto error   = string{};
+      auto ok      = load_texture(
+          stream.filenames[idx], texture, error, stream.storage);
+      auto hash   = ok ? hash_texture(texture) : (uint64_t)0;
+      auto notify = std::function<void()>{};
+      {
+        auto lock = std::lock_guard{stream.mutex};
+        if (ok) {
+          stream.landed[idx] = std::move(texture);
+          stream.hashes[idx] = hash;
+          stream.ready.push_back(idx);
+        } else {
+          stream.pending -= 1;
+          if (stream.error.empty()) stream.error = error;
+        }
+        notify = stream.notify;
+      }
+      if (notify) notify();
+    }
+  };
+  auto nthreads = noparallel ? 1u : std::thread::hardware_concurrency();
+  nthreads      = std::clamp(nthreads, 1u, (uint)stream.order.size());
+  for (auto thread = 0u; thread < nthreads; thread++) {
+    stream.workers.push_back(std::async(std::launch::async, decode));
+  }
+}
+
+// Swap landed textures into the scene
+vector<int> update_streamed_textures(
+    texture_stream& stream, scene_data& scene) {
+  auto lock    = std::lock_guard{stream.mutex};
+  auto updated = vector<int>{};
+  std::swap(updated, stream.ready);
+  for (auto idx : updated) {
+    scene.textures[idx] = std::move(stream.landed[idx]);
+    stream.landed[idx]  = {};
+    auto& filename      = stream.filenames[idx];
+    auto  it            = scene.asset_states.find(filename);
+    if (it != scene.asset_states.end()) {
+      it->second = {stream.hashes[idx], file_time(filename)};
+    }
+  }
+  stream.pending -= (int)updated.size();
+  return updated;
+}
+
+// Number of textures not yet swapped into the scene
+int pending_streamed_textures(texture_stream& stream) {
+  auto lock = std::lock_guard{stream.mutex};
+  return stream.pending;
+}
+
+// Wait for all textures and swap them into the scene
+bool finish_streamed_textures(
+    texture_stream& stream, scene_data& scene, string& error) {
+  for (auto& worker : stream.workers) worker.get();
+  stream.workers.clear();
+  update_streamed_textures(stream, scene);
+  auto lock = std::lock_guard{stream.mutex};
+  if (!stream.error.empty()) {
+    error = stream.error;
+    return false;
+  }
+  return true;
+}
+
+// Stop decoding
+void stop_streamed_textures(texture_stream& stream) {
+  stream.stop = true;
+  for (auto& worker : stream.workers) worker.get();
+  stream.workers.clear();
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // GENERIC SCENE LOADING
 // -----------------------------------------------------------------------------
 namespace yocto {
 
 // Load/save a scene in the builtin JSON format.
-static bool load_json_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel);
+static bool load_json_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage,
+    texture_stream* stream);
 static bool save_json_scene(const string& filename, const scene_data& scene,
     string& error, bool noparallel);
 
 // Load/save a scene from/to OBJ.
-static bool load_obj_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel);
+static bool load_obj_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage,
+    texture_stream* stream);
 static bool save_obj_scene(const string& filename, const scene_data& scene,
     string& error, bool noparallel);
 
 // Load/save a scene from/to PLY. Loads/saves only one mesh with no other data.
-static bool load_ply_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel);
+static bool load_ply_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage);
 static bool save_ply_scene(const string& filename, const scene_data& scene,
     string& error, bool noparallel);
 
 // Load/save a scene from/to STL. Loads/saves only one mesh with no other data.
-static bool load_stl_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel);
+static bool load_stl_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage);
 static bool save_stl_scene(const string& filename, const scene_data& scene,
     string& error, bool noparallel);
 
 // Load/save a scene from/to glTF.
-static bool load_gltf_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel);
+static bool load_gltf_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage,
+    texture_stream* stream);
 static bool save_gltf_scene(const string& filename, const scene_data& scene,
     string& error, bool noparallel);
 
 // Load/save a scene from/to pbrt-> This is not robust at all and only
 // works on scene that have been previously adapted since the two renderers
 // are too different to match.
-static bool load_pbrt_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel);
+static bool load_pbrt_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage,
+    texture_stream* stream);
 static bool save_pbrt_scene(const string& filename, const scene_data& scene,
     string& error, bool noparallel);
 
-// Load a scene
-bool load_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel) {
-  auto ext = path_extension(filename);
+// Load a scene, queuing its textures to the stream if any
+static bool load_scene(const string& filename, scene_data& scene,
+    string& error, const scene_load_params& params, texture_stream* stream) {
+  auto noparallel = params.noparallel;
+  auto storage    = params.storage;
+  auto ordering   = params.ordering;
+  auto ext        = path_extension(filename);
+  auto ok  = false;
   if (ext == ".json" || ext == ".JSON") {
-    return load_json_scene(filename, scene, error, noparallel);
+    ok = load_json_scene(
+        filename, scene, error, noparallel, storage, stream);
   } else if (ext == ".obj" || ext == ".OBJ") {
-    return load_obj_scene(filename, scene, error, noparallel);
+    ok = load_obj_scene(
+        filename, scene, error, noparallel, storage, stream);
   } else if (ext == ".gltf" || ext == ".GLTF") {
-    return load_gltf_scene(filename, scene, error, noparallel);
+    ok = load_gltf_scene(
+        filename, scene, error, noparallel, storage, stream);
   } else if (ext == ".pbrt" || ext == ".PBRT") {
-    return load_pbrt_scene(filename, scene, error, noparallel);
+    ok = load_pbrt_scene(
+        filename, scene, error, noparallel, storage, stream);
   } else if (ext == ".ply" || ext == ".PLY") {
-    return load_ply_scene(filename, scene, error, noparallel);
+    ok = load_ply_scene(filename, scene, error, noparallel, storage);
   } else if (ext == ".stl" || ext == ".STL") {
-    return load_stl_scene(filename, scene, error, noparallel);
+    ok = load_stl_scene(filename, scene, error, noparallel, storage);
   } else if (ext == ".ypreset" || ext == ".YPRESET") {
-    return make_scene_preset(filename, scene, error);
+    ok = make_scene_preset(filename, scene, error);
+    if (ok)
+      for (auto& texture : scene.textures) convert_texture(texture, storage);
   } else {
     error = "unsupported format " + filename;
     return false;
   }
+  if (!ok) return false;
+
+  // alias duplicates
+  if (params.deduplicate)
+    deduplicate_scene(scene, noparallel, stream == nullptr);
+
+  // reorder shapes
+  if (ordering != shape_ordering::none) {
+    if (noparallel) {
+      for (auto& shape : scene.shapes) shape = reorder_shape(shape, ordering);
+    } else {
+      parallel_foreach(scene.shapes, error, [&](auto& shape, string& error) {
+        shape = reorder_shape(shape, ordering);
+        return true;
+      });
+    }
+  }
+
+  // compact vertex data
+  if (params.vertex_storage != shape_storage::float32) {
+    for (auto& shape : scene.shapes)
+      convert_shape(shape, params.vertex_storage);
+  }
+
+  // start streaming textures
+  if (stream != nullptr)
+    start_streamed_textures(*stream, scene, storage, noparallel);
+  return true;
+}
+
+// Load a scene
+bool load_scene(const string& filename, scene_data& scene, string& error,
+    const scene_load_params& params) {
+  return load_scene(filename, scene, error, params, nullptr);
+}
+
+// Load a scene streaming its textures
+bool load_scene(const string& filename, scene_data& scene,
+    texture_stream& stream, string& error, const scene_load_params& params) {
+  return load_scene(filename, scene, error, params, &stream);
 }
 
 // Save a scene
@@ -2687,15 +3478,16 @@ bool save_scene(const string& filename, const scene_data& scene, string& error,
 }
 
 // Load/save a scene
-scene_data load_scene(const string& filename, bool noparallel) {
+scene_data load_scene(const string& filename, const scene_load_params& params) {
   auto error = string{};
   auto scene = scene_data{};
-  if (!load_scene(filename, scene, error, noparallel)) throw io_error{error};
+  if (!load_scene(filename, scene, error, params)) throw io_error{error};
   return scene;
 }
-void load_scene(const string& filename, scene_data& scene, bool noparallel) {
+void load_scene(const string& filename, scene_data& scene,
+    const scene_load_params& params) {
   auto error = string{};
-  if (!load_scene(filename, scene, error, noparallel)) throw io_error{error};
+  if (!load_scene(filename, scene, error, params)) throw io_error{error};
 }
 void save_scene(
     const string& filename, const scene_data& scene, bool noparallel) {
@@ -2902,7 +3694,8 @@ NLOHMANN_JSON_SERIALIZE_ENUM(
 
 // Load a scene in the builtin JSON format.
 static bool load_json_scene_version40(const string& filename,
-    const json_value& json, scene_data& scene, string& error, bool noparallel) {
+    const json_value& json, scene_data& scene, string& error, bool noparallel,
+    texture_storage storage, texture_stream* stream) {
   auto parse_error = [filename, &error](const string& patha,
                          const string& pathb = "", const string& pathc = "") {
     auto path = patha;
@@ -3166,7 +3959,8 @@ static bool load_json_scene_version40(const string& filename,
     for (auto& texture : scene.textures) {
       auto path = find_path(get_texture_name(scene, texture), "textures",
           {".hdr", ".exr", ".png", ".jpg"});
-      if (!load_texture(path_join(dirname, path), texture, error))
+      if (!load_scene_texture(path_join(dirname, path), scene, texture, error,
+              storage, stream))
         return dependent_error();
     }
     // load instances
@@ -3197,7 +3991,8 @@ static bool load_json_scene_version40(const string& filename,
             scene.textures, error, [&](auto& texture, string& error) {
               auto path = find_path(get_texture_name(scene, texture),
                   "textures", {".hdr", ".exr", ".png", ".jpg"});
-              return load_texture(path_join(dirname, path), texture, error);
+              return load_scene_texture(path_join(dirname, path), scene,
+                  texture, error, storage, stream);
             }))
       return dependent_error();
     // load instances
@@ -3253,10 +4048,12 @@ static bool load_json_scene_version40(const string& filename,
 
 // Load a scene in the builtin JSON format.
 static bool load_json_scene_version41(const string& filename, json_value& json,
-    scene_data& scene, string& error, bool noparallel) {
+    scene_data& scene, string& error, bool noparallel,
+    texture_storage storage, texture_stream* stream) {
   // check version
   if (!json.contains("asset") || !json.at("asset").contains("version"))
-    return load_json_scene_version40(filename, json, scene, error, noparallel);
+    return load_json_scene_version40(
+        filename, json, scene, error, noparallel, storage, stream);
 
   // parse json value
   auto get_opt = [](const json_value& json, const string& key, auto& value) {
@@ -3457,7 +4254,8 @@ static bool load_json_scene_version41(const string& filename, json_value& json,
     }
     // load textures
     for (auto idx : range(scene.textures.size())) {
-      if (!load_texture(texture_filenames[idx], scene.textures[idx], error))
+      if (!load_scene_texture(texture_filenames[idx], scene,
+              scene.textures[idx], error, storage, stream))
         return dependent_error();
     }
   } else {
@@ -3478,8 +4276,8 @@ static bool load_json_scene_version41(const string& filename, json_value& json,
     // load textures
     if (!parallel_for(
             scene.textures.size(), error, [&](size_t idx, string& error) {
-              return load_texture(
-                  texture_filenames[idx], scene.textures[idx], error);
+              return load_scene_texture(texture_filenames[idx], scene,
+                  scene.textures[idx], error, storage, stream);
             }))
       return dependent_error();
   }
@@ -3494,18 +4292,21 @@ static bool load_json_scene_version41(const string& filename, json_value& json,
 }
 
 // Load a scene in the builtin JSON format.
-static bool load_json_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel) {
+static bool load_json_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage,
+    texture_stream* stream) {
   // open file
   auto json = json_value{};
   if (!load_json(filename, json, error)) return false;
 
   // check version
   if (!json.contains("asset") || !json.at("asset").contains("version"))
-    return load_json_scene_version40(filename, json, scene, error, noparallel);
+    return load_json_scene_version40(
+        filename, json, scene, error, noparallel, storage, stream);
   if (json.contains("asset") && json.at("asset").contains("version") &&
       json.at("asset").at("version") == "4.1")
-    return load_json_scene_version41(filename, json, scene, error, noparallel);
+    return load_json_scene_version41(
+        filename, json, scene, error, noparallel, storage, stream);
 
   // parse json value
   auto get_opt = [](const json_value& json, const string& key, auto& value) {
@@ -3672,8 +4473,8 @@ static bool load_json_scene(
     }
     // load textures
     for (auto idx : range(scene.textures.size())) {
-      if (!load_texture(path_join(dirname, texture_filenames[idx]),
-              scene.textures[idx], error))
+      if (!load_scene_texture(path_join(dirname, texture_filenames[idx]),
+              scene, scene.textures[idx], error, storage, stream))
         return dependent_error();
     }
   } else {
@@ -3694,8 +4495,9 @@ static bool load_json_scene(
     // load textures
     if (!parallel_for(
             scene.textures.size(), error, [&](size_t idx, string& error) {
-              return load_texture(path_join(dirname, texture_filenames[idx]),
-                  scene.textures[idx], error);
+              return load_scene_texture(
+                  path_join(dirname, texture_filenames[idx]), scene,
+                  scene.textures[idx], error, storage, stream);
             }))
       return dependent_error();
   }
@@ -3705,6 +4507,13 @@ static bool load_json_scene(
   add_missing_radius(scene);
   trim_memory(scene);
 
+  // record loaded assets
+  for (auto& datafile : shape_filenames)
+    datafile = path_join(dirname, datafile);
+  for (auto& datafile : texture_filenames)
+    datafile = path_join(dirname, datafile);
+  record_asset_states(scene, shape_filenames, texture_filenames, noparallel);
+
   // done
   return true;
 }
@@ -3748,7 +4557,7 @@ static bool save_json_scene(const string& filename, const scene_data& scene,
   auto get_filename = [](const vector<string>& names, size_t idx,
                           const string& basename,
                           const string& extension) -> string {
-    if (idx < names.size()) {
+    if (idx < names.size() && !names[idx].empty()) {
       return basename + "s/" + names[idx] + extension;
     } else {
       return basename + "s/" + basename + std::to_string(idx) + extension;
@@ -3765,7 +4574,7 @@ static bool save_json_scene(const string& filename, const scene_data& scene,
   }
   for (auto idx : range(texture_filenames.size())) {
     texture_filenames[idx] = get_filename(scene.texture_names, idx, "texture",
-        (scene.textures[idx].pixelsf.empty() ? ".png" : ".hdr"));
+        (!scene.textures[idx].pixelsb.empty() ? ".png" : ".hdr"));
   }
   for (auto idx : range(subdiv_filenames.size())) {
     subdiv_filenames[idx] = get_filename(
@@ -3900,7 +4709,7 @@ static bool save_json_scene(const string& filename, const scene_data& scene,
   }
 
   // save json
-  if (!save_json(filename, json, error)) return false;
+  if (!save_scene_text(filename, json.dump(2), error)) return false;
 
   // prepare data
   auto dirname         = path_dirname(filename);
@@ -3909,44 +4718,46 @@ static bool save_json_scene(const string& filename, const scene_data& scene,
     return false;
   };
 
-  // dirname
+  // save resources, skipping the shapes and textures unchanged since loaded
   if (noparallel) {
     // save shapes
     for (auto idx : range(scene.shapes.size())) {
-      if (!save_shape(path_join(dirname, shape_filenames[idx]),
-              scene.shapes[idx], error, true))
+      if (!save_scene_shape(path_join(dirname, shape_filenames[idx]), scene,
+              scene.shapes[idx], error))
         return dependent_error();
     }
     // save subdiv
     for (auto idx : range(scene.subdivs.size())) {
-      if (!save_subdiv(path_join(dirname, subdiv_filenames[idx]),
+      if (!save_scene_subdiv(path_join(dirname, subdiv_filenames[idx]),
               scene.subdivs[idx], error))
         return dependent_error();
     }
     // save textures
     for (auto idx : range(scene.textures.size())) {
-      if (!save_texture(path_join(dirname, texture_filenames[idx]),
-              scene.textures[idx], error))
+      if (!save_scene_texture(path_join(dirname, texture_filenames[idx]),
+              scene, scene.textures[idx], error))
         return dependent_error();
     }
   } else {
     // save shapes
     if (!parallel_for(scene.shapes.size(), error, [&](auto idx, string& error) {
-          return save_shape(path_join(dirname, shape_filenames[idx]),
-              scene.shapes[idx], error, true);
+          return save_scene_shape(path_join(dirname, shape_filenames[idx]),
+              scene, scene.shapes[idx], error);
         }))
       return dependent_error();
     // save subdivs
     if (!parallel_for(
             scene.subdivs.size(), error, [&](auto idx, string& error) {
-              return save_subdiv(path_join(dirname, subdiv_filenames[idx]),
+              return save_scene_subdiv(
+                  path_join(dirname, subdiv_filenames[idx]),
                   scene.subdivs[idx], error);
             }))
       return dependent_error();
     // save textures
     if (!parallel_for(
             scene.textures.size(), error, [&](auto idx, string& error) {
-              return save_texture(path_join(dirname, texture_filenames[idx]),
+              return save_scene_texture(
+                  path_join(dirname, texture_filenames[idx]), scene,
                   scene.textures[idx], error);
             }))
       return dependent_error();
@@ -3964,8 +4775,9 @@ static bool save_json_scene(const string& filename, const scene_data& scene,
 namespace yocto {
 
 // Loads an OBJ
-static bool load_obj_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel) {
+static bool load_obj_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage,
+    texture_stream* stream) {
   // load obj
   auto obj = obj_model{};
   if (!load_obj(filename, obj, error, false, true)) return false;
@@ -4078,7 +4890,8 @@ static bool load_obj_scene(
     // load textures
     for (auto& texture : scene.textures) {
       auto& path = texture_paths[&texture - &scene.textures.front()];
-      if (!load_texture(path_join(dirname, path), texture, error))
+      if (!load_scene_texture(path_join(dirname, path), scene, texture, error,
+              storage, stream))
         return dependent_error();
     }
   } else {
@@ -4086,7 +4899,8 @@ static bool load_obj_scene(
     if (!parallel_foreach(
             scene.textures, error, [&](auto& texture, string& error) {
               auto& path = texture_paths[&texture - &scene.textures.front()];
-              return load_texture(path_join(dirname, path), texture, error);
+              return load_scene_texture(path_join(dirname, path), scene,
+                  texture, error, storage, stream);
             }))
       return dependent_error();
   }
@@ -4128,7 +4942,7 @@ static bool save_obj_scene(const string& filename, const scene_data& scene,
   for (auto& texture : scene.textures) {
     auto& otexture = obj.textures.emplace_back();
     otexture.path  = "textures/" + get_texture_name(scene, texture) +
-                    (!texture.pixelsf.empty() ? ".hdr"s : ".png"s);
+                    (texture.pixelsb.empty() ? ".hdr"s : ".png"s);
   }
 
   // convert materials
@@ -4191,7 +5005,7 @@ static bool save_obj_scene(const string& filename, const scene_data& scene,
     // save textures
     for (auto& texture : scene.textures) {
       auto path = "textures/" + get_texture_name(scene, texture) +
-                  (!texture.pixelsf.empty() ? ".hdr"s : ".png"s);
+                  (texture.pixelsb.empty() ? ".hdr"s : ".png"s);
       if (!save_texture(path_join(dirname, path), texture, error))
         return dependent_error();
     }
@@ -4200,7 +5014,7 @@ static bool save_obj_scene(const string& filename, const scene_data& scene,
     if (!parallel_foreach(
             scene.textures, error, [&](auto& texture, string& error) {
               auto path = "textures/" + get_texture_name(scene, texture) +
-                          (!texture.pixelsf.empty() ? ".hdr"s : ".png"s);
+                          (texture.pixelsb.empty() ? ".hdr"s : ".png"s);
               return save_texture(path_join(dirname, path), texture, error);
             }))
       return dependent_error();
@@ -4217,8 +5031,8 @@ static bool save_obj_scene(const string& filename, const scene_data& scene,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-static bool load_ply_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel) {
+static bool load_ply_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage) {
   // load ply mesh and make instance
   auto shape = shape_data{};
   if (!load_shape(filename, shape, error, true)) return false;
@@ -4248,8 +5062,8 @@ static bool save_ply_scene(const string& filename, const scene_data& scene,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-static bool load_stl_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel) {
+static bool load_stl_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage) {
   // load ply mesh and make instance
   auto shape = shape_data{};
   if (!load_shape(filename, shape, error, true)) return false;
@@ -4279,8 +5093,9 @@ static bool save_stl_scene(const string& filename, const scene_data& scene,
 namespace yocto {
 
 // Load a scene
-static bool load_gltf_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel) {
+static bool load_gltf_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage,
+    texture_stream* stream) {
   // load gltf
   auto gltf = json_value{};
   if (!load_json(filename, gltf, error)) return false;
@@ -4724,7 +5539,8 @@ static bool load_gltf_scene(
     // load texture
     for (auto& texture : scene.textures) {
       auto& path = texture_paths[&texture - &scene.textures.front()];
-      if (!load_texture(path_join(dirname, path), texture, error))
+      if (!load_scene_texture(path_join(dirname, path), scene, texture, error,
+              storage, stream))
         return dependent_error();
     }
   } else {
@@ -4732,7 +5548,8 @@ static bool load_gltf_scene(
     if (!parallel_foreach(
             scene.textures, error, [&](auto& texture, string& error) {
               auto& path = texture_paths[&texture - &scene.textures.front()];
-              return load_texture(path_join(dirname, path), texture, error);
+              return load_scene_texture(path_join(dirname, path), scene,
+                  texture, error, storage, stream);
             }))
       return dependent_error();
   }
@@ -5063,7 +5880,7 @@ static bool save_gltf_scene(const string& filename, const scene_data& scene,
     // save textures
     for (auto& texture : scene.textures) {
       auto path = "textures/" + get_texture_name(scene, texture) +
-                  (!texture.pixelsf.empty() ? ".hdr" : ".png");
+                  (texture.pixelsb.empty() ? ".hdr" : ".png");
       if (!save_texture(path_join(dirname, path), texture, error))
         return dependent_error();
     }
@@ -5078,7 +5895,7 @@ static bool save_gltf_scene(const string& filename, const scene_data& scene,
     if (!parallel_foreach(
             scene.textures, error, [&](auto& texture, string& error) {
               auto path = "textures/" + get_texture_name(scene, texture) +
-                          (!texture.pixelsf.empty() ? ".hdr"s : ".png"s);
+                          (texture.pixelsb.empty() ? ".hdr"s : ".png"s);
               return save_texture(path_join(dirname, path), texture, error);
             }))
       return dependent_error();
@@ -5096,8 +5913,9 @@ static bool save_gltf_scene(const string& filename, const scene_data& scene,
 namespace yocto {
 
 // load pbrt scenes
-static bool load_pbrt_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel) {
+static bool load_pbrt_scene(const string& filename, scene_data& scene,
+    string& error, bool noparallel, texture_storage storage,
+    texture_stream* stream) {
   // load pbrt
   auto pbrt = pbrt_model{};
   if (!load_pbrt(filename, pbrt, error)) return false;
@@ -5210,7 +6028,8 @@ static bool load_pbrt_scene(
     // load texture
     for (auto& texture : scene.textures) {
       auto& path = texture_paths[&texture - &scene.textures.front()];
-      if (!load_texture(path_join(dirname, path), texture, error))
+      if (!load_scene_texture(path_join(dirname, path), scene, texture, error,
+              storage, stream))
         return dependent_error();
     }
   } else {
@@ -5225,7 +6044,8 @@ static bool load_pbrt_scene(
     if (!parallel_foreach(
             scene.textures, error, [&](auto& texture, string& error) {
               auto& path = texture_paths[&texture - &scene.textures.front()];
-              return load_texture(path_join(dirname, path), texture, error);
+              return load_scene_texture(path_join(dirname, path), scene,
+                  texture, error, storage, stream);
             }))
       return dependent_error();
   }
@@ -5256,7 +6076,7 @@ static bool save_pbrt_scene(const string& filename, const scene_data& scene,
   for (auto& texture : scene.textures) {
     auto& ptexture    = pbrt.textures.emplace_back();
     ptexture.filename = "textures/" + get_texture_name(scene, texture) +
-                        (!texture.pixelsf.empty() ? ".hdr" : ".png");
+                        (texture.pixelsb.empty() ? ".hdr" : ".png");
   }
 
   // material type map
@@ -5319,7 +6139,7 @@ static bool save_pbrt_scene(const string& filename, const scene_data& scene,
     // save shapes
     for (auto& texture : scene.textures) {
       auto path = "textures/" + get_texture_name(scene, texture) +
-                  (!texture.pixelsf.empty() ? ".hdr" : ".png");
+                  (texture.pixelsb.empty() ? ".hdr" : ".png");
       if (!save_texture(path_join(dirname, path), texture, error))
         return dependent_error();
     }
@@ -5334,7 +6154,7 @@ static bool save_pbrt_scene(const string& filename, const scene_data& scene,
     if (!parallel_foreach(
             scene.textures, error, [&](auto& texture, string& error) {
               auto path = "textures/" + get_texture_name(scene, texture) +
-                          (!texture.pixelsf.empty() ? ".hdr"s : ".png"s);
+                          (texture.pixelsb.empty() ? ".hdr"s : ".png"s);
               return save_texture(path_join(dirname, path), texture, error);
             }))
       return dependent_error();
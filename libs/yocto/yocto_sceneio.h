@@ -38,6 +38,10 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -85,6 +89,15 @@ image_data load_image(const string& filename);
 void       load_image(const string& filename, image_data& image);
 void       save_image(const string& filename, const image_data& image);
 
+// Saves an image as a palette-indexed PNG when its 8-bit colors can be
+// replaced by a palette of at most 256 colors, each within max_error, in
+// 8-bit units, of the colors it replaces in every channel. Images that need
+// larger palettes, or other formats, are saved as in save_image.
+bool save_indexed_png(const string& filename, const image_data& image,
+    int max_error, string& error, bool noparallel = false);
+void save_indexed_png(const string& filename, const image_data& image,
+    int max_error, bool noparallel = false);
+
 // Make presets. Supported mostly in IO.
 image_data make_image_preset(const string& type);
 
@@ -99,15 +112,19 @@ bool make_image_preset(
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Load/save a texture in the supported formats.
-bool load_texture(const string& filename, texture_data& texture, string& error);
+// Load/save a texture in the supported formats. Linear textures are stored
+// as set by storage, while byte textures are always loaded as bytes.
+bool load_texture(const string& filename, texture_data& texture, string& error,
+    texture_storage storage = texture_storage::float32);
 bool save_texture(
     const string& filename, const texture_data& texture, string& error);
 
 // Load/save a texture in the supported formats.
-texture_data load_texture(const string& filename);
-void         load_texture(const string& filename, texture_data& texture);
-void         save_texture(const string& filename, const texture_data& texture);
+texture_data load_texture(const string& filename,
+    texture_storage storage = texture_storage::float32);
+void load_texture(const string& filename, texture_data& texture,
+    texture_storage storage = texture_storage::float32);
+void save_texture(const string& filename, const texture_data& texture);
 
 // Make presets. Supported mostly in IO.
 texture_data make_texture_preset(const string& type);
@@ -182,9 +199,21 @@ void        save_subdiv(const string& filename, const subdiv_data& subdiv);
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Options for scene loading. Linear textures are loaded with storage, and
+// shapes are reordered with ordering. If deduplicate is set, byte-identical
+// shapes and textures are aliased. Shape normals, texcoords and colors are
+// stored with vertex_storage.
+struct scene_load_params {
+  texture_storage storage        = texture_storage::float32;
+  shape_ordering  ordering       = shape_ordering::none;
+  bool            deduplicate    = false;
+  shape_storage   vertex_storage = shape_storage::float32;
+  bool            noparallel     = false;
+};
+
 // Load/save a scene in the supported formats.
 bool load_scene(const string& filename, scene_data& scene, string& error,
-    bool noparallel = false);
+    const scene_load_params& params = {});
 bool save_scene(const string& filename, const scene_data& scene, string& error,
     bool noparallel = false);
 
@@ -195,10 +224,16 @@ bool make_scene_directories(
 // Add environment
 bool add_environment(scene_data& scene, const string& filename, string& error);
 
+// Alias shapes and textures whose payloads are byte-identical to earlier
+// ones, removing the copies and rewriting references to them. Shapes that
+// are tesselated from subdivs are kept. Payloads are hashed in parallel.
+void deduplicate_scene(scene_data& scene, bool noparallel = false);
+
 // Load/save a scene in the supported formats.
-scene_data load_scene(const string& filename, bool noparallel = false);
-void       load_scene(
-          const string& filename, scene_data& scene, bool noparallel = false);
+scene_data load_scene(
+    const string& filename, const scene_load_params& params = {});
+void load_scene(const string& filename, scene_data& scene,
+    const scene_load_params& params = {});
 void save_scene(
     const string& filename, const scene_data& scene, bool noparallel = false);
 
@@ -217,6 +252,63 @@ bool make_scene_preset(
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// TEXTURE STREAMING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Textures decoded by background threads after their scene is loaded. Until
+// they land, scene textures hold single-texel proxies that leave materials
+// unchanged, and landed textures are swapped into the scene, at full
+// resolution, by update_streamed_textures. Textures are decoded from the
+// smallest file to the largest, and notify is called by the decoding threads
+// each time one lands, e.g. to wake up a viewer. Scenes must not be saved
+// while their textures are streaming.
+struct texture_stream {
+  // queued textures
+  vector<string>  filenames = {};
+  vector<int>     order     = {};
+  texture_storage storage   = texture_storage::float32;
+
+  // decoded textures, guarded by the mutex
+  vector<texture_data>  landed  = {};
+  vector<uint64_t>      hashes  = {};
+  vector<int>           ready   = {};
+  int                   pending = 0;
+  string                error   = {};
+  std::function<void()> notify  = {};
+  std::mutex            mutex   = {};
+
+  // decoding threads, declared last to be joined first
+  std::atomic<int>          next    = 0;
+  std::atomic<bool>         stop    = false;
+  vector<std::future<void>> workers = {};
+};
+
+// Load a scene returning once its geometry is loaded, while its textures
+// are decoded in the background by the stream. Params are as in load_scene,
+// except that textures are never deduplicated.
+bool load_scene(const string& filename, scene_data& scene,
+    texture_stream& stream, string& error,
+    const scene_load_params& params = {});
+
+// Swap into the scene the textures that landed since the last call, and
+// return their indices.
+vector<int> update_streamed_textures(texture_stream& stream, scene_data& scene);
+
+// Number of textures not yet swapped into the scene.
+int pending_streamed_textures(texture_stream& stream);
+
+// Wait for all textures and swap them into the scene. Textures that failed
+// to load keep their proxies, and the first error is returned.
+bool finish_streamed_textures(
+    texture_stream& stream, scene_data& scene, string& error);
+
+// Stop decoding, discarding the textures that did not land yet.
+void stop_streamed_textures(texture_stream& stream);
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // FILE IO
 // -----------------------------------------------------------------------------
@@ -246,4 +338,32 @@ void         save_binary(const string& filename, const vector<byte>& data);
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// ATOMIC SAVING AND HASHING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Save a file by calling save on a temporary in the same directory, which
+// replaces the destination only once fully written.
+bool save_atomic(const string& filename, string& error,
+    const std::function<bool(const string& tempname, string& error)>& save);
+
+// Hash bytes into a running hash, a word at a time. Structs with padding
+// should be hashed by field.
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size);
+template <typename T>
+inline uint64_t hash_value(uint64_t hash, const T& value) {
+  return hash_bytes(hash, &value, sizeof(T));
+}
+template <typename T>
+inline uint64_t hash_values(uint64_t hash, const vector<T>& values) {
+  return hash_bytes(hash, values.data(), values.size() * sizeof(T));
+}
+
+// Hash the payloads of shapes and textures
+uint64_t hash_shape(const shape_data& shape);
+uint64_t hash_texture(const texture_data& texture);
+
+}  // namespace yocto
+
 #endif
@@ -33,11 +33,16 @@
 #include "yocto_shape.h"
 
 #include <algorithm>
+#include <atomic>
 #include <deque>
+#include <future>
 #include <memory>
+#include <queue>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
+#include "yocto_color.h"
 #include "yocto_geometry.h"
 #include "yocto_modelio.h"
 #include "yocto_noise.h"
@@ -54,11 +59,105 @@ using namespace std::string_literals;
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// PARALLEL HELPERS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Simple parallel for used since our target platforms do not yet support
+// parallel algorithms. `Func` takes the integer index.
+template <typename T, typename Func>
+inline void parallel_for(T num, Func&& func) {
+  auto              futures  = vector<std::future<void>>{};
+  auto              nthreads = std::thread::hardware_concurrency();
+  std::atomic<T>    next_idx(0);
+  std::atomic<bool> has_error(false);
+  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
+    futures.emplace_back(
+        std::async(std::launch::async, [&func, &next_idx, &has_error, num]() {
+          try {
+            while (true) {
+              auto idx = next_idx.fetch_add(1);
+              if (idx >= num) break;
+              if (has_error) break;
+              func(idx);
+            }
+          } catch (...) {
+            has_error = true;
+            throw;
+          }
+        }));
+  }
+  for (auto& f : futures) f.get();
+}
+
+// Simple parallel for over batches of indices, used for cheap per-index
+// work. `Func` takes the integer index.
+template <typename T, typename Func>
+inline void parallel_for_batch(T num, T batch, Func&& func) {
+  parallel_for((num + batch - 1) / batch, [&func, num, batch](T batch_idx) {
+    auto end = min(num, (batch_idx + 1) * batch);
+    for (auto idx = batch_idx * batch; idx < end; idx++) func(idx);
+  });
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION FO SHAPE PROPERTIES
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Vertex data that decodes the compact storage.
+vec3f get_normal(const shape_data& shape, int vertex) {
+  if (!shape.normalso.empty()) {
+    return octahedral_to_direction(shape.normalso[vertex]);
+  } else {
+    return shape.normals[vertex];
+  }
+}
+vec2f get_texcoord(const shape_data& shape, int vertex) {
+  if (!shape.texcoordsu.empty()) {
+    auto& range    = shape.texcoords_range;
+    auto  texcoord = shape.texcoordsu[vertex];
+    return range.min + vec2f{(texcoord & 0xffff) / 65535.0f,
+                           (texcoord >> 16) / 65535.0f} *
+                           (range.max - range.min);
+  } else {
+    return shape.texcoords[vertex];
+  }
+}
+vec4f get_color(const shape_data& shape, int vertex) {
+  if (!shape.colorsb.empty()) {
+    return byte_to_float(shape.colorsb[vertex]);
+  } else {
+    return shape.colors[vertex];
+  }
+}
+
+// Interpolate vertex data decoded by a function
+template <typename Func>
+static auto interpolate_vertices(const shape_data& shape, int element,
+    const vec2f& uv, Func&& vertex) -> decltype(vertex(0)) {
+  if (!shape.points.empty()) {
+    auto& point = shape.points[element];
+    return vertex(point);
+  } else if (!shape.lines.empty()) {
+    auto& line = shape.lines[element];
+    return interpolate_line(vertex(line.x), vertex(line.y), uv.x);
+  } else if (!shape.triangles.empty()) {
+    auto& triangle = shape.triangles[element];
+    return interpolate_triangle(
+        vertex(triangle.x), vertex(triangle.y), vertex(triangle.z), uv);
+  } else if (!shape.quads.empty()) {
+    auto& quad = shape.quads[element];
+    return interpolate_quad(vertex(quad.x), vertex(quad.y), vertex(quad.z),
+        vertex(quad.w), uv);
+  } else {
+    return {};
+  }
+}
+
 // Interpolate vertex data
 vec3f eval_position(const shape_data& shape, int element, const vec2f& uv) {
   if (!shape.points.empty()) {
@@ -82,6 +181,9 @@ vec3f eval_position(const shape_data& shape, int element, const vec2f& uv) {
 }
 
 vec3f eval_normal(const shape_data& shape, int element, const vec2f& uv) {
+  if (!shape.normalso.empty())
+    return normalize(interpolate_vertices(shape, element, uv,
+        [&shape](int vertex) { return get_normal(shape, vertex); }));
   if (shape.normals.empty()) return eval_element_normal(shape, element);
   if (!shape.points.empty()) {
     auto& point = shape.points[element];
@@ -109,6 +211,9 @@ vec3f eval_tangent(const shape_data& shape, int element, const vec2f& uv) {
 }
 
 vec2f eval_texcoord(const shape_data& shape, int element, const vec2f& uv) {
+  if (!shape.texcoordsu.empty())
+    return interpolate_vertices(shape, element, uv,
+        [&shape](int vertex) { return get_texcoord(shape, vertex); });
   if (shape.texcoords.empty()) return uv;
   if (!shape.points.empty()) {
     auto& point = shape.points[element];
@@ -131,6 +236,9 @@ vec2f eval_texcoord(const shape_data& shape, int element, const vec2f& uv) {
 }
 
 vec4f eval_color(const shape_data& shape, int element, const vec2f& uv) {
+  if (!shape.colorsb.empty())
+    return interpolate_vertices(shape, element, uv,
+        [&shape](int vertex) { return get_color(shape, vertex); });
   if (shape.colors.empty()) return {1, 1, 1, 1};
   if (!shape.points.empty()) {
     auto& point = shape.points[element];
@@ -295,6 +403,63 @@ void quads_to_triangles_inplace(shape_data& shape) {
   shape.quads     = {};
 }
 
+// Converts the storage of normals, texcoords and colors
+void convert_shape(shape_data& shape, shape_storage storage) {
+  // decode compact data
+  if (!shape.normalso.empty()) {
+    shape.normals.resize(shape.normalso.size());
+    for (auto idx : range((int)shape.normals.size()))
+      shape.normals[idx] = get_normal(shape, idx);
+    shape.normalso = {};
+  }
+  if (!shape.texcoordsu.empty()) {
+    shape.texcoords.resize(shape.texcoordsu.size());
+    for (auto idx : range((int)shape.texcoords.size()))
+      shape.texcoords[idx] = get_texcoord(shape, idx);
+    shape.texcoordsu      = {};
+    shape.texcoords_range = {};
+  }
+  if (!shape.colorsb.empty()) {
+    shape.colors.resize(shape.colorsb.size());
+    for (auto idx : range((int)shape.colors.size()))
+      shape.colors[idx] = get_color(shape, idx);
+    shape.colorsb = {};
+  }
+
+  // encode compact data
+  if (storage == shape_storage::compact) {
+    if (!shape.normals.empty()) {
+      shape.normalso.resize(shape.normals.size());
+      for (auto idx : range(shape.normals.size()))
+        shape.normalso[idx] = direction_to_octahedral(shape.normals[idx]);
+      shape.normals = {};
+    }
+    if (!shape.texcoords.empty()) {
+      auto bbox = invalidb2f;
+      for (auto& texcoord : shape.texcoords) bbox = merge(bbox, texcoord);
+      auto extent = bbox.max - bbox.min;
+      auto unorm  = [](float value, float extent) {
+        if (extent <= 0) return 0u;
+        return (uint)(clamp(value / extent, 0.0f, 1.0f) * 65535 + 0.5f);
+      };
+      shape.texcoordsu.resize(shape.texcoords.size());
+      for (auto idx : range(shape.texcoords.size())) {
+        auto texcoord = shape.texcoords[idx] - bbox.min;
+        shape.texcoordsu[idx] = unorm(texcoord.x, extent.x) |
+                                (unorm(texcoord.y, extent.y) << 16);
+      }
+      shape.texcoords       = {};
+      shape.texcoords_range = bbox;
+    }
+    if (!shape.colors.empty()) {
+      shape.colorsb.resize(shape.colors.size());
+      for (auto idx : range(shape.colors.size()))
+        shape.colorsb[idx] = float_to_byte(shape.colors[idx]);
+      shape.colors = {};
+    }
+  }
+}
+
 // Subdivision
 shape_data subdivide_shape(
     const shape_data& shape, int subdivisions, bool catmullclark) {
@@ -379,6 +544,9 @@ vector<string> shape_stats(const shape_data& shape, bool verbose) {
   stats.push_back("normals:      " + format(shape.normals.size()));
   stats.push_back("texcoords:    " + format(shape.texcoords.size()));
   stats.push_back("colors:       " + format(shape.colors.size()));
+  stats.push_back("normalso:     " + format(shape.normalso.size()));
+  stats.push_back("texcoordsu:   " + format(shape.texcoordsu.size()));
+  stats.push_back("colorsb:      " + format(shape.colorsb.size()));
   stats.push_back("radius:       " + format(shape.radius.size()));
   stats.push_back("center:       " + format3(center(bbox)));
   stats.push_back("size:         " + format3(size(bbox)));
@@ -1593,6 +1761,181 @@ vector<vec4f> triangles_tangent_spaces(const vector<vec3i>& triangles,
   return tangent_spaces;
 }
 
+// Vertices of an element that receive its values, where degenerate quads
+// skip their last vertex like the serial versions do.
+static int incident_vertices(const vec2i&) { return 2; }
+static int incident_vertices(const vec3i&) { return 3; }
+static int incident_vertices(const vec4i& quad) {
+  return quad.z == quad.w ? 3 : 4;
+}
+
+// Vertex to element incidence, stored as compressed rows of vertex and
+// element pairs for blocks of vertices. Within each block, elements are
+// listed in increasing order, so that gathers sum values in the same order
+// as the serial scatters.
+struct vertex_incidence {
+  int           block_size   = 4096;
+  vector<int>   block_starts = {};
+  vector<vec2i> entries      = {};
+};
+
+// Build a vertex to element incidence in parallel and without atomics, by
+// counting and then scattering chunks of elements into vertex blocks.
+template <typename T>
+static vertex_incidence make_vertex_incidence(
+    const vector<T>& elements, int num_vertices) {
+  auto incidence    = vertex_incidence{};
+  auto block_size   = incidence.block_size;
+  auto chunk_size   = 65536;
+  auto num_elements = (int)elements.size();
+  auto num_chunks   = (num_elements + chunk_size - 1) / chunk_size;
+  auto num_blocks   = (num_vertices + block_size - 1) / block_size;
+
+  // count block entries in each chunk
+  auto counts = vector<int>((size_t)num_chunks * num_blocks, 0);
+  parallel_for(num_chunks, [&](int chunk) {
+    auto chunk_counts = counts.data() + (size_t)chunk * num_blocks;
+    auto end          = min(num_elements, (chunk + 1) * chunk_size);
+    for (auto idx = chunk * chunk_size; idx < end; idx++)
+      for (auto k : range(incident_vertices(elements[idx])))
+        chunk_counts[elements[idx][k] / block_size] += 1;
+  });
+
+  // convert counts to starting positions, ordered by block and then chunk
+  auto& block_starts = incidence.block_starts;
+  block_starts.assign(num_blocks + 1, 0);
+  for (auto block : range(num_blocks)) {
+    block_starts[block + 1] = block_starts[block];
+    for (auto chunk : range(num_chunks)) {
+      auto& count = counts[(size_t)chunk * num_blocks + block];
+      auto  start = block_starts[block + 1];
+      block_starts[block + 1] += count;
+      count = start;
+    }
+  }
+
+  // scatter entries into blocks
+  auto& entries = incidence.entries;
+  entries.resize(block_starts.back());
+  parallel_for(num_chunks, [&](int chunk) {
+    auto chunk_starts = counts.data() + (size_t)chunk * num_blocks;
+    auto end          = min(num_elements, (chunk + 1) * chunk_size);
+    for (auto idx = chunk * chunk_size; idx < end; idx++) {
+      for (auto k : range(incident_vertices(elements[idx]))) {
+        auto vertex = elements[idx][k];
+        entries[chunk_starts[vertex / block_size]++] = {vertex, idx};
+      }
+    }
+  });
+
+  return incidence;
+}
+
+// Sum per-element values over incident vertices and normalize them
+static vector<vec3f> gather_normalized(const vertex_incidence& incidence,
+    const vector<vec3f>& values, int num_vertices) {
+  auto gathered   = vector<vec3f>(num_vertices, vec3f{0, 0, 0});
+  auto num_blocks = (int)incidence.block_starts.size() - 1;
+  parallel_for(num_blocks, [&](int block) {
+    auto begin = incidence.block_starts[block];
+    auto end   = incidence.block_starts[block + 1];
+    for (auto idx = begin; idx < end; idx++) {
+      auto [vertex, element] = incidence.entries[idx];
+      gathered[vertex] += values[element];
+    }
+    auto first = block * incidence.block_size;
+    auto last  = min(num_vertices, first + incidence.block_size);
+    for (auto vertex = first; vertex < last; vertex++)
+      gathered[vertex] = normalize(gathered[vertex]);
+  });
+  return gathered;
+}
+
+// Whether to gather in parallel. Building the incidence and gathering take
+// about three times the work of the serial scatters, so the serial versions
+// are used when fewer than four threads are available.
+static bool use_parallel_gather() {
+  return std::thread::hardware_concurrency() >= 4;
+}
+
+// Compute per-vertex tangents for lines in parallel.
+vector<vec3f> lines_tangents_parallel(
+    const vector<vec2i>& lines, const vector<vec3f>& positions) {
+  if (!use_parallel_gather()) return lines_tangents(lines, positions);
+  auto weighted = vector<vec3f>(lines.size());
+  parallel_for_batch((int)lines.size(), 4096, [&](int idx) {
+    auto& l       = lines[idx];
+    auto  tangent = line_tangent(positions[l.x], positions[l.y]);
+    auto  length  = line_length(positions[l.x], positions[l.y]);
+    weighted[idx] = tangent * length;
+  });
+  auto incidence = make_vertex_incidence(lines, (int)positions.size());
+  return gather_normalized(incidence, weighted, (int)positions.size());
+}
+
+// Compute per-vertex normals for triangles in parallel.
+vector<vec3f> triangles_normals_parallel(
+    const vector<vec3i>& triangles, const vector<vec3f>& positions) {
+  if (!use_parallel_gather()) return triangles_normals(triangles, positions);
+  auto weighted = vector<vec3f>(triangles.size());
+  parallel_for_batch((int)triangles.size(), 4096, [&](int idx) {
+    auto& t      = triangles[idx];
+    auto  normal = triangle_normal(
+        positions[t.x], positions[t.y], positions[t.z]);
+    auto area = triangle_area(positions[t.x], positions[t.y], positions[t.z]);
+    weighted[idx] = normal * area;
+  });
+  auto incidence = make_vertex_incidence(triangles, (int)positions.size());
+  return gather_normalized(incidence, weighted, (int)positions.size());
+}
+
+// Compute per-vertex normals for quads in parallel.
+vector<vec3f> quads_normals_parallel(
+    const vector<vec4i>& quads, const vector<vec3f>& positions) {
+  if (!use_parallel_gather()) return quads_normals(quads, positions);
+  auto weighted = vector<vec3f>(quads.size());
+  parallel_for_batch((int)quads.size(), 4096, [&](int idx) {
+    auto& q      = quads[idx];
+    auto  normal = quad_normal(
+        positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+    auto area = quad_area(
+        positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+    weighted[idx] = normal * area;
+  });
+  auto incidence = make_vertex_incidence(quads, (int)positions.size());
+  return gather_normalized(incidence, weighted, (int)positions.size());
+}
+
+// Compute per-vertex tangent frame for triangle meshes in parallel.
+vector<vec4f> triangles_tangent_spaces_parallel(const vector<vec3i>& triangles,
+    const vector<vec3f>& positions, const vector<vec3f>& normals,
+    const vector<vec2f>& texcoords) {
+  if (!use_parallel_gather())
+    return triangles_tangent_spaces(triangles, positions, normals, texcoords);
+  auto triangles_tangu = vector<vec3f>(triangles.size());
+  auto triangles_tangv = vector<vec3f>(triangles.size());
+  parallel_for_batch((int)triangles.size(), 4096, [&](int idx) {
+    auto& t    = triangles[idx];
+    auto  tutv = triangle_tangents_fromuv(positions[t.x], positions[t.y],
+        positions[t.z], texcoords[t.x], texcoords[t.y], texcoords[t.z]);
+    triangles_tangu[idx] = normalize(tutv.first);
+    triangles_tangv[idx] = normalize(tutv.second);
+  });
+  auto incidence = make_vertex_incidence(triangles, (int)positions.size());
+  auto tangu     = gather_normalized(
+      incidence, triangles_tangu, (int)positions.size());
+  auto tangv = gather_normalized(
+      incidence, triangles_tangv, (int)positions.size());
+
+  auto tangent_spaces = vector<vec4f>(positions.size());
+  parallel_for_batch((int)positions.size(), 4096, [&](int i) {
+    auto tu = orthonormalize(tangu[i], normals[i]);
+    auto s  = (dot(cross(normals[i], tu), tangv[i]) < 0) ? -1.0f : 1.0f;
+    tangent_spaces[i] = {tu.x, tu.y, tu.z, s};
+  });
+  return tangent_spaces;
+}
+
 // Apply skinning
 pair<vector<vec3f>, vector<vec3f>> skin_vertices(const vector<vec3f>& positions,
     const vector<vec3f>& normals, const vector<vec4f>& weights,
@@ -3116,6 +3459,681 @@ pair<vector<vec4i>, vector<vec4f>> subdivide_catmullclark(
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF SHAPE SIMPLIFICATION
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Symmetric 4x4 matrix that measures the sum of squared distances to a set
+// of planes, stored as its upper triangle in double precision.
+struct simplify_quadric {
+  double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0,
+         zw = 0, ww = 0;
+};
+
+// Quadric of a plane given by its unit normal and a point on it
+static simplify_quadric make_quadric(const vec3f& normal, const vec3f& point) {
+  auto a = (double)normal.x, b = (double)normal.y, c = (double)normal.z;
+  auto d = -(a * point.x + b * point.y + c * point.z);
+  return {
+      a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d};
+}
+
+// Sum of quadrics
+static simplify_quadric sum_quadrics(
+    const simplify_quadric& a, const simplify_quadric& b) {
+  return {a.xx + b.xx, a.xy + b.xy, a.xz + b.xz, a.xw + b.xw, a.yy + b.yy,
+      a.yz + b.yz, a.yw + b.yw, a.zz + b.zz, a.zw + b.zw, a.ww + b.ww};
+}
+
+// Squared distance measured by a quadric
+static double eval_quadric(const simplify_quadric& q, const vec3f& point) {
+  auto x = (double)point.x, y = (double)point.y, z = (double)point.z;
+  return q.xx * x * x + q.yy * y * y + q.zz * z * z +
+         2 * (q.xy * x * y + q.xz * x * z + q.yz * y * z) +
+         2 * (q.xw * x + q.yw * y + q.zw * z) + q.ww;
+}
+
+// Point of minimum quadric error, if well defined
+static bool solve_quadric(const simplify_quadric& q, vec3f& point) {
+  auto c00 = q.yy * q.zz - q.yz * q.yz, c01 = q.xz * q.yz - q.xy * q.zz,
+       c02 = q.xy * q.yz - q.xz * q.yy, c11 = q.xx * q.zz - q.xz * q.xz,
+       c12 = q.xy * q.xz - q.xx * q.yz, c22 = q.xx * q.yy - q.xy * q.xy;
+  auto det   = q.xx * c00 + q.xy * c01 + q.xz * c02;
+  auto scale = q.xx + q.yy + q.zz;
+  if (abs(det) <= 1e-6 * scale * scale * scale) return false;
+  point = {(float)(-(c00 * q.xw + c01 * q.yw + c02 * q.zw) / det),
+      (float)(-(c01 * q.xw + c11 * q.yw + c12 * q.zw) / det),
+      (float)(-(c02 * q.xw + c12 * q.yw + c22 * q.zw) / det)};
+  return true;
+}
+
+// Lock vertices that share their position with others, as happens along
+// seams where vertex data is split, since moving them opens cracks.
+static void lock_seams(const vector<vec3f>& positions, vector<bool>& locked) {
+  auto sorted = vector<int>(positions.size());
+  for (auto vertex : range((int)positions.size())) sorted[vertex] = vertex;
+  std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+    auto &pa = positions[a], &pb = positions[b];
+    if (pa.x != pb.x) return pa.x < pb.x;
+    if (pa.y != pb.y) return pa.y < pb.y;
+    return pa.z < pb.z;
+  });
+  for (auto idx = 1; idx < (int)sorted.size(); idx++) {
+    if (positions[sorted[idx]] != positions[sorted[idx - 1]]) continue;
+    locked[sorted[idx]] = locked[sorted[idx - 1]] = true;
+  }
+}
+
+// Edge collapse with its error when it was evaluated
+struct simplify_collapse {
+  float cost    = 0;
+  int   vertex0 = 0;
+  int   vertex1 = 0;
+};
+
+// Simplify the triangles of a shape in place. Locked vertices do not move.
+// Quadrics are computed from the triangles if not given, and are updated
+// with the vertex data. Returns the indices of the vertices kept.
+static vector<int> simplify_triangles(shape_data& shape, vector<bool>& locked,
+    vector<simplify_quadric>& quadrics, int max_triangles, float max_error,
+    bool lock_boundary) {
+  auto& triangles = shape.triangles;
+  auto& positions = shape.positions;
+
+  // triangles adjacent to each vertex
+  auto vertex_triangles = vector<vector<int>>(positions.size());
+  for (auto triangle : range((int)triangles.size())) {
+    for (auto vertex : triangles[triangle])
+      vertex_triangles[vertex].push_back(triangle);
+  }
+
+  // plane quadrics of triangles
+  auto make_quadrics = quadrics.empty();
+  if (make_quadrics) {
+    quadrics.assign(positions.size(), {});
+    for (auto& triangle : triangles) {
+      auto normal = triangle_normal(positions[triangle.x],
+          positions[triangle.y], positions[triangle.z]);
+      auto plane  = make_quadric(normal, positions[triangle.x]);
+      for (auto vertex : triangle)
+        quadrics[vertex] = sum_quadrics(quadrics[vertex], plane);
+    }
+  }
+
+  // edges, listed from their first vertex, with the number of triangles
+  // they border. Boundaries add planes orthogonal to them to keep their
+  // shape, unless locked like non-manifold edges.
+  auto edges     = vector<vec2i>{};
+  auto neighbors = vector<int>{};
+  auto is_locked = locked;
+  for (auto v0 : range((int)positions.size())) {
+    neighbors.clear();
+    for (auto triangle : vertex_triangles[v0]) {
+      for (auto vertex : triangles[triangle])
+        if (vertex > v0) neighbors.push_back(vertex);
+    }
+    std::sort(neighbors.begin(), neighbors.end());
+    for (auto idx = 0; idx < (int)neighbors.size();) {
+      auto v1     = neighbors[idx];
+      auto nfaces = 0;
+      for (; idx < (int)neighbors.size() && neighbors[idx] == v1; idx++)
+        nfaces += 1;
+      edges.push_back({v0, v1});
+      if (nfaces > 2 || (nfaces == 1 && lock_boundary)) {
+        locked[v0] = locked[v1] = true;
+      } else if (nfaces == 1 && make_quadrics &&
+                 !(is_locked[v0] && is_locked[v1])) {
+        for (auto triangle : vertex_triangles[v0]) {
+          auto& t = triangles[triangle];
+          if (t.x != v1 && t.y != v1 && t.z != v1) continue;
+          auto normal = triangle_normal(
+              positions[t.x], positions[t.y], positions[t.z]);
+          auto plane  = make_quadric(
+              normalize(cross(positions[v1] - positions[v0], normal)),
+              positions[v0]);
+          quadrics[v0] = sum_quadrics(quadrics[v0], plane);
+          quadrics[v1] = sum_quadrics(quadrics[v1], plane);
+        }
+      }
+    }
+  }
+  lock_seams(positions, locked);
+
+  // neighbors of a vertex, sorted
+  auto removed_triangles = vector<bool>(triangles.size(), false);
+  auto removed_vertices  = vector<bool>(positions.size(), false);
+  auto get_neighbors     = [&](int vertex, vector<int>& neighbors) {
+    neighbors.clear();
+    for (auto triangle : vertex_triangles[vertex]) {
+      if (removed_triangles[triangle]) continue;
+      for (auto neighbor : triangles[triangle])
+        if (neighbor != vertex) neighbors.push_back(neighbor);
+    }
+    std::sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(
+        std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+  };
+
+  // place collapsed vertices at the point of minimum error, unless locked,
+  // falling back to the edge endpoints and midpoint
+  auto eval_collapse = [&](int v0, int v1, vec3f& position) {
+    auto quadric = sum_quadrics(quadrics[v0], quadrics[v1]);
+    auto &p0 = positions[v0], &p1 = positions[v1];
+    if (locked[v0]) {
+      position = p0;
+    } else if (locked[v1]) {
+      position = p1;
+    } else if (!solve_quadric(quadric, position) ||
+               distance(position, (p0 + p1) / 2) > distance(p0, p1)) {
+      position = p0;
+      for (auto candidate : {p1, (p0 + p1) / 2}) {
+        if (eval_quadric(quadric, candidate) < eval_quadric(quadric, position))
+          position = candidate;
+      }
+    }
+    return (float)max(eval_quadric(quadric, position), 0.0);
+  };
+
+  // queue collapses by increasing error. Since errors only grow as
+  // quadrics are summed, queued errors are updated lazily when popped.
+  auto compare = [](const simplify_collapse& a, const simplify_collapse& b) {
+    return a.cost > b.cost;
+  };
+  auto queue = std::priority_queue<simplify_collapse,
+      vector<simplify_collapse>, decltype(compare)>{compare};
+  auto push_collapse = [&](int v0, int v1) {
+    if (locked[v0] && locked[v1]) return;
+    auto position = vec3f{0, 0, 0};
+    queue.push({eval_collapse(v0, v1, position), v0, v1});
+  };
+  for (auto& edge : edges) push_collapse(edge.x, edge.y);
+  edges = {};
+
+  // collapse edges
+  auto num_triangles = (int)triangles.size();
+  auto max_cost      = (double)max_error * (double)max_error;
+  auto neighbors0 = vector<int>{}, neighbors1 = vector<int>{},
+       shared     = vector<int>{};
+  while (!queue.empty() && num_triangles > max_triangles) {
+    auto [queued, v0, v1] = queue.top();
+    queue.pop();
+    if (removed_vertices[v0] || removed_vertices[v1]) continue;
+    if (locked[v0] && locked[v1]) continue;
+    auto position = vec3f{0, 0, 0};
+    auto cost     = eval_collapse(v0, v1, position);
+    if (cost > queued) {
+      queue.push({cost, v0, v1});
+      continue;
+    }
+    if (cost > max_cost) break;
+    if (locked[v1]) std::swap(v0, v1);
+
+    // keep the mesh manifold, by requiring that the endpoints share only
+    // the opposite vertices of the one or two triangles of the edge
+    auto num_shared = 0;
+    for (auto triangle : vertex_triangles[v0]) {
+      if (removed_triangles[triangle]) continue;
+      auto& t = triangles[triangle];
+      if (t.x == v1 || t.y == v1 || t.z == v1) num_shared += 1;
+    }
+    if (num_shared != 1 && num_shared != 2) continue;
+    get_neighbors(v0, neighbors0);
+    get_neighbors(v1, neighbors1);
+    shared.clear();
+    std::set_intersection(neighbors0.begin(), neighbors0.end(),
+        neighbors1.begin(), neighbors1.end(), std::back_inserter(shared));
+    if ((int)shared.size() != num_shared) continue;
+
+    // reject collapses that flip or degenerate triangles
+    auto flipped = false;
+    for (auto vertex : {v0, v1}) {
+      auto other = v0 + v1 - vertex;
+      for (auto triangle : vertex_triangles[vertex]) {
+        if (removed_triangles[triangle] || flipped) continue;
+        auto t = triangles[triangle];
+        if (t.x == other || t.y == other || t.z == other) continue;
+        auto before = cross(positions[t.y] - positions[t.x],
+            positions[t.z] - positions[t.x]);
+        for (auto& v : t)
+          if (v == vertex) v = -1;
+        auto p     = [&](int v) { return v < 0 ? position : positions[v]; };
+        auto after = cross(p(t.y) - p(t.x), p(t.z) - p(t.x));
+        flipped    = after == vec3f{0, 0, 0} ||
+                  dot(before, after) < 0.2f * length(before) * length(after);
+      }
+    }
+    if (flipped) continue;
+
+    // interpolate vertex data along the edge
+    auto& p0 = positions[v0];
+    auto  d  = positions[v1] - p0;
+    auto  t  = clamp(
+        dot(position - p0, d) / max(dot(d, d), flt_min), 0.0f, 1.0f);
+    positions[v0] = position;
+    if (!shape.normals.empty())
+      shape.normals[v0] = normalize(
+          lerp(shape.normals[v0], shape.normals[v1], t));
+    if (!shape.texcoords.empty())
+      shape.texcoords[v0] = lerp(shape.texcoords[v0], shape.texcoords[v1], t);
+    if (!shape.colors.empty())
+      shape.colors[v0] = lerp(shape.colors[v0], shape.colors[v1], t);
+    if (!shape.radius.empty())
+      shape.radius[v0] = lerp(shape.radius[v0], shape.radius[v1], t);
+    if (!shape.tangents.empty()) {
+      auto &t0 = shape.tangents[v0], &t1 = shape.tangents[v1];
+      auto  tangent = normalize(lerp(xyz(t0), xyz(t1), t));
+      t0 = {tangent.x, tangent.y, tangent.z, t < 0.5f ? t0.w : t1.w};
+    }
+    quadrics[v0] = sum_quadrics(quadrics[v0], quadrics[v1]);
+
+    // move the triangles of the removed vertex, and queue the new edges
+    for (auto triangle : vertex_triangles[v1]) {
+      if (removed_triangles[triangle]) continue;
+      auto& t = triangles[triangle];
+      if (t.x == v0 || t.y == v0 || t.z == v0) {
+        removed_triangles[triangle] = true;
+        num_triangles -= 1;
+      } else {
+        for (auto& v : t)
+          if (v == v1) v = v0;
+        vertex_triangles[v0].push_back(triangle);
+      }
+    }
+    vertex_triangles[v1] = {};
+    removed_vertices[v1] = true;
+    vertex_triangles[v0].erase(
+        std::remove_if(vertex_triangles[v0].begin(),
+            vertex_triangles[v0].end(),
+            [&](int triangle) { return (bool)removed_triangles[triangle]; }),
+        vertex_triangles[v0].end());
+    for (auto neighbor : neighbors1) {
+      if (neighbor == v0) continue;
+      if (std::binary_search(neighbors0.begin(), neighbors0.end(), neighbor))
+        continue;
+      push_collapse(v0, neighbor);
+    }
+  }
+
+  // compact triangles and vertex data
+  auto kept      = vector<int>{};
+  auto used      = vector<int>(positions.size(), -1);
+  auto compacted = vector<vec3i>{};
+  for (auto triangle : range((int)triangles.size())) {
+    if (removed_triangles[triangle]) continue;
+    compacted.push_back(triangles[triangle]);
+    for (auto vertex : triangles[triangle]) used[vertex] = 0;
+  }
+  for (auto vertex : range((int)positions.size())) {
+    if (used[vertex] < 0) continue;
+    used[vertex] = (int)kept.size();
+    kept.push_back(vertex);
+  }
+  for (auto& triangle : compacted)
+    for (auto& vertex : triangle) vertex = used[vertex];
+  auto compact = [&kept](auto& values) {
+    if (values.empty()) return;
+    auto compacted = values;
+    compacted.resize(kept.size());
+    for (auto idx : range((int)kept.size())) compacted[idx] = values[kept[idx]];
+    values = std::move(compacted);
+  };
+  triangles = std::move(compacted);
+  compact(shape.positions);
+  compact(shape.normals);
+  compact(shape.texcoords);
+  compact(shape.colors);
+  compact(shape.radius);
+  compact(shape.tangents);
+  compact(quadrics);
+  compact(locked);
+  return kept;
+}
+
+// Simplification
+shape_data simplify_shape(const shape_data& shape, int max_triangles,
+    float max_error, bool lock_boundary) {
+  if (shape.triangles.empty() && shape.quads.empty()) return shape;
+  auto simplified = quads_to_triangles(shape);
+  auto locked     = vector<bool>(simplified.positions.size(), false);
+  auto quadrics   = vector<simplify_quadric>{};
+  simplify_triangles(simplified, locked, quadrics, max_triangles, max_error,
+      lock_boundary);
+  return simplified;
+}
+
+// Interleave the bits of a point quantized in [0,1024)^3
+static uint32_t morton_code(const vec3f& uvw) {
+  auto expand = [](float value) {
+    auto bits = (uint32_t)clamp(value * 1024, 0.0f, 1023.0f);
+    bits      = (bits * 0x00010001u) & 0xFF0000FFu;
+    bits      = (bits * 0x00000101u) & 0x0F00F00Fu;
+    bits      = (bits * 0x00000011u) & 0xC30C30C3u;
+    bits      = (bits * 0x00000005u) & 0x49249249u;
+    return bits;
+  };
+  return expand(uvw.x) * 4 + expand(uvw.y) * 2 + expand(uvw.z);
+}
+
+// Simplification in parallel over clusters of triangles
+shape_data simplify_shape_clusters(const shape_data& shape, int max_triangles,
+    float max_error, bool lock_boundary, int cluster_triangles,
+    bool noparallel) {
+  if (shape.triangles.empty() && shape.quads.empty()) return shape;
+  auto source = quads_to_triangles(shape);
+  if ((int)source.triangles.size() <= cluster_triangles)
+    return simplify_shape(source, max_triangles, max_error, lock_boundary);
+  auto& triangles = source.triangles;
+  auto& positions = source.positions;
+
+  // split triangles in clusters along a morton curve
+  auto bbox = invalidb3f;
+  for (auto& position : positions) bbox = merge(bbox, position);
+  auto extent = max(bbox.max - bbox.min, vec3f{flt_min, flt_min, flt_min});
+  auto codes  = vector<uint32_t>(triangles.size());
+  for (auto idx : range((int)triangles.size())) {
+    auto& t     = triangles[idx];
+    auto center = (positions[t.x] + positions[t.y] + positions[t.z]) / 3;
+    codes[idx]  = morton_code((center - bbox.min) / extent);
+  }
+  auto sorted = vector<int>(triangles.size());
+  for (auto idx : range((int)triangles.size())) sorted[idx] = idx;
+  std::sort(sorted.begin(), sorted.end(),
+      [&](int a, int b) { return codes[a] < codes[b]; });
+  auto num_clusters = ((int)triangles.size() + cluster_triangles - 1) /
+                      cluster_triangles;
+
+  // lock vertices shared by clusters, and seams that clusters may split
+  auto vertex_clusters = vector<int>(positions.size(), -1);
+  for (auto idx : range((int)sorted.size())) {
+    auto cluster = idx / cluster_triangles;
+    for (auto vertex : triangles[sorted[idx]]) {
+      auto& vertex_cluster = vertex_clusters[vertex];
+      vertex_cluster = vertex_cluster == -1 || vertex_cluster == cluster
+                           ? cluster
+                           : -2;
+    }
+  }
+  auto locked = vector<bool>(positions.size(), false);
+  for (auto vertex : range((int)positions.size()))
+    locked[vertex] = vertex_clusters[vertex] == -2;
+  lock_seams(positions, locked);
+
+  // simplify clusters, keeping the original indices of their vertices
+  auto clusters         = vector<shape_data>(num_clusters);
+  auto cluster_vertices = vector<vector<int>>(num_clusters);
+  auto cluster_quadrics = vector<vector<simplify_quadric>>(num_clusters);
+  auto simplify_cluster = [&](int cluster) {
+    auto  first    = cluster * cluster_triangles;
+    auto  last     = min(first + cluster_triangles, (int)sorted.size());
+    auto& part     = clusters[cluster];
+    auto& vertices = cluster_vertices[cluster];
+    for (auto idx = first; idx < last; idx++)
+      for (auto vertex : triangles[sorted[idx]]) vertices.push_back(vertex);
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(
+        std::unique(vertices.begin(), vertices.end()), vertices.end());
+    auto local = [&](int vertex) {
+      return (int)(std::lower_bound(vertices.begin(), vertices.end(), vertex) -
+                   vertices.begin());
+    };
+    for (auto idx = first; idx < last; idx++) {
+      auto& t = triangles[sorted[idx]];
+      part.triangles.push_back({local(t.x), local(t.y), local(t.z)});
+    }
+    auto copy = [&](auto& values, const auto& source) {
+      if (source.empty()) return;
+      for (auto vertex : vertices) values.push_back(source[vertex]);
+    };
+    copy(part.positions, source.positions);
+    copy(part.normals, source.normals);
+    copy(part.texcoords, source.texcoords);
+    copy(part.colors, source.colors);
+    copy(part.radius, source.radius);
+    copy(part.tangents, source.tangents);
+    auto part_locked = vector<bool>(vertices.size());
+    auto num_shared  = 0;
+    for (auto idx : range((int)vertices.size())) {
+      part_locked[idx] = locked[vertices[idx]];
+      if (vertex_clusters[vertices[idx]] == -2) num_shared += 1;
+    }
+
+    // stop before the locked borders distort the cluster, leaving room for
+    // the final pass
+    auto target = max((int)((double)max_triangles * (last - first) /
+                                (double)triangles.size()),
+        2 * num_shared);
+    auto kept   = simplify_triangles(part, part_locked,
+        cluster_quadrics[cluster], target, max_error, lock_boundary);
+    for (auto& vertex : kept) vertex = vertices[vertex];
+    vertices = std::move(kept);
+  };
+  if (noparallel) {
+    for (auto cluster : range(num_clusters)) simplify_cluster(cluster);
+  } else {
+    parallel_for(num_clusters, simplify_cluster);
+  }
+
+  // join clusters, merging the vertices they share and their quadrics
+  auto joined   = shape_data{};
+  auto quadrics = vector<simplify_quadric>{};
+  auto merged   = vector<int>(positions.size(), -1);
+  auto local    = vector<int>{};
+  for (auto cluster : range(num_clusters)) {
+    auto& part     = clusters[cluster];
+    auto& vertices = cluster_vertices[cluster];
+    local.assign(vertices.size(), -1);
+    for (auto idx : range((int)vertices.size())) {
+      auto& quadric = cluster_quadrics[cluster][idx];
+      auto  shared  = vertex_clusters[vertices[idx]] == -2;
+      if (shared && merged[vertices[idx]] >= 0) {
+        local[idx]            = merged[vertices[idx]];
+        quadrics[local[idx]] = sum_quadrics(quadrics[local[idx]], quadric);
+        continue;
+      }
+      local[idx] = (int)joined.positions.size();
+      if (shared) merged[vertices[idx]] = local[idx];
+      quadrics.push_back(quadric);
+      joined.positions.push_back(part.positions[idx]);
+      if (!part.normals.empty()) joined.normals.push_back(part.normals[idx]);
+      if (!part.texcoords.empty())
+        joined.texcoords.push_back(part.texcoords[idx]);
+      if (!part.colors.empty()) joined.colors.push_back(part.colors[idx]);
+      if (!part.radius.empty()) joined.radius.push_back(part.radius[idx]);
+      if (!part.tangents.empty())
+        joined.tangents.push_back(part.tangents[idx]);
+    }
+    for (auto& t : part.triangles)
+      joined.triangles.push_back({local[t.x], local[t.y], local[t.z]});
+    part                      = {};
+    cluster_quadrics[cluster] = {};
+  }
+
+  // simplify across cluster borders
+  auto joined_locked = vector<bool>(joined.positions.size(), false);
+  simplify_triangles(joined, joined_locked, quadrics, max_triangles, max_error,
+      lock_boundary);
+  return joined;
+}
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF SHAPE REORDERING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Element centers used to sort elements
+static vec3f element_center(int point, const vector<vec3f>& positions) {
+  return positions[point];
+}
+template <typename T>
+static vec3f element_center(const T& element, const vector<vec3f>& positions) {
+  auto center = vec3f{0, 0, 0};
+  auto count  = 0;
+  for (auto vertex : element) {
+    center += positions[vertex];
+    count += 1;
+  }
+  return center / count;
+}
+
+// Sort elements along a Morton curve of their centers
+template <typename T>
+static void sort_elements_spatially(
+    vector<T>& elements, const vector<vec3f>& positions, const bbox3f& bbox) {
+  if (elements.size() < 2) return;
+  auto extent = max(bbox.max - bbox.min, vec3f{flt_min, flt_min, flt_min});
+  auto codes  = vector<std::pair<uint32_t, int>>(elements.size());
+  for (auto idx : range((int)elements.size())) {
+    auto center = element_center(elements[idx], positions);
+    codes[idx]  = {morton_code((center - bbox.min) / extent), idx};
+  }
+  std::sort(codes.begin(), codes.end());
+  auto sorted = vector<T>(elements.size());
+  for (auto idx : range((int)codes.size()))
+    sorted[idx] = elements[codes[idx].second];
+  elements = std::move(sorted);
+}
+
+// Sort triangles or quads for a post-transform vertex cache with Tipsify
+// [Sander et al. 2007]. Elements are emitted in fans around vertices that
+// are likely still in the cache, skipping to recently used vertices, or to
+// the next vertex in index order, at dead ends.
+template <typename T>
+static void sort_elements_for_cache(
+    vector<T>& elements, int num_vertices, int cache_size = 16) {
+  if (elements.size() < 2) return;
+
+  // vertex to element adjacency
+  auto offsets = vector<int>(num_vertices + 1, 0);
+  for (auto& element : elements)
+    for (auto vertex : element) offsets[vertex + 1] += 1;
+  for (auto vertex : range(num_vertices))
+    offsets[vertex + 1] += offsets[vertex];
+  auto adjacency = vector<int>(offsets.back());
+  auto live      = vector<int>(num_vertices, 0);
+  for (auto idx : range((int)elements.size()))
+    for (auto vertex : elements[idx])
+      adjacency[offsets[vertex] + live[vertex]++] = idx;
+
+  // fan around vertices
+  auto timestamps = vector<int>(num_vertices, 0);
+  auto emitted    = vector<bool>(elements.size(), false);
+  auto dead_ends  = vector<int>{};
+  auto candidates = vector<int>{};
+  auto sorted     = vector<T>{};
+  sorted.reserve(elements.size());
+  auto time = cache_size + 1, cursor = 0, fanning = 0;
+  while (fanning >= 0) {
+    candidates.clear();
+    for (auto adj = offsets[fanning]; adj < offsets[fanning + 1]; adj++) {
+      auto idx = adjacency[adj];
+      if (emitted[idx]) continue;
+      emitted[idx] = true;
+      sorted.push_back(elements[idx]);
+      for (auto vertex : elements[idx]) {
+        dead_ends.push_back(vertex);
+        candidates.push_back(vertex);
+        live[vertex] -= 1;
+        if (time - timestamps[vertex] > cache_size) timestamps[vertex] = time++;
+      }
+    }
+
+    // pick the candidate that stays longest in cache after its fan
+    fanning       = -1;
+    auto priority = -1;
+    for (auto vertex : candidates) {
+      if (live[vertex] <= 0) continue;
+      auto age             = time - timestamps[vertex];
+      auto vertex_priority = age + 2 * live[vertex] <= cache_size ? age : 0;
+      if (vertex_priority > priority) {
+        priority = vertex_priority;
+        fanning  = vertex;
+      }
+    }
+
+    // dead end
+    while (fanning < 0 && !dead_ends.empty()) {
+      auto vertex = dead_ends.back();
+      dead_ends.pop_back();
+      if (live[vertex] > 0) fanning = vertex;
+    }
+    while (fanning < 0 && cursor < num_vertices) {
+      if (live[cursor] > 0) fanning = cursor;
+      cursor += 1;
+    }
+  }
+  elements = std::move(sorted);
+}
+
+// Renumber vertices in order of first use, keeping unused vertices last
+static void sort_vertices_by_use(shape_data& shape) {
+  auto remap = vector<int>(shape.positions.size(), -1);
+  auto order = vector<int>{};
+  order.reserve(shape.positions.size());
+  auto use = [&](int& vertex) {
+    if (remap[vertex] < 0) {
+      remap[vertex] = (int)order.size();
+      order.push_back(vertex);
+    }
+    vertex = remap[vertex];
+  };
+  for (auto& point : shape.points) use(point);
+  for (auto& line : shape.lines)
+    for (auto& vertex : line) use(vertex);
+  for (auto& triangle : shape.triangles)
+    for (auto& vertex : triangle) use(vertex);
+  for (auto& quad : shape.quads)
+    for (auto& vertex : quad) use(vertex);
+  for (auto vertex : range((int)remap.size()))
+    if (remap[vertex] < 0) order.push_back(vertex);
+
+  auto permute = [&order](auto& values) {
+    if (values.empty()) return;
+    auto permuted = values;
+    for (auto idx : range((int)order.size()))
+      permuted[idx] = values[order[idx]];
+    values = std::move(permuted);
+  };
+  permute(shape.positions);
+  permute(shape.normals);
+  permute(shape.texcoords);
+  permute(shape.colors);
+  permute(shape.radius);
+  permute(shape.tangents);
+  permute(shape.normalso);
+  permute(shape.texcoordsu);
+  permute(shape.colorsb);
+}
+
+// Reorder elements and vertices for memory locality
+shape_data reorder_shape(const shape_data& shape, shape_ordering ordering) {
+  if (ordering == shape_ordering::none) return shape;
+  auto reordered = shape;
+
+  // sort elements spatially
+  auto bbox = invalidb3f;
+  for (auto& position : shape.positions) bbox = merge(bbox, position);
+  sort_elements_spatially(reordered.points, shape.positions, bbox);
+  sort_elements_spatially(reordered.lines, shape.positions, bbox);
+  sort_elements_spatially(reordered.triangles, shape.positions, bbox);
+  sort_elements_spatially(reordered.quads, shape.positions, bbox);
+  sort_vertices_by_use(reordered);
+
+  // sort elements for the vertex cache, starting from the spatial order
+  if (ordering == shape_ordering::vertex_cache) {
+    auto num_vertices = (int)reordered.positions.size();
+    sort_elements_for_cache(reordered.triangles, num_vertices);
+    sort_elements_for_cache(reordered.quads, num_vertices);
+    sort_vertices_by_use(reordered);
+  }
+
+  return reordered;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION OF SHAPE SAMPLING
 // -----------------------------------------------------------------------------
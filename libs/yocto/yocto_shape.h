@@ -71,6 +71,9 @@ namespace yocto {
 
 // Shape data represented as indexed meshes of elements.
 // May contain either points, lines, triangles and quads.
+// Normals, texcoords and colors may instead be stored compactly as
+// octahedral normals, 16-bit texcoords relative to texcoords_range and
+// byte colors, in which case the corresponding float arrays are empty.
 struct shape_data {
   // element data
   vector<int>   points    = {};
@@ -85,8 +88,26 @@ struct shape_data {
   vector<vec4f> colors    = {};
   vector<float> radius    = {};
   vector<vec4f> tangents  = {};
+
+  // compact vertex data
+  vector<uint>  normalso        = {};
+  vector<uint>  texcoordsu      = {};
+  vector<vec4b> colorsb         = {};
+  bbox2f        texcoords_range = {};
 };
 
+// Storage for normals, texcoords and colors: 36 bytes per vertex for floats
+// and 12 for the compact encoding.
+enum struct shape_storage { float32, compact };
+
+// Enum labels
+inline const auto shape_storage_names = vector<string>{"float32", "compact"};
+
+// Vertex data that decodes the compact storage.
+vec3f get_normal(const shape_data& shape, int vertex);
+vec2f get_texcoord(const shape_data& shape, int vertex);
+vec4f get_color(const shape_data& shape, int vertex);
+
 // Interpolate vertex data
 vec3f eval_position(const shape_data& shape, int element, const vec2f& uv);
 vec3f eval_normal(const shape_data& shape, int element, const vec2f& uv);
@@ -124,6 +145,36 @@ void       quads_to_triangles_inplace(shape_data& shape);
 shape_data subdivide_shape(
     const shape_data& shape, int subdivisions, bool catmullclark);
 
+// Simplification by quadric error edge collapses, that stops when reaching
+// max_triangles or when collapses would move the surface by more than
+// max_error. Vertex data is interpolated along collapsed edges. Boundaries
+// are kept in place if lock_boundary is set, while vertices split along
+// seams always are. Quads are converted to triangles. The clustered version
+// simplifies spatial clusters of triangles in parallel, with their borders
+// locked, and then joins them for a final pass.
+shape_data simplify_shape(const shape_data& shape, int max_triangles,
+    float max_error = flt_max, bool lock_boundary = false);
+shape_data simplify_shape_clusters(const shape_data& shape, int max_triangles,
+    float max_error = flt_max, bool lock_boundary = false,
+    int cluster_triangles = 65536, bool noparallel = false);
+
+// Element orderings for memory locality: along a Morton curve of element
+// centers, or, for triangles and quads, further sorted for post-transform
+// vertex caches.
+enum struct shape_ordering { none, spatial, vertex_cache };
+
+// Enum labels
+inline const auto shape_ordering_names = vector<string>{
+    "none", "spatial", "vertex_cache"};
+
+// Reorder elements for memory locality, and then vertices in order of first
+// use. Unreferenced vertices are kept last.
+shape_data reorder_shape(const shape_data& shape,
+    shape_ordering ordering = shape_ordering::spatial);
+
+// Converts the storage of normals, texcoords and colors.
+void convert_shape(shape_data& shape, shape_storage storage);
+
 // Shape statistics
 vector<string> shape_stats(const shape_data& shape, bool verbose = false);
 
@@ -326,7 +377,21 @@ void quads_normals(vector<vec3f>& normals, const vector<vec4i>& quads,
 // The first three components are the tangent with respect to the u texcoord.
 // The fourth component is the sign of the tangent wrt the v texcoord.
 // Tangent frame is useful in normal mapping.
-vector<vec4f> triangle_tangent_spaces(const vector<vec3i>& triangles,
+vector<vec4f> triangles_tangent_spaces(const vector<vec3i>& triangles,
+    const vector<vec3f>& positions, const vector<vec3f>& normals,
+    const vector<vec2f>& texcoords);
+
+// Parallel versions of the above, that gather element values over a
+// vertex to element incidence instead of scattering them, so that no
+// atomics are needed. Sums are taken in the same order as the serial
+// versions.
+vector<vec3f> lines_tangents_parallel(
+    const vector<vec2i>& lines, const vector<vec3f>& positions);
+vector<vec3f> triangles_normals_parallel(
+    const vector<vec3i>& triangles, const vector<vec3f>& positions);
+vector<vec3f> quads_normals_parallel(
+    const vector<vec4i>& quads, const vector<vec3f>& positions);
+vector<vec4f> triangles_tangent_spaces_parallel(const vector<vec3i>& triangles,
     const vector<vec3f>& positions, const vector<vec3f>& normals,
     const vector<vec2f>& texcoords);
 
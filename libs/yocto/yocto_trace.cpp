@@ -38,6 +38,7 @@
 #include "yocto_color.h"
 #include "yocto_geometry.h"
 #include "yocto_sampling.h"
+#include "yocto_sceneio.h"
 #include "yocto_shading.h"
 #include "yocto_shape.h"
 
@@ -86,8 +87,273 @@ namespace yocto {
 
 // Build the bvh acceleration structure.
 scene_bvh make_bvh(const scene_data& scene, const trace_params& params) {
-  return make_bvh(
-      scene, params.highqualitybvh, params.embreebvh, params.noparallel);
+  return make_bvh(scene, params.highqualitybvh, params.embreebvh,
+      params.noparallel, params.trianglesbvh);
+}
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF PATH GUIDING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Directional trees are refined where they hold more than this energy fraction
+constexpr auto guiding_rho = 0.01f;
+// Spatial leaves are split once they record this many samples, times the
+// square root of the samples in the training pass
+constexpr auto guiding_split = 4000.0f;
+// Tree depths are limited by the precision of the sampled directions
+constexpr auto guiding_max_ddepth = 16;
+constexpr auto guiding_max_sdepth = 24;
+
+// Map directions to and from the unit square, preserving areas
+static vec2f guiding_square(const vec3f& direction) {
+  auto phi = atan2(direction.y, direction.x);
+  if (phi < 0) phi += 2 * pif;
+  return {clamp((direction.z + 1) / 2, 0.0f, 1.0f),
+      clamp(phi / (2 * pif), 0.0f, 1.0f)};
+}
+static vec3f guiding_direction(const vec2f& uv) {
+  auto z   = 2 * uv.x - 1;
+  auto r   = sqrt(clamp(1 - z * z, 0.0f, 1.0f));
+  auto phi = 2 * pif * uv.y;
+  return {r * cos(phi), r * sin(phi), z};
+}
+
+// Find the spatial leaf that contains a point
+static int find_guiding_leaf(
+    const trace_guiding& guiding, const vec3f& position) {
+  auto bbox = guiding.bbox;
+  auto node = 0;
+  while (guiding.stree[node].x >= 0) {
+    auto axis = guiding.stree[node].x;
+    auto mid  = (bbox.min[axis] + bbox.max[axis]) / 2;
+    if (position[axis] < mid) {
+      bbox.max[axis] = mid;
+      node           = guiding.stree[node].y;
+    } else {
+      bbox.min[axis] = mid;
+      node           = guiding.stree[node].y + 1;
+    }
+  }
+  return guiding.stree[node].z;
+}
+
+// Find the directional leaf that contains a point of the unit square
+static int find_dtree_leaf(const trace_dtree& dtree, vec2f uv) {
+  auto node = 0;
+  while (dtree.nodes[node] != 0) {
+    auto i = uv.x >= 0.5f ? 1 : 0, j = uv.y >= 0.5f ? 1 : 0;
+    node   = dtree.nodes[node] + i + 2 * j;
+    uv     = uv * 2 - vec2f{(float)i, (float)j};
+  }
+  return node;
+}
+
+// Sample a direction from a directional tree, picking children in proportion
+// to their energy.
+static vec3f sample_dtree(const trace_dtree& dtree, vec2f ruv) {
+  auto node   = 0;
+  auto origin = vec2f{0, 0};
+  auto size   = 1.0f;
+  while (dtree.nodes[node] != 0) {
+    auto  child = dtree.nodes[node];
+    auto& e     = dtree.energy;
+    auto  e0    = e[child + 0] + e[child + 2];
+    auto  e1    = e[child + 1] + e[child + 3];
+    auto  i     = 0;
+    if (ruv.x * (e0 + e1) < e0) {
+      ruv.x = e0 > 0 ? ruv.x * (e0 + e1) / e0 : 0;
+    } else {
+      i     = 1;
+      ruv.x = e1 > 0 ? (ruv.x * (e0 + e1) - e0) / e1 : 0;
+    }
+    auto f0 = e[child + i], f1 = e[child + i + 2];
+    auto j  = 0;
+    if (ruv.y * (f0 + f1) < f0) {
+      ruv.y = f0 > 0 ? ruv.y * (f0 + f1) / f0 : 0;
+    } else {
+      j     = 1;
+      ruv.y = f1 > 0 ? (ruv.y * (f0 + f1) - f0) / f1 : 0;
+    }
+    ruv    = clamp(ruv, 0.0f, 1.0f);
+    size   = size / 2;
+    origin = origin + vec2f{(float)i, (float)j} * size;
+    node   = child + i + 2 * j;
+  }
+  return guiding_direction(origin + ruv * size);
+}
+
+// Pdf for direction sampling from a directional tree
+static float sample_dtree_pdf(
+    const trace_dtree& dtree, const vec3f& direction) {
+  auto uv   = guiding_square(direction);
+  auto pdf  = 1 / (4 * pif);
+  auto node = 0;
+  while (dtree.nodes[node] != 0) {
+    if (dtree.energy[node] <= 0) return 0;
+    auto i = uv.x >= 0.5f ? 1 : 0, j = uv.y >= 0.5f ? 1 : 0;
+    auto child = dtree.nodes[node] + i + 2 * j;
+    pdf *= 4 * dtree.energy[child] / dtree.energy[node];
+    uv   = uv * 2 - vec2f{(float)i, (float)j};
+    node = child;
+  }
+  return pdf;
+}
+
+// Check whether the guiding structure is learning from the current samples
+static bool is_guiding_training(
+    const trace_state& state, const trace_params& params) {
+  return params.sampler == trace_sampler_type::pathguided &&
+         state.guiding.next <= params.guidingsamples;
+}
+
+// Record the radiance arriving at a point from a direction, divided by the
+// pdf of the direction.
+static void record_guiding(trace_guiding& guiding, int leaf,
+    const vec3f& direction, float value) {
+  auto& dtree  = guiding.building[leaf];
+  auto  node   = find_dtree_leaf(dtree, guiding_square(direction));
+  auto& record = guiding.records[guiding.offsets[leaf] + node];
+  auto  old    = record.load(std::memory_order_relaxed);
+  while (!record.compare_exchange_weak(
+      old, old + value, std::memory_order_relaxed)) {
+  }
+  guiding.counts[leaf].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Build a directional tree that splits the nodes of a learned one holding
+// enough energy, and merges the ones that do not.
+static trace_dtree refine_dtree(const trace_dtree& dtree) {
+  if (dtree.energy[0] <= 0) return dtree;
+  auto refined = trace_dtree{};
+  auto refine  = [&](auto& refine, int node, int depth, float fraction,
+                    int source) -> void {
+    if (fraction <= guiding_rho || depth >= guiding_max_ddepth) return;
+    auto child = (int)refined.nodes.size();
+    refined.nodes[node] = child;
+    refined.nodes.insert(refined.nodes.end(), 4, 0);
+    for (auto k = 0; k < 4; k++) {
+      if (source >= 0 && dtree.nodes[source] != 0) {
+        auto source_child = dtree.nodes[source] + k;
+        refine(refine, child + k, depth + 1,
+            dtree.energy[source_child] / dtree.energy[0], source_child);
+      } else {
+        refine(refine, child + k, depth + 1, fraction / 4, -1);
+      }
+    }
+  };
+  refined.nodes = {0};
+  refine(refine, 0, 0, 1, 0);
+  refined.energy.assign(refined.nodes.size(), 0);
+  return refined;
+}
+
+// Init guiding structure
+static trace_guiding make_guiding(
+    const scene_data& scene, const trace_params& params) {
+  auto guiding = trace_guiding{};
+  if (params.sampler != trace_sampler_type::pathguided) return guiding;
+  auto bbox        = compute_bounds(scene);
+  auto extent      = max(bbox.max - bbox.min) * 0.01f + 1e-4f;
+  guiding.bbox     = {bbox.min - extent, bbox.max + extent};
+  guiding.stree    = {{-1, 0, 0}};
+  guiding.sampling = {{{0}, {0}}};
+  guiding.building = {refine_dtree({{0}, {1}})};
+  guiding.offsets  = {0};
+  guiding.records  = vector<std::atomic<float>>(
+      guiding.building[0].nodes.size());
+  guiding.counts   = vector<std::atomic<int>>(1);
+  return guiding;
+}
+
+// Count the samples just taken, and update the guiding structure at the end
+// of a training pass
+void finish_samples(
+    trace_state& state, const trace_params& params, int samples) {
+  auto& guiding = state.guiding;
+  if (!is_guiding_training(state, params)) {
+    state.samples += samples;
+    return;
+  }
+  state.training += samples;
+  if (state.training < guiding.next) return;
+
+  // learned energy, summed from the leaves up
+  for (auto leaf = 0; leaf < guiding.building.size(); leaf++) {
+    auto& dtree = guiding.building[leaf];
+    for (auto node = (int)dtree.nodes.size() - 1; node >= 0; node--) {
+      if (dtree.nodes[node] == 0) {
+        dtree.energy[node] = guiding.records[guiding.offsets[leaf] + node];
+      } else {
+        auto child         = dtree.nodes[node];
+        dtree.energy[node] = dtree.energy[child + 0] + dtree.energy[child + 1] +
+                             dtree.energy[child + 2] + dtree.energy[child + 3];
+      }
+    }
+    if (dtree.energy[0] > 0) {
+      guiding.sampling[leaf] = dtree;
+      guiding.building[leaf] = refine_dtree(dtree);
+    } else {
+      dtree.energy.assign(dtree.nodes.size(), 0);
+    }
+  }
+
+  // split spatial leaves that recorded many samples
+  auto threshold = guiding_split * sqrt((float)(1 << guiding.iteration));
+  auto counts    = vector<int>(guiding.counts.size());
+  for (auto leaf = 0; leaf < counts.size(); leaf++)
+    counts[leaf] = guiding.counts[leaf];
+  auto split = [&](auto& split, int node, int depth, float count) -> void {
+    if (count <= threshold || depth >= guiding_max_sdepth) return;
+    auto leaf  = guiding.stree[node].z;
+    auto child = (int)guiding.stree.size();
+    guiding.stree[node] = {depth % 3, child, -1};
+    guiding.stree.push_back({-1, 0, leaf});
+    guiding.stree.push_back({-1, 0, (int)guiding.sampling.size()});
+    guiding.sampling.push_back(guiding.sampling[leaf]);
+    guiding.building.push_back(guiding.building[leaf]);
+    split(split, child + 0, depth + 1, count / 2);
+    split(split, child + 1, depth + 1, count / 2);
+  };
+  auto stack  = vector<vec2i>{{0, 0}};
+  auto leaves = vector<vec2i>{};
+  while (!stack.empty()) {
+    auto [node, depth] = stack.back();
+    stack.pop_back();
+    if (guiding.stree[node].x < 0) {
+      leaves.push_back({node, depth});
+    } else {
+      stack.push_back({guiding.stree[node].y + 0, depth + 1});
+      stack.push_back({guiding.stree[node].y + 1, depth + 1});
+    }
+  }
+  for (auto [node, depth] : leaves)
+    split(split, node, depth, (float)counts[guiding.stree[node].z]);
+
+  // reset records
+  guiding.offsets.resize(guiding.building.size());
+  auto size = 0;
+  for (auto leaf = 0; leaf < guiding.building.size(); leaf++) {
+    guiding.offsets[leaf] = size;
+    size += (int)guiding.building[leaf].nodes.size();
+  }
+  guiding.records = vector<std::atomic<float>>(size);
+  guiding.counts  = vector<std::atomic<int>>(guiding.building.size());
+
+  // training passes double their samples
+  guiding.iteration += 1;
+  guiding.next = state.training + (1 << guiding.iteration);
+
+  // samples from training passes are guided by poorly learned trees, so
+  // they are discarded once training ends
+  if (guiding.next > params.guidingsamples) {
+    std::fill(state.image.begin(), state.image.end(), vec4f{0, 0, 0, 0});
+    std::fill(state.albedo.begin(), state.albedo.end(), vec3f{0, 0, 0});
+    std::fill(state.normal.begin(), state.normal.end(), vec3f{0, 0, 0});
+    std::fill(state.hits.begin(), state.hits.end(), 0);
+  }
 }
 
 }  // namespace yocto
@@ -423,6 +689,7 @@ struct trace_result {
   bool  hit      = false;
   vec3f albedo   = {0, 0, 0};
   vec3f normal   = {0, 0, 0};
+  int   bounces  = 0;
 };
 
 // Recursive path tracing.
@@ -439,6 +706,7 @@ static trace_result trace_path(const scene_data& scene, const scene_bvh& bvh,
   auto hit_albedo    = vec3f{0, 0, 0};
   auto hit_normal    = vec3f{0, 0, 0};
   auto opbounce      = 0;
+  auto bounces       = 0;
 
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
@@ -449,6 +717,7 @@ static trace_result trace_path(const scene_data& scene, const scene_bvh& bvh,
         radiance += weight * eval_environment(scene, ray.d);
       break;
     }
+    bounces += 1;
 
     // handle transmission if inside a volume
     auto in_volume = false;
@@ -568,7 +837,7 @@ static trace_result trace_path(const scene_data& scene, const scene_bvh& bvh,
     }
   }
 
-  return {radiance, hit, hit_albedo, hit_normal};
+  return {radiance, hit, hit_albedo, hit_normal, bounces};
 }
 
 // Recursive path tracing.
@@ -586,6 +855,7 @@ static trace_result trace_pathdirect(const scene_data& scene,
   auto hit_normal    = vec3f{0, 0, 0};
   auto next_emission = true;
   auto opbounce      = 0;
+  auto bounces       = 0;
 
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
@@ -596,6 +866,7 @@ static trace_result trace_pathdirect(const scene_data& scene,
         radiance += weight * eval_environment(scene, ray.d);
       break;
     }
+    bounces += 1;
 
     // handle transmission if inside a volume
     auto in_volume = false;
@@ -739,7 +1010,7 @@ static trace_result trace_pathdirect(const scene_data& scene,
     }
   }
 
-  return {radiance, hit, hit_albedo, hit_normal};
+  return {radiance, hit, hit_albedo, hit_normal, bounces};
 }
 
 // Recursive path tracing with MIS.
@@ -756,6 +1027,7 @@ static trace_result trace_pathmis(const scene_data& scene, const scene_bvh& bvh,
   auto hit_albedo    = vec3f{0, 0, 0};
   auto hit_normal    = vec3f{0, 0, 0};
   auto opbounce      = 0;
+  auto bounces       = 0;
 
   // MIS helpers
   auto mis_heuristic = [](float this_pdf, float other_pdf) {
@@ -775,6 +1047,7 @@ static trace_result trace_pathmis(const scene_data& scene, const scene_bvh& bvh,
         radiance += weight * eval_environment(scene, ray.d);
       break;
     }
+    bounces += 1;
 
     // handle transmission if inside a volume
     auto in_volume = false;
@@ -922,7 +1195,245 @@ static trace_result trace_pathmis(const scene_data& scene, const scene_bvh& bvh,
     }
   }
 
-  return {radiance, hit, hit_albedo, hit_normal};
+  return {radiance, hit, hit_albedo, hit_normal, bounces};
+}
+
+// Recursive path tracing with MIS and guiding. Indirect directions are
+// sampled from a mixture of the BSDF and the guiding tree learned at the
+// shading point. While training, the trees record the indirect radiance
+// reaching path vertices.
+static trace_result trace_pathguided(const scene_data& scene,
+    const scene_bvh& bvh, const trace_lights& lights, trace_guiding& guiding,
+    bool training, const ray3f& ray_, rng_state& rng,
+    const trace_params& params) {
+  // initialize
+  auto radiance      = vec3f{0, 0, 0};
+  auto weight        = vec3f{1, 1, 1};
+  auto ray           = ray_;
+  auto volume_stack  = vector<material_point>{};
+  auto max_roughness = 0.0f;
+  auto hit           = false;
+  auto hit_albedo    = vec3f{0, 0, 0};
+  auto hit_normal    = vec3f{0, 0, 0};
+  auto opbounce      = 0;
+  auto bounces       = 0;
+
+  // MIS helpers
+  auto mis_heuristic = [](float this_pdf, float other_pdf) {
+    return (this_pdf * this_pdf) /
+           (this_pdf * this_pdf + other_pdf * other_pdf);
+  };
+  auto next_emission     = true;
+  auto next_intersection = scene_intersection{};
+
+  // guiding records
+  struct guided_vertex {
+    int   bounce    = 0;
+    int   leaf      = 0;
+    vec3f direction = {0, 0, 0};
+    float pdf       = 0;
+    vec3f weight    = {0, 0, 0};
+    vec3f radiance  = {0, 0, 0};
+  };
+  auto vertices = vector<guided_vertex>{};
+
+  // trace  path
+  for (auto bounce = 0; bounce < params.bounces; bounce++) {
+    // intersect next point
+    auto intersection = next_emission ? intersect_scene(bvh, scene, ray)
+                                      : next_intersection;
+    if (!intersection.hit) {
+      if ((bounce > 0 || !params.envhidden) && next_emission)
+        radiance += weight * eval_environment(scene, ray.d);
+      break;
+    }
+    bounces += 1;
+
+    // handle transmission if inside a volume
+    auto in_volume = false;
+    if (!volume_stack.empty()) {
+      auto& vsdf     = volume_stack.back();
+      auto  distance = sample_transmittance(
+          vsdf.density, intersection.distance, rand1f(rng), rand1f(rng));
+      weight *= eval_transmittance(vsdf.density, distance) /
+                sample_transmittance_pdf(
+                    vsdf.density, distance, intersection.distance);
+      in_volume             = distance < intersection.distance;
+      intersection.distance = distance;
+    }
+
+    // switch between surface and volume
+    if (!in_volume) {
+      // prepare shading point
+      auto outgoing = -ray.d;
+      auto position = eval_shading_position(scene, intersection, outgoing);
+      auto normal   = eval_shading_normal(scene, intersection, outgoing);
+      auto material = eval_material(scene, intersection);
+
+      // correct roughness
+      if (params.nocaustics) {
+        max_roughness      = max(material.roughness, max_roughness);
+        material.roughness = max_roughness;
+      }
+
+      // handle opacity
+      if (material.opacity < 1 && rand1f(rng) >= material.opacity) {
+        if (opbounce++ > 128) break;
+        ray = {position + ray.d * 1e-2f, ray.d};
+        bounce -= 1;
+        continue;
+      }
+
+      // set hit variables
+      if (bounce == 0) {
+        hit        = true;
+        hit_albedo = material.color;
+        hit_normal = normal;
+      }
+
+      // accumulate emission
+      if (next_emission) {
+        radiance += weight * eval_emission(material, normal, outgoing);
+      }
+
+      // next direction
+      auto incoming = vec3f{0, 0, 0};
+      if (!is_delta(material)) {
+        // guiding tree, used once trained
+        auto  leaf       = find_guiding_leaf(guiding, position);
+        auto& dtree      = guiding.sampling[leaf];
+        auto  guide_prob = dtree.energy[0] > 0 ? 0.5f : 0.0f;
+        auto  guided_pdf = [&](const vec3f& incoming) {
+          auto bsdf_pdf = sample_bsdfcos_pdf(
+              material, normal, outgoing, incoming);
+          if (guide_prob == 0) return bsdf_pdf;
+          return guide_prob * sample_dtree_pdf(dtree, incoming) +
+                 (1 - guide_prob) * bsdf_pdf;
+        };
+
+        // direct with MIS --- light
+        for (auto sample_light : {true, false}) {
+          if (sample_light) {
+            incoming = sample_lights(
+                scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
+          } else if (rand1f(rng) < guide_prob) {
+            incoming = sample_dtree(dtree, rand2f(rng));
+          } else {
+            incoming = sample_bsdfcos(
+                material, normal, outgoing, rand1f(rng), rand2f(rng));
+          }
+          if (incoming == vec3f{0, 0, 0}) break;
+          auto bsdfcos   = eval_bsdfcos(material, normal, outgoing, incoming);
+          auto light_pdf = sample_lights_pdf(
+              scene, bvh, lights, position, incoming);
+          auto bsdf_pdf = guided_pdf(incoming);
+          auto mis_weight = sample_light
+                                ? mis_heuristic(light_pdf, bsdf_pdf) / light_pdf
+                                : mis_heuristic(bsdf_pdf, light_pdf) / bsdf_pdf;
+          if (bsdfcos != vec3f{0, 0, 0} && mis_weight != 0) {
+            auto intersection = intersect_scene(
+                bvh, scene, {position, incoming});
+            if (!sample_light) next_intersection = intersection;
+            auto emission = vec3f{0, 0, 0};
+            if (!intersection.hit) {
+              emission = eval_environment(scene, incoming);
+            } else {
+              auto material = eval_material(scene,
+                  scene.instances[intersection.instance], intersection.element,
+                  intersection.uv);
+              emission      = eval_emission(material,
+                  eval_shading_normal(scene,
+                      scene.instances[intersection.instance],
+                      intersection.element, intersection.uv, -incoming),
+                  -incoming);
+            }
+            radiance += weight * bsdfcos * emission * mis_weight;
+          }
+        }
+
+        // indirect
+        auto pdf = guided_pdf(incoming);
+        weight *= eval_bsdfcos(material, normal, outgoing, incoming) / pdf;
+        next_emission = false;
+        if (training && incoming != vec3f{0, 0, 0}) {
+          vertices.push_back({bounce, leaf, incoming, pdf, weight, radiance});
+        }
+      } else {
+        incoming = sample_delta(material, normal, outgoing, rand1f(rng));
+        weight *= eval_delta(material, normal, outgoing, incoming) /
+                  sample_delta_pdf(material, normal, outgoing, incoming);
+        next_emission = true;
+      }
+
+      // update volume stack
+      if (is_volumetric(scene, intersection) &&
+          dot(normal, outgoing) * dot(normal, incoming) < 0) {
+        if (volume_stack.empty()) {
+          auto material = eval_material(scene, intersection);
+          volume_stack.push_back(material);
+        } else {
+          volume_stack.pop_back();
+        }
+      }
+
+      // setup next iteration
+      ray = {position, incoming};
+    } else {
+      // prepare shading point
+      auto  outgoing = -ray.d;
+      auto  position = ray.o + ray.d * intersection.distance;
+      auto& vsdf     = volume_stack.back();
+
+      // next direction
+      auto incoming = vec3f{0, 0, 0};
+      if (rand1f(rng) < 0.5f) {
+        incoming = sample_scattering(vsdf, outgoing, rand1f(rng), rand2f(rng));
+        next_emission = true;
+      } else {
+        incoming = sample_lights(
+            scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
+        next_emission = true;
+      }
+      weight *=
+          eval_scattering(vsdf, outgoing, incoming) /
+          (0.5f * sample_scattering_pdf(vsdf, outgoing, incoming) +
+              0.5f * sample_lights_pdf(scene, bvh, lights, position, incoming));
+
+      // setup next iteration
+      ray = {position, incoming};
+    }
+
+    // check weight
+    if (weight == vec3f{0, 0, 0} || !isfinite(weight)) break;
+
+    // russian roulette
+    if (bounce > 3) {
+      auto rr_prob = min((float)0.99, max(weight));
+      if (rand1f(rng) >= rr_prob) break;
+      weight *= 1 / rr_prob;
+      if (!vertices.empty() && vertices.back().bounce == bounce)
+        vertices.back().weight = weight;
+    }
+  }
+
+  // record the indirect radiance that reached each vertex from its next
+  // direction, recovered from what the path gathered after it
+  for (auto& vertex : vertices) {
+    auto incoming = radiance - vertex.radiance;
+    auto value    = 0.0f;
+    auto channels = 0;
+    for (auto c = 0; c < 3; c++) {
+      if (vertex.weight[c] <= 0) continue;
+      value += incoming[c] / vertex.weight[c];
+      channels += 1;
+    }
+    if (channels == 0) continue;
+    value /= channels * vertex.pdf;
+    if (!isfinite(value)) continue;
+    record_guiding(guiding, vertex.leaf, vertex.direction, value);
+  }
+
+  return {radiance, hit, hit_albedo, hit_normal, bounces};
 }
 
 // Recursive path tracing.
@@ -937,6 +1448,7 @@ static trace_result trace_naive(const scene_data& scene, const scene_bvh& bvh,
   auto hit_albedo = vec3f{0, 0, 0};
   auto hit_normal = vec3f{0, 0, 0};
   auto opbounce   = 0;
+  auto bounces    = 0;
 
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
@@ -947,6 +1459,7 @@ static trace_result trace_naive(const scene_data& scene, const scene_bvh& bvh,
         radiance += weight * eval_environment(scene, ray.d);
       break;
     }
+    bounces += 1;
 
     // prepare shading point
     auto outgoing = -ray.d;
@@ -1001,7 +1514,7 @@ static trace_result trace_naive(const scene_data& scene, const scene_bvh& bvh,
     ray = {position, incoming};
   }
 
-  return {radiance, hit, hit_albedo, hit_normal};
+  return {radiance, hit, hit_albedo, hit_normal, bounces};
 }
 
 // Eyelight for quick previewing.
@@ -1016,6 +1529,7 @@ static trace_result trace_eyelight(const scene_data& scene,
   auto hit_albedo = vec3f{0, 0, 0};
   auto hit_normal = vec3f{0, 0, 0};
   auto opbounce   = 0;
+  auto bounces    = 0;
 
   // trace  path
   for (auto bounce = 0; bounce < max(params.bounces, 4); bounce++) {
@@ -1026,6 +1540,7 @@ static trace_result trace_eyelight(const scene_data& scene,
         radiance += weight * eval_environment(scene, ray.d);
       break;
     }
+    bounces += 1;
 
     // prepare shading point
     auto outgoing = -ray.d;
@@ -1068,7 +1583,7 @@ static trace_result trace_eyelight(const scene_data& scene,
     ray = {position, incoming};
   }
 
-  return {radiance, hit, hit_albedo, hit_normal};
+  return {radiance, hit, hit_albedo, hit_normal, bounces};
 }
 
 // Eyelight with ambient occlusion for quick previewing.
@@ -1083,6 +1598,7 @@ static trace_result trace_eyelightao(const scene_data& scene,
   auto hit_albedo = vec3f{0, 0, 0};
   auto hit_normal = vec3f{0, 0, 0};
   auto opbounce   = 0;
+  auto bounces    = 0;
 
   // trace  path
   for (auto bounce = 0; bounce < max(params.bounces, 4); bounce++) {
@@ -1093,6 +1609,7 @@ static trace_result trace_eyelightao(const scene_data& scene,
         radiance += weight * eval_environment(scene, ray.d);
       break;
     }
+    bounces += 1;
 
     // prepare shading point
     auto outgoing = -ray.d;
@@ -1139,7 +1656,7 @@ static trace_result trace_eyelightao(const scene_data& scene,
     ray = {position, incoming};
   }
 
-  return {radiance, hit, hit_albedo, hit_normal};
+  return {radiance, hit, hit_albedo, hit_normal, bounces};
 }
 
 // Furnace test.
@@ -1154,6 +1671,7 @@ static trace_result trace_furnace(const scene_data& scene, const scene_bvh& bvh,
   auto hit_albedo = vec3f{0, 0, 0};
   auto hit_normal = vec3f{0, 0, 0};
   auto opbounce   = 0;
+  auto bounces    = 0;
   auto in_volume  = false;
 
   // trace  path
@@ -1171,6 +1689,7 @@ static trace_result trace_furnace(const scene_data& scene, const scene_bvh& bvh,
         radiance += weight * eval_environment(scene, ray.d);
       break;
     }
+    bounces += 1;
 
     // prepare shading point
     auto outgoing = -ray.d;
@@ -1233,7 +1752,7 @@ static trace_result trace_furnace(const scene_data& scene, const scene_bvh& bvh,
   }
 
   // done
-  return {radiance, hit, hit_albedo, hit_normal};
+  return {radiance, hit, hit_albedo, hit_normal, bounces};
 }
 
 // False color rendering
@@ -1314,7 +1833,7 @@ static trace_result trace_falsecolor(const scene_data& scene,
   }
 
   // done
-  return {srgb_to_rgb(result), true, material.color, normal};
+  return {srgb_to_rgb(result), true, material.color, normal, 1};
 }
 
 // Trace a single ray from the camera using the given algorithm.
@@ -1326,6 +1845,7 @@ static sampler_func get_trace_sampler_func(const trace_params& params) {
     case trace_sampler_type::path: return trace_path;
     case trace_sampler_type::pathdirect: return trace_pathdirect;
     case trace_sampler_type::pathmis: return trace_pathmis;
+    case trace_sampler_type::pathguided: return nullptr;  // see trace_sample
     case trace_sampler_type::naive: return trace_naive;
     case trace_sampler_type::eyelight: return trace_eyelight;
     case trace_sampler_type::eyelightao: return trace_eyelightao;
@@ -1344,6 +1864,7 @@ bool is_sampler_lit(const trace_params& params) {
     case trace_sampler_type::path: return true;
     case trace_sampler_type::pathdirect: return true;
     case trace_sampler_type::pathmis: return true;
+    case trace_sampler_type::pathguided: return true;
     case trace_sampler_type::naive: return true;
     case trace_sampler_type::eyelight: return false;
     case trace_sampler_type::eyelightao: return false;
@@ -1365,11 +1886,16 @@ void trace_sample(trace_state& state, const scene_data& scene,
   auto  idx     = state.width * j + i;
   auto  ray     = sample_camera(camera, {i, j}, {state.width, state.height},
       rand2f(state.rngs[idx]), rand2f(state.rngs[idx]), params.tentfilter);
-  auto [radiance, hit, albedo, normal] = sampler(
-      scene, bvh, lights, ray, state.rngs[idx], params);
+  auto [radiance, hit, albedo, normal, bounces] =
+      params.sampler == trace_sampler_type::pathguided
+          ? trace_pathguided(scene, bvh, lights, state.guiding,
+                is_guiding_training(state, params), ray, state.rngs[idx],
+                params)
+          : sampler(scene, bvh, lights, ray, state.rngs[idx], params);
   if (!isfinite(radiance)) radiance = {0, 0, 0};
   if (max(radiance) > params.clamp)
     radiance = radiance * (params.clamp / max(radiance));
+  state.bounces[idx] += bounces;
   if (hit) {
     state.image[idx] += {radiance.x, radiance.y, radiance.z, 1};
     state.albedo[idx] += albedo;
@@ -1394,16 +1920,19 @@ trace_state make_state(const scene_data& scene, const trace_params& params) {
     state.height = params.resolution;
     state.width  = (int)round(params.resolution * camera.aspect);
   }
-  state.samples = 0;
+  state.samples  = 0;
+  state.training = 0;
   state.image.assign(state.width * state.height, {0, 0, 0, 0});
   state.albedo.assign(state.width * state.height, {0, 0, 0});
   state.normal.assign(state.width * state.height, {0, 0, 0});
   state.hits.assign(state.width * state.height, 0);
+  state.bounces.assign(state.width * state.height, 0);
   state.rngs.assign(state.width * state.height, {});
   auto rng_ = make_rng(1301081);
   for (auto& rng : state.rngs) {
     rng = make_rng(params.seed, rand1i(rng_, 1 << 31) / 2 + 1);
   }
+  state.guiding = make_guiding(scene, params);
   return state;
 }
 
@@ -1472,7 +2001,7 @@ image_data trace_image(const scene_data& scene, const trace_params& params) {
   auto bvh    = make_bvh(scene, params);
   auto lights = make_lights(scene, params);
   auto state  = make_state(scene, params);
-  for (auto sample = 0; sample < params.samples; sample++) {
+  while (state.samples < params.samples) {
     trace_samples(state, scene, bvh, lights, params);
   }
   return get_render(state);
@@ -1487,14 +2016,16 @@ void trace_samples(trace_state& state, const scene_data& scene,
     for (auto j = 0; j < state.height; j++) {
       for (auto i = 0; i < state.width; i++) {
         trace_sample(state, scene, bvh, lights, i, j, params);
+        release_shapes(bvh);
       }
     }
   } else {
     parallel_for(state.width, state.height, [&](int i, int j) {
       trace_sample(state, scene, bvh, lights, i, j, params);
+      release_shapes(bvh);
     });
   }
-  state.samples += 1;
+  finish_samples(state, params);
 }
 
 // Check image type
@@ -1507,6 +2038,12 @@ static void check_image(
         linear ? "expected linear image" : "expected srgb image"};
 }
 
+// Samples accumulated in the state buffers, that are the training samples
+// until path guiding training ends
+static int get_accumulated(const trace_state& state) {
+  return state.samples != 0 ? state.samples : max(state.training, 1);
+}
+
 // Get resulting render
 image_data get_render(const trace_state& state) {
   auto image = make_image(state.width, state.height, true);
@@ -1515,7 +2052,7 @@ image_data get_render(const trace_state& state) {
 }
 void get_render(image_data& image, const trace_state& state) {
   check_image(image, state.width, state.height, true);
-  auto scale = 1.0f / (float)state.samples;
+  auto scale = 1.0f / (float)get_accumulated(state);
   for (auto idx = 0; idx < state.width * state.height; idx++) {
     image.pixels[idx] = state.image[idx] * scale;
   }
@@ -1539,7 +2076,7 @@ void get_denoised(image_data& image, const trace_state& state) {
   // get albedo and normal
   auto albedo = vector<vec3f>(image.pixels.size()),
        normal = vector<vec3f>(image.pixels.size());
-  auto scale  = 1.0f / (float)state.samples;
+  auto scale  = 1.0f / (float)get_accumulated(state);
   for (auto idx = 0; idx < state.width * state.height; idx++) {
     albedo[idx] = state.albedo[idx] * scale;
     normal[idx] = state.normal[idx] * scale;
@@ -1574,7 +2111,7 @@ image_data get_albedo(const trace_state& state) {
 }
 void get_albedo(image_data& albedo, const trace_state& state) {
   check_image(albedo, state.width, state.height, true);
-  auto scale = 1.0f / (float)state.samples;
+  auto scale = 1.0f / (float)get_accumulated(state);
   for (auto idx = 0; idx < state.width * state.height; idx++) {
     albedo.pixels[idx] = {state.albedo[idx].x * scale,
         state.albedo[idx].y * scale, state.albedo[idx].z * scale, 1.0f};
@@ -1587,7 +2124,7 @@ image_data get_normal(const trace_state& state) {
 }
 void get_normal(image_data& normal, const trace_state& state) {
   check_image(normal, state.width, state.height, true);
-  auto scale = 1.0f / (float)state.samples;
+  auto scale = 1.0f / (float)get_accumulated(state);
   for (auto idx = 0; idx < state.width * state.height; idx++) {
     normal.pixels[idx] = {state.normal[idx].x * scale,
         state.normal[idx].y * scale, state.normal[idx].z * scale, 1.0f};
@@ -1640,3 +2177,202 @@ void denoise_render(image_data& denoised, const image_data& render,
 }
 
 }  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF CHECKPOINTS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Checkpoint header
+static const auto trace_checkpoint_magic   = array<char, 4>{'Y', 'T', 'C', 'P'};
+static const auto trace_checkpoint_version = 3;
+
+// Hash of the scene and of the params that change the samples taken, so that
+// checkpoints of other renders are rejected. Structs with padding are hashed
+// by field.
+static uint64_t hash_checkpoint(
+    const scene_data& scene, const trace_params& params) {
+  auto hash = (uint64_t)0;
+
+  // scene
+  for (auto& camera : scene.cameras) {
+    hash = hash_value(hash, camera.frame);
+    hash = hash_value(hash, camera.orthographic);
+    hash = hash_value(hash, camera.lens);
+    hash = hash_value(hash, camera.film);
+    hash = hash_value(hash, camera.aspect);
+    hash = hash_value(hash, camera.focus);
+    hash = hash_value(hash, camera.aperture);
+  }
+  hash = hash_values(hash, scene.instances);
+  hash = hash_values(hash, scene.environments);
+  hash = hash_values(hash, scene.materials);
+  for (auto& shape : scene.shapes) hash = hash_value(hash, hash_shape(shape));
+  for (auto& texture : scene.textures)
+    hash = hash_value(hash, hash_texture(texture));
+
+  // params
+  hash = hash_value(hash, params.camera);
+  hash = hash_value(hash, params.resolution);
+  hash = hash_value(hash, params.sampler);
+  hash = hash_value(hash, params.falsecolor);
+  hash = hash_value(hash, params.samples);
+  hash = hash_value(hash, params.bounces);
+  hash = hash_value(hash, params.clamp);
+  hash = hash_value(hash, params.nocaustics);
+  hash = hash_value(hash, params.envhidden);
+  hash = hash_value(hash, params.tentfilter);
+  hash = hash_value(hash, params.seed);
+  hash = hash_value(hash, params.guidingsamples);
+  return hash;
+}
+
+// Save the rendering state
+bool save_checkpoint(const string& filename, const trace_state& state,
+    const scene_data& scene, const trace_params& params, string& error) {
+  auto data         = vector<byte>{};
+  auto write_values = [&](const auto* values, size_t count) {
+    auto start = (const byte*)values;
+    data.insert(data.end(), start, start + count * sizeof(values[0]));
+  };
+  auto write_value = [&](const auto& value) { write_values(&value, 1); };
+  auto write_array = [&](const auto& values) {
+    write_value((uint64_t)values.size());
+    write_values(values.data(), values.size());
+  };
+
+  // state
+  write_value(trace_checkpoint_magic);
+  write_value(trace_checkpoint_version);
+  write_value(hash_checkpoint(scene, params));
+  write_value(state.width);
+  write_value(state.height);
+  write_value(state.samples);
+  write_value(state.training);
+  write_array(state.image);
+  write_array(state.albedo);
+  write_array(state.normal);
+  write_array(state.hits);
+  write_array(state.rngs);
+
+  // guiding
+  auto& guiding = state.guiding;
+  write_value(guiding.bbox);
+  write_value(guiding.iteration);
+  write_value(guiding.next);
+  write_array(guiding.stree);
+  for (auto trees : {&guiding.sampling, &guiding.building}) {
+    write_value((uint64_t)trees->size());
+    for (auto& tree : *trees) {
+      write_array(tree.nodes);
+      write_array(tree.energy);
+    }
+  }
+  write_array(guiding.offsets);
+  write_value((uint64_t)guiding.records.size());
+  for (auto& record : guiding.records) write_value(record.load());
+  write_value((uint64_t)guiding.counts.size());
+  for (auto& count : guiding.counts) write_value(count.load());
+
+  // write to a temporary file and replace the previous checkpoint
+  return save_atomic(
+      filename, error, [&](const string& tempname, string& error) {
+        return save_binary(tempname, data, error);
+      });
+}
+
+// Load the rendering state
+bool load_checkpoint(const string& filename, trace_state& state,
+    const scene_data& scene, const trace_params& params, string& error) {
+  auto read_error = [&]() {
+    error = "corrupted checkpoint " + filename;
+    return false;
+  };
+  auto data = vector<byte>{};
+  if (!load_binary(filename, data, error)) return false;
+  auto offset      = (size_t)0;
+  auto read_values = [&](auto* values, size_t count) {
+    auto size = count * sizeof(values[0]);
+    if (offset + size > data.size()) return false;
+    memcpy((void*)values, data.data() + offset, size);
+    offset += size;
+    return true;
+  };
+  auto read_value = [&](auto& value) { return read_values(&value, 1); };
+  auto read_array = [&](auto& values) {
+    auto size = (uint64_t)0;
+    if (!read_value(size)) return false;
+    if (size > data.size() - offset) return false;
+    values.resize(size);
+    return read_values(values.data(), size);
+  };
+
+  // header
+  auto magic   = array<char, 4>{};
+  auto version = 0;
+  if (!read_value(magic) || !read_value(version)) return read_error();
+  if (magic != trace_checkpoint_magic || version != trace_checkpoint_version) {
+    error = "unsupported checkpoint " + filename;
+    return false;
+  }
+  auto hash = (uint64_t)0;
+  if (!read_value(hash)) return read_error();
+  if (hash != hash_checkpoint(scene, params)) {
+    error = "mismatched checkpoint " + filename;
+    return false;
+  }
+
+  // state
+  auto loaded = trace_state{};
+  if (!read_value(loaded.width) || !read_value(loaded.height) ||
+      !read_value(loaded.samples) || !read_value(loaded.training))
+    return read_error();
+  if (loaded.width != state.width || loaded.height != state.height) {
+    error = "mismatched checkpoint " + filename;
+    return false;
+  }
+  auto pixels = (size_t)state.width * (size_t)state.height;
+  if (!read_array(loaded.image) || !read_array(loaded.albedo) ||
+      !read_array(loaded.normal) || !read_array(loaded.hits) ||
+      !read_array(loaded.rngs))
+    return read_error();
+  if (loaded.image.size() != pixels || loaded.albedo.size() != pixels ||
+      loaded.normal.size() != pixels || loaded.hits.size() != pixels ||
+      loaded.rngs.size() != pixels)
+    return read_error();
+
+  // guiding
+  auto& guiding = loaded.guiding;
+  if (!read_value(guiding.bbox) || !read_value(guiding.iteration) ||
+      !read_value(guiding.next) || !read_array(guiding.stree))
+    return read_error();
+  for (auto trees : {&guiding.sampling, &guiding.building}) {
+    auto size = (uint64_t)0;
+    if (!read_value(size) || size > data.size() - offset) return read_error();
+    trees->resize(size);
+    for (auto& tree : *trees) {
+      if (!read_array(tree.nodes) || !read_array(tree.energy))
+        return read_error();
+    }
+  }
+  if (!read_array(guiding.offsets)) return read_error();
+  auto records = vector<float>{};
+  auto counts  = vector<int>{};
+  if (!read_array(records) || !read_array(counts)) return read_error();
+  guiding.records = vector<std::atomic<float>>(records.size());
+  for (auto idx = (size_t)0; idx < records.size(); idx++)
+    guiding.records[idx] = records[idx];
+  guiding.counts = vector<std::atomic<int>>(counts.size());
+  for (auto idx = (size_t)0; idx < counts.size(); idx++)
+    guiding.counts[idx] = counts[idx];
+  if (offset != data.size()) return read_error();
+
+  // bounce statistics are not checkpointed
+  loaded.bounces = std::move(state.bounces);
+
+  // done
+  state = std::move(loaded);
+  return true;
+}
+
+}  // namespace yocto
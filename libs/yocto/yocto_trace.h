@@ -37,6 +37,7 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <utility>
@@ -70,12 +71,18 @@ enum struct trace_sampler_type {
   path,        // path tracing
   pathdirect,  // path tracing with direct
   pathmis,     // path tracing with mis
+  pathguided,  // path tracing with learned guiding
   naive,       // naive path tracing
   eyelight,    // eyelight rendering
   eyelightao,  // eyelight with ambient occlusion
   furnace,     // furnace test
   falsecolor,  // false color rendering
 };
+// The pathguided sampler is opt-in. On the indirect-lit cornell box it did
+// not beat pathmis at equal time, with rmse 0.0463 in 8.6s against 0.0436 in
+// 5.8s. Its guiding trees are accumulated in thread order, so parallel
+// renders differ from run to run, and are reproducible only with noparallel.
+
 // Type of false color visualization
 enum struct trace_falsecolor_type {
   // clang-format off
@@ -88,7 +95,9 @@ enum struct trace_falsecolor_type {
 // Default trace seed
 const auto trace_default_seed = 961748941ull;
 
-// Options for trace functions
+// Options for trace functions. Guidingsamples are the training samples of
+// the pathguided sampler. They are not kept in the image, so they add to the
+// render time, and do not make pathguided faster than pathmis.
 struct trace_params {
   int                   camera         = 0;
   int                   resolution     = 1280;
@@ -103,12 +112,14 @@ struct trace_params {
   uint64_t              seed           = trace_default_seed;
   bool                  embreebvh      = false;
   bool                  highqualitybvh = false;
+  bool                  trianglesbvh   = false;
   bool                  noparallel     = false;
   int                   pratio         = 8;
   float                 exposure       = 0;
   bool                  filmic         = false;
   bool                  denoise        = false;
   int                   batch          = 1;
+  int                   guidingsamples = 64;
 };
 
 // Progressively computes an image.
@@ -136,16 +147,46 @@ struct trace_lights {
 // Check is a sampler requires lights
 bool is_sampler_lit(const trace_params& params);
 
-// Trace state
+// Directional quadtree over the square parametrization of the sphere. Node
+// children are stored contiguously, with nodes holding the first of them, or
+// zero for leaves.
+struct trace_dtree {
+  vector<int>   nodes  = {};
+  vector<float> energy = {};
+};
+
+// Path guiding structure in the style of SD-trees. A binary tree over the
+// scene bounds, split along cycling axes, holds a directional quadtree per
+// leaf. Leaves sample from the trees learned in the previous training pass
+// while recording into trees refined from them.
+struct trace_guiding {
+  bbox3f                     bbox      = {};
+  vector<vec3i>              stree     = {};  // axis or -1, child, leaf
+  vector<trace_dtree>        sampling  = {};  // per leaf
+  vector<trace_dtree>        building  = {};  // per leaf
+  vector<int>                offsets   = {};  // first record per leaf
+  vector<std::atomic<float>> records   = {};  // energy per building node
+  vector<std::atomic<int>>   counts    = {};  // samples per leaf
+  int                        iteration = 0;
+  int                        next      = 1;  // training at next update
+};
+
+// Trace state. Bounces count the path vertices traced per pixel, including
+// the transparent surfaces crossed, since the state was made. Samples counts
+// the samples kept in the image, while training counts the samples of the
+// path guiding training passes, that are discarded.
 struct trace_state {
-  int               width   = 0;
-  int               height  = 0;
-  int               samples = 0;
-  vector<vec4f>     image   = {};
-  vector<vec3f>     albedo  = {};
-  vector<vec3f>     normal  = {};
-  vector<int>       hits    = {};
-  vector<rng_state> rngs    = {};
+  int               width    = 0;
+  int               height   = 0;
+  int               samples  = 0;
+  int               training = 0;
+  vector<vec4f>     image    = {};
+  vector<vec3f>     albedo   = {};
+  vector<vec3f>     normal   = {};
+  vector<int>       hits     = {};
+  vector<int>       bounces  = {};
+  vector<rng_state> rngs     = {};
+  trace_guiding     guiding  = {};
 };
 
 // Initialize state.
@@ -157,7 +198,10 @@ trace_lights make_lights(const scene_data& scene, const trace_params& params);
 // Build the bvh acceleration structure.
 scene_bvh make_bvh(const scene_data& scene, const trace_params& params);
 
-// Progressively computes an image.
+// Progressively computes an image. With out-of-core shapes, callers of
+// trace_sample must call release_shapes(bvh) after each sample, as
+// trace_samples does, or the shapes it faults in stay pinned and the cache
+// can never evict them.
 void trace_samples(trace_state& state, const scene_data& scene,
     const scene_bvh& bvh, const trace_lights& lights,
     const trace_params& params);
@@ -165,6 +209,14 @@ void trace_sample(trace_state& state, const scene_data& scene,
     const scene_bvh& bvh, const trace_lights& lights, int i, int j,
     const trace_params& params);
 
+// Count the samples just taken for all pixels, and update the guiding
+// structure once all samples of a training pass are in. Called by
+// trace_samples, and by renderers that call trace_sample. Training samples
+// are counted in state.training and discarded when training ends, so that
+// rendering stops when state.samples reaches params.samples.
+void finish_samples(
+    trace_state& state, const trace_params& params, int samples = 1);
+
 // Get resulting render
 image_data get_render(const trace_state& state);
 void       get_render(image_data& render, const trace_state& state);
@@ -185,6 +237,17 @@ image_data denoise_render(const image_data& render, const image_data& albedo,
 void       denoise_render(image_data& denoised, const image_data& render,
           const image_data& albedo, const image_data& normal);
 
+// Save and load the rendering state to resume interrupted renders. Saving
+// writes to a temporary file that replaces the previous checkpoint only once
+// complete. Checkpoints store a hash of the scene and of the params that
+// change the samples, and loading rejects the ones made for other renders.
+// Resumed pathguided renders are bit-identical to uninterrupted ones only
+// when rendering serially, since parallel guiding trees differ by run.
+bool save_checkpoint(const string& filename, const trace_state& state,
+    const scene_data& scene, const trace_params& params, string& error);
+bool load_checkpoint(const string& filename, trace_state& state,
+    const scene_data& scene, const trace_params& params, string& error);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -194,7 +257,8 @@ namespace yocto {
 
 // trace sampler names
 inline const auto trace_sampler_names = vector<string>{"path", "pathdirect",
-    "pathmis", "naive", "eyelight", "eyelightao", "furnace", "falsecolor"};
+    "pathmis", "pathguided", "naive", "eyelight", "eyelightao", "furnace",
+    "falsecolor"};
 
 // false color names
 inline const auto trace_falsecolor_names = vector<string>{"position", "normal",
@@ -207,6 +271,7 @@ inline const auto trace_sampler_labels =
     vector<pair<trace_sampler_type, string>>{{trace_sampler_type::path, "path"},
         {trace_sampler_type::pathdirect, "pathdirect"},
         {trace_sampler_type::pathmis, "pathmis"},
+        {trace_sampler_type::pathguided, "pathguided"},
         {trace_sampler_type::naive, "naive"},
         {trace_sampler_type::eyelight, "eyelight"},
         {trace_sampler_type::eyelightao, "eyelightao"},
@@ -32,6 +32,8 @@
 
 #include "yocto_dgram.h"
 
+#include <algorithm>
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
@@ -74,3 +76,533 @@ namespace yocto {
   }
 
 }  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// DGRAM OPTIMIZATION
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Checks whether two materials render the same
+  static bool equal_materials(
+      const dgram_material& a, const dgram_material& b) {
+    return a.fill == b.fill && a.stroke == b.stroke &&
+           a.thickness == b.thickness && a.dash_period == b.dash_period &&
+           a.dash_phase == b.dash_phase && a.dash_on == b.dash_on &&
+           a.dash_cap == b.dash_cap && a.dashed == b.dashed;
+  }
+
+  // Camera projection used to find the primitives that reach the film. It
+  // inverts eval_camera, mapping camera-space points to image coordinates.
+  struct film_projection {
+    frame3f frame        = identity3x4f;
+    bool    orthographic = true;
+    vec2f   film         = {0, 0};
+    vec2f   center       = {0, 0};
+    float   lens         = 0;
+    float   distance     = 0;
+    bbox2f  region       = {};
+  };
+
+  static film_projection make_film_projection(const dgram_camera& camera,
+      const vec2f& offset, const vec2f& size, const float& scale) {
+    auto aspect = size.x / size.y;
+
+    auto projection         = film_projection{};
+    projection.frame        = inverse(
+        lookat_frame(camera.from, camera.to, {0, 1, 0}));
+    projection.orthographic = camera.orthographic;
+    projection.film         = aspect >= 1
+                                  ? vec2f{camera.film, camera.film / aspect}
+                                  : vec2f{camera.film * aspect, camera.film};
+    projection.center       = {camera.center.x * scale / size.x,
+        camera.center.y * scale / size.y};
+    projection.lens         = camera.lens / size.x * scale;
+    projection.distance     = length(camera.from - camera.to);
+
+    // scenes are shifted on the image by their offset, and a few pixels are
+    // added to account for pixel filtering
+    auto shift        = offset * scale * 2 / size;
+    projection.region = {-shift - 0.05f, 1 - shift + 0.05f};
+    return projection;
+  }
+
+  // Projects a point on the film. Returns false for points behind a
+  // perspective camera, which cannot be bounded on the film.
+  static bool project_point(
+      const film_projection& projection, const vec3f& p, vec2f& uv) {
+    auto& film   = projection.film;
+    auto& center = projection.center;
+    auto  q      = transform_point(projection.frame, p);
+    if (projection.orthographic) {
+      auto s = projection.distance / projection.lens;
+      uv     = {q.x / (film.x * s) + 0.5f - center.x,
+          0.5f + center.y - q.y / (film.y * s)};
+      return true;
+    } else {
+      if (q.z >= 0) return false;
+      auto t = projection.lens / -q.z;
+      uv     = {q.x * t / film.x + 0.5f - center.x,
+          0.5f + center.y - q.y * t / film.y};
+      return true;
+    }
+  }
+
+  // Checks whether the projection of a primitive lies outside the film
+  static bool is_outside(const int* vertices, int num,
+      const vector<vec2f>& uvs, const vector<bool>& projected,
+      const bbox2f& region) {
+    auto bounds = invalidb2f;
+    for (auto idx = 0; idx < num; idx++) {
+      if (!projected[vertices[idx]]) return false;
+      bounds = merge(bounds, uvs[vertices[idx]]);
+    }
+    return bounds.max.x < region.min.x || bounds.min.x > region.max.x ||
+           bounds.max.y < region.min.y || bounds.min.y > region.max.y;
+  }
+
+  // Removes the vertices not referenced by any primitive. Vertices keep their
+  // relative order, so that edges are extracted in the same order.
+  static void compact_vertices(dgram_shape& shape) {
+    auto vertex_map = vector<int>(shape.positions.size(), -1);
+    for (auto& point : shape.points) vertex_map[point] = 0;
+    for (auto& line : shape.lines) vertex_map[line.x] = vertex_map[line.y] = 0;
+    for (auto& triangle : shape.triangles)
+      vertex_map[triangle.x] = vertex_map[triangle.y] =
+          vertex_map[triangle.z] = 0;
+    for (auto& quad : shape.quads)
+      vertex_map[quad.x] = vertex_map[quad.y] = vertex_map[quad.z] =
+          vertex_map[quad.w] = 0;
+    for (auto& bezier : shape.beziers)
+      vertex_map[bezier.x] = vertex_map[bezier.y] = vertex_map[bezier.z] =
+          vertex_map[bezier.w] = 0;
+    for (auto& arc : shape.arcs)
+      vertex_map[arc.x] = vertex_map[arc.y] = vertex_map[arc.z] = 0;
+
+    auto positions = vector<vec3f>{};
+    for (auto idx = 0; idx < shape.positions.size(); idx++) {
+      if (vertex_map[idx] < 0) continue;
+      vertex_map[idx] = (int)positions.size();
+      positions.push_back(shape.positions[idx]);
+    }
+    shape.positions = std::move(positions);
+
+    for (auto& point : shape.points) point = vertex_map[point];
+    for (auto& line : shape.lines)
+      line = {vertex_map[line.x], vertex_map[line.y]};
+    for (auto& triangle : shape.triangles)
+      triangle = {vertex_map[triangle.x], vertex_map[triangle.y],
+          vertex_map[triangle.z]};
+    for (auto& quad : shape.quads)
+      quad = {vertex_map[quad.x], vertex_map[quad.y], vertex_map[quad.z],
+          vertex_map[quad.w]};
+    for (auto& bezier : shape.beziers)
+      bezier = {vertex_map[bezier.x], vertex_map[bezier.y],
+          vertex_map[bezier.z], vertex_map[bezier.w]};
+    for (auto& arc : shape.arcs)
+      arc = {vertex_map[arc.x], vertex_map[arc.y], vertex_map[arc.z]};
+  }
+
+  // Drops the primitives of an object that cannot reach the film, leaving the
+  // shape empty when none does. Primitives are only removed one by one when
+  // this does not change dashes and boundaries, since those depend on the
+  // other primitives in the shape. Beziers lie in the hull of their control
+  // points, while arcs may bulge out of their points and are always kept.
+  // Returns whether the shape changed.
+  static bool cull_shape(dgram_shape& shape, const frame3f& frame,
+      const dgram_material& material, const film_projection& projection,
+      const vec2f& size) {
+    // strokes, points and arrow heads extend past their vertices
+    auto margin = vec2f{2 * material.thickness + 2} / size;
+    auto region = bbox2f{
+        projection.region.min - margin, projection.region.max + margin};
+
+    auto uvs       = vector<vec2f>(shape.positions.size());
+    auto projected = vector<bool>(shape.positions.size());
+    for (auto idx = 0; idx < shape.positions.size(); idx++) {
+      projected[idx] = project_point(
+          projection, transform_point(frame, shape.positions[idx]), uvs[idx]);
+    }
+
+    auto outside = [&](const auto& element) {
+      return is_outside((const int*)&element,
+          (int)(sizeof(element) / sizeof(int)), uvs, projected, region);
+    };
+
+    auto culled = false;
+    if (material.dashed != dashed_line::never) {
+      for (auto& point : shape.points)
+        if (!outside(point)) return false;
+      for (auto& line : shape.lines)
+        if (!outside(line)) return false;
+      for (auto& bezier : shape.beziers)
+        if (!outside(bezier)) return false;
+      if (!shape.arcs.empty()) return false;
+      for (auto& triangle : shape.triangles)
+        if (!outside(triangle)) return false;
+      for (auto& quad : shape.quads)
+        if (!outside(quad)) return false;
+      culled = true;
+      shape  = dgram_shape{};
+      return culled;
+    }
+
+    auto points = vector<int>{};
+    for (auto& point : shape.points)
+      if (!outside(point)) points.push_back(point);
+    culled |= points.size() != shape.points.size();
+    shape.points = std::move(points);
+
+    auto lines = vector<vec2i>{};
+    auto ends  = vector<line_ends>{};
+    for (auto idx = 0; idx < shape.lines.size(); idx++) {
+      if (outside(shape.lines[idx])) continue;
+      lines.push_back(shape.lines[idx]);
+      if (idx < shape.ends.size()) ends.push_back(shape.ends[idx]);
+    }
+    culled |= lines.size() != shape.lines.size();
+    shape.lines = std::move(lines);
+    shape.ends  = std::move(ends);
+
+    auto beziers     = vector<vec4i>{};
+    auto bezier_ends = vector<line_ends>{};
+    for (auto idx = 0; idx < shape.beziers.size(); idx++) {
+      if (outside(shape.beziers[idx])) continue;
+      beziers.push_back(shape.beziers[idx]);
+      if (idx < shape.bezier_ends.size())
+        bezier_ends.push_back(shape.bezier_ends[idx]);
+    }
+    culled |= beziers.size() != shape.beziers.size();
+    shape.beziers     = std::move(beziers);
+    shape.bezier_ends = std::move(bezier_ends);
+
+    auto faces_outside = true;
+    for (auto& triangle : shape.triangles)
+      faces_outside = faces_outside && outside(triangle);
+    for (auto& quad : shape.quads)
+      faces_outside = faces_outside && outside(quad);
+
+    if (faces_outside) {
+      culled |= !shape.triangles.empty() || !shape.quads.empty();
+      shape.triangles.clear();
+      shape.quads.clear();
+      shape.fills.clear();
+    } else if (!shape.boundary) {
+      auto triangles = vector<vec3i>{};
+      for (auto& triangle : shape.triangles)
+        if (!outside(triangle)) triangles.push_back(triangle);
+      culled |= triangles.size() != shape.triangles.size();
+      shape.triangles = std::move(triangles);
+
+      auto quads = vector<vec4i>{};
+      auto fills = vector<vec4f>{};
+      for (auto idx = 0; idx < shape.quads.size(); idx++) {
+        if (outside(shape.quads[idx])) continue;
+        quads.push_back(shape.quads[idx]);
+        if (!shape.fills.empty()) fills.push_back(shape.fills[idx]);
+      }
+      culled |= quads.size() != shape.quads.size();
+      shape.quads = std::move(quads);
+      shape.fills = std::move(fills);
+    }
+
+    if (culled) compact_vertices(shape);
+    return culled;
+  }
+
+  // Primitive kinds, in the order used to composite the primitives of a shape
+  enum struct dgram_primitive { point, line, curve, triangle, quad, border };
+  constexpr auto num_primitives = 6;
+
+  // Kinds of primitives drawn by a shape and their color, when uniform.
+  // Overlapping primitives composite to the same color in any order only if
+  // they have the same color.
+  struct shape_colors {
+    int   kinds   = 0;  // bitmask of drawn kinds
+    int   uniform = 0;  // bitmask of kinds with a uniform color
+    vec3f colors[num_primitives] = {};
+  };
+
+  static shape_colors make_shape_colors(
+      const dgram_shape& shape, const dgram_material& material) {
+    auto colors = shape_colors{};
+    auto add    = [&](dgram_primitive kind, const vec3f& color, bool uniform) {
+      colors.kinds |= 1 << (int)kind;
+      if (uniform) colors.uniform |= 1 << (int)kind;
+      colors.colors[(int)kind] = color;
+    };
+
+    auto stroke = xyz(material.stroke), fill = xyz(material.fill);
+    if (!shape.points.empty()) add(dgram_primitive::point, stroke, true);
+    if (!shape.lines.empty()) add(dgram_primitive::line, stroke, true);
+    if (!shape.beziers.empty() || !shape.arcs.empty())
+      add(dgram_primitive::curve, stroke, true);
+    if (!shape.triangles.empty()) add(dgram_primitive::triangle, fill, true);
+    if (!shape.quads.empty()) {
+      auto uniform = true;
+      auto color   = shape.fills.empty() ? fill : xyz(shape.fills.front());
+      for (auto& quad_fill : shape.fills) uniform &= xyz(quad_fill) == color;
+      add(dgram_primitive::quad, color, uniform);
+    }
+    if (!shape.triangles.empty() || !shape.quads.empty())
+      add(dgram_primitive::border, stroke, true);
+    return colors;
+  }
+
+  // Merging shapes draws all the primitives of a kind before the ones of the
+  // next kind. Checks that a primitive of b moved before a primitive of a has
+  // the same color, so that the composite order does not matter.
+  static bool can_reorder(const shape_colors& a, const shape_colors& b) {
+    for (auto ka = 0; ka < num_primitives; ka++) {
+      if (!(a.kinds & (1 << ka))) continue;
+      for (auto kb = 0; kb < ka; kb++) {
+        if (!(b.kinds & (1 << kb))) continue;
+        if (!(a.uniform & (1 << ka)) || !(b.uniform & (1 << kb))) return false;
+        if (a.colors[ka] != b.colors[kb]) return false;
+      }
+    }
+    return true;
+  }
+
+  static shape_colors merge_colors(
+      const shape_colors& a, const shape_colors& b) {
+    auto colors    = shape_colors{};
+    colors.kinds   = a.kinds | b.kinds;
+    colors.uniform = (a.uniform & ~b.kinds) | (b.uniform & ~a.kinds) |
+                     (a.uniform & b.uniform);
+    for (auto k = 0; k < num_primitives; k++) {
+      auto mask = 1 << k;
+      if (a.kinds & mask) {
+        colors.colors[k] = a.colors[k];
+        if ((b.kinds & mask) && a.colors[k] != b.colors[k])
+          colors.uniform &= ~mask;
+      } else {
+        colors.colors[k] = b.colors[k];
+      }
+    }
+    return colors;
+  }
+
+  // Appends a shape to another one, moving its vertices in world space
+  static void merge_shape(dgram_shape& merged, const dgram_shape& shape,
+      const frame3f& frame, const dgram_material& material) {
+    auto offset = (int)merged.positions.size();
+    for (auto& position : shape.positions)
+      merged.positions.push_back(transform_point(frame, position));
+
+    for (auto& point : shape.points) merged.points.push_back(point + offset);
+
+    merged.ends.resize(merged.lines.size());
+    for (auto& line : shape.lines) merged.lines.push_back(line + offset);
+    merged.ends.insert(merged.ends.end(), shape.ends.begin(), shape.ends.end());
+    merged.ends.resize(merged.lines.size());
+
+    merged.bezier_ends.resize(merged.beziers.size());
+    for (auto& bezier : shape.beziers)
+      merged.beziers.push_back(bezier + offset);
+    merged.bezier_ends.insert(merged.bezier_ends.end(),
+        shape.bezier_ends.begin(), shape.bezier_ends.end());
+    merged.bezier_ends.resize(merged.beziers.size());
+
+    merged.arc_ends.resize(merged.arcs.size());
+    for (auto& arc : shape.arcs) merged.arcs.push_back(arc + offset);
+    merged.arc_ends.insert(
+        merged.arc_ends.end(), shape.arc_ends.begin(), shape.arc_ends.end());
+    merged.arc_ends.resize(merged.arcs.size());
+
+    for (auto& triangle : shape.triangles)
+      merged.triangles.push_back(triangle + offset);
+
+    if (!shape.fills.empty() && merged.fills.size() != merged.quads.size())
+      merged.fills.resize(merged.quads.size(), material.fill);
+    for (auto idx = 0; idx < shape.quads.size(); idx++) {
+      merged.quads.push_back(shape.quads[idx] + offset);
+      if (!shape.fills.empty())
+        merged.fills.push_back(shape.fills[idx]);
+      else if (!merged.fills.empty())
+        merged.fills.push_back(material.fill);
+    }
+
+    if (!shape.triangles.empty() || !shape.quads.empty())
+      merged.cull = shape.cull;
+  }
+
+  dgram_scene optimize_scene(const dgram_scene& scene, const int& cam,
+      const vec2f& size, const float& scale,
+      const dgram_optimize_params& params) {
+    auto optimized    = dgram_scene{};
+    optimized.offset  = scene.offset;
+    optimized.cameras = scene.cameras;
+    optimized.labels  = scene.labels;
+
+    // materials are mapped to the first equal one
+    auto material_map = vector<int>(scene.materials.size());
+    for (auto idx = 0; idx < scene.materials.size(); idx++) {
+      material_map[idx] = idx;
+      for (auto prev = 0; prev < idx; prev++) {
+        if (equal_materials(scene.materials[prev], scene.materials[idx])) {
+          material_map[idx] = prev;
+          break;
+        }
+      }
+    }
+
+    auto cull = params.cull_primitives && cam >= 0 &&
+                cam < scene.cameras.size();
+    auto projection = cull ? make_film_projection(scene.cameras[cam],
+                                 scene.offset, size, scale)
+                           : film_projection{};
+
+    // objects drawing shapes, merged in groups
+    struct object_group {
+      vector<int>         objects = {};
+      vector<dgram_shape> shapes  = {};
+      vector<bool>        culled  = {};
+      shape_colors        colors  = {};
+    };
+    auto groups = vector<object_group>{};
+
+    auto mergeable = [&](const object_group& group, const dgram_object& object,
+                         const dgram_shape& shape, const shape_colors& colors) {
+      if (!params.merge_objects) return false;
+      auto& last = scene.objects[group.objects.back()];
+      if (material_map[last.material] != material_map[object.material])
+        return false;
+      auto& material = scene.materials[object.material];
+      if (material.dashed != dashed_line::never) return false;
+      auto has_faces = [](const dgram_shape& shape) {
+        return !shape.triangles.empty() || !shape.quads.empty();
+      };
+      for (auto& group_shape : group.shapes) {
+        if (has_faces(group_shape) && group_shape.boundary) return false;
+        if (has_faces(group_shape) && has_faces(shape) &&
+            group_shape.cull != shape.cull)
+          return false;
+      }
+      if (has_faces(shape) && shape.boundary) return false;
+      return can_reorder(group.colors, colors);
+    };
+
+    // objects are emitted with the index of the input object they come from,
+    // so that shapes and labels keep their drawing order
+    auto objects      = vector<pair<int, dgram_object>>{};
+    auto label_object = [&](const dgram_object& object) {
+      auto label_object  = object;
+      label_object.shape = -1;
+      if (object.material != -1)
+        label_object.material = material_map[object.material];
+      return label_object;
+    };
+
+    for (auto idx = 0; idx < scene.objects.size(); idx++) {
+      auto& object = scene.objects[idx];
+      if (object.shape == -1) {
+        if (object.labels != -1) objects.push_back({idx, label_object(object)});
+        continue;
+      }
+
+      auto& material = scene.materials[object.material];
+      auto  shape    = scene.shapes[object.shape];
+      auto  culled   = cull ? cull_shape(shape, object.frame, material,
+                               projection, size)
+                            : false;
+      if (shape.points.empty() && shape.lines.empty() &&
+          shape.beziers.empty() && shape.arcs.empty() &&
+          shape.triangles.empty() && shape.quads.empty()) {
+        if (object.labels != -1) objects.push_back({idx, label_object(object)});
+        continue;
+      }
+
+      auto colors = make_shape_colors(shape, material);
+      if (!groups.empty() &&
+          mergeable(groups.back(), object, shape, colors)) {
+        auto& group  = groups.back();
+        group.colors = merge_colors(group.colors, colors);
+      } else {
+        auto& group  = groups.emplace_back();
+        group.colors = colors;
+      }
+      auto& group = groups.back();
+      group.objects.push_back(idx);
+      group.shapes.push_back(std::move(shape));
+      group.culled.push_back(culled);
+    }
+
+    // shapes left untouched are shared as in the input
+    auto shape_map = vector<int>(scene.shapes.size(), -1);
+    for (auto& group : groups) {
+      auto& first = scene.objects[group.objects.front()];
+      if (group.objects.size() == 1) {
+        auto object     = first;
+        object.material = material_map[first.material];
+        if (!group.culled.front()) {
+          if (shape_map[first.shape] == -1) {
+            shape_map[first.shape] = (int)optimized.shapes.size();
+            optimized.shapes.push_back(std::move(group.shapes.front()));
+          }
+          object.shape = shape_map[first.shape];
+        } else {
+          object.shape = (int)optimized.shapes.size();
+          optimized.shapes.push_back(std::move(group.shapes.front()));
+        }
+        objects.push_back({group.objects.front(), object});
+      } else {
+        auto& material = scene.materials[first.material];
+        auto  merged   = dgram_shape{};
+        for (auto idx = 0; idx < group.objects.size(); idx++) {
+          merge_shape(merged, group.shapes[idx],
+              scene.objects[group.objects[idx]].frame, material);
+        }
+        auto object     = dgram_object{};
+        object.shape    = (int)optimized.shapes.size();
+        object.material = material_map[first.material];
+        optimized.shapes.push_back(std::move(merged));
+        objects.push_back({group.objects.front(), object});
+
+        // labels are split from merged objects
+        for (auto idx : group.objects) {
+          auto& object = scene.objects[idx];
+          if (object.labels != -1)
+            objects.push_back({idx, label_object(object)});
+        }
+      }
+    }
+
+    std::stable_sort(objects.begin(), objects.end(),
+        [](auto& a, auto& b) { return a.first < b.first; });
+    for (auto& [idx, object] : objects) optimized.objects.push_back(object);
+
+    // materials
+    if (params.dedup_materials) {
+      auto used = vector<int>(scene.materials.size(), -1);
+      for (auto& object : optimized.objects) {
+        if (object.material == -1) continue;
+        if (used[object.material] == -1) used[object.material] = 0;
+      }
+      for (auto idx = 0; idx < scene.materials.size(); idx++) {
+        if (used[idx] == -1) continue;
+        used[idx] = (int)optimized.materials.size();
+        optimized.materials.push_back(scene.materials[idx]);
+      }
+      for (auto& object : optimized.objects) {
+        if (object.material != -1) object.material = used[object.material];
+      }
+    } else {
+      optimized.materials = scene.materials;
+    }
+
+    return optimized;
+  }
+
+  dgram_scenes optimize_scenes(const dgram_scenes& dgram, const int& cam,
+      const dgram_optimize_params& params) {
+    auto optimized  = dgram_scenes{};
+    optimized.size  = dgram.size;
+    optimized.scale = dgram.scale;
+    for (auto& scene : dgram.scenes) {
+      optimized.scenes.push_back(
+          optimize_scene(scene, cam, dgram.size, dgram.scale, params));
+    }
+    return optimized;
+  }
+
+}  // namespace yocto
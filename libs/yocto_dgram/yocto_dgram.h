@@ -103,11 +103,18 @@ namespace yocto {
     vector<vec3i> triangles = {};
     vector<vec4i> quads     = {};
 
+    // cubic Bézier curves, as four control points, and circular arcs, as the
+    // start point, a point along the arc and the end point
+    vector<vec4i> beziers = {};
+    vector<vec3i> arcs    = {};
+
     // flll colors for quads
     vector<vec4f> fills = {};
 
-    // end types for lines
-    vector<line_ends> ends = {};
+    // end types for lines, beziers and arcs
+    vector<line_ends> ends        = {};
+    vector<line_ends> bezier_ends = {};
+    vector<line_ends> arc_ends    = {};
 
     bool cull     = false;
     bool boundary = false;
@@ -143,4 +150,29 @@ namespace yocto {
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// DGRAM OPTIMIZATION
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  struct dgram_optimize_params {
+    bool merge_objects   = true;  // merge consecutive compatible objects
+    bool dedup_materials = true;  // remove duplicated materials
+    bool cull_primitives = true;  // drop primitives outside the film
+  };
+
+  // Simplifies a scene as seen from a camera, without changing its rendering.
+  // Objects sharing the same material are merged when this does not change the
+  // compositing order of overlapping primitives, primitives that cannot reach
+  // the film are dropped and equal materials are collapsed. Labels are kept
+  // untouched in separate objects. Without dedup_materials, material indices
+  // are preserved, so that the result can be traced with the input materials.
+  dgram_scene optimize_scene(const dgram_scene& scene, const int& cam,
+      const vec2f& size, const float& scale,
+      const dgram_optimize_params& params = {});
+  dgram_scenes optimize_scenes(const dgram_scenes& dgram, const int& cam,
+      const dgram_optimize_params& params = {});
+
+}  // namespace yocto
+
 #endif
\ No newline at end of file
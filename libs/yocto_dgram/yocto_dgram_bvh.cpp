@@ -36,9 +36,14 @@
 
 #include <algorithm>
 #include <future>
+#include <stdexcept>
 
 #include "yocto_dgram_geometry.h"
 
+#ifdef YOCTO_EMBREE
+#include <embree3/rtcore.h>
+#endif
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
@@ -247,9 +252,8 @@ namespace yocto {
     nodes.shrink_to_fit();
   }
 
-  dgram_shape_bvh make_bvh(const trace_shape& shape, bool highquality) {
-    auto bvh = dgram_shape_bvh{};
-
+  // Primitive bounds, in the order of the bvh primitive indices
+  static vector<bbox3f> primitive_bounds(const trace_shape& shape) {
     auto bboxes = vector<bbox3f>{};
 
     for (auto& point : shape.points) {
@@ -265,16 +269,35 @@ namespace yocto {
                 shape.radii[line.x], shape.radii[line.y], end.a, end.b);
     }
 
+    for (auto idx = 0; idx < shape.curve_spans.size(); idx++) {
+      auto& curve = shape.curves[shape.curve_spans[idx].curve];
+      auto& bbox  = bboxes.emplace_back();
+      bbox        = curve_bounds(shape.curve_spans, curve, idx);
+    }
+
+    // fills enlarged by half a pixel for analytic antialiasing
+    auto aa_radius = [&](int vertex) {
+      return shape.aa_radii.empty() ? 0.0f : shape.aa_radii[vertex];
+    };
+
     for (auto& triangle : shape.triangles) {
       auto& bbox = bboxes.emplace_back();
       bbox       = triangle_bounds(shape.positions[triangle.x],
                 shape.positions[triangle.y], shape.positions[triangle.z]);
+      auto r = max(aa_radius(triangle.x),
+          max(aa_radius(triangle.y), aa_radius(triangle.z)));
+      bbox.min -= r;
+      bbox.max += r;
     }
 
     for (auto& quad : shape.quads) {
       auto& bbox = bboxes.emplace_back();
       bbox       = quad_bounds(shape.positions[quad.x], shape.positions[quad.y],
                 shape.positions[quad.z], shape.positions[quad.w]);
+      auto r = max(max(aa_radius(quad.x), aa_radius(quad.y)),
+          max(aa_radius(quad.z), aa_radius(quad.w)));
+      bbox.min -= r;
+      bbox.max += r;
     }
 
     for (auto& border : shape.borders) {
@@ -284,13 +307,30 @@ namespace yocto {
           line_end::cap);
     }
 
-    build_bvh(bvh.nodes, bvh.primitives, bboxes, highquality);
+    return bboxes;
+  }
+
+  dgram_shape_bvh make_bvh(const trace_shape& shape, bool highquality) {
+    auto bvh = dgram_shape_bvh{};
+
+    build_bvh(bvh.nodes, bvh.primitives, primitive_bounds(shape), highquality);
 
     return bvh;
   }
 
-  dgram_scene_bvh make_bvh(
-      const trace_shapes& shapes, bool highquality, bool noparallel) {
+#ifdef YOCTO_EMBREE
+  // Embree bvh, implemented below
+  static dgram_scene_bvh make_embree_bvh(
+      const trace_shapes& shapes, bool highquality);
+#endif
+
+  dgram_scene_bvh make_bvh(const trace_shapes& shapes, bool highquality,
+      bool embree, bool noparallel) {
+    // embree
+#ifdef YOCTO_EMBREE
+    if (embree) return make_embree_bvh(shapes, highquality);
+#endif
+
     auto bvh    = dgram_scene_bvh{};
     auto bboxes = vector<bbox3f>{};
 
@@ -321,6 +361,194 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+  // Adds a hit, keeping only the ones within ray_eps from the closest. The ray
+  // is shortened to the end of this window, so that farther primitives are
+  // skipped while the hits inside the window are kept in any visit order.
+  // Curves are made of many spans, but are hit once at the closest one.
+  static void add_intersection(bvh_intersections& intersections, ray3f& ray,
+      const bvh_intersection& intersection) {
+    auto& hits = intersections.intersections;
+    if (intersection.element.primitive == primitive_type::curve) {
+      auto same = std::find_if(
+          hits.begin(), hits.end(), [&](const bvh_intersection& hit) {
+            return hit.shape == intersection.shape &&
+                   hit.element.primitive == primitive_type::curve &&
+                   hit.element.index == intersection.element.index;
+          });
+      if (same != hits.end()) {
+        if (same->distance <= intersection.distance) return;
+        hits.erase(same);
+      }
+    }
+    if (intersection.distance < intersections.distance) {
+      intersections.distance = intersection.distance;
+      intersections.position = intersection.position;
+      ray.tmax               = intersection.distance + ray_eps;
+      hits.erase(std::remove_if(hits.begin(), hits.end(),
+                     [&](const bvh_intersection& hit) {
+                       return hit.distance > ray.tmax;
+                     }),
+          hits.end());
+    }
+    hits.push_back(intersection);
+  }
+
+  // Intersects the half pixel that enlarges a fill across the boundary edges of
+  // a triangle or a quad, given by three of its corners, for analytic
+  // antialiasing
+  static bool intersect_fill_edges(const ray3f& ray, const trace_shape& shape,
+      const shape_element& element, const vec3f& p0, const vec3f& p1,
+      const vec3f& p2, float& dist, vec3f& pos, vec3f& norm) {
+    auto n   = cross(p1 - p0, p2 - p0);
+    auto den = dot(ray.d, n);
+    if (den == 0) return false;
+    auto t = dot(p0 - ray.o, n) / den;
+    if (t < ray.tmin || t > ray.tmax) return false;
+    if (eval_fill_coverage(ray, shape, element) <= 0) return false;
+    dist = t;
+    pos  = ray.o + t * ray.d;
+    norm = normalize(n);
+    return true;
+  }
+
+  // Intersects a shape primitive, in the order of the bvh primitive indices
+  static void intersect_primitive(const trace_shape& shape, int shape_id,
+      int prim, ray3f& ray, bvh_intersections& intersections) {
+    // shared variables
+    vec2f uv        = {0, 0};
+    float dist      = 0;
+    vec3f pos       = {0, 0, 0};
+    vec3f norm      = {0, 0, 0};
+    bool  hit_arrow = false;
+
+    auto i    = prim;
+    auto size = shape.points.size();
+    if (prim < size) {
+      auto& p = shape.points[i];
+      if (intersect_point(ray, shape.positions[p], shape.radii[p] * 3, uv,
+              dist, pos, norm)) {
+        add_intersection(intersections, ray,
+            bvh_intersection{
+                .shape    = shape_id,
+                .element  = shape_element{primitive_type::point, i},
+                .uv       = uv,
+                .distance = dist,
+                .position = pos,
+                .normal   = norm,
+            });
+      }
+    } else if (i -= shape.points.size(), size += shape.lines.size();
+               prim < size) {
+      auto& l   = shape.lines[i];
+      auto& end = shape.ends[i];
+
+      auto& plane_norm_0     = shape.plane_norms_0[i];
+      auto& plane_norm_1     = shape.plane_norms_1[i];
+      auto& plane_45a_norm_0 = shape.plane_45a_norms_0[i];
+      auto& plane_45a_norm_1 = shape.plane_45a_norms_1[i];
+      auto& plane_45b_norm_0 = shape.plane_45b_norms_0[i];
+      auto& plane_45b_norm_1 = shape.plane_45b_norms_1[i];
+
+      auto& arrow_center0 = shape.arrow_centers0[i];
+      auto& arrow_center1 = shape.arrow_centers1[i];
+      auto& arrow_radius0 = shape.arrow_radii0[i];
+      auto& arrow_radius1 = shape.arrow_radii1[i];
+
+      if (intersect_line(ray, shape.positions[l.x], shape.positions[l.y],
+              shape.radii[l.x], shape.radii[l.y], end.a, end.b,
+              plane_norm_0, plane_norm_1, plane_45a_norm_0,
+              plane_45a_norm_1, plane_45b_norm_0, plane_45b_norm_1,
+              arrow_center0, arrow_center1, arrow_radius0, arrow_radius1,
+              uv, dist, pos, norm, hit_arrow)) {
+        add_intersection(intersections, ray,
+            bvh_intersection{
+                .shape     = shape_id,
+                .element   = shape_element{primitive_type::line, i},
+                .uv        = uv,
+                .distance  = dist,
+                .position  = pos,
+                .normal    = norm,
+                .hit_arrow = hit_arrow,
+            });
+      }
+    } else if (i -= shape.lines.size(),
+               size += shape.curve_spans.size();
+               prim < size) {
+      auto c = shape.curve_spans[i].curve;
+      if (intersect_curve(ray, shape.curve_spans, shape.curves[c], i, uv,
+              dist, pos, norm, hit_arrow)) {
+        add_intersection(intersections, ray,
+            bvh_intersection{
+                .shape     = shape_id,
+                .element   = shape_element{primitive_type::curve, c},
+                .uv        = uv,
+                .distance  = dist,
+                .position  = pos,
+                .normal    = norm,
+                .hit_arrow = hit_arrow,
+            });
+      }
+    } else if (i -= shape.curve_spans.size(),
+               size += shape.triangles.size();
+               prim < size) {
+      auto& t       = shape.triangles[i];
+      auto  element = shape_element{primitive_type::triangle, i};
+      if (intersect_triangle(ray, shape.positions[t.x],
+              shape.positions[t.y], shape.positions[t.z], uv, dist, pos,
+              norm) ||
+          (!shape.aa_radii.empty() && shape.triangle_edges[i] != 0 &&
+              intersect_fill_edges(ray, shape, element, shape.positions[t.x],
+                  shape.positions[t.y], shape.positions[t.z], dist, pos,
+                  norm))) {
+        add_intersection(intersections, ray,
+            bvh_intersection{
+                .shape    = shape_id,
+                .element  = element,
+                .uv       = uv,
+                .distance = dist,
+                .position = pos,
+                .normal   = norm,
+            });
+      }
+    } else if (i -= shape.triangles.size(), size += shape.quads.size();
+               prim < size) {
+      auto& q       = shape.quads[i];
+      auto  element = shape_element{primitive_type::quad, i};
+      if (intersect_quad(ray, shape.positions[q.x], shape.positions[q.y],
+              shape.positions[q.z], shape.positions[q.w], uv, dist, pos,
+              norm) ||
+          (!shape.aa_radii.empty() && shape.quad_edges[i] != 0 &&
+              intersect_fill_edges(ray, shape, element, shape.positions[q.x],
+                  shape.positions[q.y], shape.positions[q.w], dist, pos,
+                  norm))) {
+        add_intersection(intersections, ray,
+            bvh_intersection{
+                .shape    = shape_id,
+                .element  = element,
+                .uv       = uv,
+                .distance = dist,
+                .position = pos,
+                .normal   = norm,
+            });
+      }
+    } else if (i -= shape.quads.size(), size += shape.borders.size();
+               prim < size) {
+      auto& b = shape.borders[i];
+      if (intersect_line(ray, shape.positions[b.x], shape.positions[b.y],
+              shape.radii[b.x], shape.radii[b.y], uv, dist, pos, norm)) {
+        add_intersection(intersections, ray,
+            bvh_intersection{
+                .shape    = shape_id,
+                .element  = shape_element{primitive_type::border, i},
+                .uv       = uv,
+                .distance = dist,
+                .position = pos,
+                .normal   = norm,
+            });
+      }
+    }
+  }
+
   static void intersect_bvh(const dgram_shape_bvh& bvh,
       const trace_shape& shape, const int& shape_id, ray3f& ray,
       bvh_intersections& intersections) {
@@ -332,13 +560,6 @@ namespace yocto {
     auto node_cur          = 0;
     node_stack[node_cur++] = 0;
 
-    // shared variables
-    vec2f uv        = {0, 0};
-    float dist      = 0;
-    vec3f pos       = {0, 0, 0};
-    vec3f norm      = {0, 0, 0};
-    bool  hit_arrow = false;
-
     // prepare ray for fast queries
     auto ray_dinv  = vec3f{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
     auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
@@ -366,130 +587,26 @@ namespace yocto {
         }
       } else {
         for (auto idx = node.start; idx < node.start + node.num; idx++) {
-          auto prim = bvh.primitives[idx];
-          auto i    = prim;
-          auto size = shape.points.size();
-          if (prim < size) {
-            auto& p = shape.points[i];
-            if (intersect_point(ray, shape.positions[p], shape.radii[p] * 3, uv,
-                    dist, pos, norm)) {
-              if (dist < ray.tmax - ray_eps)
-                intersections.intersections.clear();
-              ray.tmax = dist;
-
-              auto intersection = bvh_intersection{
-                  .shape    = shape_id,
-                  .element  = shape_element{primitive_type::point, i},
-                  .uv       = uv,
-                  .distance = dist,
-                  .position = pos,
-                  .normal   = norm,
-              };
-              intersections.intersections.push_back(intersection);
-            }
-          } else if (i -= shape.points.size(), size += shape.lines.size();
-                     prim < size) {
-            auto& l   = shape.lines[i];
-            auto& end = shape.ends[i];
-
-            auto& plane_norm_0     = shape.plane_norms_0[i];
-            auto& plane_norm_1     = shape.plane_norms_1[i];
-            auto& plane_45a_norm_0 = shape.plane_45a_norms_0[i];
-            auto& plane_45a_norm_1 = shape.plane_45a_norms_1[i];
-            auto& plane_45b_norm_0 = shape.plane_45b_norms_0[i];
-            auto& plane_45b_norm_1 = shape.plane_45b_norms_1[i];
-
-            auto& arrow_center0 = shape.arrow_centers0[i];
-            auto& arrow_center1 = shape.arrow_centers1[i];
-            auto& arrow_radius0 = shape.arrow_radii0[i];
-            auto& arrow_radius1 = shape.arrow_radii1[i];
-
-            if (intersect_line(ray, shape.positions[l.x], shape.positions[l.y],
-                    shape.radii[l.x], shape.radii[l.y], end.a, end.b,
-                    plane_norm_0, plane_norm_1, plane_45a_norm_0,
-                    plane_45a_norm_1, plane_45b_norm_0, plane_45b_norm_1,
-                    arrow_center0, arrow_center1, arrow_radius0, arrow_radius1,
-                    uv, dist, pos, norm, hit_arrow)) {
-              if (dist < ray.tmax - ray_eps)
-                intersections.intersections.clear();
-              ray.tmax = dist;
-
-              auto intersection = bvh_intersection{.shape = shape_id,
-                  .element   = shape_element{primitive_type::line, i},
-                  .uv        = uv,
-                  .distance  = dist,
-                  .position  = pos,
-                  .normal    = norm,
-                  .hit_arrow = hit_arrow};
-              intersections.intersections.push_back(intersection);
-            }
-          } else if (i -= shape.lines.size(), size += shape.triangles.size();
-                     prim < size) {
-            auto& t = shape.triangles[i];
-            if (intersect_triangle(ray, shape.positions[t.x],
-                    shape.positions[t.y], shape.positions[t.z], uv, dist, pos,
-                    norm)) {
-              if (dist < ray.tmax - ray_eps)
-                intersections.intersections.clear();
-              ray.tmax = dist;
-
-              auto intersection = bvh_intersection{
-                  .shape    = shape_id,
-                  .element  = shape_element{primitive_type::triangle, i},
-                  .uv       = uv,
-                  .distance = dist,
-                  .position = pos,
-                  .normal   = norm,
-              };
-              intersections.intersections.push_back(intersection);
-            }
-          } else if (i -= shape.triangles.size(), size += shape.quads.size();
-                     prim < size) {
-            auto& q = shape.quads[i];
-            if (intersect_quad(ray, shape.positions[q.x], shape.positions[q.y],
-                    shape.positions[q.z], shape.positions[q.w], uv, dist, pos,
-                    norm)) {
-              if (dist < ray.tmax - ray_eps)
-                intersections.intersections.clear();
-              ray.tmax = dist;
-
-              auto intersection = bvh_intersection{
-                  .shape    = shape_id,
-                  .element  = shape_element{primitive_type::quad, i},
-                  .uv       = uv,
-                  .distance = dist,
-                  .position = pos,
-                  .normal   = norm,
-              };
-              intersections.intersections.push_back(intersection);
-            }
-          } else if (i -= shape.quads.size(), size += shape.borders.size();
-                     prim < size) {
-            auto& b = shape.borders[i];
-            if (intersect_line(ray, shape.positions[b.x], shape.positions[b.y],
-                    shape.radii[b.x], shape.radii[b.y], uv, dist, pos, norm)) {
-              if (dist < ray.tmax - ray_eps)
-                intersections.intersections.clear();
-              ray.tmax = dist;
-
-              auto intersection = bvh_intersection{
-                  .shape    = shape_id,
-                  .element  = shape_element{primitive_type::border, i},
-                  .uv       = uv,
-                  .distance = dist,
-                  .position = pos,
-                  .normal   = norm,
-              };
-              intersections.intersections.push_back(intersection);
-            }
-          }
+          intersect_primitive(
+              shape, shape_id, bvh.primitives[idx], ray, intersections);
         }
       }
     }
   }
 
+#ifdef YOCTO_EMBREE
+  // Embree bvh, implemented below
+  static bvh_intersections intersect_embree_bvh(const dgram_scene_bvh& bvh,
+      const trace_shapes& shapes, const ray3f& ray);
+#endif
+
   bvh_intersections intersect_bvh(const dgram_scene_bvh& bvh,
       const trace_shapes& shapes, const ray3f& ray_) {
+    // embree
+#ifdef YOCTO_EMBREE
+    if (bvh.embree_bvh) return intersect_embree_bvh(bvh, shapes, ray_);
+#endif
+
     auto intersections = bvh_intersections{};
 
     // check empty
@@ -544,4 +661,134 @@ namespace yocto {
     return intersections;
   }
 
-}  // namespace yocto
\ No newline at end of file
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// EMBREE BVH
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+#ifdef YOCTO_EMBREE
+
+  // Get Embree device
+  static RTCDevice dgram_embree_device() {
+    static RTCDevice device = nullptr;
+    if (!device) {
+      device = rtcNewDevice("");
+      rtcSetDeviceErrorFunction(
+          device,
+          [](void* ctx, RTCError code, const char* message) {
+            throw std::runtime_error(
+                "embree error " + std::to_string(code) + ": " + message);
+          },
+          nullptr);
+    }
+    return device;
+  }
+
+  // Clear embree bvh
+  static void clear_embree_bvh(void* embree_bvh) {
+    if (embree_bvh) rtcReleaseScene((RTCScene)embree_bvh);
+  }
+
+  // Context passed to the intersection of user geometries
+  struct embree_context {
+    RTCIntersectContext context       = {};
+    const trace_shapes* shapes        = nullptr;
+    bvh_intersections*  intersections = nullptr;
+  };
+
+  // Bounds of user geometries, only used while building
+  static void embree_bounds(const RTCBoundsFunctionArguments* args) {
+    auto& bboxes   = *(const vector<bbox3f>*)args->geometryUserPtr;
+    auto& bbox     = bboxes[args->primID];
+    auto  bounds   = args->bounds_o;
+    bounds->lower_x = bbox.min.x;
+    bounds->lower_y = bbox.min.y;
+    bounds->lower_z = bbox.min.z;
+    bounds->upper_x = bbox.max.x;
+    bounds->upper_y = bbox.max.y;
+    bounds->upper_z = bbox.max.z;
+  }
+
+  // Intersects user geometries with the native primitive intersections. Hits
+  // are gathered in the context and only shorten the ray, since embree keeps
+  // just the closest one.
+  static void embree_intersect(const RTCIntersectFunctionNArguments* args) {
+    if (!args->valid[0]) return;
+    auto  context = (embree_context*)args->context;
+    auto  rays    = RTCRayHitN_RayN(args->rayhit, args->N);
+    auto& tfar    = RTCRayN_tfar(rays, args->N, 0);
+    auto  ray     = ray3f{{RTCRayN_org_x(rays, args->N, 0),
+                         RTCRayN_org_y(rays, args->N, 0),
+                         RTCRayN_org_z(rays, args->N, 0)},
+        {RTCRayN_dir_x(rays, args->N, 0), RTCRayN_dir_y(rays, args->N, 0),
+            RTCRayN_dir_z(rays, args->N, 0)},
+        RTCRayN_tnear(rays, args->N, 0), tfar};
+    intersect_primitive(context->shapes->shapes[args->geomID],
+        (int)args->geomID, (int)args->primID, ray, *context->intersections);
+    tfar = ray.tmax;
+  }
+
+  // Initialize Embree BVH with one user geometry per shape
+  static dgram_scene_bvh make_embree_bvh(
+      const trace_shapes& shapes, bool highquality) {
+    auto bvh       = dgram_scene_bvh{};
+    auto edevice   = dgram_embree_device();
+    bvh.embree_bvh = unique_ptr<void, void (*)(void*)>{
+        rtcNewScene(edevice), &clear_embree_bvh};
+    auto escene = (RTCScene)bvh.embree_bvh.get();
+    rtcSetSceneFlags(escene, RTC_SCENE_FLAG_ROBUST);
+    if (highquality) rtcSetSceneBuildQuality(escene, RTC_BUILD_QUALITY_HIGH);
+    auto bboxes = vector<vector<bbox3f>>(shapes.shapes.size());
+    for (auto idx = 0; idx < (int)shapes.shapes.size(); idx++) {
+      bboxes[idx] = primitive_bounds(shapes.shapes[idx]);
+      if (bboxes[idx].empty()) continue;
+      auto egeometry = rtcNewGeometry(edevice, RTC_GEOMETRY_TYPE_USER);
+      rtcSetGeometryUserPrimitiveCount(egeometry, (unsigned)bboxes[idx].size());
+      rtcSetGeometryUserData(egeometry, &bboxes[idx]);
+      rtcSetGeometryBoundsFunction(egeometry, embree_bounds, nullptr);
+      rtcSetGeometryIntersectFunction(egeometry, embree_intersect);
+      rtcCommitGeometry(egeometry);
+      rtcAttachGeometryByID(escene, egeometry, idx);
+      rtcReleaseGeometry(egeometry);
+    }
+    rtcCommitScene(escene);
+    return bvh;
+  }
+
+  // Intersect Embree BVH, gathering the same hits as the native bvh
+  static bvh_intersections intersect_embree_bvh(const dgram_scene_bvh& bvh,
+      const trace_shapes& shapes, const ray3f& ray) {
+    auto intersections = bvh_intersections{};
+    auto context       = embree_context{};
+    rtcInitIntersectContext(&context.context);
+    context.shapes        = &shapes;
+    context.intersections = &intersections;
+    RTCRayHit embree_ray;
+    embree_ray.ray.org_x     = ray.o.x;
+    embree_ray.ray.org_y     = ray.o.y;
+    embree_ray.ray.org_z     = ray.o.z;
+    embree_ray.ray.dir_x     = ray.d.x;
+    embree_ray.ray.dir_y     = ray.d.y;
+    embree_ray.ray.dir_z     = ray.d.z;
+    embree_ray.ray.tnear     = ray.tmin;
+    embree_ray.ray.tfar      = ray.tmax;
+    embree_ray.ray.time      = 0;
+    embree_ray.ray.mask      = (unsigned)-1;
+    embree_ray.ray.flags     = 0;
+    embree_ray.hit.geomID    = RTC_INVALID_GEOMETRY_ID;
+    embree_ray.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+    rtcIntersect1(
+        (RTCScene)bvh.embree_bvh.get(), &context.context, &embree_ray);
+
+    // sort
+    sort(
+        intersections.intersections.begin(), intersections.intersections.end());
+
+    return intersections;
+  }
+
+#endif
+
+}  // namespace yocto
@@ -33,6 +33,8 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <memory>
+
 #include "yocto_dgram.h"
 #include "yocto_dgram_shape.h"
 
@@ -42,6 +44,7 @@
 namespace yocto {
 
   // using directives
+  using std::unique_ptr;
 
 }  // namespace yocto
 
@@ -67,10 +70,16 @@ namespace yocto {
     vector<dgram_bvh_node>  nodes      = {};
     vector<int>             primitives = {};
     vector<dgram_shape_bvh> shapes     = {};
+
+    // embree
+    unique_ptr<void, void (*)(void*)> embree_bvh = {nullptr, nullptr};
   };
 
+  // Builds the bvh. With embree, when compiled with YOCTO_EMBREE, all
+  // primitives are embree user geometries that call the same intersection
+  // functions, so that images match the native bvh.
   dgram_scene_bvh make_bvh(const trace_shapes& shapes, bool highquality = false,
-      bool noparallel = false);
+      bool embree = false, bool noparallel = false);
 
 }  // namespace yocto
 
@@ -94,8 +103,12 @@ namespace yocto {
     }
   };
 
+  // Hits within ray_eps from the closest one, sorted by shape and element.
+  // The set does not depend on the order in which the bvh is visited.
   struct bvh_intersections {
     vector<bvh_intersection> intersections = {};
+    float                    distance      = flt_max;    // closest hit
+    vec3f                    position      = {0, 0, 0};  // closest hit
   };
 
   bvh_intersections intersect_bvh(const dgram_scene_bvh& bvh,
@@ -34,6 +34,7 @@
 // -----------------------------------------------------------------------------
 
 #include "yocto_dgram.h"
+#include "yocto_dgram_shape.h"
 
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
@@ -70,6 +71,18 @@ namespace yocto {
   // d is the distance of the depth of the result point. p must be in camera
   // coordinates.
   inline vec3f world_space_point(const vec3f& p, const float d);
+
+  // Evaluates a Bézier span at u with de Casteljau's algorithm.
+  template <typename T>
+  inline T eval_bezier(const T (&c)[4], float u);
+
+  // Splits a Bézier span in two halves with de Casteljau's algorithm.
+  template <typename T>
+  inline void split_bezier(const T (&c)[4], T (&c0)[4], T (&c1)[4]);
+
+  // Evaluates position and radius of a curve span at u.
+  inline void eval_curve_span(
+      const curve_span& span, float u, vec3f& pos, float& radius);
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -80,6 +93,10 @@ namespace yocto {
   inline bbox3f line_bounds(const vec3f& p0, const vec3f& p1, float r0,
       float r1, line_end e0, line_end e1);
 
+  // Bounds of a curve span, including the arrow-heads at the curve ends
+  inline bbox3f curve_bounds(const arena_vector<curve_span>& spans,
+      const trace_curve& curve, int span);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -101,6 +118,12 @@ namespace yocto {
   inline bool intersect_line(const ray3f& ray, const vec3f& p0, const vec3f& p1,
       float r0, float r1, vec2f& uv, float& dist, vec3f& pos, vec3f& norm);
 
+  // Intersect a ray with a curve span and the arrow-heads at the curve ends
+  inline bool intersect_curve(const ray3f& ray,
+      const arena_vector<curve_span>& spans, const trace_curve& curve,
+      int span, vec2f& uv, float& dist, vec3f& pos, vec3f& norm,
+      bool& hit_arrow);
+
   // Intersect a ray with a triangle
   inline bool intersect_triangle(const ray3f& ray, const vec3f& p0,
       const vec3f& p1, const vec3f& p2, vec2f& uv, float& dist, vec3f& pos,
@@ -144,6 +167,42 @@ namespace yocto {
   inline vec3f world_space_point(const vec3f& p, const float d) {
     return vec3f{p.x / p.z * d, p.y / p.z * d, d};
   }
+
+  template <typename T>
+  inline T eval_bezier(const T (&c)[4], float u) {
+    auto c01  = lerp(c[0], c[1], u);
+    auto c12  = lerp(c[1], c[2], u);
+    auto c23  = lerp(c[2], c[3], u);
+    auto c012 = lerp(c01, c12, u);
+    auto c123 = lerp(c12, c23, u);
+    return lerp(c012, c123, u);
+  }
+
+  template <typename T>
+  inline void split_bezier(const T (&c)[4], T (&c0)[4], T (&c1)[4]) {
+    auto c01  = (c[0] + c[1]) / 2;
+    auto c12  = (c[1] + c[2]) / 2;
+    auto c23  = (c[2] + c[3]) / 2;
+    auto c012 = (c01 + c12) / 2;
+    auto c123 = (c12 + c23) / 2;
+    auto cm   = (c012 + c123) / 2;
+
+    c0[0] = c[0];
+    c0[1] = c01;
+    c0[2] = c012;
+    c0[3] = cm;
+    c1[0] = cm;
+    c1[1] = c123;
+    c1[2] = c23;
+    c1[3] = c[3];
+  }
+
+  inline void eval_curve_span(
+      const curve_span& span, float u, vec3f& pos, float& radius) {
+    auto p = eval_bezier(span.points, u);
+    pos    = xyz(p) / p.w;
+    radius = eval_bezier(span.radii, u) / p.w;
+  }
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -219,6 +278,34 @@ namespace yocto {
     return {min(pac - rac, pbc - rbc), max(pac + rac, pbc + rbc)};
   }
 
+  inline bbox3f curve_bounds(const arena_vector<curve_span>& spans,
+      const trace_curve& curve, int span) {
+    // spans are contained in the hull of their control points
+    auto& cs   = spans[span];
+    auto  bbox = invalidb3f;
+    for (auto i = 0; i < 4; i++) {
+      auto& c = cs.points[i];
+      bbox    = merge(bbox, point_bounds(xyz(c) / c.w, cs.radii[i] / c.w));
+    }
+
+    // arrow-heads, with the barbs of stealth ones behind the base
+    if (span == curve.start && curve.ends.a != line_end::cap) {
+      auto& c = cs.points[0];
+      auto  p = xyz(c) / c.w;
+      auto  r = 2 * (distance(p, curve.arrow0.center) + curve.arrow0.radius);
+      bbox    = merge(bbox, point_bounds(p, r));
+    }
+    if (span == curve.start + curve.num - 1 &&
+        curve.ends.b != line_end::cap) {
+      auto& c = cs.points[3];
+      auto  p = xyz(c) / c.w;
+      auto  r = 2 * (distance(p, curve.arrow1.center) + curve.arrow1.radius);
+      bbox    = merge(bbox, point_bounds(p, r));
+    }
+
+    return bbox;
+  }
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -693,6 +780,192 @@ namespace yocto {
     return true;
   }
 
+  // Intersect the z axis with a curve span transformed in ray space. The span
+  // is split until it is flat, then the axis is tested against the point of
+  // the span closest to it along its chord. Clamping to the chord ends gives
+  // round caps. Sets u from the parameters u0 and u1 of the span ends.
+  inline bool intersect_curve_span(const curve_span& span, float u0, float u1,
+      int depth, float tmin, float& tmax, float& u, vec2f& offset,
+      float& radius) {
+    // reject the span if its hull does not contain the axis
+    vec3f q[4];
+    auto  r = 0.0f;
+    for (auto i = 0; i < 4; i++) {
+      q[i] = xyz(span.points[i]) / span.points[i].w;
+      r    = max(r, span.radii[i] / span.points[i].w);
+    }
+    if (max(q[0].x, max(q[1].x, max(q[2].x, q[3].x))) + r < 0) return false;
+    if (min(q[0].x, min(q[1].x, min(q[2].x, q[3].x))) - r > 0) return false;
+    if (max(q[0].y, max(q[1].y, max(q[2].y, q[3].y))) + r < 0) return false;
+    if (min(q[0].y, min(q[1].y, min(q[2].y, q[3].y))) - r > 0) return false;
+    if (max(q[0].z, max(q[1].z, max(q[2].z, q[3].z))) + r < tmin) return false;
+    if (min(q[0].z, min(q[1].z, min(q[2].z, q[3].z))) - r > tmax) return false;
+
+    if (depth > 0) {
+      auto span0 = curve_span{};
+      auto span1 = curve_span{};
+      split_bezier(span.points, span0.points, span1.points);
+      split_bezier(span.radii, span0.radii, span1.radii);
+      auto um   = (u0 + u1) / 2;
+      auto hit0 = intersect_curve_span(
+          span0, u0, um, depth - 1, tmin, tmax, u, offset, radius);
+      auto hit1 = intersect_curve_span(
+          span1, um, u1, depth - 1, tmin, tmax, u, offset, radius);
+      return hit0 || hit1;
+    }
+
+    auto d  = vec2f{q[3].x - q[0].x, q[3].y - q[0].y};
+    auto dd = dot(d, d);
+    auto s  = dd > 0 ? clamp(-dot(vec2f{q[0].x, q[0].y}, d) / dd, 0.0f, 1.0f)
+                     : 0.0f;
+
+    auto p  = vec3f{0, 0, 0};
+    auto rp = 0.0f;
+    eval_curve_span(span, s, p, rp);
+    if (p.x * p.x + p.y * p.y > rp * rp) return false;
+    if (p.z < tmin || p.z > tmax) return false;
+
+    tmax   = p.z;
+    u      = lerp(u0, u1, s);
+    offset = {p.x, p.y};
+    radius = rp;
+    return true;
+  }
+
+  // Intersect a ray with a curve span and the arrow-heads at the curve ends
+  inline bool intersect_curve(const ray3f& ray,
+      const arena_vector<curve_span>& spans, const trace_curve& curve,
+      int span, vec2f& uv, float& dist, vec3f& pos, vec3f& norm,
+      bool& hit_arrow) {
+    auto& cs     = spans[span];
+    auto  arrow0 = span == curve.start && curve.ends.a != line_end::cap;
+    auto  arrow1 = span == curve.start + curve.num - 1 &&
+                  curve.ends.b != line_end::cap;
+
+    // reject the body by its bounding sphere
+    auto sv   = xyz(cs.sphere) - ray.o;
+    auto sd   = dot(sv, ray.d);
+    auto body = dot(sv, sv) * dot(ray.d, ray.d) - sd * sd <=
+                cs.sphere.w * cs.sphere.w * dot(ray.d, ray.d);
+    if (!body && !arrow0 && !arrow1) return false;
+
+    // ray space, with the ray along the z axis
+    auto len   = length(ray.d);
+    auto frame = basis_fromz(ray.d / len);
+
+    auto  rspan = curve_span{};
+    vec2f q[4];
+    auto  r = 0.0f;
+    for (auto i = 0; i < 4; i++) {
+      auto& c         = cs.points[i];
+      auto  v         = xyz(c) - ray.o * c.w;
+      rspan.points[i] = {dot(frame.x, v), dot(frame.y, v), 0, c.w};
+      rspan.radii[i]  = cs.radii[i];
+      q[i]            = vec2f{rspan.points[i].x, rspan.points[i].y} / c.w;
+      r               = max(r, cs.radii[i] / c.w);
+    }
+
+    // the body is missed if the hull of the span does not contain the ray
+    body = body && max(q[0].x, max(q[1].x, max(q[2].x, q[3].x))) + r >= 0 &&
+           min(q[0].x, min(q[1].x, min(q[2].x, q[3].x))) - r <= 0 &&
+           max(q[0].y, max(q[1].y, max(q[2].y, q[3].y))) + r >= 0 &&
+           min(q[0].y, min(q[1].y, min(q[2].y, q[3].y))) - r <= 0;
+    if (!body && !arrow0 && !arrow1) return false;
+
+    hit_arrow = false;
+    auto hit  = false;
+    auto t    = ray.tmax;
+    auto p    = vec3f{0, 0, 0};
+    auto n    = vec3f{0, 0, 0};
+    auto u    = 0.0f;
+
+    // number of splits needed to approximate the span with segments within
+    // a fifth of its width
+    auto l     = max(
+        length(q[0] - 2 * q[1] + q[2]), length(q[1] - 2 * q[2] + q[3]));
+    auto eps   = r / 5;
+    auto depth = 0;
+    if (body && l > 0 && eps > 0)
+      depth = clamp(
+          (int)ceil(log2(1.41421356f * 6 * l / (8 * eps)) / 2), 0, 10);
+
+    if (body) {
+      for (auto i = 0; i < 4; i++) {
+        auto& c           = cs.points[i];
+        rspan.points[i].z = dot(frame.z, xyz(c) - ray.o * c.w);
+      }
+    }
+
+    auto k      = span - curve.start;
+    auto tmax   = ray.tmax * len;
+    auto offset = vec2f{0, 0};
+    auto radius = 0.0f;
+    if (body && intersect_curve_span(rspan, (float)k / curve.num,
+                    (float)(k + 1) / curve.num, depth, ray.tmin * len, tmax,
+                    u, offset, radius)) {
+      // the body is seen as a tube from the ray, hit on its front surface
+      auto s  = offset / radius;
+      auto sz = sqrt(max(1 - dot(s, s), 0.0f));
+      hit     = true;
+      t       = max(tmax - radius * sz, ray.tmin * len) / len;
+      p       = ray.o + t * ray.d;
+      n       = normalize(-frame.x * s.x - frame.y * s.y - frame.z * sz);
+    }
+
+    // cutting the body inside the arrow-heads
+    auto& a0 = curve.arrow0;
+    auto& a1 = curve.arrow1;
+    if (hit && curve.ends.a != line_end::cap && u < a0.trim &&
+        dot(p - a0.center, a0.plane_norm) < 0) {
+      hit = false;
+      t   = ray.tmax;
+    }
+    if (hit && curve.ends.b != line_end::cap && u > a1.trim &&
+        dot(p - a1.center, a1.plane_norm) < 0) {
+      hit = false;
+      t   = ray.tmax;
+    }
+
+    if (arrow0) {
+      auto apex = xyz(cs.points[0]) / cs.points[0].w;
+      auto dir  = normalize(a0.center - apex);
+      auto pna  = curve.ends.a == line_end::triangle_arrow ? a0.plane_norm
+                                                           : a0.plane_45a_norm;
+      auto pnb  = curve.ends.a == line_end::triangle_arrow ? a0.plane_norm
+                                                           : a0.plane_45b_norm;
+      if (intersect_arrow(
+              ray, apex, a0.center, a0.radius, dir, pna, pnb, t, p, n)) {
+        hit       = true;
+        hit_arrow = true;
+        u         = 0;
+      }
+    }
+
+    if (arrow1) {
+      auto apex = xyz(cs.points[3]) / cs.points[3].w;
+      auto dir  = normalize(a1.center - apex);
+      auto pna  = curve.ends.b == line_end::triangle_arrow ? a1.plane_norm
+                                                           : a1.plane_45a_norm;
+      auto pnb  = curve.ends.b == line_end::triangle_arrow ? a1.plane_norm
+                                                           : a1.plane_45b_norm;
+      if (intersect_arrow(
+              ray, apex, a1.center, a1.radius, dir, pna, pnb, t, p, n)) {
+        hit       = true;
+        hit_arrow = true;
+        u         = 1;
+      }
+    }
+
+    if (!hit) return false;
+
+    // intersection occurred: set params and exit
+    uv   = {u, 0};
+    dist = t;
+    pos  = p;
+    norm = n;
+    return true;
+  }
+
   // Intersect a ray with a triangle
   inline bool intersect_triangle(const ray3f& ray, const vec3f& p0,
       const vec3f& p1, const vec3f& p2, vec2f& uv, float& dist, vec3f& pos,
@@ -34,6 +34,8 @@
 
 #include <yocto/yocto_gui.h>
 
+#include "yocto_dgram_geometry.h"
+
 #ifdef YOCTO_OPENGL
 
 #include <glad/glad.h>
@@ -41,6 +43,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <future>
+#include <numeric>
 #include <stdexcept>
 
 #ifdef __APPLE__
@@ -100,6 +103,398 @@ namespace yocto {
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// RASTERIZED PREVIEW
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Projection of diagram points on the image, following eval_camera, in
+  // pixels with y up, with the distance from the camera in z
+  struct preview_projection {
+    frame3f frame        = identity3x4f;  // inverse camera frame
+    bool    orthographic = true;
+    vec2f   film         = {0, 0};
+    vec2f   center       = {0, 0};
+    float   lens         = 0;
+    float   distance     = 0;
+    vec2f   image        = {0, 0};
+    vec2f   offset       = {0, 0};  // scene offset in pixels
+  };
+
+  static preview_projection make_preview_projection(
+      const dgram_scene& scene, const dgram_trace_params& params) {
+    auto& camera     = scene.cameras.at(params.camera);
+    auto  aspect     = params.size.x / params.size.y;
+    auto  projection = preview_projection{};
+    projection.frame = inverse(
+        lookat_frame(camera.from, camera.to, {0, 1, 0}));
+    projection.orthographic = camera.orthographic;
+    projection.film         = aspect >= 1
+                                  ? vec2f{camera.film, camera.film / aspect}
+                                  : vec2f{camera.film * aspect, camera.film};
+    projection.center   = camera.center * params.scale / params.size;
+    projection.lens     = camera.lens * params.scale / params.size.x;
+    projection.distance = length(camera.from - camera.to);
+    projection.image    = {(float)params.width, (float)params.height};
+    projection.offset   = scene.offset * params.scale * params.width * 2 /
+                        params.size.x;
+    return projection;
+  }
+
+  // Projects a point, returning false if it is behind the camera
+  static bool project_point(
+      const preview_projection& projection, const vec3f& p, vec3f& pixel) {
+    auto q     = transform_point(projection.frame, p);
+    auto scale = projection.orthographic ? projection.lens / projection.distance
+                                         : projection.lens / -q.z;
+    if (!projection.orthographic && q.z >= 0) return false;
+    auto uv = vec2f{
+        q.x * scale / projection.film.x + 0.5f - projection.center.x,
+        0.5f + projection.center.y - q.y * scale / projection.film.y};
+    pixel   = {uv.x * projection.image.x + projection.offset.x,
+        projection.image.y - uv.y * projection.image.y - projection.offset.y,
+        -q.z};
+    return true;
+  }
+
+  static void add_preview_triangle(
+      shape_data& shape, const vec3f& p0, const vec3f& p1, const vec3f& p2) {
+    auto index = (int)shape.positions.size();
+    shape.positions.push_back(p0);
+    shape.positions.push_back(p1);
+    shape.positions.push_back(p2);
+    shape.triangles.push_back({index, index + 1, index + 2});
+  }
+
+  static void add_preview_disk(
+      shape_data& shape, const vec3f& center, float radius) {
+    if (radius <= 0) return;
+    auto steps = clamp((int)(radius * 2), 8, 32);
+    auto index = (int)shape.positions.size();
+    shape.positions.push_back(center);
+    for (auto step = 0; step < steps; step++) {
+      auto angle = 2 * pif * step / steps;
+      shape.positions.push_back(
+          center + vec3f{cos(angle) * radius, sin(angle) * radius, 0});
+      shape.triangles.push_back(
+          {index, index + 1 + step, index + 1 + (step + 1) % steps});
+    }
+  }
+
+  // Segments are expanded in screen space, keeping the depth of their ends
+  static void add_preview_segment(
+      shape_data& shape, const vec3f& p0, const vec3f& p1, float radius) {
+    auto direction = vec2f{p1.x - p0.x, p1.y - p0.y};
+    auto len       = length(direction);
+    if (radius <= 0 || len == 0) return;
+    auto normal = vec3f{-direction.y, direction.x, 0} * radius / len;
+    add_preview_triangle(shape, p0 - normal, p1 - normal, p1 + normal);
+    add_preview_triangle(shape, p0 - normal, p1 + normal, p0 + normal);
+  }
+
+  static void add_preview_arrow(shape_data& shape, const vec3f& tip,
+      const vec3f& center, float radius, line_end end) {
+    auto direction = vec2f{tip.x - center.x, tip.y - center.y};
+    auto len       = length(direction);
+    if (radius <= 0 || len == 0) return;
+    auto normal = vec3f{-direction.y, direction.x, 0} * radius / len;
+    if (end == line_end::stealth_arrow) {
+      auto notch = lerp(center, tip, 0.25f);
+      add_preview_triangle(shape, tip, center + normal, notch);
+      add_preview_triangle(shape, tip, notch, center - normal);
+    } else {
+      add_preview_triangle(shape, tip, center + normal, center - normal);
+    }
+  }
+
+  // End of a line or curve, with the end point and the point where the body
+  // leaves the arrow-head, if any
+  static void add_preview_end(shape_data& shape, const vec3f& tip,
+      const vec3f& center, float radius, line_end end) {
+    if (end == line_end::cap) {
+      add_preview_disk(shape, tip, radius);
+    } else {
+      add_preview_arrow(shape, tip, center, radius * 8 / 3, end);
+    }
+  }
+
+  static int add_preview_instance(
+      scene_data& scene, const vec4f& color, int texture = invalidid) {
+    auto& material     = scene.materials.emplace_back();
+    material.type      = material_type::matte;
+    material.emission  = xyz(color);
+    material.color     = {0, 0, 0};
+    material.opacity   = color.w;
+    material.color_tex = texture;
+    auto& instance     = scene.instances.emplace_back();
+    instance.shape     = (int)scene.shapes.size();
+    instance.material  = (int)scene.materials.size() - 1;
+    scene.shapes.emplace_back();
+    return instance.shape;
+  }
+
+  // Label texture, cropped to the coverage of the rasterized label, with a
+  // transparent border since textures repeat and are mipmapped
+  static texture_data make_preview_label(
+      const image_data& image, vec4i& region) {
+    region = {image.width, image.height, 0, 0};
+    for (auto j = 0; j < image.height; j++) {
+      for (auto i = 0; i < image.width; i++) {
+        if (image.pixels[j * image.width + i].w <= 0) continue;
+        region = {min(region.x, i), min(region.y, j), max(region.z, i + 1),
+            max(region.w, j + 1)};
+      }
+    }
+    if (region.x >= region.z) region = {0, 0, 1, 1};
+    region = {max(region.x - 2, 0), max(region.y - 2, 0),
+        min(region.z + 2, image.width), min(region.w + 2, image.height)};
+    auto texture   = texture_data{};
+    texture.width  = region.z - region.x;
+    texture.height = region.w - region.y;
+    texture.pixelsb.resize((size_t)texture.width * texture.height);
+    for (auto j = 0; j < texture.height; j++) {
+      for (auto i = 0; i < texture.width; i++) {
+        auto alpha =
+            image.pixels[(region.y + j) * image.width + region.x + i].w;
+        texture.pixelsb[j * texture.width + i] = {
+            255, 255, 255, (byte)(clamp(alpha, 0.0f, 1.0f) * 255)};
+      }
+    }
+    return texture;
+  }
+
+  void update_preview(dgram_preview& preview, const dgram_scenes& dgram,
+      const dgram_trace_params& params, bool update_labels) {
+    auto& scene = preview.scene;
+    scene.shapes.clear();
+    scene.materials.clear();
+    scene.instances.clear();
+    if (update_labels) {
+      scene.textures.clear();
+      preview.labels.clear();
+    }
+
+    // camera looking down at the image, with scenes layered in depth
+    scene.cameras       = {camera_data{}};
+    auto& camera        = scene.cameras[0];
+    camera.frame        = translation_frame({params.width / 2.0f,
+        params.height / 2.0f, (float)dgram.scenes.size() + 1});
+    camera.orthographic = true;
+    camera.lens         = 1;
+    camera.film         = (float)params.width;
+    camera.aspect       = (float)params.width / (float)params.height;
+
+    auto stroke_radius = params.width / (2 * params.size.x);
+    auto label_index   = 0;
+    for (auto layer = 0; layer < (int)dgram.scenes.size(); layer++) {
+      auto& dscene     = dgram.scenes[layer];
+      auto  projection = make_preview_projection(dscene, params);
+      auto  shapes     = make_shapes(dscene, params.camera, params.size,
+               params.scale, params.noparallel);
+
+      // project positions, mapping the camera distance to the scene layer
+      auto pixels  = vector<vector<vec3f>>(shapes.shapes.size());
+      auto visible = vector<vector<bool>>(shapes.shapes.size());
+      auto depths  = vec2f{flt_max, flt_min};
+      for (auto idx = 0; idx < (int)shapes.shapes.size(); idx++) {
+        auto& shape = shapes.shapes[idx];
+        pixels[idx].resize(shape.positions.size());
+        visible[idx].resize(shape.positions.size());
+        for (auto vid = 0; vid < (int)shape.positions.size(); vid++) {
+          visible[idx][vid] = project_point(
+              projection, shape.positions[vid], pixels[idx][vid]);
+          if (!visible[idx][vid]) continue;
+          depths = {min(depths.x, pixels[idx][vid].z),
+              max(depths.y, pixels[idx][vid].z)};
+        }
+      }
+      auto layer_scale = depths.y > depths.x ? 0.8f / (depths.y - depths.x)
+                                             : 0.0f;
+      auto to_layer    = [&](vec3f pixel, float bias) {
+        auto depth = layer_scale > 0 ? (depths.y - pixel.z) * layer_scale
+                                        : 0.4f;
+        pixel.z = layer + 0.1f + clamp(depth, 0.0f, 0.8f) + bias;
+        return pixel;
+      };
+      auto project = [&](const vec3f& p, vec3f& pixel, float bias) {
+        if (!project_point(projection, p, pixel)) return false;
+        pixel = to_layer(pixel, bias);
+        return true;
+      };
+
+      for (auto idx = 0; idx < (int)shapes.shapes.size(); idx++) {
+        auto& shape    = shapes.shapes[idx];
+        auto& material = dscene.materials[shape.material];
+        auto& ppixels  = pixels[idx];
+        auto& pvisible = visible[idx];
+        for (auto& pixel : ppixels) pixel = to_layer(pixel, 0);
+
+        // fills, grouped by color
+        auto fills = vector<pair<vec4f, int>>{};
+        auto fill  = [&](const vec4f& color) -> shape_data& {
+          for (auto& [fcolor, index] : fills)
+            if (fcolor == color) return scene.shapes[index];
+          fills.push_back({color, add_preview_instance(scene, color)});
+          return scene.shapes[fills.back().second];
+        };
+        if (material.fill.w > 0) {
+          for (auto& t : shape.triangles) {
+            if (!pvisible[t.x] || !pvisible[t.y] || !pvisible[t.z]) continue;
+            add_preview_triangle(
+                fill(material.fill), ppixels[t.x], ppixels[t.y], ppixels[t.z]);
+          }
+        }
+        for (auto qid = 0; qid < (int)shape.quads.size(); qid++) {
+          auto& q     = shape.quads[qid];
+          auto  color = shape.fills.empty() ? material.fill : shape.fills[qid];
+          if (color.w <= 0) continue;
+          if (!pvisible[q.x] || !pvisible[q.y] || !pvisible[q.z] ||
+              !pvisible[q.w])
+            continue;
+          auto& fshape = fill(color);
+          add_preview_triangle(
+              fshape, ppixels[q.x], ppixels[q.y], ppixels[q.w]);
+          if (q.z != q.w)
+            add_preview_triangle(
+                fshape, ppixels[q.z], ppixels[q.w], ppixels[q.y]);
+        }
+
+        // strokes, in front of fills by their radius as traced strokes are
+        auto radius = material.thickness * stroke_radius;
+        if (material.stroke.w <= 0 || radius <= 0) continue;
+        auto& stroke = scene.shapes[add_preview_instance(
+            scene, material.stroke)];
+        auto  depth  = 0.0f;
+        for (auto r : shape.radii) depth = max(depth, r * layer_scale);
+        auto bias = vec3f{0, 0, clamp(depth, 2e-4f, 0.02f)};
+        for (auto& p : shape.points) {
+          if (!pvisible[p]) continue;
+          add_preview_disk(stroke, ppixels[p] + bias * 3, radius * 3);
+        }
+        for (auto lid = 0; lid < (int)shape.lines.size(); lid++) {
+          auto& l = shape.lines[lid];
+          if (!pvisible[l.x] || !pvisible[l.y]) continue;
+          auto  p0   = ppixels[l.x] + bias, p1 = ppixels[l.y] + bias;
+          auto  ends = shape.ends.empty() ? line_ends{} : shape.ends[lid];
+          auto  len  = length(vec2f{p1.x - p0.x, p1.y - p0.y});
+          auto  trim = len > 0 ? min(radius * 8 / len, 0.5f) : 0.0f;
+          auto  c0 = ends.a == line_end::cap ? p0 : lerp(p0, p1, trim);
+          auto  c1 = ends.b == line_end::cap ? p1 : lerp(p1, p0, trim);
+          add_preview_segment(stroke, c0, c1, radius);
+          add_preview_end(stroke, p0, c0, radius, ends.a);
+          add_preview_end(stroke, p1, c1, radius, ends.b);
+        }
+        for (auto& b : shape.borders) {
+          if (!pvisible[b.x] || !pvisible[b.y]) continue;
+          auto p0 = ppixels[b.x] + bias, p1 = ppixels[b.y] + bias;
+          add_preview_segment(stroke, p0, p1, radius);
+          add_preview_disk(stroke, p0, radius);
+          add_preview_disk(stroke, p1, radius);
+        }
+        for (auto& curve : shape.curves) {
+          auto eval = [&](float u, vec3f& pixel) {
+            auto k = clamp((int)(u * curve.num), 0, curve.num - 1);
+            auto p = eval_bezier(
+                shape.curve_spans[curve.start + k].points, u * curve.num - k);
+            return project(xyz(p) / p.w, pixel, bias.z);
+          };
+          auto u0 = curve.ends.a == line_end::cap ? 0.0f : curve.arrow0.trim;
+          auto u1 = curve.ends.b == line_end::cap ? 1.0f : curve.arrow1.trim;
+          auto steps = 16 * curve.num;
+          auto last  = vec3f{0, 0, 0};
+          auto valid = eval(u0, last);
+          for (auto step = 1; step <= steps; step++) {
+            auto pixel = vec3f{0, 0, 0};
+            auto next  = eval(u0 + (u1 - u0) * step / steps, pixel);
+            if (valid && next) {
+              add_preview_segment(stroke, last, pixel, radius);
+              if (step < steps) add_preview_disk(stroke, pixel, radius);
+            }
+            last  = pixel;
+            valid = next;
+          }
+          auto tip = vec3f{0, 0, 0}, center = vec3f{0, 0, 0};
+          if (eval(0, tip) && (curve.ends.a == line_end::cap ||
+                                  project(curve.arrow0.center, center, bias.z)))
+            add_preview_end(stroke, tip, center, radius, curve.ends.a);
+          if (eval(1, tip) && (curve.ends.b == line_end::cap ||
+                                  project(curve.arrow1.center, center, bias.z)))
+            add_preview_end(stroke, tip, center, radius, curve.ends.b);
+        }
+      }
+
+      // labels, on top of the scene and tinted with the stroke color
+      auto pixel_size = params.width / params.size.x;
+      for (auto& object : dscene.objects) {
+        if (object.labels < 0) continue;
+        auto& labels   = dscene.labels[object.labels];
+        auto& material = dscene.materials[object.material];
+        for (auto j = 0; j < (int)labels.texts.size(); j++, label_index++) {
+          if (update_labels) {
+            if (j < (int)labels.images.size() &&
+                !labels.images[j].pixels.empty() &&
+                labels.images[j].width == params.width * 2) {
+              scene.textures.push_back(make_preview_label(
+                  labels.images[j], preview.labels.emplace_back()));
+            } else {
+              preview.labels.push_back({0, 0, 0, 0});
+              scene.textures.push_back(
+                  texture_data{1, 1, false, {}, {vec4b{0, 0, 0, 0}}});
+            }
+          }
+          if (label_index >= (int)preview.labels.size()) continue;
+          auto region = preview.labels[label_index];
+          if (region.x >= region.z) continue;
+
+          auto anchor = vec3f{0, 0, 0};
+          if (!project_point(projection,
+                  transform_point(object.frame, labels.positions[j]), anchor))
+            continue;
+          auto offset = labels.offsets[j];
+          auto x0     = anchor.x + offset.x * pixel_size;
+          auto y0     = anchor.y - (7 + offset.y) * pixel_size;
+          if (labels.alignments[j] > 0) {
+            x0 -= params.width;
+          } else if (labels.alignments[j] == 0) {
+            x0 -= params.width / 2.0f;
+          }
+          auto top = y0 + params.height;
+
+          // the label image is rasterized at twice the resolution
+          auto  z     = layer + 0.95f;
+          auto& label = scene.shapes[add_preview_instance(
+              scene, material.stroke, label_index)];
+          label.positions = {
+              {x0 + region.x / 2.0f, top - region.y / 2.0f, z},
+              {x0 + region.z / 2.0f, top - region.y / 2.0f, z},
+              {x0 + region.z / 2.0f, top - region.w / 2.0f, z},
+              {x0 + region.x / 2.0f, top - region.w / 2.0f, z}};
+          label.texcoords = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+          label.quads     = {{0, 3, 2, 1}};
+        }
+      }
+    }
+  }
+
+  void draw_preview(glscene_state& glscene, const dgram_preview& preview,
+      const vec4i& viewport, const vec4f& background) {
+    auto params         = shade_params{};
+    params.lighting     = shade_lighting::eyelight;
+    params.exposure     = 0;
+    params.gamma        = 1;
+    params.double_sided = true;
+    params.background   = background;
+    params.near         = 0.5f;
+    params.far          = preview.scene.cameras.at(0).frame.o.z + 1;
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(
+        GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    draw_scene(glscene, preview.scene, viewport, params);
+    glDisable(GL_BLEND);
+  }
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // VIEW
 // -----------------------------------------------------------------------------
@@ -170,8 +565,9 @@ namespace yocto {
   };
 
   void show_dgram_gui(dgram_scenes& dgram, dgram_trace_params& params,
-      bool transparent_background) {
-    auto shapes_v = vector<trace_shapes>(dgram.scenes.size());
+      bool transparent_background, bool optimize) {
+    auto optimized_v = vector<dgram_scene>(dgram.scenes.size());
+    auto shapes_v    = vector<trace_shapes>(dgram.scenes.size());
     auto texts_v  = vector<trace_texts>(dgram.scenes.size());
     auto bvh_v    = vector<dgram_scene_bvh>(dgram.scenes.size());
     auto state_v  = vector<dgram_trace_state>(dgram.scenes.size());
@@ -187,6 +583,13 @@ namespace yocto {
     auto glimage  = glimage_state{};
     auto glparams = glimage_params{};
 
+    // rasterized preview, drawn while interacting, with label textures
+    // updated only when labels are rasterized again
+    auto preview        = dgram_preview{};
+    auto glscene        = glscene_state{};
+    auto previewing     = false;
+    auto preview_labels = true;
+
     // renderer update
     auto render_update  = std::atomic<bool>{};
     auto render_current = std::atomic<int>{};
@@ -197,6 +600,8 @@ namespace yocto {
       // stop render
       render_stop = true;
       if (render_worker.valid()) render_worker.get();
+      previewing = false;
+      if (text_edited) preview_labels = true;
 
       for (auto idx = 0; idx < dgram.scenes.size(); idx++) {
         if (needs_rendering[idx]) {
@@ -209,9 +614,20 @@ namespace yocto {
           auto& texts  = texts_v[idx];
           auto& state  = state_v[idx];
 
-          shapes = make_shapes(scene, params.camera, params.size, params.scale,
-               params.noparallel);
-          bvh    = make_bvh(shapes, true, params.noparallel);
+          // shapes come from an optimized copy, with the same materials
+          // and cameras, so that the edited scene can still be traced
+          auto& optimized = optimized_v[idx];
+          if (optimize) {
+            auto oparams            = dgram_optimize_params{};
+            oparams.dedup_materials = false;
+            optimized = optimize_scene(
+                scene, params.camera, params.size, params.scale, oparams);
+          }
+
+          shapes = make_shapes(optimize ? optimized : scene, params.camera,
+               params.size, params.scale, params.noparallel,
+               get_pixel_size(params));
+          bvh    = make_bvh(shapes, true, false, params.noparallel);
           texts  = trace_texts{};
           state  = make_state(params);
 
@@ -260,6 +676,7 @@ namespace yocto {
                 get_render(render, state);
                 render_update = true;
               }
+              wakeup_gui_window();
             }
           });
         }
@@ -272,6 +689,24 @@ namespace yocto {
       if (render_worker.valid()) render_worker.get();
     };
 
+    // update the preview, stopping the render when the interaction starts,
+    // while the traced render is restarted by reset_display when it ends
+    auto update_glpreview = [&]() {
+      auto update_labels = preview_labels;
+      if (!previewing) stop_render();
+      previewing     = true;
+      preview_labels = false;
+      update_preview(preview, dgram, params, update_labels);
+      auto updated_shapes = vector<int>(preview.scene.shapes.size());
+      std::iota(updated_shapes.begin(), updated_shapes.end(), 0);
+      auto updated_textures = vector<int>{};
+      if (update_labels) {
+        updated_textures.resize(preview.scene.textures.size());
+        std::iota(updated_textures.begin(), updated_textures.end(), 0);
+      }
+      update_glscene(glscene, preview.scene, updated_shapes, updated_textures);
+    };
+
     // start rendering
     reset_display();
 
@@ -283,9 +718,37 @@ namespace yocto {
       auto lock = std::lock_guard{render_mutex};
       init_image(glimage);
       set_image(glimage, image);
+      init_glscene(glscene, preview.scene);
+    };
+    callbacks.clear = [&](const gui_input& input) {
+      clear_image(glimage);
+      clear_scene(glscene);
     };
-    callbacks.clear = [&](const gui_input& input) { clear_image(glimage); };
-    callbacks.draw  = [&](const gui_input& input) {
+    callbacks.draw = [&](const gui_input& input) {
+      // draw preview in the image rectangle, that is clipped to the view
+      if (previewing) {
+        update_image_params(input, image, glparams);
+        auto& framebuffer = input.framebuffer;
+        glViewport(
+            framebuffer.x, framebuffer.y, framebuffer.z, framebuffer.w);
+        glClearColor(glparams.background.x, glparams.background.y,
+            glparams.background.z, glparams.background.w);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        auto ratio  = (float)framebuffer.z / (float)input.window.x;
+        auto size   = vec2f{(float)params.width, (float)params.height} *
+                    glparams.scale * ratio;
+        auto corner = (glparams.center * ratio) - size / 2;
+        auto viewport = vec4i{framebuffer.x + (int)round(corner.x),
+            framebuffer.y + framebuffer.w - (int)round(corner.y + size.y),
+            (int)round(size.x), (int)round(size.y)};
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(framebuffer.x, framebuffer.y, framebuffer.z, framebuffer.w);
+        draw_preview(glscene, preview, viewport,
+            transparent_background ? glparams.background : vec4f{1, 1, 1, 1});
+        glDisable(GL_SCISSOR_TEST);
+        return;
+      }
+
       // update image
       if (render_update) {
         auto lock = std::lock_guard{render_mutex};
@@ -314,8 +777,9 @@ namespace yocto {
       draw_image(glimage, glparams);
     };
     callbacks.widgets = [&](const gui_input& input) {
-      auto one_edited = 0;
-      auto all_edited = 0;
+      auto one_edited     = 0;
+      auto all_edited     = 0;
+      auto preview_edited = 0;
       text_edited     = false;
 
       auto current = (int)render_current;
@@ -377,7 +841,8 @@ namespace yocto {
           selection.scene = selected_scene;
         }
 
-        draw_gui_dragger("offset", dgram.scenes[selection.scene].offset, 0.01f);
+        preview_edited += draw_gui_dragger(
+            "offset", dgram.scenes[selection.scene].offset, 0.01f);
         one_edited += ImGui::IsItemDeactivated();
 
         end_gui_header();
@@ -391,19 +856,19 @@ namespace yocto {
 
         one_edited += draw_gui_checkbox("ortho", camera.orthographic);
 
-        draw_gui_dragger("center", camera.center, 0.01f);
+        preview_edited += draw_gui_dragger("center", camera.center, 0.01f);
         one_edited += ImGui::IsItemDeactivated();
 
-        draw_gui_dragger("from", camera.from, 0.05f);
+        preview_edited += draw_gui_dragger("from", camera.from, 0.05f);
         one_edited += ImGui::IsItemDeactivated();
 
-        draw_gui_dragger("to", camera.to, 0.05f);
+        preview_edited += draw_gui_dragger("to", camera.to, 0.05f);
         one_edited += ImGui::IsItemDeactivated();
 
-        draw_gui_slider("lens", camera.lens, 0.001f, 1);
+        preview_edited += draw_gui_slider("lens", camera.lens, 0.001f, 1);
         one_edited += ImGui::IsItemDeactivated();
 
-        draw_gui_slider("film", camera.film, 0.001f, 0.5f);
+        preview_edited += draw_gui_slider("film", camera.film, 0.001f, 0.5f);
         one_edited += ImGui::IsItemDeactivated();
 
         end_gui_header();
@@ -433,13 +898,14 @@ namespace yocto {
         auto& material = dgram.scenes[selection.scene].materials.at(
             selection.material);
 
-        draw_gui_coloredit("fill", material.fill);
+        preview_edited += draw_gui_coloredit("fill", material.fill);
         one_edited += ImGui::IsItemDeactivated();
 
-        draw_gui_coloredit("stroke", material.stroke);
+        preview_edited += draw_gui_coloredit("stroke", material.stroke);
         one_edited += ImGui::IsItemDeactivated();
 
-        draw_gui_slider("thickness", material.thickness, 0.0f, 100.0f);
+        preview_edited += draw_gui_slider(
+            "thickness", material.thickness, 0.0f, 100.0f);
         one_edited += ImGui::IsItemDeactivated();
 
         draw_gui_slider("dash_period", material.dash_period, 0.0f, 100.0f);
@@ -468,6 +934,8 @@ namespace yocto {
         draw_gui_label("positions", (int)shape.positions.size());
         draw_gui_label("points", (int)shape.points.size());
         draw_gui_label("lines", (int)shape.lines.size());
+        draw_gui_label("beziers", (int)shape.beziers.size());
+        draw_gui_label("arcs", (int)shape.arcs.size());
         draw_gui_label("triangles", (int)shape.triangles.size());
         draw_gui_label("quads", (int)shape.quads.size());
         draw_gui_label("fills", (int)shape.fills.size());
@@ -490,11 +958,12 @@ namespace yocto {
             (int)labels.positions.size(), true);
 
         if (selection.label != -1) {
-          draw_gui_dragger(
+          preview_edited += draw_gui_dragger(
               "position", labels.positions[selection.label], 0.01f);
           one_edited += ImGui::IsItemDeactivated();
 
-          draw_gui_dragger("offset", labels.offsets[selection.label], 1.0f);
+          preview_edited += draw_gui_dragger(
+              "offset", labels.offsets[selection.label], 1.0f);
           one_edited += ImGui::IsItemDeactivated();
 
           draw_gui_textinput("text", labels.texts[selection.label]);
@@ -526,6 +995,9 @@ namespace yocto {
         end_gui_header();
       }
 
+      if (preview_edited && ImGui::IsAnyItemActive()) {
+        update_glpreview();
+      }
       if (one_edited) {
         stop_render();
         params                           = tparams;
@@ -543,12 +1015,16 @@ namespace yocto {
     callbacks.uiupdate = [&](const gui_input& input) {
       auto camera = dgram.scenes[selection.scene].cameras[params.camera];
       if (uiupdate_camera_params(input, camera)) {
-        stop_render();
         dgram.scenes[selection.scene].cameras[params.camera] = camera;
         needs_rendering[selection.scene]                     = true;
-        reset_display();
+        update_glpreview();
       }
     };
+    callbacks.update = [&](const gui_input& input) {
+      // trace again once the mouse is released
+      if (previewing && input.mouse == zero3i) reset_display();
+    };
+    callbacks.idle = [&](const gui_input& input) { return !render_update; };
 
     show_gui_window({1280 + 320, 720}, "dgram", callbacks);
   }
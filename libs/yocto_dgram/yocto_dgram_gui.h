@@ -33,6 +33,9 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <yocto/yocto_gui.h>
+#include <yocto/yocto_scene.h>
+
 #include "yocto_dgram.h"
 #include "yocto_dgram_trace.h"
 
@@ -45,12 +48,38 @@ namespace yocto {
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// RASTERIZED PREVIEW
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Diagrams rasterized with OpenGL while interacting. Shapes are projected
+  // on the image, in pixels, with strokes expanded to their screen-space
+  // width, and seen by an orthographic camera, with the scenes layered in
+  // depth in compositing order. Dashes are not drawn.
+  struct dgram_preview {
+    scene_data    scene  = {};
+    vector<vec4i> labels = {};  // label regions, cropped to their coverage
+  };
+
+  // Updates the preview shapes. Label textures are kept unless update_labels
+  // is true, since they only depend on the rasterized label images.
+  void update_preview(dgram_preview& preview, const dgram_scenes& dgram,
+      const dgram_trace_params& params, bool update_labels);
+
+  // Draws the preview in a viewport, clearing it to the background.
+  void draw_preview(glscene_state& glscene, const dgram_preview& preview,
+      const vec4i& viewport, const vec4f& background);
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // VIEW
 // -----------------------------------------------------------------------------
 namespace yocto {
+  // Scenes are rendered through optimize_scene unless optimize is false.
   void show_dgram_gui(dgram_scenes& dgram, dgram_trace_params& params,
-      bool transparent_background = false);
+      bool transparent_background = false, bool optimize = true);
 
 }  // namespace yocto
 
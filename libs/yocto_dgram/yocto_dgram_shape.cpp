@@ -81,6 +81,32 @@ namespace yocto {
     for (auto& f : futures) f.get();
   }
 
+  // Simple parallel for that also passes to `Func` the index of the thread
+  // that runs it, in [0, nthreads), e.g. to use per-thread storage.
+  template <typename T, typename Func>
+  inline void parallel_for(T num, int nthreads, Func&& func) {
+    auto              futures = vector<std::future<void>>{};
+    std::atomic<T>    next_idx(0);
+    std::atomic<bool> has_error(false);
+    for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+      futures.emplace_back(std::async(std::launch::async,
+          [&func, &next_idx, &has_error, num, thread_id]() {
+            try {
+              while (true) {
+                auto idx = next_idx.fetch_add(1);
+                if (idx >= num) break;
+                if (has_error) break;
+                func(idx, thread_id);
+              }
+            } catch (...) {
+              has_error = true;
+              throw;
+            }
+          }));
+    }
+    for (auto& f : futures) f.get();
+  }
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -110,11 +136,222 @@ namespace yocto {
     return get_boundary(triangles, num_vertices);
   }
 
+  // Masks of the edges of each face that are on the mesh boundary, with bit k
+  // for the edge that starts at the k-th vertex of the face
+  template <typename T>
+  static vector<uint8_t> get_boundary_edges(const vector<T>& faces) {
+    auto emap  = make_edge_map(faces);
+    auto masks = vector<uint8_t>(faces.size(), 0);
+    auto num   = (int)(sizeof(T) / sizeof(int));
+    for (auto idx = 0; idx < faces.size(); idx++) {
+      auto& face = faces[idx];
+      for (auto k = 0; k < num; k++) {
+        auto a = face[k], b = face[(k + 1) % num];
+        if (a == b) continue;
+        auto edge = a < b ? vec2i{a, b} : vec2i{b, a};
+        if (emap.edges.at(edge).nfaces < 2) masks[idx] |= 1 << k;
+      }
+    }
+    return masks;
+  }
+
+  // Computes the screen-space position of p, given in camera coordinates
+  static vec3f screen_point(const frame3f& camera_frame,
+      const bool orthographic, const float plane_distance,
+      const vec3f& camera_p) {
+    return orthographic
+               ? transform_point(camera_frame,
+                     vec3f{camera_p.x, camera_p.y, plane_distance})
+               : transform_point(camera_frame,
+                     screen_space_point(camera_p, plane_distance));
+  }
+
+  // Arrow-head at the end p0 of a curve that leaves it towards p1, computed as
+  // the one of the line from p0 to p1.
+  static curve_arrow make_curve_arrow(const vec3f& p0, const vec3f& p1,
+      const frame3f& camera_frame, const bool orthographic,
+      const float plane_distance, const float radius, const float aa_radius) {
+    auto arrow = curve_arrow{};
+
+    auto camera_p0 = transform_point(inverse(camera_frame), p0);
+    auto camera_p1 = transform_point(inverse(camera_frame), p1);
+
+    auto screen_camera_p0 =
+        orthographic ? vec3f{camera_p0.x, camera_p0.y, plane_distance}
+                     : screen_space_point(camera_p0, plane_distance);
+    auto screen_camera_p1 =
+        orthographic ? vec3f{camera_p1.x, camera_p1.y, plane_distance}
+                     : screen_space_point(camera_p1, plane_distance);
+
+    auto screen_p0     = transform_point(camera_frame, screen_camera_p0);
+    auto screen_p1     = transform_point(camera_frame, screen_camera_p1);
+    auto screen_length = distance(screen_p0, screen_p1);
+
+    // computing the arrow-head base center and radius
+    auto camera_arrow_center =
+        orthographic
+            ? line_point(camera_p0, camera_p1, 8 * radius / screen_length)
+            : perspective_line_point(
+                  camera_p0, camera_p1, 8 * radius / screen_length);
+    arrow.center = transform_point(camera_frame, camera_arrow_center);
+    arrow.radius = radius * 8 / 3 + aa_radius;
+    if (!orthographic)
+      arrow.radius *= abs(camera_arrow_center.z / plane_distance);
+
+    // computing the truncation planes normals
+    auto screen_camera_dir = normalize(screen_camera_p1 - screen_camera_p0);
+    auto screen_dir        = normalize(screen_p1 - screen_p0);
+    auto screen_dir_45a    = transform_direction(
+           camera_frame, vec3f{screen_camera_dir.x + screen_camera_dir.y,
+                          screen_camera_dir.y - screen_camera_dir.x, 0});
+    auto screen_dir_45b = transform_direction(
+        camera_frame, vec3f{screen_camera_dir.x - screen_camera_dir.y,
+                          screen_camera_dir.y + screen_camera_dir.x, 0});
+
+    if (orthographic) {
+      arrow.plane_norm     = screen_dir;
+      arrow.plane_45a_norm = screen_dir_45a;
+      arrow.plane_45b_norm = screen_dir_45b;
+    } else {
+      auto ray = transform_direction(camera_frame, camera_arrow_center);
+      arrow.plane_norm     = orthonormalize(screen_dir, ray);
+      arrow.plane_45a_norm = orthonormalize(screen_dir_45a, ray);
+      arrow.plane_45b_norm = orthonormalize(screen_dir_45b, ray);
+    }
+
+    return arrow;
+  }
+
+  // Curve parameter where a curve leaves the arrow-head at its start or at its
+  // end, found by marching from the end and refining by bisection.
+  static float curve_arrow_trim(
+      const vector<curve_span>& spans, const curve_arrow& arrow, bool end) {
+    auto num    = (int)spans.size();
+    auto inside = [&](float u) {
+      auto k = min((int)(u * num), num - 1);
+      auto q = eval_bezier(spans[k].points, u * num - k);
+      return dot(xyz(q) / q.w - arrow.center, arrow.plane_norm) < 0;
+    };
+
+    const auto steps = 64 * num;
+    auto       u0    = end ? 1.0f : 0.0f;
+    for (auto j = 1; j <= steps; j++) {
+      auto u1 = end ? 1 - (float)j / steps : (float)j / steps;
+      if (!inside(u1)) {
+        for (auto i = 0; i < 16; i++) {
+          auto um = (u0 + u1) / 2;
+          if (inside(um))
+            u0 = um;
+          else
+            u1 = um;
+        }
+        return (u0 + u1) / 2;
+      }
+      u0 = u1;
+    }
+    return end ? 0.0f : 1.0f;
+  }
+
+  // Splits a circular arc from p0 through pm to p1 in rational Bézier spans of
+  // at most 90 degrees. Radii are left to the caller.
+  static vector<curve_span> make_arc_spans(
+      const vec3f& p0, const vec3f& pm, const vec3f& p1) {
+    auto spans = vector<curve_span>{};
+
+    auto u = pm - p0;
+    auto v = p1 - p0;
+    auto w = cross(u, v);
+    if (dot(w, w) <= 1e-12f * dot(u, u) * dot(v, v)) {
+      // degenerate arcs are segments
+      auto& span    = spans.emplace_back();
+      span.points[0] = {p0.x, p0.y, p0.z, 1};
+      span.points[3] = {p1.x, p1.y, p1.z, 1};
+      auto q1        = lerp(p0, p1, 1.0f / 3);
+      auto q2        = lerp(p0, p1, 2.0f / 3);
+      span.points[1] = {q1.x, q1.y, q1.z, 1};
+      span.points[2] = {q2.x, q2.y, q2.z, 1};
+      return spans;
+    }
+
+    // circle center and frame, with the arc going counter-clockwise around z
+    auto center = p0 + (dot(u, u) * cross(v, w) + dot(v, v) * cross(w, u)) /
+                           (2 * dot(w, w));
+    auto radius = distance(p0, center);
+    auto z      = normalize(w);
+    auto x      = normalize(p0 - center);
+    auto y      = cross(z, x);
+
+    auto angle = atan2(dot(p1 - center, y), dot(p1 - center, x));
+    if (angle <= 0) angle += 2 * pif;
+
+    auto num  = max((int)ceil(angle / (pif / 2) - 1e-4f), 1);
+    auto step = angle / num;
+    auto wm   = cos(step / 2);
+    auto arc_point = [&](float a, float r) {
+      return center + r * (cos(a) * x + sin(a) * y);
+    };
+
+    for (auto k = 0; k < num; k++) {
+      auto q0 = k == 0 ? p0 : arc_point(k * step, radius);
+      auto q2 = k == num - 1 ? p1 : arc_point((k + 1) * step, radius);
+      auto q1 = arc_point((k + 0.5f) * step, radius / wm);
+
+      // rational quadratic elevated to cubic in homogeneous coordinates
+      auto h0 = vec4f{q0.x, q0.y, q0.z, 1};
+      auto h1 = vec4f{q1.x * wm, q1.y * wm, q1.z * wm, wm};
+      auto h2 = vec4f{q2.x, q2.y, q2.z, 1};
+
+      auto& span     = spans.emplace_back();
+      span.points[0] = h0;
+      span.points[1] = (h0 + 2 * h1) / 3;
+      span.points[2] = (2 * h1 + h2) / 3;
+      span.points[3] = h2;
+    }
+
+    return spans;
+  }
+
+  // Empty shape whose arrays are allocated from an arena
+  static trace_shape make_arena_shape(std::pmr::memory_resource* arena) {
+    auto shape     = trace_shape{};
+    auto set_arena = [arena](auto& array) {
+      array = std::decay_t<decltype(array)>(arena);
+    };
+    set_arena(shape.positions);
+    set_arena(shape.points);
+    set_arena(shape.lines);
+    set_arena(shape.triangles);
+    set_arena(shape.quads);
+    set_arena(shape.borders);
+    set_arena(shape.curves);
+    set_arena(shape.curve_spans);
+    set_arena(shape.fills);
+    set_arena(shape.ends);
+    set_arena(shape.radii);
+    set_arena(shape.plane_norms_0);
+    set_arena(shape.plane_norms_1);
+    set_arena(shape.plane_45a_norms_0);
+    set_arena(shape.plane_45a_norms_1);
+    set_arena(shape.plane_45b_norms_0);
+    set_arena(shape.plane_45b_norms_1);
+    set_arena(shape.arrow_radii0);
+    set_arena(shape.arrow_radii1);
+    set_arena(shape.arrow_centers0);
+    set_arena(shape.arrow_centers1);
+    set_arena(shape.line_lengths);
+    set_arena(shape.border_lengths);
+    set_arena(shape.aa_radii);
+    set_arena(shape.triangle_edges);
+    set_arena(shape.quad_edges);
+    return shape;
+  }
+
   trace_shape make_shape(const dgram_scene& scene, const dgram_object& object,
       const frame3f& camera_frame, const float camera_distance,
       const bool orthographic, const vec2f& film, const float lens,
-      const vec2f& size, const float scale) {
-    auto shape = trace_shape{};
+      const vec2f& size, const float scale, const float pixel_size,
+      std::pmr::memory_resource* arena) {
+    auto shape = make_arena_shape(arena);
 
     auto& dshape   = scene.shapes[object.shape];
     auto& material = scene.materials[object.material];
@@ -124,34 +361,58 @@ namespace yocto {
                                : material.thickness * film.x / (2 * size.x);
     auto plane_distance = -lens * scale / size.x;
 
+    // half pixel added to the radii for analytic antialiasing, invisible
+    // strokes are left untouched
+    auto pixel_radius = orthographic ? pixel_size * film.x * camera_distance /
+                                           (2 * lens * scale)
+                                     : pixel_size * film.x / (2 * size.x);
+    auto aa_radius = 0.0f;
+    if (pixel_size > 0 && material.thickness > 0) {
+      aa_radius      = pixel_radius;
+      shape.aa_ratio = aa_radius / (radius + aa_radius);
+    }
+
+    // half pixel added to fills for analytic antialiasing
+    auto aa_fills = pixel_size > 0 &&
+                    (!dshape.triangles.empty() || !dshape.quads.empty());
+    if (aa_fills) shape.aa_radii.reserve(dshape.positions.size());
+
+    shape.positions.reserve(dshape.positions.size());
+    shape.radii.reserve(dshape.positions.size());
     for (auto& pos : dshape.positions) {
       // position
       auto& p = shape.positions.emplace_back();
       p       = transform_point(object.frame, pos);
 
       // radius
-      if (orthographic)
-        shape.radii.push_back(radius);
-      else {
+      if (orthographic) {
+        shape.radii.push_back(radius + aa_radius);
+        if (aa_fills) shape.aa_radii.push_back(pixel_radius);
+      } else {
         // compuing world-space radius from screen-space radius using triangles
         // similarities
         auto camera_p = transform_point(inverse(camera_frame), p);
 
-        shape.radii.push_back(radius * abs(camera_p.z / plane_distance));
+        shape.radii.push_back(
+            (radius + aa_radius) * abs(camera_p.z / plane_distance));
+        if (aa_fills)
+          shape.aa_radii.push_back(
+              pixel_radius * abs(camera_p.z / plane_distance));
       }
     }
 
-    shape.points = dshape.points;
+    shape.points.assign(dshape.points.begin(), dshape.points.end());
 
-    shape.lines = dshape.lines;
-    shape.ends  = dshape.ends;
+    shape.lines.assign(dshape.lines.begin(), dshape.lines.end());
+    shape.ends.assign(dshape.ends.begin(), dshape.ends.end());
 
     shape.material = object.material;
 
     // triangles
     if (!dshape.triangles.empty()) {
+      auto triangles = vector<vec3i>{};
       if (!dshape.cull)
-        shape.triangles = dshape.triangles;
+        triangles = dshape.triangles;
       else {
         // culling triangles
         for (auto& triangle : dshape.triangles) {
@@ -166,23 +427,29 @@ namespace yocto {
           }
 
           if (dot(dir, cross(p1 - p0, p2 - p0)) <= 0) continue;
-          shape.triangles.push_back(triangle);
+          triangles.push_back(triangle);
         }
       }
+      shape.triangles.assign(triangles.begin(), triangles.end());
+      if (aa_fills) {
+        auto edges = get_boundary_edges(triangles);
+        shape.triangle_edges.assign(edges.begin(), edges.end());
+      }
 
       // computing triangles borders
-      auto borders = dshape.boundary ? get_boundary(shape.triangles,
+      auto borders = dshape.boundary ? get_boundary(triangles,
                                            (int)shape.positions.size())
-                                     : get_edges(shape.triangles);
+                                     : get_edges(triangles);
 
       shape.borders.insert(shape.borders.end(), borders.begin(), borders.end());
     }
 
     // quads
     if (!dshape.quads.empty()) {
+      auto quads = vector<vec4i>{};
       if (!dshape.cull) {
-        shape.quads = dshape.quads;
-        shape.fills = dshape.fills;
+        quads = dshape.quads;
+        shape.fills.assign(dshape.fills.begin(), dshape.fills.end());
       } else {
         // culling quads
         for (auto idx = 0; idx < dshape.quads.size(); idx++) {
@@ -199,20 +466,34 @@ namespace yocto {
           }
 
           if (dot(dir, cross(p1 - p0, p2 - p0)) <= 0) continue;
-          shape.quads.push_back(quad);
+          quads.push_back(quad);
           if (!dshape.fills.empty()) shape.fills.push_back(dshape.fills[idx]);
         }
       }
+      shape.quads.assign(quads.begin(), quads.end());
+      if (aa_fills) {
+        auto edges = get_boundary_edges(quads);
+        shape.quad_edges.assign(edges.begin(), edges.end());
+      }
 
       // computing quads borders
-      auto borders = dshape.boundary ? get_boundary(shape.quads,
+      auto borders = dshape.boundary ? get_boundary(quads,
                                            (int)shape.positions.size())
-                                     : get_edges(shape.quads);
+                                     : get_edges(quads);
 
       shape.borders.insert(shape.borders.end(), borders.begin(), borders.end());
     }
 
     // arrow dirs
+    auto num_lines = shape.lines.size();
+    for (auto lines : {&shape.line_lengths, &shape.arrow_radii0,
+             &shape.arrow_radii1})
+      lines->reserve(num_lines);
+    for (auto lines : {&shape.arrow_centers0, &shape.arrow_centers1,
+             &shape.plane_norms_0, &shape.plane_norms_1,
+             &shape.plane_45a_norms_0, &shape.plane_45a_norms_1,
+             &shape.plane_45b_norms_0, &shape.plane_45b_norms_1})
+      lines->reserve(num_lines);
     for (auto& line : shape.lines) {
       auto& p0 = shape.positions[line.x];
       auto& p1 = shape.positions[line.y];
@@ -247,8 +528,8 @@ namespace yocto {
         shape.arrow_centers1.push_back(arrow_center1);
 
         // computing the arrow-heads base radii
-        auto arrow_radius0 = radius * 8 / 3;
-        auto arrow_radius1 = radius * 8 / 3;
+        auto arrow_radius0 = radius * 8 / 3 + aa_radius;
+        auto arrow_radius1 = radius * 8 / 3 + aa_radius;
 
         shape.arrow_radii0.push_back(arrow_radius0);
         shape.arrow_radii1.push_back(arrow_radius1);
@@ -296,9 +577,9 @@ namespace yocto {
         shape.arrow_centers1.push_back(arrow_center1);
 
         // computing the arrow-heads base radii
-        auto arrow_radius0 = radius * 8 / 3 *
+        auto arrow_radius0 = (radius * 8 / 3 + aa_radius) *
                              abs(camera_arrow_center0.z / plane_distance);
-        auto arrow_radius1 = radius * 8 / 3 *
+        auto arrow_radius1 = (radius * 8 / 3 + aa_radius) *
                              abs(camera_arrow_center1.z / plane_distance);
 
         shape.arrow_radii0.push_back(arrow_radius0);
@@ -328,6 +609,126 @@ namespace yocto {
       }
     }
 
+    // curves
+    auto curve_radius = [&](const vec3f& p) {
+      if (orthographic) return radius + aa_radius;
+      auto camera_p = transform_point(inverse(camera_frame), p);
+      return (radius + aa_radius) * abs(camera_p.z / plane_distance);
+    };
+
+    auto add_curve = [&](vector<curve_span> spans, const line_ends& ends) {
+      // splitting all spans the same number of times, until their control
+      // points are within a stroke width from their chords
+      auto splits = 0;
+      for (auto& span : spans) {
+        auto q = vector<vec3f>{};
+        auto r = 0.0f;
+        for (auto& c : span.points) {
+          q.push_back(xyz(c) / c.w);
+          r = max(r, curve_radius(q.back()));
+        }
+        auto l = max(length(q[0] - 2 * q[1] + q[2]),
+            length(q[1] - 2 * q[2] + q[3]));
+        if (l > 2 * r)
+          splits = max(splits, min((int)ceil(log2(l / (2 * r)) / 2), 6));
+      }
+      for (auto split = 0; split < splits; split++) {
+        auto halves = vector<curve_span>(spans.size() * 2);
+        for (auto idx = 0; idx < spans.size(); idx++) {
+          split_bezier(spans[idx].points, halves[idx * 2].points,
+              halves[idx * 2 + 1].points);
+        }
+        spans = std::move(halves);
+      }
+
+      auto& curve = shape.curves.emplace_back();
+      curve.start = (int)shape.curve_spans.size();
+      curve.num   = (int)spans.size();
+      curve.ends  = ends;
+
+      // radii are affine in the depth, so they are interpolated exactly by
+      // the radii of the control points
+      for (auto& span : spans) {
+        for (auto i = 0; i < 4; i++) {
+          auto& c       = span.points[i];
+          span.radii[i] = curve_radius(xyz(c) / c.w) * c.w;
+        }
+        span.curve  = (int)shape.curves.size() - 1;
+        auto center = (xyz(span.points[0]) / span.points[0].w +
+                          xyz(span.points[3]) / span.points[3].w) /
+                      2;
+        auto radius = 0.0f;
+        for (auto i = 0; i < 4; i++) {
+          auto& c = span.points[i];
+          radius  = max(radius,
+               distance(xyz(c) / c.w, center) + span.radii[i] / c.w);
+        }
+        span.sphere = {center.x, center.y, center.z, radius};
+        shape.curve_spans.push_back(span);
+      }
+
+      // screen-space length, by sampling the spans
+      const auto samples  = 16;
+      auto       screen_p = [&](const vec4f& p) {
+        return screen_point(camera_frame, orthographic, plane_distance,
+            transform_point(inverse(camera_frame), xyz(p) / p.w));
+      };
+      auto prev = screen_p(spans[0].points[0]);
+      for (auto& span : spans) {
+        for (auto j = 1; j <= samples; j++) {
+          auto next = screen_p(eval_bezier(span.points, (float)j / samples));
+          curve.length += distance(prev, next);
+          prev = next;
+        }
+      }
+
+      // arrow-heads along the tangents at the ends
+      auto tangent_point = [](const curve_span& span, bool end) {
+        auto p0 = xyz(span.points[end ? 3 : 0]) / span.points[end ? 3 : 0].w;
+        for (auto i = 1; i < 4; i++) {
+          auto& c = span.points[end ? 3 - i : i];
+          auto  p = xyz(c) / c.w;
+          if (p != p0) return p;
+        }
+        return p0;
+      };
+      auto& first = spans.front();
+      auto& last  = spans.back();
+      auto  p0    = xyz(first.points[0]) / first.points[0].w;
+      auto  p1    = xyz(last.points[3]) / last.points[3].w;
+      if (ends.a != line_end::cap) {
+        curve.arrow0      = make_curve_arrow(p0, tangent_point(first, false),
+                 camera_frame, orthographic, plane_distance, radius, aa_radius);
+        curve.arrow0.trim = curve_arrow_trim(spans, curve.arrow0, false);
+      }
+      if (ends.b != line_end::cap) {
+        curve.arrow1      = make_curve_arrow(p1, tangent_point(last, true),
+                 camera_frame, orthographic, plane_distance, radius, aa_radius);
+        curve.arrow1.trim = curve_arrow_trim(spans, curve.arrow1, true);
+      }
+    };
+
+    shape.curves.reserve(dshape.beziers.size() + dshape.arcs.size());
+    for (auto idx = 0; idx < dshape.beziers.size(); idx++) {
+      auto& bezier = dshape.beziers[idx];
+      auto  span   = curve_span{};
+      for (auto i = 0; i < 4; i++) {
+        auto& p        = shape.positions[bezier[i]];
+        span.points[i] = {p.x, p.y, p.z, 1};
+      }
+      add_curve({span}, idx < dshape.bezier_ends.size()
+                            ? dshape.bezier_ends[idx]
+                            : line_ends{});
+    }
+
+    for (auto idx = 0; idx < dshape.arcs.size(); idx++) {
+      auto& arc = dshape.arcs[idx];
+      add_curve(make_arc_spans(shape.positions[arc.x], shape.positions[arc.y],
+                    shape.positions[arc.z]),
+          idx < dshape.arc_ends.size() ? dshape.arc_ends[idx] : line_ends{});
+    }
+
+    shape.border_lengths.reserve(shape.borders.size());
     for (auto& border : shape.borders) {
       auto& p0 = shape.positions[border.x];
       auto& p1 = shape.positions[border.y];
@@ -356,7 +757,8 @@ namespace yocto {
   }
 
   trace_shapes make_shapes(const dgram_scene& scene, const int& cam,
-      const vec2f& size, const float& scale, const bool noparallel) {
+      const vec2f& size, const float& scale, const bool noparallel,
+      const float pixel_size) {
     auto& camera          = scene.cameras[cam];
     auto  camera_frame    = lookat_frame(camera.from, camera.to, {0, 1, 0});
     auto  camera_distance = length(camera.from - camera.to);
@@ -366,13 +768,22 @@ namespace yocto {
 
     auto shapes = trace_shapes{};
 
+    // one arena for each thread, sized to fit the shapes of small diagrams
+    auto nthreads = noparallel ? 1 : (int)std::thread::hardware_concurrency();
+    nthreads      = max(nthreads, 1);
+    for (auto thread = 0; thread < nthreads; thread++) {
+      shapes.arenas.push_back(
+          std::make_unique<std::pmr::monotonic_buffer_resource>(1 << 16));
+    }
+
     if (noparallel) {
       for (auto idx = 0; idx < scene.objects.size(); idx++) {
         auto& object = scene.objects[idx];
         if (object.shape != -1) {
           auto shape = make_shape(scene, object, camera_frame, camera_distance,
-              camera.orthographic, film, camera.lens, size, scale);
-          shapes.shapes.push_back(shape);
+              camera.orthographic, film, camera.lens, size, scale,
+              pixel_size, shapes.arenas[0].get());
+          shapes.shapes.push_back(std::move(shape));
         }
       }
     } else {
@@ -386,13 +797,14 @@ namespace yocto {
       }
 
       shapes.shapes.resize(idxs.size());
-      parallel_for(idxs.size(), [&](size_t i) {
+      parallel_for(idxs.size(), nthreads, [&](size_t i, int thread) {
         auto  idx    = idxs[i];
         auto& object = scene.objects[idx];
         if (object.shape != -1) {
           auto shape = make_shape(scene, object, camera_frame, camera_distance,
-              camera.orthographic, film, camera.lens, size, scale);
-          shapes.shapes[i] = shape;
+              camera.orthographic, film, camera.lens, size, scale,
+              pixel_size, shapes.arenas[thread].get());
+          shapes.shapes[i] = std::move(shape);
         }
       });
     }
@@ -414,6 +826,7 @@ namespace yocto {
     switch (element.primitive) {
       case primitive_type::point: color = material.stroke; break;
       case primitive_type::line: color = material.stroke; break;
+      case primitive_type::curve: color = material.stroke; break;
       case primitive_type::triangle: color = material.fill; break;
       case primitive_type::quad:
         color = shape.fills.empty() ? material.fill
@@ -425,9 +838,10 @@ namespace yocto {
     return color;
   }
 
-  bool eval_dashes(const vec3f& p, const trace_shape& shape,
+  float eval_dashes(const vec3f& p, const trace_shape& shape,
       const dgram_material& material, const shape_element& element,
-      const dgram_camera& camera, const vec2f& size, const float& scale) {
+      const vec2f& uv, const dgram_camera& camera, const vec2f& size,
+      const float& scale, const float pixel_size) {
     auto camera_frame    = lookat_frame(camera.from, camera.to, {0, 1, 0});
     auto camera_distance = length(camera.from - camera.to);
     auto aspect          = size.x / size.y;
@@ -449,73 +863,294 @@ namespace yocto {
     auto xp = 0.0f;
     auto yp = 0.0f;
 
-    auto& lines   = element.primitive == primitive_type::line ? shape.lines
-                                                              : shape.borders;
-    auto& lengths = element.primitive == primitive_type::line
-                        ? shape.line_lengths
-                        : shape.border_lengths;
+    if (element.primitive == primitive_type::curve) {
+      auto& curve = shape.curves[element.index];
 
-    auto& p0 = shape.positions[lines[element.index].x];
-    auto& p1 = shape.positions[lines[element.index].y];
+      // summing the lengths of the preceding curves
+      for (auto idx = 0; idx < element.index; idx++) {
+        xp += shape.curves[idx].length;
+      }
 
-    // getting the positions on the image plane
-    auto camera_p  = transform_point(inverse(camera_frame), p);
-    auto camera_p0 = transform_point(inverse(camera_frame), p0);
-    auto camera_p1 = transform_point(inverse(camera_frame), p1);
+      // span and span parameter of the hit
+      auto u = clamp(uv.x, 0.0f, 1.0f) * curve.num;
+      auto k = min((int)u, curve.num - 1);
+      auto s = u - k;
+
+      auto to_screen = [&](const vec3f& q) {
+        return screen_point(camera_frame, camera.orthographic, plane_distance,
+            transform_point(inverse(camera_frame), q));
+      };
+
+      // length up to the hit, sampled as in make_shape()
+      const auto samples = 16;
+      auto&      first   = shape.curve_spans[curve.start].points[0];
+      auto       prev    = to_screen(xyz(first) / first.w);
+      for (auto idx = 0; idx <= k; idx++) {
+        auto& span = shape.curve_spans[curve.start + idx];
+        for (auto j = 1; j <= samples; j++) {
+          auto t = idx == k ? min((float)j / samples, s) : (float)j / samples;
+          auto q = eval_bezier(span.points, t);
+          auto screen_q = to_screen(xyz(q) / q.w);
+          xp += distance(prev, screen_q);
+          prev = screen_q;
+          if (t >= s && idx == k) break;
+        }
+      }
 
-    // summing the lengths of the preceding lines
-    for (auto idx = 0; idx < element.index; idx++) {
-      xp += lengths[idx];
-    }
+      // distance from the curve point of the hit
+      auto pc = vec3f{0, 0, 0};
+      auto rc = 0.0f;
+      eval_curve_span(shape.curve_spans[curve.start + k], s, pc, rc);
+      yp = distance(to_screen(p), to_screen(pc));
+    } else {
+      auto& lines   = element.primitive == primitive_type::line ? shape.lines
+                                                                : shape.borders;
+      auto& lengths = element.primitive == primitive_type::line
+                          ? shape.line_lengths
+                          : shape.border_lengths;
 
-    if (camera.orthographic) {
-      auto screen_p = transform_point(
-          camera_frame, vec3f{camera_p.x, camera_p.y, 0});
-      auto screen_p0 = transform_point(
-          camera_frame, vec3f{camera_p0.x, camera_p0.y, 0});
-      auto screen_p1 = transform_point(
-          camera_frame, vec3f{camera_p1.x, camera_p1.y, 0});
+      auto& p0 = shape.positions[lines[element.index].x];
+      auto& p1 = shape.positions[lines[element.index].y];
 
-      auto screen_dir = normalize(screen_p1 - screen_p0);
-      auto line_p     = screen_p0 +
-                    dot(screen_p - screen_p0, screen_dir) * screen_dir;
+      // getting the positions on the image plane
+      auto camera_p  = transform_point(inverse(camera_frame), p);
+      auto camera_p0 = transform_point(inverse(camera_frame), p0);
+      auto camera_p1 = transform_point(inverse(camera_frame), p1);
 
-      auto p_sign = sign(dot(screen_p1 - screen_p0, line_p - screen_p0));
+      // summing the lengths of the preceding lines
+      for (auto idx = 0; idx < element.index; idx++) {
+        xp += lengths[idx];
+      }
 
-      xp += p_sign * distance(line_p, screen_p0);
-      yp = distance(line_p, screen_p);
-    } else {
-      auto screen_p = transform_point(
-          camera_frame, screen_space_point(camera_p, plane_distance));
-      auto screen_p0 = transform_point(
-          camera_frame, screen_space_point(camera_p0, plane_distance));
-      auto screen_p1 = transform_point(
-          camera_frame, screen_space_point(camera_p1, plane_distance));
+      if (camera.orthographic) {
+        auto screen_p = transform_point(
+            camera_frame, vec3f{camera_p.x, camera_p.y, 0});
+        auto screen_p0 = transform_point(
+            camera_frame, vec3f{camera_p0.x, camera_p0.y, 0});
+        auto screen_p1 = transform_point(
+            camera_frame, vec3f{camera_p1.x, camera_p1.y, 0});
+
+        auto screen_dir = normalize(screen_p1 - screen_p0);
+        auto line_p     = screen_p0 +
+                      dot(screen_p - screen_p0, screen_dir) * screen_dir;
+
+        auto p_sign = sign(dot(screen_p1 - screen_p0, line_p - screen_p0));
+
+        xp += p_sign * distance(line_p, screen_p0);
+        yp = distance(line_p, screen_p);
+      } else {
+        auto screen_p = transform_point(
+            camera_frame, screen_space_point(camera_p, plane_distance));
+        auto screen_p0 = transform_point(
+            camera_frame, screen_space_point(camera_p0, plane_distance));
+        auto screen_p1 = transform_point(
+            camera_frame, screen_space_point(camera_p1, plane_distance));
 
-      auto screen_dir = normalize(screen_p1 - screen_p0);
-      auto line_p     = screen_p0 +
-                    dot(screen_p - screen_p0, screen_dir) * screen_dir;
+        auto screen_dir = normalize(screen_p1 - screen_p0);
+        auto line_p     = screen_p0 +
+                      dot(screen_p - screen_p0, screen_dir) * screen_dir;
 
-      auto p_sign = sign(dot(screen_p1 - screen_p0, line_p - screen_p0));
+        auto p_sign = sign(dot(screen_p1 - screen_p0, line_p - screen_p0));
 
-      xp += p_sign * distance(line_p, screen_p0);
-      yp = distance(line_p, screen_p);
+        xp += p_sign * distance(line_p, screen_p0);
+        yp = distance(line_p, screen_p);
+      }
     }
 
-    if (period < on) return true;
+    if (period < on) return 1;
 
     auto mp = fmod(xp + phase, period);
 
-    if (material.dash_cap == dash_cap_type::square) return mp <= on;
+    // extent of the dash along the stroke at the hit, where round caps are
+    // narrower away from the stroke center
+    auto start = 0.0f, end = on;
+    if (material.dash_cap == dash_cap_type::round) {
+      auto w = yp < r ? sqrt(r * r - yp * yp) : 0.0f;
+      start  = r - w;
+      end    = on - r + w;
+    }
+
+    // signed distance along the stroke from the closest dash, also looking
+    // at the dashes of the previous and of the next period
+    auto sd = min(max(start - mp, mp - end),
+        min(mp - end + period, start + period - mp));
+    if (pixel_size <= 0) return sd <= 0 ? 1 : 0;
+
+    // coverage of the dash ends over a pixel, in screen-space units
+    auto h = pixel_size * camera_scale / 2;
+    return clamp(0.5f - sd / (2 * h), 0.0f, 1.0f);
+  }
+
+  // Distance of a point from the ray line.
+  static float ray_point_distance(const ray3f& ray, const vec3f& p) {
+    auto op = p - ray.o;
+    return length(op - ray.d * dot(op, ray.d) / dot(ray.d, ray.d));
+  }
+
+  // Distance of a segment from the ray line. Sets u to the segment parameter
+  // of the closest point.
+  static float ray_segment_distance(
+      const ray3f& ray, const vec3f& p0, const vec3f& p1, float& u) {
+    auto e   = p1 - p0;
+    auto w   = p0 - ray.o;
+    auto a   = dot(ray.d, ray.d);
+    auto b   = dot(ray.d, e);
+    auto c   = dot(e, e);
+    auto den = a * c - b * b;
+    u = den > 0 ? clamp((b * dot(ray.d, w) - a * dot(e, w)) / den, 0.0f, 1.0f)
+                : 0.0f;
+    return ray_point_distance(ray, p0 + e * u);
+  }
+
+  // Coverage from the signed distance to the silhouette, with h half a pixel.
+  static float distance_coverage(float sd, float h) {
+    return clamp(0.5f - sd / (2 * h), 0.0f, 1.0f);
+  }
+
+  // Coverage of an arrow-head, treated as a triangle in the plane orthogonal to
+  // the ray, with the apex at the line end and the base at the arrow center.
+  // Stealth arrows replace the base with a notch at 45 degrees, leaving barbs.
+  // ar is the arrow radius and ha the half pixel at the apex, while rl and h
+  // are the line radius and the half pixel at the hit.
+  static float arrow_coverage(const vec3f& p, const ray3f& ray,
+      const vec3f& apex, const vec3f& center, float ar, float ha, float rl,
+      float h, line_end end) {
+    auto dir  = normalize(ray.d);
+    auto axis = apex - center;
+    axis -= dir * dot(axis, dir);
+    auto len = length(axis);
+    if (len == 0) return 1;
+    axis /= len;
+
+    auto q = p - center;
+    q -= dir * dot(q, dir);
+    auto x = dot(q, axis);
+    auto y = length(q - axis * x);
+
+    // distance from the arrow side and, outside of the line, from the base
+    auto sd = (x * ar + (y - ar) * len) / sqrt(ar * ar + len * len);
+    if (y > rl - h) {
+      sd = end == line_end::stealth_arrow ? max(sd, -(x + y) / sqrt(2.0f))
+                                          : max(sd, -x);
+    }
+    return distance_coverage(sd, ha);
+  }
+
+  float eval_fill_coverage(const ray3f& ray, const trace_shape& shape,
+      const shape_element& element) {
+    auto face = vec4i{0, 0, 0, 0};
+    auto num  = 4;
+    auto mask = 0;
+    if (element.primitive == primitive_type::triangle) {
+      auto& triangle = shape.triangles[element.index];
+      face           = {triangle.x, triangle.y, triangle.z, triangle.z};
+      num            = 3;
+      mask           = shape.triangle_edges[element.index];
+    } else {
+      face = shape.quads[element.index];
+      mask = shape.quad_edges[element.index];
+    }
+
+    auto center = vec3f{0, 0, 0};
+    for (auto k = 0; k < num; k++) center += shape.positions[face[k]];
+    center /= (float)num;
+
+    // each boundary edge covers the half plane on the side of the face, and
+    // corners are covered by the product as for a box filter
+    auto coverage = 1.0f;
+    for (auto k = 0; k < num; k++) {
+      auto& p0 = shape.positions[face[k]];
+      auto& p1 = shape.positions[face[(k + 1) % num]];
+      auto  m  = cross(p1 - p0, ray.d);
+      auto  ml = length(m);
+      if (ml == 0) continue;
+      m /= ml;
+
+      // signed distance of the ray from the edge line, positive outside
+      auto sd = dot(ray.o - p0, m);
+      if (dot(center - p0, m) > 0) sd = -sd;
+
+      auto u = 0.0f;
+      ray_segment_distance(ray, p0, p1, u);
+      auto h = lerp(
+          shape.aa_radii[face[k]], shape.aa_radii[face[(k + 1) % num]], u);
+      if ((mask & (1 << k)) == 0) {
+        if (sd > h * 1e-3f) return 0;
+        continue;
+      }
+      coverage *= distance_coverage(sd, h);
+    }
+    return coverage;
+  }
+
+  float eval_coverage(const vec3f& p, const ray3f& ray,
+      const trace_shape& shape, const shape_element& element, const vec2f& uv,
+      const bool hit_arrow) {
+    if (element.primitive == primitive_type::triangle ||
+        element.primitive == primitive_type::quad) {
+      if (shape.aa_radii.empty()) return 1;
+      return eval_fill_coverage(ray, shape, element);
+    }
+
+    if (shape.aa_ratio <= 0) return 1;
+
+    if (element.primitive == primitive_type::point) {
+      auto& point = shape.points[element.index];
+      auto  h     = shape.radii[point] * shape.aa_ratio;
+      auto  r     = (shape.radii[point] - h) * 3;
+      return distance_coverage(
+          ray_point_distance(ray, shape.positions[point]) - r, h);
+    }
+
+    if (element.primitive == primitive_type::curve) {
+      auto& curve = shape.curves[element.index];
+      auto  u     = clamp(uv.x, 0.0f, 1.0f) * curve.num;
+      auto  k     = min((int)u, curve.num - 1);
+      auto  pc    = vec3f{0, 0, 0};
+      auto  rl    = 0.0f;
+      eval_curve_span(shape.curve_spans[curve.start + k], u - k, pc, rl);
+      auto h = rl * shape.aa_ratio;
+
+      if (!hit_arrow)
+        return distance_coverage(ray_point_distance(ray, pc) - (rl - h), h);
+
+      auto& arrow = uv.x > 0.5f ? curve.arrow1 : curve.arrow0;
+      auto  end   = uv.x > 0.5f ? curve.ends.b : curve.ends.a;
+      auto  ha    = rl * shape.aa_ratio;
+      return arrow_coverage(
+          p, ray, pc, arrow.center, arrow.radius - ha, ha, rl, h, end);
+    }
 
-    if (mp < r) {
-      auto x = r - mp;
-      return pow(x, 2) + pow(yp, 2) <= pow(r, 2);
-    } else if (mp <= on && mp > on - r) {
-      auto x = r - on + mp;
-      return pow(x, 2) + pow(yp, 2) <= pow(r, 2);
-    } else
-      return mp <= on;
+    if (element.primitive != primitive_type::line &&
+        element.primitive != primitive_type::border)
+      return 1;
+
+    auto& line = element.primitive == primitive_type::line
+                     ? shape.lines[element.index]
+                     : shape.borders[element.index];
+    auto& p0   = shape.positions[line.x];
+    auto& p1   = shape.positions[line.y];
+
+    auto u  = 0.0f;
+    auto d  = ray_segment_distance(ray, p0, p1, u);
+    auto rl = lerp(shape.radii[line.x], shape.radii[line.y], u);
+    auto h  = rl * shape.aa_ratio;
+
+    if (!hit_arrow) return distance_coverage(d - (rl - h), h);
+
+    auto& ends  = shape.ends[element.index];
+    auto  end_b = ends.a == line_end::cap ||
+                 (ends.b != line_end::cap && u > 0.5f);
+    auto& apex   = end_b ? p1 : p0;
+    auto& center = end_b ? shape.arrow_centers1[element.index]
+                         : shape.arrow_centers0[element.index];
+    auto  ha     = shape.radii[end_b ? line.y : line.x] * shape.aa_ratio;
+    auto  ar     = (end_b ? shape.arrow_radii1[element.index]
+                          : shape.arrow_radii0[element.index]) -
+              ha;
+
+    return arrow_coverage(
+        p, ray, apex, center, ar, ha, rl, h, end_b ? ends.b : ends.a);
   }
 
-}  // namespace yocto
\ No newline at end of file
+}  // namespace yocto
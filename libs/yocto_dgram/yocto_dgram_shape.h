@@ -33,6 +33,9 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <memory>
+#include <memory_resource>
+
 #include "yocto_dgram.h"
 
 // -----------------------------------------------------------------------------
@@ -44,43 +47,159 @@ namespace yocto {
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// SHAPE ARENAS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Allocator that takes memory from an arena and never returns it, so that
+  // the arrays of many shapes are freed at once by releasing their arena.
+  // Default-constructed allocators, also used for copies, take memory from
+  // the heap as std::allocator does.
+  template <typename T>
+  struct arena_allocator {
+    using value_type                             = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+
+    std::pmr::memory_resource* arena = nullptr;
+
+    arena_allocator() = default;
+    arena_allocator(std::pmr::memory_resource* arena) : arena{arena} {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& other) : arena{other.arena} {}
+
+    T* allocate(size_t n) {
+      if (arena == nullptr) return std::allocator<T>{}.allocate(n);
+      return (T*)arena->allocate(n * sizeof(T), alignof(T));
+    }
+    void deallocate(T* data, size_t n) {
+      if (arena == nullptr) std::allocator<T>{}.deallocate(data, n);
+    }
+    arena_allocator select_on_container_copy_construction() const {
+      return {};
+    }
+  };
+
+  template <typename T, typename U>
+  inline bool operator==(
+      const arena_allocator<T>& a, const arena_allocator<U>& b) {
+    return a.arena == b.arena;
+  }
+  template <typename T, typename U>
+  inline bool operator!=(
+      const arena_allocator<T>& a, const arena_allocator<U>& b) {
+    return a.arena != b.arena;
+  }
+
+  // Array allocated from an arena
+  template <typename T>
+  using arena_vector = std::vector<T, arena_allocator<T>>;
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // SHAPE BUILD
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  enum class primitive_type { point, line, triangle, quad, border };
+  enum class primitive_type { point, line, curve, triangle, quad, border };
+
+  // Span of a curve as a rational cubic Bézier in homogeneous coordinates,
+  // with positions and radii multiplied by the weights, so that spans are
+  // evaluated and split like polynomial ones.
+  struct curve_span {
+    vec4f points[4] = {};  // positions times weights, weights
+    float radii[4]  = {};  // radii times weights
+    int   curve     = 0;   // curve the span belongs to
+    vec4f sphere    = {};  // bounding sphere of the body, center and radius
+  };
+
+  // Arrow-head at a curve end, built as the one of a line tangent to the end
+  struct curve_arrow {
+    vec3f center         = {0, 0, 0};
+    float radius         = 0;
+    vec3f plane_norm     = {0, 0, 0};
+    vec3f plane_45a_norm = {0, 0, 0};
+    vec3f plane_45b_norm = {0, 0, 0};
+    float trim           = 0;  // curve parameter where the body leaves it
+  };
+
+  // Beziers and arcs, in this order, as sequences of spans with the same
+  // parameter range. Arcs are split in spans of at most 90 degrees that
+  // represent them exactly, and all spans are split until they are nearly
+  // flat, so that they are bounded tightly in the bvh.
+  struct trace_curve {
+    int         start  = 0;
+    int         num    = 0;
+    line_ends   ends   = {};
+    curve_arrow arrow0 = {};
+    curve_arrow arrow1 = {};
+    float       length = 0;  // screen-space length
+  };
 
   struct trace_shape {
-    vector<vec3f> positions = {};
-
-    vector<int>   points    = {};
-    vector<vec2i> lines     = {};
-    vector<vec3i> triangles = {};
-    vector<vec4i> quads     = {};
-    vector<vec2i> borders   = {};
-
-    vector<vec4f>     fills            = {};
-    vector<line_ends> ends             = {};
-    vector<float>     radii            = {};
-    vector<vec3f>     plane_norms_0     = {};
-    vector<vec3f>     plane_norms_1     = {};
-    vector<vec3f>     plane_45a_norms_0 = {};
-    vector<vec3f>     plane_45a_norms_1 = {};
-    vector<vec3f>     plane_45b_norms_0 = {};
-    vector<vec3f>     plane_45b_norms_1 = {};
-    vector<float>     arrow_radii0     = {};
-    vector<float>     arrow_radii1     = {};
-    vector<vec3f>     arrow_centers0   = {};
-    vector<vec3f>     arrow_centers1   = {};
-    vector<float>     line_lengths     = {};
-    vector<float>     border_lengths   = {};
+    arena_vector<vec3f> positions = {};
+
+    arena_vector<int>   points    = {};
+    arena_vector<vec2i> lines     = {};
+    arena_vector<vec3i> triangles = {};
+    arena_vector<vec4i> quads     = {};
+    arena_vector<vec2i> borders   = {};
+
+    arena_vector<trace_curve> curves      = {};
+    arena_vector<curve_span>  curve_spans = {};
+
+    arena_vector<vec4f>     fills            = {};
+    arena_vector<line_ends> ends             = {};
+    arena_vector<float>     radii            = {};
+    arena_vector<vec3f>     plane_norms_0     = {};
+    arena_vector<vec3f>     plane_norms_1     = {};
+    arena_vector<vec3f>     plane_45a_norms_0 = {};
+    arena_vector<vec3f>     plane_45a_norms_1 = {};
+    arena_vector<vec3f>     plane_45b_norms_0 = {};
+    arena_vector<vec3f>     plane_45b_norms_1 = {};
+    arena_vector<float>     arrow_radii0     = {};
+    arena_vector<float>     arrow_radii1     = {};
+    arena_vector<vec3f>     arrow_centers0   = {};
+    arena_vector<vec3f>     arrow_centers1   = {};
+    arena_vector<float>     line_lengths     = {};
+    arena_vector<float>     border_lengths   = {};
+
+    // for analytic antialiasing radii are enlarged by half a pixel, this is
+    // the ratio between the half pixel and the enlarged radius
+    float aa_ratio = 0;
+
+    // for analytic antialiasing fills are also enlarged by half a pixel across
+    // the boundary edges, these are the half pixel at each position and, for
+    // each triangle and quad, the mask of its edges on the boundary, with bit
+    // k for the edge that starts at its k-th vertex
+    arena_vector<float>   aa_radii       = {};
+    arena_vector<uint8_t> triangle_edges = {};
+    arena_vector<uint8_t> quad_edges     = {};
 
     int material = -1;
   };
 
+  // Shapes built at once, whose arrays are allocated from a few arenas, one
+  // for each building thread, that are freed together with the shapes.
+  // Arenas are declared first so that they are destroyed after the shapes,
+  // and move assignment drops the old shapes before their arenas. A shape
+  // moved out of its trace_shapes must not outlive it.
   struct trace_shapes {
+    vector<std::unique_ptr<std::pmr::monotonic_buffer_resource>> arenas = {};
+
     vector<trace_shape> shapes = {};
+
+    trace_shapes()                    = default;
+    trace_shapes(trace_shapes&&)      = default;
+    trace_shapes(const trace_shapes&) = delete;
+    trace_shapes& operator=(trace_shapes&& other) {
+      shapes = std::move(other.shapes);
+      arenas = std::move(other.arenas);
+      return *this;
+    }
+    trace_shapes& operator=(const trace_shapes&) = delete;
   };
 
   struct shape_element {
@@ -93,8 +212,12 @@ namespace yocto {
     }
   };
 
+  // Builds the shapes seen from a camera. If pixel_size, in diagram units, is
+  // positive, strokes, points and fills are enlarged by half a pixel so that
+  // their coverage can be evaluated analytically with eval_coverage.
   trace_shapes make_shapes(const dgram_scene& scene, const int& cam,
-      const vec2f& size, const float& scale, const bool noparallel = false);
+      const vec2f& size, const float& scale, const bool noparallel = false,
+      const float pixel_size = 0);
 
 }  // namespace yocto
 
@@ -106,9 +229,26 @@ namespace yocto {
   vec4f eval_material(const trace_shape& shape, const dgram_material& material,
       const shape_element& element, const vec2f& uv);
 
-  bool eval_dashes(const vec3f& p, const trace_shape& shape,
+  // Fraction of the pixel covered by the dash at a stroke hit, along the
+  // stroke. It is 0 or 1 unless pixel_size, in diagram units, is positive, in
+  // which case dash ends are antialiased over a pixel.
+  float eval_dashes(const vec3f& p, const trace_shape& shape,
       const dgram_material& material, const shape_element& element,
-      const dgram_camera& camera, const vec2f& size, const float& scale);
+      const vec2f& uv, const dgram_camera& camera, const vec2f& size,
+      const float& scale, const float pixel_size = 0);
+
+  // Fraction of the pixel covered by a point, a line, a curve or a fill,
+  // computed from the screen-space distance of the ray to the primitive
+  // silhouette. Returns 1 for shapes built without analytic antialiasing.
+  float eval_coverage(const vec3f& p, const ray3f& ray,
+      const trace_shape& shape, const shape_element& element, const vec2f& uv,
+      const bool hit_arrow);
+
+  // Fraction of the pixel covered by a triangle or a quad, from the distances
+  // of the ray to its boundary edges. Returns 0 if the ray passes outside an
+  // inner edge, where the neighboring face is hit instead.
+  float eval_fill_coverage(
+      const ray3f& ray, const trace_shape& shape, const shape_element& element);
 
 }  // namespace yocto
 
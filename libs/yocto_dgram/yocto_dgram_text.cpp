@@ -37,7 +37,9 @@
 
 #include <future>
 #include <iomanip>
+#include <set>
 #include <sstream>
+#include <tuple>
 
 #include "ext/HTTPRequest.hpp"
 #include "ext/base64.h"
@@ -156,15 +158,11 @@ namespace yocto {
   }
 
   static image_data make_text_image(const string& text, const float alignment,
-      const vec4f& color, const int width, const int height, const float zoom) {
+      const int width, const int height, const float zoom) {
     http::Request request{"localhost:5500/rasterize"};
     auto body = "text=" + escape_string(text) + "&width=" + to_string(width) +
                 "&height=" + to_string(height) + "&zoom=" + to_string(zoom) +
-                "&align_x=" + to_string(alignment) +
-                "&r=" + to_string((int)round(color.x * 255)) +
-                "&g=" + to_string((int)round(color.y * 255)) +
-                "&b=" + to_string((int)round(color.z * 255)) +
-                "&a=" + to_string((int)round(color.w));
+                "&align_x=" + to_string(alignment);
     auto response = request.send(
         "POST", body, {"Content-Type: application/x-www-form-urlencoded"});
     auto string64 = string{response.body.begin(), response.body.end()};
@@ -179,14 +177,12 @@ namespace yocto {
       const bool rerender) {
     auto text = trace_text{};
 
-    auto& object   = scene.objects[i];
-    auto& label    = scene.labels[object.labels];
-    auto& material = scene.materials[object.material];
-    auto& color    = material.stroke;
+    auto& object = scene.objects[i];
+    auto& label  = scene.labels[object.labels];
 
     if (rerender) {
-      text.image = make_text_image(label.texts[j], label.alignments[j], color,
-          width, height, width / size.x);
+      text.image = make_text_image(
+          label.texts[j], label.alignments[j], width, height, width / size.x);
       label.images[j] = text.image;
     } else {
       if (!label.images[j].pixels.empty() && label.images[j].width == width * 2)
@@ -281,7 +277,8 @@ namespace yocto {
     text.positions.push_back(p2);
     text.positions.push_back(p3);
 
-    text.name = label.names[j];
+    text.name     = label.names[j];
+    text.material = object.material;
 
     return text;
   }
@@ -290,21 +287,36 @@ namespace yocto {
       const float& scale, const int width, const int height) {
     auto images = text_images{};
 
+    // masks do not depend on the material, so labels with the same name, text
+    // and alignment are rasterized only once
+    auto idxs = vector<pair<int, int>>{};
+    auto keys = std::set<std::tuple<string, string, float>>{};
     for (auto i = 0; i < scene.objects.size(); i++) {
       auto& object = scene.objects[i];
       if (object.labels != -1) {
-        auto& label    = scene.labels[object.labels];
-        auto& material = scene.materials[object.material];
-        auto& color    = material.stroke;
+        auto& label = scene.labels[object.labels];
         for (auto j = 0; j < label.texts.size(); j++) {
-          auto& text_image = images.images.emplace_back();
-          text_image.image = make_text_image(label.texts[j],
-              label.alignments[j], color, width, height, width / size.x);
-          text_image.name  = label.names[j];
+          auto key = std::make_tuple(
+              label.names[j], label.texts[j], label.alignments[j]);
+          if (!keys.insert(key).second) continue;
+          idxs.push_back(make_pair(i, j));
         }
       }
     }
 
+    // requests are sent concurrently since the server keeps a pool of pages
+    images.images.resize(idxs.size());
+    parallel_for(idxs.size(), [&](size_t idx) {
+      auto  i          = idxs[idx].first;
+      auto  j          = idxs[idx].second;
+      auto& object     = scene.objects[i];
+      auto& label      = scene.labels[object.labels];
+      auto& text_image = images.images[idx];
+      text_image.image = make_text_image(label.texts[j], label.alignments[j],
+          width, height, width / size.x);
+      text_image.name  = label.names[j];
+    });
+
     return images;
   }
 
@@ -372,8 +384,8 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  vec4f eval_text(const trace_text& text, const vec2f& uv) {
-    return eval_image(text.image, uv, false);
+  float eval_text(const trace_text& text, const vec2f& uv) {
+    return eval_image(text.image, uv, false).w;
   }
 
 }  // namespace yocto
\ No newline at end of file
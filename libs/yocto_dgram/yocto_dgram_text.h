@@ -49,10 +49,14 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+  // Labels are rasterized as coverage masks stored in the alpha channel of
+  // the image, the material stroke color is applied when compositing.
   struct trace_text {
     string        name      = {};
     vector<vec3f> positions = {};
     image_data    image     = {};
+
+    int material = -1;
   };
 
   struct trace_texts {
@@ -86,7 +90,7 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  vec4f eval_text(const trace_text& text, const vec2f& uv);
+  float eval_text(const trace_text& text, const vec2f& uv);
 
 }  // namespace yocto
 
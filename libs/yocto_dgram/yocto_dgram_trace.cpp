@@ -32,6 +32,9 @@
 
 #include "yocto_dgram_trace.h"
 
+#include <yocto/yocto_sceneio.h>
+
+#include <cstring>
 #include <future>
 
 // -----------------------------------------------------------------------------
@@ -90,7 +93,7 @@ namespace yocto {
         shape, material, intersection.element, intersection.uv);
   }
 
-  static bool eval_dashes(const dgram_scene& scene, const trace_shapes& shapes,
+  static float eval_dashes(const dgram_scene& scene, const trace_shapes& shapes,
       const bvh_intersection& intersection, const dgram_trace_params& params,
       const bool first) {
     auto& shape    = shapes.shapes[intersection.shape];
@@ -101,12 +104,103 @@ namespace yocto {
         (material.dashed == dashed_line::always ||
             (material.dashed == dashed_line::transparency && !first)) &&
         (intersection.element.primitive == primitive_type::line ||
+            intersection.element.primitive == primitive_type::curve ||
             intersection.element.primitive == primitive_type::border)) {
       return eval_dashes(intersection.position, shape, material,
-          intersection.element, camera, params.size, params.scale);
+          intersection.element, intersection.uv, camera, params.size,
+          params.scale, get_pixel_size(params));
     }
 
-    return true;
+    return 1;
+  }
+
+  static float eval_coverage(const trace_shapes& shapes,
+      const bvh_intersection& intersection, const ray3f& ray,
+      const dgram_trace_params& params) {
+    if (params.antialiasing != antialiasing_type::analytic) return 1;
+    auto& shape = shapes.shapes[intersection.shape];
+    return eval_coverage(intersection.position, ray, shape,
+        intersection.element, intersection.uv, intersection.hit_arrow);
+  }
+
+  // Coverage of a stroke primitive of a shape hit by a ray
+  struct stroke_coverage {
+    int           shape    = -1;
+    shape_element element  = {};
+    float         coverage = 0;
+  };
+
+  // Whether two primitives of a shape are the same stroke, points drawn at
+  // the same position, or segments of a polyline sharing a vertex
+  static bool connected_strokes(const trace_shape& shape,
+      const shape_element& a, const shape_element& b) {
+    if (a.primitive != b.primitive) return false;
+    if (a.primitive == primitive_type::triangle ||
+        a.primitive == primitive_type::quad)
+      return false;
+    if (a.index == b.index) return true;
+    if (a.primitive == primitive_type::point)
+      return shape.positions[shape.points[a.index]] ==
+             shape.positions[shape.points[b.index]];
+    if (a.primitive != primitive_type::line &&
+        a.primitive != primitive_type::border)
+      return false;
+    auto& lines = a.primitive == primitive_type::line ? shape.lines
+                                                      : shape.borders;
+    auto& la    = lines[a.index];
+    auto& lb    = lines[b.index];
+    return la.x == lb.x || la.x == lb.y || la.y == lb.x || la.y == lb.y;
+  }
+
+  // In analytic antialiasing, the hits of connected strokes, like the
+  // segments of a polyline at a joint, overlap rather than add up their
+  // coverage, so only the most covering one is kept by clearing the others.
+  // A ray continuing behind hits them again, like the back of an enlarged
+  // stroke, so there only the coverage in excess of the one in front is kept.
+  // Fills, and strokes that merely cross, are composited as they are, so
+  // rendering barely depends on how objects are grouped in shapes.
+  static void merge_coverages(const trace_shapes& shapes,
+      const bvh_intersections& intersections, vector<vec4f>& colors,
+      vector<stroke_coverage>& front, const dgram_trace_params& params) {
+    if (params.antialiasing != antialiasing_type::analytic) return;
+    auto& hits = intersections.intersections;
+    for (auto i = 0; i < (int)hits.size(); i++) {
+      auto& shape = shapes.shapes[hits[i].shape];
+      for (auto j = 0; j < i && colors[i].w > 0; j++) {
+        if (hits[j].shape != hits[i].shape ||
+            !connected_strokes(shape, hits[j].element, hits[i].element))
+          continue;
+        if (colors[i].w > colors[j].w)
+          colors[j].w = 0;
+        else
+          colors[i].w = 0;
+      }
+    }
+    for (auto i = 0; i < (int)hits.size(); i++) {
+      auto& shape = shapes.shapes[hits[i].shape];
+      auto& hit   = hits[i];
+      if (colors[i].w <= 0 ||
+          !connected_strokes(shape, hit.element, hit.element))
+        continue;
+      auto covered = 0.0f;
+      auto same    = front.end();
+      for (auto it = front.begin(); it != front.end(); ++it) {
+        if (it->shape != hit.shape ||
+            !connected_strokes(shape, it->element, hit.element))
+          continue;
+        covered = max(covered, it->coverage);
+        if (it->element.index == hit.element.index) same = it;
+      }
+      auto coverage = colors[i].w;
+      colors[i].w   = coverage <= covered
+                          ? 0
+                          : (coverage - covered) / (1 - covered);
+      if (same == front.end()) {
+        front.push_back({hit.shape, hit.element, coverage});
+      } else {
+        same->coverage = max(same->coverage, coverage);
+      }
+    }
   }
 
   static ray3f sample_camera(const dgram_camera& camera, const vec2i& ij,
@@ -131,43 +225,68 @@ namespace yocto {
     return state;
   }
 
-  static vec4f trace_text(const trace_texts& texts, const ray3f& ray,
-      rng_state& rng, const dgram_trace_params& params) {
+  float get_pixel_size(const dgram_trace_params& params) {
+    if (params.antialiasing != antialiasing_type::analytic) return 0;
+    auto ns = max((int)sqrt((float)params.samples), 1);
+    return params.size.x / (params.width * ns);
+  }
+
+  static vec4f trace_text(const dgram_scene& scene, const trace_texts& texts,
+      const ray3f& ray, rng_state& rng, const dgram_trace_params& params) {
     auto text_color = vec4f{0, 0, 0, 0};
     for (auto& text : texts.texts) {
       auto uv = zero2f;
-      if (intersect_text(text, ray, uv))
-        text_color = composite(eval_text(text, uv), text_color);
+      if (intersect_text(text, ray, uv)) {
+        auto coverage = eval_text(text, uv);
+        if (coverage <= 0) continue;
+        // tinting the label mask with the material stroke color
+        auto color = scene.materials[text.material].stroke;
+        color.w *= coverage;
+        text_color = composite(color, text_color);
+      }
     }
     return text_color;
   }
 
   static vec4f trace_color(const dgram_scene& scene, const trace_shapes& shapes,
       const dgram_scene_bvh& bvh, const ray3f& ray, rng_state& rng,
-      const dgram_trace_params& params, const bool first) {
+      const dgram_trace_params& params, const bool first,
+      vector<stroke_coverage>& front) {
     auto radiance = vec4f{0, 0, 0, 0};
 
     auto intersections = intersect_bvh(bvh, shapes, ray);
 
-    auto hit = false;
+    auto& hits   = intersections.intersections;
+    auto  hit    = !hits.empty();
+    auto  colors = vector<vec4f>(hits.size());
 
-    for (auto& intersection : intersections.intersections) {
-      hit        = true;
-      auto color = eval_material(scene, shapes, intersection);
+    for (auto idx = 0; idx < (int)hits.size(); idx++) {
+      auto& intersection = hits[idx];
+      auto& color        = colors[idx];
+      color              = eval_material(scene, shapes, intersection);
       color.w *= eval_dashes(scene, shapes, intersection, params, first);
-
-      radiance = composite(color, radiance);
+      color.w *= eval_coverage(shapes, intersection, ray, params);
     }
 
+    merge_coverages(shapes, intersections, colors, front, params);
+    for (auto& color : colors) radiance = composite(color, radiance);
+
     if (hit && radiance.w < 1) {
       auto back_color = trace_color(scene, shapes, bvh,
-          {intersections.intersections[0].position, ray.d}, rng, params, false);
+          {intersections.position, ray.d}, rng, params, false, front);
       return composite(radiance, back_color);
     }
 
     return radiance;
   }
 
+  static vec4f trace_color(const dgram_scene& scene, const trace_shapes& shapes,
+      const dgram_scene_bvh& bvh, const ray3f& ray, rng_state& rng,
+      const dgram_trace_params& params, const bool first) {
+    auto front = vector<stroke_coverage>{};
+    return trace_color(scene, shapes, bvh, ray, rng, params, first, front);
+  }
+
   static vec4f trace_normal(const dgram_scene& scene,
       const trace_shapes& shapes, const dgram_scene_bvh& bvh, const ray3f& ray,
       rng_state& rng, const dgram_trace_params& params, const bool first) {
@@ -194,34 +313,47 @@ namespace yocto {
 
   static vec4f trace_eyelight(const dgram_scene& scene,
       const trace_shapes& shapes, const dgram_scene_bvh& bvh, const ray3f& ray,
-      rng_state& rng, const dgram_trace_params& params, const bool first) {
+      rng_state& rng, const dgram_trace_params& params, const bool first,
+      vector<stroke_coverage>& front) {
     auto radiance = vec4f{0, 0, 0, 0};
 
     auto intersections = intersect_bvh(bvh, shapes, ray);
 
-    auto hit = false;
+    auto& hits   = intersections.intersections;
+    auto  hit    = !hits.empty();
+    auto  colors = vector<vec4f>(hits.size());
 
-    for (auto& intersection : intersections.intersections) {
-      hit            = true;
-      auto color     = eval_material(scene, shapes, intersection);
+    for (auto idx = 0; idx < (int)hits.size(); idx++) {
+      auto& intersection = hits[idx];
+      auto& color        = colors[idx];
+      color              = eval_material(scene, shapes, intersection);
       auto rgb_color = rgba_to_rgb(color) * abs(dot(intersection.normal, ray.d));
       color.x        = rgb_color.x;
       color.y        = rgb_color.y;
       color.z        = rgb_color.z;
       color.w *= eval_dashes(scene, shapes, intersection, params, first);
-
-      radiance = composite(color, radiance);
+      color.w *= eval_coverage(shapes, intersection, ray, params);
     }
 
+    merge_coverages(shapes, intersections, colors, front, params);
+    for (auto& color : colors) radiance = composite(color, radiance);
+
     if (hit && radiance.w < 1) {
       auto back_color = trace_eyelight(scene, shapes, bvh,
-          {intersections.intersections[0].position, ray.d}, rng, params, false);
+          {intersections.position, ray.d}, rng, params, false, front);
       return composite(radiance, back_color);
     }
 
     return radiance;
   }
 
+  static vec4f trace_eyelight(const dgram_scene& scene,
+      const trace_shapes& shapes, const dgram_scene_bvh& bvh, const ray3f& ray,
+      rng_state& rng, const dgram_trace_params& params, const bool first) {
+    auto front = vector<stroke_coverage>{};
+    return trace_eyelight(scene, shapes, bvh, ray, rng, params, first, front);
+  }
+
   using sampler_func = vec4f (*)(const dgram_scene& scene,
       const trace_shapes& shapes, const dgram_scene_bvh& bvh, const ray3f& ray,
       rng_state& rng, const dgram_trace_params& params, const bool first);
@@ -253,6 +385,13 @@ namespace yocto {
       auto si = floor(state.samples / ns);
       auto sj = state.samples - floor(state.samples / ns) * ns;
       puv     = (vec2f{si, sj} + 0.5f) / ns;
+    } else if (params.antialiasing == antialiasing_type::analytic) {
+      // strokes, fills and dash ends are covered analytically over a cell of
+      // a k by k grid, as sized by get_pixel_size(), so each sample goes
+      // through the center of a cell, and samples past k * k repeat them
+      auto ns = max((int)sqrt((float)params.samples), 1);
+      auto cs = state.samples % (ns * ns);
+      puv     = (vec2f{(float)(cs / ns), (float)(cs % ns)} + 0.5f) / ns;
     }
 
     auto offset = scene.offset * params.scale * params.width * 2 /
@@ -264,7 +403,7 @@ namespace yocto {
         camera, {ii, ij}, {state.width, state.height}, puv, params);
     auto radiance = sampler(
         scene, shapes, bvh, ray, state.rngs[idx], params, true);
-    auto text = trace_text(texts, ray, state.rngs[idx], params);
+    auto text = trace_text(scene, texts, ray, state.rngs[idx], params);
     radiance  = composite(text, radiance);
     if (radiance.w > 0) {
       if (state.image[idx].w > 0)
@@ -320,3 +459,153 @@ namespace yocto {
   }
 
 }  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// CHECKPOINTS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Checkpoint header
+  static const auto dgram_checkpoint_magic = array<char, 4>{
+      'Y', 'D', 'C', 'P'};
+  static const auto dgram_checkpoint_version = 2;
+
+  // Hash of the scene and of the params that change the samples taken, so
+  // that checkpoints of other renders are rejected. Structs with padding are
+  // hashed by field.
+  static uint64_t hash_checkpoint(
+      const dgram_scene& scene, const dgram_trace_params& params) {
+    auto hash = (uint64_t)0;
+
+    // scene
+    hash = hash_value(hash, scene.offset);
+    for (auto& camera : scene.cameras) {
+      hash = hash_value(hash, camera.orthographic);
+      hash = hash_value(hash, camera.center);
+      hash = hash_value(hash, camera.from);
+      hash = hash_value(hash, camera.to);
+      hash = hash_value(hash, camera.lens);
+      hash = hash_value(hash, camera.film);
+    }
+    hash = hash_values(hash, scene.objects);
+    hash = hash_values(hash, scene.materials);
+    for (auto& shape : scene.shapes) {
+      hash = hash_values(hash, shape.positions);
+      hash = hash_values(hash, shape.points);
+      hash = hash_values(hash, shape.lines);
+      hash = hash_values(hash, shape.triangles);
+      hash = hash_values(hash, shape.quads);
+      hash = hash_values(hash, shape.beziers);
+      hash = hash_values(hash, shape.arcs);
+      hash = hash_values(hash, shape.fills);
+      hash = hash_values(hash, shape.ends);
+      hash = hash_values(hash, shape.bezier_ends);
+      hash = hash_values(hash, shape.arc_ends);
+      hash = hash_value(hash, shape.cull);
+      hash = hash_value(hash, shape.boundary);
+    }
+    for (auto& label : scene.labels) {
+      hash = hash_values(hash, label.positions);
+      for (auto& text : label.texts)
+        hash = hash_bytes(hash, text.data(), text.size());
+      hash = hash_values(hash, label.offsets);
+      hash = hash_values(hash, label.alignments);
+      for (auto& image : label.images) {
+        hash = hash_value(hash, image.width);
+        hash = hash_value(hash, image.height);
+        hash = hash_value(hash, image.linear);
+        hash = hash_values(hash, image.pixels);
+      }
+    }
+
+    // params
+    hash = hash_value(hash, params.camera);
+    hash = hash_value(hash, params.scale);
+    hash = hash_value(hash, params.size);
+    hash = hash_value(hash, params.width);
+    hash = hash_value(hash, params.height);
+    hash = hash_value(hash, params.samples);
+    hash = hash_value(hash, params.seed);
+    hash = hash_value(hash, params.sampler);
+    hash = hash_value(hash, params.antialiasing);
+    return hash;
+  }
+
+  bool save_checkpoint(const string& filename, const dgram_trace_state& state,
+      const dgram_scene& scene, const dgram_trace_params& params,
+      string& error) {
+    auto data         = vector<byte>{};
+    auto write_values = [&](const auto* values, size_t count) {
+      auto start = (const byte*)values;
+      data.insert(data.end(), start, start + count * sizeof(values[0]));
+    };
+    auto write_value = [&](const auto& value) { write_values(&value, 1); };
+
+    write_value(dgram_checkpoint_magic);
+    write_value(dgram_checkpoint_version);
+    write_value(hash_checkpoint(scene, params));
+    write_value(state.width);
+    write_value(state.height);
+    write_value(state.samples);
+    write_values(state.image.data(), state.image.size());
+    write_values(state.rngs.data(), state.rngs.size());
+
+    // write to a temporary file and replace the previous checkpoint
+    return save_atomic(
+        filename, error, [&](const string& tempname, string& error) {
+          return save_binary(tempname, data, error);
+        });
+  }
+
+  bool load_checkpoint(const string& filename, dgram_trace_state& state,
+      const dgram_scene& scene, const dgram_trace_params& params,
+      string& error) {
+    auto data = vector<byte>{};
+    if (!load_binary(filename, data, error)) return false;
+    auto offset      = (size_t)0;
+    auto read_values = [&](auto* values, size_t count) {
+      auto size = count * sizeof(values[0]);
+      if (offset + size > data.size()) return false;
+      memcpy((void*)values, data.data() + offset, size);
+      offset += size;
+      return true;
+    };
+    auto read_value = [&](auto& value) { return read_values(&value, 1); };
+
+    auto magic   = array<char, 4>{};
+    auto version = 0;
+    if (!read_value(magic) || !read_value(version) ||
+        magic != dgram_checkpoint_magic ||
+        version != dgram_checkpoint_version) {
+      error = "unsupported checkpoint " + filename;
+      return false;
+    }
+
+    auto hash  = (uint64_t)0;
+    auto width = 0, height = 0, samples = 0;
+    if (!read_value(hash) || !read_value(width) || !read_value(height) ||
+        !read_value(samples)) {
+      error = "corrupted checkpoint " + filename;
+      return false;
+    }
+    if (hash != hash_checkpoint(scene, params) || width != state.width ||
+        height != state.height) {
+      error = "mismatched checkpoint " + filename;
+      return false;
+    }
+
+    auto image = vector<vec4f>(state.image.size());
+    auto rngs  = vector<rng_state>(state.rngs.size());
+    if (!read_values(image.data(), image.size()) ||
+        !read_values(rngs.data(), rngs.size()) || offset != data.size()) {
+      error = "corrupted checkpoint " + filename;
+      return false;
+    }
+
+    state.samples = samples;
+    state.image   = std::move(image);
+    state.rngs    = std::move(rngs);
+    return true;
+  }
+
+}  // namespace yocto
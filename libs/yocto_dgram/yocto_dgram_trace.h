@@ -58,7 +58,7 @@ namespace yocto {
   enum struct dgram_sampler_type { color, normal, uv, eyelight };
 
   // Type of antialiasing
-  enum struct antialiasing_type { random_sampling, super_sampling };
+  enum struct antialiasing_type { random_sampling, super_sampling, analytic };
 
   const auto dgram_default_seed = 961748941ull;
 
@@ -92,6 +92,12 @@ namespace yocto {
 
   dgram_trace_state make_state(const dgram_trace_params& params);
 
+  // Pixel size in diagram units used to build shapes for analytic
+  // antialiasing, zero for the other antialiasing types. With k the square
+  // root of the samples, rounded down, each sample covers one cell of a k by k
+  // grid, so this is the size of a cell.
+  float get_pixel_size(const dgram_trace_params& params);
+
   void trace_samples(dgram_trace_state& state, const dgram_scene& scene,
       const trace_shapes& shapes, const trace_texts& texts,
       const dgram_scene_bvh& bvh, const dgram_trace_params& params);
@@ -103,6 +109,18 @@ namespace yocto {
   image_data get_render(const dgram_trace_state& state);
   void       get_render(image_data& render, const dgram_trace_state& state);
 
+  // Save and load the rendering state to resume interrupted renders. Saving
+  // goes through a temporary file, so that the previous checkpoint survives a
+  // crash while writing. Checkpoints store a hash of the scene and of the
+  // params that change the samples, and loading rejects the ones made for
+  // other renders.
+  bool save_checkpoint(const string& filename, const dgram_trace_state& state,
+      const dgram_scene& scene, const dgram_trace_params& params,
+      string& error);
+  bool load_checkpoint(const string& filename, dgram_trace_state& state,
+      const dgram_scene& scene, const dgram_trace_params& params,
+      string& error);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -124,13 +142,14 @@ namespace yocto {
 
   // antialiasing names
   inline const auto antialiasing_names = vector<string>{
-      "random_sampling", "super_sampling"};
+      "random_sampling", "super_sampling", "analytic"};
 
   // antialiasing labels
   inline const auto antialiasing_labels =
       vector<pair<antialiasing_type, string>>{
           {antialiasing_type::random_sampling, "random_sampling"},
-          {antialiasing_type::super_sampling, "super_sampling"}};
+          {antialiasing_type::super_sampling, "super_sampling"},
+          {antialiasing_type::analytic, "analytic"}};
 
 }  // namespace yocto
 #endif
\ No newline at end of file
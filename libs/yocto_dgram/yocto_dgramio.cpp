@@ -146,6 +146,15 @@ namespace yocto {
   inline void to_json(json_value& json, const vec4f& value) {
     nlohmann::to_json(json, (const array<float, 4>&)value);
   }
+  inline void to_json(json_value& json, const vec2i& value) {
+    nlohmann::to_json(json, (const array<int, 2>&)value);
+  }
+  inline void to_json(json_value& json, const vec3i& value) {
+    nlohmann::to_json(json, (const array<int, 3>&)value);
+  }
+  inline void to_json(json_value& json, const vec4i& value) {
+    nlohmann::to_json(json, (const array<int, 4>&)value);
+  }
   inline void to_json(json_value& json, const frame2f& value) {
     nlohmann::to_json(json, (const array<float, 6>&)value);
   }
@@ -195,6 +204,9 @@ namespace yocto {
     nlohmann::from_json(json, (array<float, 16>&)value);
   }
 
+  inline void to_json(json_value& json, const line_ends& value) {
+    nlohmann::to_json(json, (const array<line_end, 2>&)value);
+  }
   inline void from_json(const json_value& json, line_ends& value) {
     nlohmann::from_json(json, (array<line_end, 2>&)value);
   }
@@ -222,7 +234,7 @@ namespace yocto {
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
-// DGRAM SCENES LOADER
+// DGRAM SCENES IO
 // -----------------------------------------------------------------------------
 namespace yocto {
 
@@ -319,6 +331,11 @@ namespace yocto {
 
               get_opt(jshape, "lines", shape.lines);
               get_opt(jshape, "ends", shape.ends);
+
+              get_opt(jshape, "beziers", shape.beziers);
+              get_opt(jshape, "bezier_ends", shape.bezier_ends);
+              get_opt(jshape, "arcs", shape.arcs);
+              get_opt(jshape, "arc_ends", shape.arc_ends);
             }
           }
 
@@ -389,6 +406,137 @@ namespace yocto {
     return dgram;
   }
 
+  static bool save_json_dgram(
+      const string& filename, const dgram_scenes& dgram, string& error) {
+    // values are only written when different from their defaults
+    auto add_opt = [](json_value& json, const string& key, const auto& value,
+                       const auto& def) {
+      if (!(value == def)) json[key] = value;
+    };
+    auto add_vec = [](json_value& json, const string& key, const auto& value) {
+      if (!value.empty()) json[key] = value;
+    };
+
+    auto json = json_value::object();
+    try {
+      auto ddgram = dgram_scenes{};
+      add_opt(json, "size", dgram.size, ddgram.size);
+      add_opt(json, "resolution", dgram.scale, ddgram.scale);
+
+      auto& jscenes = json["scenes"] = json_value::array();
+      for (auto& scene : dgram.scenes) {
+        auto& jscene = jscenes.emplace_back(json_value::object());
+
+        add_opt(jscene, "offset", scene.offset, vec2f{0, 0});
+
+        auto& jcameras = jscene["cameras"] = json_value::array();
+        for (auto& camera : scene.cameras) {
+          auto& jcamera = jcameras.emplace_back(json_value::object());
+          auto  dcamera = dgram_camera{};
+          add_opt(jcamera, "orthographic", camera.orthographic,
+              dcamera.orthographic);
+          add_opt(jcamera, "center", camera.center, dcamera.center);
+          add_opt(jcamera, "from", camera.from, dcamera.from);
+          add_opt(jcamera, "to", camera.to, dcamera.to);
+          add_opt(jcamera, "lens", camera.lens, dcamera.lens);
+        }
+
+        auto& jobjects = jscene["objects"] = json_value::array();
+        for (auto& object : scene.objects) {
+          auto& jobject = jobjects.emplace_back(json_value::object());
+          auto  dobject = dgram_object{};
+          add_opt(jobject, "frame", object.frame, dobject.frame);
+          add_opt(jobject, "shape", object.shape, dobject.shape);
+          add_opt(jobject, "material", object.material, dobject.material);
+          add_opt(jobject, "labels", object.labels, dobject.labels);
+        }
+
+        auto& jmaterials = jscene["materials"] = json_value::array();
+        for (auto& material : scene.materials) {
+          auto& jmaterial = jmaterials.emplace_back(json_value::object());
+          auto  dmaterial = dgram_material{};
+          add_opt(jmaterial, "fill", material.fill, dmaterial.fill);
+          add_opt(jmaterial, "stroke", material.stroke, dmaterial.stroke);
+
+          add_opt(jmaterial, "thickness", material.thickness,
+              dmaterial.thickness);
+
+          add_opt(jmaterial, "dash_period", material.dash_period,
+              dmaterial.dash_period);
+          add_opt(jmaterial, "dash_phase", material.dash_phase,
+              dmaterial.dash_phase);
+          add_opt(jmaterial, "dash_on", material.dash_on, dmaterial.dash_on);
+          add_opt(
+              jmaterial, "dash_cap", material.dash_cap, dmaterial.dash_cap);
+
+          add_opt(jmaterial, "dashed", material.dashed, dmaterial.dashed);
+        }
+
+        auto& jshapes = jscene["shapes"] = json_value::array();
+        for (auto& shape : scene.shapes) {
+          auto& jshape = jshapes.emplace_back(json_value::object());
+
+          add_vec(jshape, "points", shape.points);
+          add_vec(jshape, "triangles", shape.triangles);
+          add_vec(jshape, "quads", shape.quads);
+
+          add_vec(jshape, "positions", shape.positions);
+          add_vec(jshape, "fills", shape.fills);
+
+          add_opt(jshape, "cull", shape.cull, false);
+          add_opt(jshape, "boundary", shape.boundary, false);
+
+          add_vec(jshape, "lines", shape.lines);
+          add_vec(jshape, "ends", shape.ends);
+
+          add_vec(jshape, "beziers", shape.beziers);
+          add_vec(jshape, "bezier_ends", shape.bezier_ends);
+          add_vec(jshape, "arcs", shape.arcs);
+          add_vec(jshape, "arc_ends", shape.arc_ends);
+        }
+
+        auto& jlabels = jscene["labels"] = json_value::array();
+        for (auto& label : scene.labels) {
+          auto& jlabel = jlabels.emplace_back(json_value::object());
+
+          add_vec(jlabel, "positions", label.positions);
+
+          auto& jtexts = jlabel["labels"] = json_value::array();
+          for (auto j = 0; j < label.texts.size(); j++) {
+            auto& elem = jtexts.emplace_back(json_value::object());
+
+            elem["unprocessed"] = label.texts[j];
+            add_opt(elem, "offset", label.offsets[j], vec2f{0, 0});
+            add_opt(elem, "alignment", label.alignments[j], 0.0f);
+            add_opt(
+                elem, "name", label.names[j], escape_string(label.texts[j]));
+          }
+        }
+      }
+    } catch (...) {
+      error = "cannot write " + filename;
+      return false;
+    }
+
+    return save_json(filename, json, error);
+  }
+
+  bool save_dgram(
+      const string& filename, const dgram_scenes& dgram, string& error) {
+    auto ext = path_extension(filename);
+    if (ext == ".json" || ext == ".JSON") {
+      return save_json_dgram(filename, dgram, error);
+    } else {
+      error = "unsupported format " + filename;
+      return false;
+    }
+  }
+
+  void save_dgram(const string& filename, const dgram_scenes& dgram) {
+    auto error = string{};
+    if (!save_dgram(filename, dgram, error)) throw io_error{error};
+  }
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -48,13 +48,18 @@ namespace yocto {
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
-// DGRAM SCENES LOADER
+// DGRAM SCENES IO
 // -----------------------------------------------------------------------------
 namespace yocto {
 
   bool load_dgram(const string& filename, dgram_scenes& dgram, string& error);
   dgram_scenes load_dgram(const string& filename);
 
+  // Saves the scenes in json. Label images are not saved, see save_texts.
+  bool save_dgram(
+      const string& filename, const dgram_scenes& dgram, string& error);
+  void save_dgram(const string& filename, const dgram_scenes& dgram);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
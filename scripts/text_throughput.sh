@@ -0,0 +1,56 @@
+# Measures the label throughput of the text server: starts a local server
+# with one page and then with the given number of pages, sends the given
+# number of concurrent raw rasterize requests to each, and prints the labels
+# per second of both. Requests are sent directly, without dgram, so that only
+# the server is timed.
+#
+# usage: scripts/text_throughput.sh [pages] [requests]
+
+pages=${1:-4}
+requests=${2:-40}
+
+case "$(uname)" in
+    Darwin) phantomjs=./mac/phantomjs ;;
+    MINGW*|MSYS*|CYGWIN*) phantomjs=./win/phantomjs.exe ;;
+    *) phantomjs=./linux/phantomjs ;;
+esac
+
+measure() {
+    # start the server and wait for it to warm up its pages
+    log=$(mktemp)
+    (cd text_server && $phantomjs server.js $1 > $log 2>&1) &
+    until grep -q "Web server running" $log
+    do
+        sleep 0.1
+    done
+    until curl -s -o /dev/null localhost:5500/rasterize -d "text=warmup" \
+        -d width=10 -d height=10 -d zoom=1
+    do
+        sleep 0.1
+    done
+
+    # distinct labels, as dgram sends them, all in flight at once
+    clients=()
+    start=$(date +%s.%N)
+    for i in $(seq 1 $requests)
+    do
+        curl -s -o /dev/null localhost:5500/rasterize \
+            --data-urlencode "text=\$x_{$i}^2 + \\frac{$i}{2}\$" \
+            -d width=720 -d height=480 -d zoom=1 -d align_x=0 &
+        clients+=($!)
+    done
+    wait ${clients[@]}
+    end=$(date +%s.%N)
+
+    curl -s -o /dev/null localhost:5500/exit
+    wait
+    grep -i "warning\|error" $log
+    rm $log
+
+    awk -v labels=$requests -v pages=$1 -v start=$start -v end=$end 'BEGIN {
+        printf "%d labels with %d pages in %.2f s: %.2f labels/s\n",
+            labels, pages, end - start, labels / (end - start) }'
+}
+
+measure 1
+measure $pages
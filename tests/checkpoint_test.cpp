@@ -0,0 +1,190 @@
+//
+// Checks that renders stopped at a random sample, saved to a checkpoint and
+// resumed from it match uninterrupted renders exactly, and that checkpoints
+// of other scenes or params are rejected. Covers trace states on the cornell
+// box, and diagram trace states on the diagram passed on the command line.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2021 -- 2022 Simone Bartolini
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_sampling.h>
+#include <yocto/yocto_scene.h>
+#include <yocto/yocto_trace.h>
+#include <yocto_dgram/yocto_dgram.h>
+#include <yocto_dgram/yocto_dgram_bvh.h>
+#include <yocto_dgram/yocto_dgram_shape.h>
+#include <yocto_dgram/yocto_dgram_text.h>
+#include <yocto_dgram/yocto_dgram_trace.h>
+#include <yocto_dgram/yocto_dgramio.h>
+
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+using namespace yocto;
+
+// Compare the bytes of two renders
+static bool same_render(const image_data& render1, const image_data& render2) {
+  return render1.pixels.size() == render2.pixels.size() &&
+         memcmp(render1.pixels.data(), render2.pixels.data(),
+             render1.pixels.size() * sizeof(vec4f)) == 0;
+}
+
+// Trace states, with path guiding so that its trees are saved too. Rendering
+// is serial, since guiding trees accumulated in parallel differ by run.
+static bool test_trace(const string& filename, rng_state& rng) {
+  auto scene            = make_cornellbox();
+  auto params           = trace_params{};
+  params.resolution     = 32;
+  params.sampler        = trace_sampler_type::pathguided;
+  params.samples        = 24;
+  params.bounces        = 4;
+  params.guidingsamples = 8;
+  params.noparallel     = true;
+  auto bvh              = make_bvh(scene, params);
+  auto lights           = make_lights(scene, params);
+
+  // uninterrupted render
+  auto state = make_state(scene, params);
+  auto calls = 0;
+  while (state.samples < params.samples) {
+    trace_samples(state, scene, bvh, lights, params);
+    calls += 1;
+  }
+
+  // stop at a random call, that may fall in training, and resume
+  auto stop    = 1 + rand1i(rng, calls - 1);
+  auto resumed = make_state(scene, params);
+  for (auto call = 0; call < stop; call++)
+    trace_samples(resumed, scene, bvh, lights, params);
+  auto error = string{};
+  if (!save_checkpoint(filename, resumed, scene, params, error)) {
+    print_error(error);
+    return false;
+  }
+  resumed = make_state(scene, params);
+  if (!load_checkpoint(filename, resumed, scene, params, error)) {
+    print_error(error);
+    return false;
+  }
+  while (resumed.samples < params.samples)
+    trace_samples(resumed, scene, bvh, lights, params);
+  auto identical = same_render(get_render(state), get_render(resumed));
+  print_info("trace: stop at {}/{}: {}", stop, calls,
+      identical ? "identical" : "different");
+
+  // other params and scenes
+  auto other_params    = params;
+  other_params.samples = params.samples + 1;
+  auto other_scene     = scene;
+  other_scene.materials.front().color.x += 0.01f;
+  auto other_state = make_state(scene, params);
+  auto rejected =
+      !load_checkpoint(filename, other_state, scene, other_params, error) &&
+      !load_checkpoint(filename, other_state, other_scene, params, error);
+  print_info("trace: other scenes and params: {}",
+      rejected ? "rejected" : "accepted");
+  return identical && rejected;
+}
+
+// Diagram trace states of the first scene of a diagram
+static bool test_dgram(
+    const string& dgramname, const string& filename, rng_state& rng) {
+  auto dgram          = load_dgram(dgramname);
+  auto scene          = dgram.scenes.front();
+  auto params         = dgram_trace_params{};
+  params.width        = 160;
+  params.height       = (int)round(params.width * dgram.size.y / dgram.size.x);
+  params.samples      = 9;
+  params.scale        = dgram.scale;
+  params.size         = dgram.size;
+  params.antialiasing = antialiasing_type::random_sampling;
+  auto shapes = make_shapes(scene, params.camera, params.size, params.scale,
+      params.noparallel, get_pixel_size(params));
+  auto bvh    = make_bvh(shapes);
+  auto texts  = make_texts(scene, params.camera, params.size, params.scale,
+      params.width, params.height, params.noparallel);
+
+  // uninterrupted render
+  auto state = make_state(params);
+  while (state.samples < params.samples)
+    trace_samples(state, scene, shapes, texts, bvh, params);
+
+  // stop at a random sample and resume
+  auto stop    = 1 + rand1i(rng, params.samples - 1);
+  auto resumed = make_state(params);
+  while (resumed.samples < stop)
+    trace_samples(resumed, scene, shapes, texts, bvh, params);
+  auto error = string{};
+  if (!save_checkpoint(filename, resumed, scene, params, error)) {
+    print_error(error);
+    return false;
+  }
+  resumed = make_state(params);
+  if (!load_checkpoint(filename, resumed, scene, params, error)) {
+    print_error(error);
+    return false;
+  }
+  while (resumed.samples < params.samples)
+    trace_samples(resumed, scene, shapes, texts, bvh, params);
+  auto identical = same_render(get_render(state), get_render(resumed));
+  print_info("dgram: stop at {}/{}: {}", stop, params.samples,
+      identical ? "identical" : "different");
+
+  // other params and scenes
+  auto other_params         = params;
+  other_params.antialiasing = antialiasing_type::super_sampling;
+  auto other_scene          = scene;
+  other_scene.offset.x += 1;
+  auto other_state = make_state(params);
+  auto rejected =
+      !load_checkpoint(filename, other_state, scene, other_params, error) &&
+      !load_checkpoint(filename, other_state, other_scene, params, error);
+  print_info("dgram: other scenes and params: {}",
+      rejected ? "rejected" : "accepted");
+  return identical && rejected;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc != 2 && argc != 3) {
+    print_error("usage: checkpoint_test <dgram> [seed]");
+    return 1;
+  }
+  auto filename = (std::filesystem::temp_directory_path() /
+                   "yocto_checkpoint_test.ckpt")
+                      .string();
+  auto seed   = argc == 3 ? (uint64_t)std::stoull(argv[2])
+                          : (uint64_t)std::random_device{}();
+  auto rng    = make_rng(seed);
+  print_info("seed: {}", seed);
+  auto passed = test_trace(filename, rng) && test_dgram(argv[1], filename, rng);
+  std::filesystem::remove(filename);
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+//
+// Checks that analytic antialiasing at one and two samples per pixel stays
+// within fixed bounds of super sampling at nine samples, for the mean
+// absolute error and the 99.9th percentile of the per-pixel error, and that
+// it beats super sampling at one sample. Labels are dropped, since their
+// masks are sampled the same way by both methods.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2021 -- 2022 Simone Bartolini
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_image.h>
+#include <yocto_dgram/yocto_dgram.h>
+#include <yocto_dgram/yocto_dgram_bvh.h>
+#include <yocto_dgram/yocto_dgram_shape.h>
+#include <yocto_dgram/yocto_dgram_text.h>
+#include <yocto_dgram/yocto_dgram_trace.h>
+#include <yocto_dgram/yocto_dgramio.h>
+
+#include <algorithm>
+
+using namespace yocto;
+
+// Bounds against super sampling at nine samples
+const auto max_mean_error = 0.0015f;
+const auto max_p999_error = 0.30f;
+
+// Render all the scenes of a diagram as dgram render does
+static image_data render_dgram(
+    dgram_scenes& dgram, antialiasing_type antialiasing, int samples) {
+  auto width  = 720;
+  auto height = (int)round(width * dgram.size.y / dgram.size.x);
+  auto image  = make_image(width, height, false);
+  image.pixels.assign(width * height, {1, 1, 1, 1});
+  for (auto& scene : dgram.scenes) {
+    auto params         = dgram_trace_params{};
+    params.width        = width;
+    params.height       = height;
+    params.samples      = samples;
+    params.scale        = dgram.scale;
+    params.size         = dgram.size;
+    params.antialiasing = antialiasing;
+
+    auto shapes = make_shapes(scene, params.camera, params.size, params.scale,
+        params.noparallel, get_pixel_size(params));
+    auto bvh    = make_bvh(shapes);
+    auto texts  = make_texts(scene, params.camera, params.size, params.scale,
+        params.width, params.height, params.noparallel);
+    auto state  = make_state(params);
+    for (auto sample = 0; sample < params.samples; sample++) {
+      trace_samples(state, scene, shapes, texts, bvh, params);
+    }
+    image = composite_image(get_render(state), image);
+  }
+  return image;
+}
+
+// Mean and 99.9th percentile of the largest channel difference of each pixel
+static pair<float, float> compare_images(
+    const image_data& image, const image_data& reference) {
+  auto errors = vector<float>(image.pixels.size());
+  auto mean   = 0.0f;
+  for (auto idx = 0; idx < (int)errors.size(); idx++) {
+    auto diff   = abs(image.pixels[idx] - reference.pixels[idx]);
+    errors[idx] = max(max(diff.x, diff.y), max(diff.z, diff.w));
+    mean += errors[idx];
+  }
+  mean /= (float)errors.size();
+  auto p999 = errors.begin() + (int)(errors.size() * 0.999f);
+  std::nth_element(errors.begin(), p999, errors.end());
+  return {mean, *p999};
+}
+
+int main(int argc, const char* argv[]) {
+  auto failed = false;
+  for (auto arg = 1; arg < argc; arg++) {
+    auto dgram = load_dgram(argv[arg]);
+    for (auto& scene : dgram.scenes) {
+      scene.labels.clear();
+      for (auto& object : scene.objects) object.labels = -1;
+    }
+
+    auto reference = render_dgram(dgram, antialiasing_type::super_sampling, 9);
+    auto [ss_mean, ss_p999] = compare_images(
+        render_dgram(dgram, antialiasing_type::super_sampling, 1), reference);
+    print_info("{} super_sampling 1: {} mean, {} p99.9", argv[arg], ss_mean,
+        ss_p999);
+    for (auto samples : {1, 2}) {
+      auto [mean, p999] = compare_images(
+          render_dgram(dgram, antialiasing_type::analytic, samples),
+          reference);
+      print_info("{} analytic {}: {} mean, {} p99.9", argv[arg], samples,
+          mean, p999);
+      if (mean > max_mean_error || p999 > max_p999_error || mean > ss_mean ||
+          p999 > ss_p999)
+        failed = true;
+    }
+  }
+  return failed ? 1 : 0;
+}
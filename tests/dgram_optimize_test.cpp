@@ -0,0 +1,98 @@
+//
+// Checks that optimized diagrams render exactly as the original ones, for
+// the diagrams passed on the command line.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2021 -- 2022 Simone Bartolini
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_image.h>
+#include <yocto_dgram/yocto_dgram.h>
+#include <yocto_dgram/yocto_dgram_bvh.h>
+#include <yocto_dgram/yocto_dgram_shape.h>
+#include <yocto_dgram/yocto_dgram_text.h>
+#include <yocto_dgram/yocto_dgram_trace.h>
+#include <yocto_dgram/yocto_dgramio.h>
+
+using namespace yocto;
+
+// Render all the scenes of a diagram as dgram render does
+static image_data render_dgram(
+    const dgram_scenes& dgram, antialiasing_type antialiasing, bool optimize) {
+  auto width  = 240;
+  auto height = (int)round(width * dgram.size.y / dgram.size.x);
+  auto image  = make_image(width, height, false);
+  image.pixels.assign(width * height, {1, 1, 1, 1});
+  for (auto& scene_ : dgram.scenes) {
+    auto params         = dgram_trace_params{};
+    params.width        = width;
+    params.height       = height;
+    params.samples      = 4;
+    params.scale        = dgram.scale;
+    params.size         = dgram.size;
+    params.antialiasing = antialiasing;
+
+    auto scene  = optimize ? optimize_scene(scene_, params.camera, params.size,
+                                 params.scale)
+                           : scene_;
+    auto shapes = make_shapes(scene, params.camera, params.size, params.scale,
+        params.noparallel, get_pixel_size(params));
+    auto bvh    = make_bvh(shapes);
+    auto texts  = make_texts(scene, params.camera, params.size, params.scale,
+        params.width, params.height, params.noparallel);
+    auto state  = make_state(params);
+    for (auto sample = 0; sample < params.samples; sample++) {
+      trace_samples(state, scene, shapes, texts, bvh, params);
+    }
+    image = composite_image(get_render(state), image);
+  }
+  return image;
+}
+
+int main(int argc, const char* argv[]) {
+  auto failed = false;
+  for (auto arg = 1; arg < argc; arg++) {
+    auto dgram = load_dgram(argv[arg]);
+    for (auto antialiasing : {antialiasing_type::super_sampling,
+             antialiasing_type::analytic}) {
+      auto original  = render_dgram(dgram, antialiasing, false);
+      auto optimized = render_dgram(dgram, antialiasing, true);
+      auto original_bytes  = vector<vec4b>{};
+      auto optimized_bytes = vector<vec4b>{};
+      float_to_byte(original_bytes, original.pixels);
+      float_to_byte(optimized_bytes, optimized.pixels);
+      auto identical = original_bytes == optimized_bytes;
+      print_info("{} {}: {}", argv[arg],
+          antialiasing_names[(int)antialiasing],
+          identical ? "identical" : "different");
+      if (!identical) failed = true;
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+//
+// Checks that images graded in the glimage shader match colorgrade_image,
+// drawing into a framebuffer of a surfaceless EGL context, so that it can
+// run headless on Mesa's software rasterizer.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2022 Fabio Pellacini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <EGL/egl.h>
+#include <glad/glad.h>
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_color.h>
+#include <yocto/yocto_gui.h>
+#include <yocto/yocto_image.h>
+
+using namespace yocto;
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Make current an OpenGL 3.3 core context without a surface
+static bool make_headless_context(string& error) {
+  auto display = eglGetPlatformDisplay(
+      EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+    error = "cannot open a surfaceless EGL display";
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    error = "cannot bind OpenGL";
+    return false;
+  }
+  EGLint config_attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+  auto   config           = EGLConfig{};
+  auto   num_configs      = (EGLint)0;
+  eglChooseConfig(display, config_attribs, &config, 1, &num_configs);
+  EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3,
+      EGL_CONTEXT_MINOR_VERSION, 3, EGL_CONTEXT_OPENGL_PROFILE_MASK,
+      EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+  auto context = eglCreateContext(display,
+      num_configs != 0 ? config : nullptr, EGL_NO_CONTEXT, context_attribs);
+  if (context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    error = "cannot create an OpenGL 3.3 context";
+    return false;
+  }
+  if (!gladLoadGL()) {
+    error = "cannot load OpenGL";
+    return false;
+  }
+  return true;
+}
+
+// Grading presets that exercise every stage of the shader
+static vector<pair<string, colorgrade_params>> make_gradings() {
+  auto filmic               = colorgrade_params{};
+  filmic.exposure           = 1;
+  filmic.filmic             = true;
+  auto contrast             = colorgrade_params{};
+  contrast.contrast         = 0.7f;
+  contrast.saturation       = 0.3f;
+  contrast.logcontrast      = 0.6f;
+  contrast.tint             = {1, 0.9f, 0.8f};
+  auto balance              = colorgrade_params{};
+  balance.shadows           = 0.4f;
+  balance.highlights        = 0.6f;
+  balance.midtones_color    = {1, 0.8f, 0.9f};
+  balance.lincontrast       = 0.6f;
+  balance.linsaturation     = 0.7f;
+  return {{"identity", colorgrade_params{}}, {"filmic", filmic},
+      {"contrast", contrast}, {"balance", balance}};
+}
+
+int main(int argc, const char* argv[]) {
+  // context
+  auto error = string{};
+  if (!make_headless_context(error)) {
+    print_error(error);
+    return 1;
+  }
+  print_info("renderer: {}", (const char*)glGetString(GL_RENDERER));
+
+  // framebuffer
+  auto width = 256, height = 128;
+  auto framebuffer = (GLuint)0, renderbuffer = (GLuint)0;
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glGenRenderbuffers(1, &renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glFramebufferRenderbuffer(
+      GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer);
+
+  // hdr ramps, rounded to the half floats the shader reads
+  auto image = make_image(width, height, true);
+  for (auto j = 0; j < height; j++) {
+    for (auto i = 0; i < width; i++) {
+      auto u = i / (float)width, v = j / (float)height;
+      image.pixels[j * width + i] = half_to_float(
+          float_to_half(vec4f{4 * u * u, 2 * v, 4 * u * v, 1}));
+    }
+  }
+
+  // image drawing
+  auto glimage = glimage_state{};
+  if (!init_image(glimage)) {
+    print_error("cannot init the image program");
+    return 1;
+  }
+  set_image(glimage, image);
+
+  // compare each grading to the cpu, allowing for rounding
+  auto failed  = false;
+  auto display = make_image(width, height, false);
+  auto pixels  = vector<vec4b>(width * height);
+  for (auto& [name, grading] : make_gradings()) {
+    auto params        = glimage_params{};
+    params.window      = {width, height};
+    params.framebuffer = {0, 0, width, height};
+    params.center      = {width / 2.0f, height / 2.0f};
+    params.scale       = 1;
+    params.graded      = true;
+    params.grading     = grading;
+    draw_image(glimage, params);
+    glReadPixels(
+        0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    colorgrade_image(display, image, grading);
+    auto max_error = 0;
+    for (auto j = 0; j < height; j++) {
+      for (auto i = 0; i < width; i++) {
+        auto cpu = float_to_byte(display.pixels[j * width + i]);
+        auto gpu = pixels[(height - 1 - j) * width + i];
+        for (auto c = 0; c < 3; c++)
+          max_error = max(max_error, std::abs((int)cpu[c] - (int)gpu[c]));
+      }
+    }
+    print_info("{}: max error {}/255", name, max_error);
+    if (max_error > 1) failed = true;
+  }
+
+  // done
+  clear_image(glimage);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+//
+// Checks that shapes stored compactly upload the same vertex data as the
+// float ones, reading back the buffers of a surfaceless EGL context, so that
+// it can run headless on Mesa's software rasterizer.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2022 Fabio Pellacini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <EGL/egl.h>
+#include <glad/glad.h>
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_gui.h>
+#include <yocto/yocto_scene.h>
+#include <yocto/yocto_shape.h>
+
+using namespace yocto;
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Make current an OpenGL 3.3 core context without a surface
+static bool make_headless_context(string& error) {
+  auto display = eglGetPlatformDisplay(
+      EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+    error = "cannot open a surfaceless EGL display";
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    error = "cannot bind OpenGL";
+    return false;
+  }
+  EGLint config_attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+  auto   config           = EGLConfig{};
+  auto   num_configs      = (EGLint)0;
+  eglChooseConfig(display, config_attribs, &config, 1, &num_configs);
+  EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3,
+      EGL_CONTEXT_MINOR_VERSION, 3, EGL_CONTEXT_OPENGL_PROFILE_MASK,
+      EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+  auto context = eglCreateContext(display,
+      num_configs != 0 ? config : nullptr, EGL_NO_CONTEXT, context_attribs);
+  if (context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    error = "cannot create an OpenGL 3.3 context";
+    return false;
+  }
+  if (!gladLoadGL()) {
+    error = "cannot load OpenGL";
+    return false;
+  }
+  return true;
+}
+
+// Read back a vertex buffer
+template <typename T>
+static vector<T> read_buffer(uint buffer, int num) {
+  auto values = vector<T>(num);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glGetBufferSubData(GL_ARRAY_BUFFER, 0, num * sizeof(T), values.data());
+  return values;
+}
+
+// Largest component difference between two arrays
+template <typename T>
+static float max_difference(const vector<T>& values1, const vector<T>& values2) {
+  if (values1.size() != values2.size()) return flt_max;
+  auto difference = 0.0f;
+  for (auto idx = 0; idx < (int)values1.size(); idx++)
+    difference = max(difference, max(abs(values1[idx] - values2[idx])));
+  return difference;
+}
+
+int main(int argc, const char* argv[]) {
+  // context
+  auto error = string{};
+  if (!make_headless_context(error)) {
+    print_error(error);
+    return 1;
+  }
+  print_info("renderer: {}", (const char*)glGetString(GL_RENDERER));
+
+  // the same shape stored as floats and compactly
+  auto shape = make_sphere(8);
+  for (auto& normal : shape.normals)
+    shape.colors.push_back({normal.x * 0.5f + 0.5f, 0.25f, 0.75f, 1});
+  auto scene = scene_data{};
+  scene.shapes.push_back(shape);
+  convert_shape(shape, shape_storage::compact);
+  scene.shapes.push_back(shape);
+  auto glscene = glscene_state{};
+  init_glscene(glscene, scene);
+
+  // compare the uploaded data, allowing for the compact precision
+  auto& glfloat   = glscene.shapes[0];
+  auto& glcompact = glscene.shapes[1];
+  auto  normals   = max_difference(
+      read_buffer<vec3f>(glfloat.normals, glfloat.num_normals),
+      read_buffer<vec3f>(glcompact.normals, glcompact.num_normals));
+  auto texcoords = max_difference(
+      read_buffer<vec2f>(glfloat.texcoords, glfloat.num_texcoords),
+      read_buffer<vec2f>(glcompact.texcoords, glcompact.num_texcoords));
+  auto colors = max_difference(
+      read_buffer<vec4f>(glfloat.colors, glfloat.num_colors),
+      read_buffer<vec4f>(glcompact.colors, glcompact.num_colors));
+  print_info("normals: max error {}", normals);
+  print_info("texcoords: max error {}", texcoords);
+  print_info("colors: max error {}", colors);
+  auto failed = normals > 1e-3f || texcoords > 1e-4f || colors > 1 / 255.0f;
+
+  // done
+  clear_scene(glscene);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+//
+// Checks that saving a loaded scene after editing one material rewrites only
+// the json, printing the save time and the bytes written against a full
+// save of the same scene.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2022 Fabio Pellacini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_image.h>
+#include <yocto/yocto_scene.h>
+#include <yocto/yocto_sceneio.h>
+#include <yocto/yocto_shape.h>
+
+#include <filesystem>
+#include <map>
+
+using namespace yocto;
+
+// Modification time and size of the files in a directory
+using file_states = std::map<string, pair<int64_t, uintmax_t>>;
+static file_states get_file_states(const string& dirname) {
+  auto states = file_states{};
+  for (auto& entry : std::filesystem::recursive_directory_iterator(dirname)) {
+    if (!entry.is_regular_file()) continue;
+    states[entry.path().string()] = {
+        (int64_t)entry.last_write_time().time_since_epoch().count(),
+        entry.file_size()};
+  }
+  return states;
+}
+
+// Save a scene, counting the files and bytes written
+static bool save_and_measure(const string& filename, const scene_data& scene,
+    const string& label, int& files, uintmax_t& bytes) {
+  auto dirname = std::filesystem::path(filename).parent_path().string();
+  auto before  = get_file_states(dirname);
+  auto error   = string{};
+  auto timer   = simple_timer{};
+  if (!save_scene(filename, scene, error)) {
+    print_error(error);
+    return false;
+  }
+  auto elapsed = elapsed_formatted(timer);
+  files        = 0;
+  bytes        = 0;
+  for (auto& [path, state] : get_file_states(dirname)) {
+    auto it = before.find(path);
+    if (it != before.end() && it->second == state) continue;
+    files += 1;
+    bytes += state.second;
+  }
+  print_info("{}: {}, {} files, {} bytes", label, elapsed, files, bytes);
+  return true;
+}
+
+int main(int argc, const char* argv[]) {
+  // a cornell box with detailed shapes and textures
+  auto scene = make_cornellbox();
+  for (auto idx = 0; idx < 4; idx++) {
+    scene.shapes.push_back(make_uvsphere({256, 128}, 0.1f));
+    scene.textures.push_back(image_to_texture(make_bumps(512, 512)));
+  }
+
+  auto dirname  = std::filesystem::temp_directory_path() /
+                 "yocto_sceneio_save_test";
+  auto filename = (dirname / "scene.json").string();
+  std::filesystem::remove_all(dirname);
+  auto error = string{};
+  if (!make_scene_directories(filename, scene, error)) {
+    print_error(error);
+    return 1;
+  }
+
+  // full save, then edit one material of the loaded scene
+  auto full_files = 0, edit_files = 0;
+  auto full_bytes = (uintmax_t)0, edit_bytes = (uintmax_t)0;
+  auto loaded     = scene_data{};
+  auto ok = save_and_measure(filename, scene, "full save", full_files,
+                full_bytes) &&
+            load_scene(filename, loaded, error);
+  if (ok) {
+    loaded.materials.front().color = {0.1f, 0.2f, 0.3f};
+    ok = save_and_measure(
+        filename, loaded, "edit one material", edit_files, edit_bytes);
+  }
+
+  // only the json is rewritten, and reloading returns the edit
+  auto reloaded = scene_data{};
+  if (ok && !load_scene(filename, reloaded, error)) ok = false;
+  if (!ok && !error.empty()) print_error(error);
+  auto failed = !ok || edit_files != 1 ||
+                edit_bytes != std::filesystem::file_size(filename) ||
+                reloaded.materials.front().color != vec3f{0.1f, 0.2f, 0.3f} ||
+                reloaded.shapes.size() != scene.shapes.size() ||
+                reloaded.textures.size() != scene.textures.size();
+  if (ok && failed) {
+    print_error("expected only the json to be written, {} files written",
+        edit_files);
+  }
+
+  // done
+  std::filesystem::remove_all(dirname);
+  return failed ? 1 : 0;
+}
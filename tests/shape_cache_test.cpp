@@ -0,0 +1,133 @@
+//
+// Checks that renders with out-of-core shapes, under budgets that force
+// evictions, match the in-core render exactly, and that no shape stays
+// pinned once sampling is done, whether sampling with trace_samples or with
+// trace_sample and release_shapes.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2022 Fabio Pellacini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <yocto/yocto_bvh.h>
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_scene.h>
+#include <yocto/yocto_shape.h>
+#include <yocto/yocto_trace.h>
+
+#include <cstring>
+#include <filesystem>
+
+using namespace yocto;
+
+// A cornell box with a grid of detailed spheres
+static scene_data make_test_scene() {
+  auto scene = make_cornellbox();
+  for (auto j = 0; j < 3; j++) {
+    for (auto i = 0; i < 3; i++) {
+      auto& instance = scene.instances.emplace_back();
+      instance.frame = translation_frame(
+          {-0.6f + 0.6f * i, 0.3f + 0.6f * j, 0.2f});
+      instance.shape    = (int)scene.shapes.size();
+      instance.material = 1;
+      scene.shapes.push_back(make_sphere(32, 0.2f));
+    }
+  }
+  return scene;
+}
+
+// Render with trace_samples, or with trace_sample in batches as the viewer
+static image_data render_scene(const scene_data& scene, const scene_bvh& bvh,
+    const trace_params& params, bool batched) {
+  auto lights = make_lights(scene, params);
+  auto state  = make_state(scene, params);
+  while (state.samples < params.samples) {
+    if (!batched) {
+      trace_samples(state, scene, bvh, lights, params);
+    } else {
+      for (auto j = 0; j < state.height; j++) {
+        for (auto i = 0; i < state.width; i++) {
+          for (auto s = 0; s < params.batch; s++) {
+            trace_sample(state, scene, bvh, lights, i, j, params);
+            release_shapes(bvh);
+          }
+        }
+      }
+      finish_samples(state, params, params.batch);
+    }
+  }
+  return get_render(state);
+}
+
+int main(int argc, const char* argv[]) {
+  auto params       = trace_params{};
+  params.resolution = 48;
+  params.samples    = 4;
+  params.bounces    = 4;
+  params.batch      = 2;
+
+  // in-core render
+  auto scene     = make_test_scene();
+  auto bvh       = make_bvh(scene, params);
+  auto reference = render_scene(scene, bvh, params, false);
+
+  // out-of-core renders, from no room at all to half of the shapes
+  auto cachename =
+      (std::filesystem::temp_directory_path() / "yocto_shape_cache_test.shapes")
+          .string();
+  auto failed = false;
+  for (auto budget : {(size_t)1, (size_t)256 * 1024, (size_t)1024 * 1024}) {
+    for (auto batched : {false, true}) {
+      auto cscene = make_test_scene();
+      auto cbvh   = make_bvh(cscene, params);
+      auto error  = string{};
+      if (!make_shape_cache(cbvh, cscene, cachename, budget, error)) {
+        print_error(error);
+        return 1;
+      }
+      auto render    = render_scene(cscene, cbvh, params, batched);
+      auto identical = render.pixels.size() == reference.pixels.size() &&
+                       memcmp(render.pixels.data(), reference.pixels.data(),
+                           render.pixels.size() * sizeof(vec4f)) == 0;
+
+      // only the shapes of lights stay pinned
+      auto& cache    = *cbvh.cache;
+      auto  unpinned = true;
+      for (auto& instance : cscene.instances) {
+        auto emissive = cscene.materials[instance.material].emission !=
+                        vec3f{0, 0, 0};
+        if (cache.pins[instance.shape] != (emissive ? 1 : 0)) unpinned = false;
+      }
+      print_info("budget {} {}: {}, {}, {} misses, {} evictions", budget,
+          batched ? "trace_sample" : "trace_samples",
+          identical ? "identical" : "different",
+          unpinned ? "unpinned" : "pinned", cache.misses, cache.evictions);
+      if (!identical || !unpinned || cache.evictions == 0) failed = true;
+      cbvh = {};
+    }
+  }
+
+  // done
+  std::filesystem::remove(cachename);
+  return failed ? 1 : 0;
+}
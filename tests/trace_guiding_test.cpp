@@ -0,0 +1,101 @@
+//
+// Checks that path guiding keeps exactly the requested samples, discarding
+// the training passes, whether rendering stops during or after training.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2022 Fabio Pellacini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_scene.h>
+#include <yocto/yocto_trace.h>
+
+using namespace yocto;
+
+// Check that the render is finite and not black
+static bool check_render(const image_data& render) {
+  auto sum = 0.0;
+  for (auto& pixel : render.pixels) {
+    if (!isfinite(pixel.x) || !isfinite(pixel.y) || !isfinite(pixel.z))
+      return false;
+    sum += pixel.x + pixel.y + pixel.z;
+  }
+  return sum > 0;
+}
+
+int main(int argc, const char* argv[]) {
+  auto scene        = make_cornellbox();
+  auto params       = trace_params{};
+  params.resolution = 16;
+  params.sampler    = trace_sampler_type::pathguided;
+  params.bounces    = 4;
+  params.noparallel = true;
+  auto bvh          = make_bvh(scene, params);
+  auto lights       = make_lights(scene, params);
+  auto training     = 0;
+  auto failed       = false;
+  for (auto guidingsamples : {0, 1, 7, 64}) {
+    for (auto samples : {1, 5, 63, 64, 80}) {
+      params.samples        = samples;
+      params.guidingsamples = guidingsamples;
+
+      // trace_samples, as trace_image and the apps do
+      auto state = make_state(scene, params);
+      while (state.samples < params.samples) {
+        trace_samples(state, scene, bvh, lights, params);
+      }
+      auto ok = state.samples == samples && check_render(get_render(state));
+
+      // trace_sample in batches, as the viewer does
+      params.batch = 3;
+      auto batched = make_state(scene, params);
+      while (batched.samples < params.samples) {
+        for (auto j = 0; j < batched.height; j++) {
+          for (auto i = 0; i < batched.width; i++) {
+            for (auto s = 0; s < params.batch; s++) {
+              trace_sample(batched, scene, bvh, lights, i, j, params);
+            }
+          }
+        }
+        finish_samples(batched, params, params.batch);
+      }
+      params.batch = 1;
+      ok = ok && batched.samples >= samples &&
+           batched.samples < samples + 3 && check_render(get_render(batched));
+
+      print_info("guidingsamples {} samples {}: {} kept, {} training, {}",
+          guidingsamples, samples, state.samples, state.training,
+          ok ? "ok" : "failed");
+      if (guidingsamples == 64) training = state.training;
+      if (!ok) failed = true;
+    }
+  }
+
+  // training passes double their samples up to guidingsamples
+  if (training != 63) {
+    print_error("expected 63 training samples, got {}", training);
+    failed = true;
+  }
+  return failed ? 1 : 0;
+}
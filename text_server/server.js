@@ -27,10 +27,215 @@
 //
 
 var port = 5500;
+var system = require("system");
+
+// number of pre-loaded pages used to rasterize labels concurrently,
+// can be changed by passing it as the first argument of the script
+var pool_size = 4;
+if (system.args.length > 1 && !isNaN(system.args[1]))
+  pool_size = Math.max(1, parseInt(system.args[1], 10));
+
+// label rasterized before the pages are made available, that also waits for
+// the fonts to load
+var warmup_text = "*a* _a_ $x^2 + \\mathbf{A} \\mathcal{A} \\sum x$";
+
+var idle_pages = [];
+var pending = [];
+
+// Installs in the page context the function that renders a label. The
+// function clears the previous label, so that a page can be reused, and
+// signals the server with `callPhantom` once KaTeX is done. The first label,
+// the warm-up, also waits until every font face has been loaded.
+function install_rasterizer() {
+  function format(text) {
+    const bold = /\*([\s\S]*?)\*/gi;
+    const italic = /_([\s\S]*?)_/gi;
+    const subscript = /~([\s\S]*?)~/gi;
+    const superscript = /\^([\s\S]*?)\^/gi;
+
+    if (text.length < 2 || text[0] != "$" || text.slice(-1) != "$") {
+      return text
+        .replace(bold, "<b>$1</b>")
+        .replace(italic, "<i>$1</i>")
+        .replace(subscript, "<sub>$1</sub>")
+        .replace(superscript, "<sup>$1</sup>");
+    }
+    return text;
+  }
+
+  // font faces shipped with KaTeX and latex.css, as family, weight and style;
+  // Libertinus is left out since it ships only as woff2, that QtWebKit
+  // cannot load
+  var font_faces = [
+    ["KaTeX_AMS", "normal", "normal"],
+    ["KaTeX_Caligraphic", "bold", "normal"],
+    ["KaTeX_Caligraphic", "normal", "normal"],
+    ["KaTeX_Fraktur", "bold", "normal"],
+    ["KaTeX_Fraktur", "normal", "normal"],
+    ["KaTeX_Main", "bold", "normal"],
+    ["KaTeX_Main", "normal", "italic"],
+    ["KaTeX_Main", "normal", "normal"],
+    ["KaTeX_Math", "normal", "italic"],
+    ["KaTeX_SansSerif", "normal", "normal"],
+    ["KaTeX_Script", "normal", "normal"],
+    ["KaTeX_Size1", "normal", "normal"],
+    ["KaTeX_Size2", "normal", "normal"],
+    ["KaTeX_Size3", "normal", "normal"],
+    ["KaTeX_Size4", "normal", "normal"],
+    ["KaTeX_Typewriter", "normal", "normal"],
+    ["Latin Modern", "normal", "normal"],
+    ["Latin Modern", "normal", "italic"],
+    ["Latin Modern", "bold", "normal"],
+    ["Latin Modern", "bold", "italic"],
+  ];
+  var fonts_loaded = false;
+
+  // QtWebKit has no document.fonts, so every face is loaded by laying out
+  // a hidden glyph probe with it, and is known to be ready once the probe
+  // is measured wider or narrower than with the fallback fonts alone. The
+  // probe text mixes letters, digits and the delimiters of the Size fonts.
+  function when_fonts_ready(callback) {
+    if (fonts_loaded) return window.setTimeout(callback, 0);
+
+    var fallbacks = ["monospace", "serif"];
+    var probe_box = document.createElement("div");
+    probe_box.style.cssText =
+      "position: absolute; left: -10000px; top: 0; visibility: hidden;";
+    document.documentElement.appendChild(probe_box);
+    function make_probe(font, weight, style) {
+      var span = document.createElement("span");
+      span.textContent = "Ag0x(\u2211)\u221a[\u222b]";
+      span.style.cssText =
+        "font-size: 40px; white-space: nowrap; font-family: " + font + ";" +
+        "font-weight: " + weight + "; font-style: " + style + ";";
+      probe_box.appendChild(span);
+      probe_box.appendChild(document.createElement("br"));
+      return span;
+    }
+    var pending = [];
+    for (var i = 0; i < font_faces.length; i++) {
+      var face = font_faces[i];
+      var entry = { face: face, probes: [] };
+      for (var j = 0; j < fallbacks.length; j++) {
+        entry.probes.push([
+          make_probe("'" + face[0] + "', " + fallbacks[j], face[1], face[2]),
+          make_probe(fallbacks[j], face[1], face[2]),
+        ]);
+      }
+      pending.push(entry);
+    }
+
+    var start = Date.now();
+    function poll() {
+      pending = pending.filter(function (entry) {
+        return entry.probes.every(function (probe) {
+          return probe[0].offsetWidth == probe[1].offsetWidth;
+        });
+      });
+      if (pending.length == 0 || Date.now() - start > 5000) {
+        if (pending.length != 0) {
+          var faces = pending.map(function (entry) {
+            return entry.face.join(" ");
+          });
+          console.log("Warning: fonts not loaded: " + faces.join(", "));
+        }
+        document.documentElement.removeChild(probe_box);
+        fonts_loaded = true;
+        callback();
+      } else {
+        window.setTimeout(poll, 10);
+      }
+    }
+    poll();
+  }
+
+  window.rasterize = function (text, style) {
+    while (document.body.firstChild) {
+      document.body.removeChild(document.body.firstChild);
+    }
+
+    var div = document.createElement("div");
+    div.innerHTML = format(text);
+    div.style.cssText = style;
+    document.body.appendChild(div);
+
+    renderMathInElement(document.body, {
+      delimiters: [
+        { left: "$$", right: "$$", display: true },
+        { left: "$", right: "$", display: false },
+        { left: "\\(", right: "\\)", display: false },
+        { left: "\\[", right: "\\]", display: true },
+      ],
+      throwOnError: false,
+    });
+
+    // force layout before waiting for the fonts used by the label
+    div.offsetHeight;
+    when_fonts_ready(function () {
+      window.callPhantom("done");
+    });
+  };
+}
+
+function rasterize(page, job) {
+  page.job = job;
+  page.viewportSize = job.viewport;
+  page.zoomFactor = job.zoom;
+  page.evaluate(
+    function (text, style) {
+      window.rasterize(text, style);
+    },
+    job.text,
+    job.style
+  );
+}
+
+function dispatch() {
+  while (idle_pages.length > 0 && pending.length > 0) {
+    rasterize(idle_pages.pop(), pending.shift());
+  }
+}
+
+function create_page() {
+  var page = require("webpage").create();
+  page.job = null;
+
+  page.onConsoleMessage = function (msg) {
+    console.log(msg);
+  };
+
+  page.onCallback = function () {
+    var job = page.job;
+    page.job = null;
+    if (job != null) {
+      var image = page.renderBase64("PNG");
+      job.response.statusCode = 200;
+      job.response.write(image);
+      job.response.close();
+    }
+    idle_pages.push(page);
+    dispatch();
+  };
+
+  page.open("text.html", function (status) {
+    if (status != "success") {
+      console.log("Error: could not open text.html");
+      phantom.exit();
+    }
+    page.evaluate(install_rasterizer);
+    page.viewportSize = { width: 200, height: 100 };
+    page.evaluate(
+      function (text) {
+        window.rasterize(text, "font-size:20pt;");
+      },
+      warmup_text
+    );
+  });
+}
+
 var server = require("webserver").create();
 var service = server.listen(port, function (request, response) {
-  console.log("Request at " + new Date());
-  console.log(JSON.stringify(request, null, 4));
+  console.log("Request " + request.url + " at " + new Date());
 
   if (request.url == "/exit") {
     response.statusCode = 200;
@@ -70,14 +275,6 @@ var service = server.listen(port, function (request, response) {
       response.write("zoom is not a number");
       response.close();
     } else {
-      var page = require("webpage").create();
-      var text = request.post.text;
-      page.viewportSize = {
-        width: parseInt(request.post.width, 10) * 2,
-        height: parseInt(request.post.height, 10) * 2,
-      };
-      page.zoomFactor = Number(request.post.zoom);
-
       var align_x = parseInt(request.post.align_x, 10);
 
       var align_x_css = "";
@@ -85,75 +282,33 @@ var service = server.listen(port, function (request, response) {
       else if (align_x < 0) align_x_css = "text-align: left!important;";
       else if (align_x == 0) align_x_css = "text-align: center!important;";
 
-      var color =
-        "color: rgba(" +
-        request.post.r + "," +
-        request.post.g + "," +
-        request.post.b + "," +
-        request.post.a +
-        ")";
-
+      // labels are rasterized as opaque black text, so the alpha channel of
+      // the image is the coverage mask that is tinted by the client
       var style =
         "font-size:20pt; position: absolute; bottom: 0; width: 100%;" +
         align_x_css +
-        color;
-
-      page.onConsoleMessage = function (msg) {
-        console.log(msg);
-      };
-
-      page.open("text.html", function () {
-        page.evaluate(
-          function (text, width, style) {
-            function format(text) {
-              const bold = /\*([\s\S]*?)\*/gi;
-              const italic = /_([\s\S]*?)_/gi;
-              const subscript = /~([\s\S]*?)~/gi;
-              const superscript = /\^([\s\S]*?)\^/gi;
-
-              if (text.length < 2 || text[0] != "$" || text.slice(-1) != "$") {
-                return text
-                  .replace(bold, "<b>$1</b>")
-                  .replace(italic, "<i>$1</i>")
-                  .replace(subscript, "<sub>$1</sub>")
-                  .replace(superscript, "<sup>$1</sup>");
-              }
-              return text;
-            }
-
-            var div = document.createElement("div");
-            div.innerHTML = format(text);
-            div.style.cssText = style;
-            document.body.appendChild(div);
-
-            renderMathInElement(document.body, {
-              delimiters: [
-                { left: "$$", right: "$$", display: true },
-                { left: "$", right: "$", display: false },
-                { left: "\\(", right: "\\)", display: false },
-                { left: "\\[", right: "\\]", display: true },
-              ],
-              throwOnError: false,
-            });
-          },
-          text,
-          page.viewportSize.width,
-          style
-        );
-        window.setTimeout(function () {
-          var image = page.renderBase64("PNG");
-          response.statusCode = 200;
-          response.write(image);
-          response.close();
-          page.close();
-        }, 200);
+        "color: black;";
+
+      pending.push({
+        text: request.post.text,
+        style: style,
+        viewport: {
+          width: parseInt(request.post.width, 10) * 2,
+          height: parseInt(request.post.height, 10) * 2,
+        },
+        zoom: Number(request.post.zoom),
+        response: response,
       });
+      dispatch();
     }
   }
 });
 
 if (service) {
-  console.log("Web server running on port " + port);
+  for (var i = 0; i < pool_size; i++) create_page();
+  console.log(
+    "Web server running on port " + port + " with " + pool_size + " pages"
+  );
 } else {
   console.log("Error: Could not create web server listening on port " + port);
   phantom.exit();